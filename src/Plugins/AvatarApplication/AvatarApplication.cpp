@@ -136,10 +136,10 @@ void AvatarApplication::UpdateAvatarAnimations()
 {
     if (!lastScene_)
         return;
-    EntityVector entities = lastScene_->EntitiesWithComponent<Avatar>();
-    for (uint i = 0; i < entities.Size(); ++i)
+    const Scene::ComponentList &avatars = lastScene_->ComponentsOfType(Avatar::ComponentTypeId);
+    for (uint i = 0; i < avatars.Size(); ++i)
     {
-        AnimationController* ctrl = entities[i]->Component<AnimationController>();
+        AnimationController* ctrl = avatars[i]->ParentEntity()->Component<AnimationController>();
         if (ctrl)
         {
             // Very simple operation: enable the exclusive animation specified in the "animationState" freedata field
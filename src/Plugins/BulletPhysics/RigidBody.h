@@ -80,6 +80,7 @@ namespace Tundra
 class BULLETPHYSICS_API RigidBody : public IComponent
 {
     COMPONENT_NAME(RigidBody, 23)
+    COMPONENT_POOL_ALLOCATED(RigidBody)
 
     friend class PhysicsWorld;
 
@@ -16,7 +16,8 @@ namespace Tundra
 
 HttpAssetTransfer::HttpAssetTransfer(HttpAssetProvider *provider, HttpRequestPtr &request, const String &assetRef_, const String &assetType_) :
     provider_(provider),
-    request_(request)
+    request_(request),
+    bytesReceived_(0)
 {
     // Prepare IAssetTransfer
     source.ref = assetRef_;
@@ -26,11 +27,22 @@ HttpAssetTransfer::HttpAssetTransfer(HttpAssetProvider *provider, HttpRequestPtr
        Once 304 response is detected, this will be changed to Cached. */
     diskSourceType = IAsset::Original; 
 
-    // Cache destination path and source for 'If-Modified-Since' for a '304 Not Modified' response.
-    if (provider_->Fw()->Asset()->Cache())
+    /* The cached copy is the source for a '304 Not Modified' response. 'If-Modified-Since' and 'If-None-Match' are
+       only sent if there is one. A '200 OK' body is streamed to a file next to the cache file and moved to the cache in OnFinished. */
+    AssetCache *cache = provider_->Fw()->Asset()->Cache();
+    if (cache)
     {
-        String cacheFile = provider_->Fw()->Asset()->Cache()->DiskSourceByRef(source.ref);
-        request->SetCacheFile(cacheFile, true);
+        String cacheFile = cache->FindInCache(source.ref);
+        if (!cacheFile.Empty())
+        {
+            unsigned lastModified = cache->LastModified(source.ref);
+            request->SetCacheFile(cacheFile, (lastModified > 0 ? Http::LocalEpochToHttpDate(static_cast<time_t>(lastModified)) : String()));
+            String etag = cache->ETag(source.ref);
+            if (!etag.Empty())
+                request->SetHeader(Http::Header::IfNoneMatch, etag);
+        }
+        else
+            request->SetCacheFile(cache->DiskSourceByRef(source.ref), false);
         /* Indicated so AssetAPI that we will take care of writing the cache, but it can find
            the source file from this path. */
         SetCachingBehavior(false, cacheFile);
@@ -53,19 +65,39 @@ void HttpAssetTransfer::OnFinished(HttpRequestPtr &request, int status, const St
     // but these redirects are automatically detected and executed by HttpRequest.
     if ((status == 200 || status == 304) && error.Empty())
     {
-        /* 304 Not Modified
-           1) HttpRequest has already written file to asset cache file set with HttpRequest::SetCacheFile()
-           2) Mark disk source as cached. Previous SetCachingBehavior already marked so that AssetAPI wont
-              rewrite the disk file even if we provide rawAssetData.
-           3) If we do not load 'rawAssetData' with a valid disk source. AssetAPI will do the right thing and load
-              bytes from disk. This was desirable with Ogre as its threading mechanisms let us pass a filepath.
-              If it was a certain type of Ogre asset, the disk read was skipped and path was used. With Urho it is more efficient 
-              to do a memcpy here and not re-read from disk, which is slower as we already have the file in memory here.
-              @todo In other works for above: AssetAPI and its 'data shuffling' could be re-thinked with Urho. */
+        /* 200 OK and 304 Not Modified
+           1) For 304 the asset is loaded from the cache file set with HttpRequest::SetCacheFile(), which the previous
+              SetCachingBehavior set as the disk source. Mark the disk source as cached.
+           2) For 200 HttpRequest has streamed the body to a file. It is moved to the cache, which shares the data with other
+              refs that have identical data, and the asset is loaded from the cache file. The validators for the next request
+              are stored with it. The body is only in memory if it could not be written to a file; then AssetAPI caches it.
+           AssetAPI loads the asset from 'rawAssetData' if it is not empty, otherwise from the disk source. */
+        bytesReceived_ = request->ResponseBodySize() + request->DownloadedFileSize();
+        request->MoveResponseBodyTo(rawAssetData);
+
+        AssetCache *cache = provider_->Fw()->Asset()->Cache();
         if (status == 304)
             diskSourceType = IAsset::Cached;
-
-        request->CopyResponseBodyTo(rawAssetData);
+        else if (cache)
+        {
+            String downloadedFile = request->DownloadedFile();
+            String cacheFile;
+            if (!downloadedFile.Empty())
+            {
+                cacheFile = cache->StoreFile(downloadedFile, request->DownloadedFileHash(), request->DownloadedFileSize(), source.ref);
+                // The file could not be moved to the cache, so let AssetAPI cache the data instead
+                if (cacheFile.Empty())
+                    LoadFileToVector(downloadedFile, rawAssetData);
+            }
+            if (!cacheFile.Empty())
+            {
+                time_t lastModified = Http::HttpDateToUtcEpoch(request->ResponseHeader(Http::Header::LastModified));
+                if (lastModified > 0)
+                    cache->SetLastModified(source.ref, static_cast<unsigned>(lastModified));
+                cache->SetETag(source.ref, request->ResponseHeader(Http::Header::ETag).Trimmed());
+            }
+            SetCachingBehavior(cacheFile.Empty(), cacheFile);
+        }
 
         provider_->Fw()->Asset()->AssetTransferCompleted(this);
     }
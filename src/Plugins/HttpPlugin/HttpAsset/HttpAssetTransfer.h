@@ -19,11 +19,15 @@ public:
 
     HttpRequestPtr Request() const { return request_; }
 
+    /// Returns the size of the response body, which is received to a file instead of rawAssetData when the asset is cached.
+    virtual uint BytesReceived() const { return bytesReceived_; }
+
 private:
     void OnFinished(HttpRequestPtr &request, int status, const String &error);
 
     HttpAssetProvider *provider_;
     HttpRequestPtr request_;
+    uint bytesReceived_;
 };
 
 }
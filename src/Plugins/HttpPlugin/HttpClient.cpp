@@ -10,6 +10,7 @@
 #include "ConsoleAPI.h"
 #include "LoggingFunctions.h"
 
+#include <Urho3D/Core/StringUtils.h>
 #include <Urho3D/UI/Text.h>
 
 #include <curl/curl.h>
@@ -22,7 +23,11 @@ HttpClient::HttpClient(Framework *framework) :
 {
     CURLcode err = curl_global_init(CURL_GLOBAL_DEFAULT);
     if (err == CURLE_OK)
-        queue_ = new HttpWorkQueue();
+    {
+        StringVector maxHostConnections = framework_->CommandLineParameters("--httpMaxHostConnections");
+        queue_ = new HttpWorkQueue(framework_->HasCommandLineParameter("--httpMultiEngine"),
+            maxHostConnections.Empty() ? 6 : Urho3D::ToUInt(maxHostConnections.Back()));
+    }
     else
         LogErrorF("[HttpClient] Failed to initialize curl: %s", curl_easy_strerror(err));
 }
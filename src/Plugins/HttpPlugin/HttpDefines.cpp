@@ -271,6 +271,8 @@ time_t HttpDateToUtcEpoch(const String &date)
 RequestData::RequestData() :
     curlHandle(0),
     curlHeaders(0),
+    cacheStream(0),
+    usecDiskWrite(0),
     msecNetwork(-1),
     msecDiskRead(-1),
     msecDiskWrite(-1),
@@ -318,6 +320,8 @@ ResponseData::ResponseData() :
     httpVersionMajor(-1),
     httpVersionMinor(-1),
     status(-1),
+    bodyBytesWritten(0),
+    bodyHash(0),
     downloadBytesPerSec(-1.0),
     uploadBytesPerSec(-1.0),
     headersParsed(false)
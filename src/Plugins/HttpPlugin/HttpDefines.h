@@ -7,6 +7,7 @@
 #include <Urho3D/Core/Timer.h>
 
 #include <time.h>
+#include <cstdio>
 
 /// @cond PRIVATE
 
@@ -149,6 +150,11 @@ namespace Http
 
         // File to read and write cache entry to
         String cacheFile;
+        // File the response body is streamed to while downloading.
+        String cacheTempFile;
+        FILE *cacheStream;
+        // Time spent streaming the body to cacheTempFile.
+        long long usecDiskWrite;
 
         // Error occurred during threaded run.
         String error;
@@ -186,6 +192,10 @@ namespace Http
 
         // Received body and header bytes
         Vector<u8> bodyBytes;
+        // Body bytes streamed to RequestData::cacheFile instead of bodyBytes
+        uint bodyBytesWritten;
+        // AssetCache::ContentHash of the body bytes streamed to RequestData::cacheFile
+        u64 bodyHash;
         Vector<u8> headersBytes;
         bool headersParsed;
 
@@ -5,6 +5,7 @@
 
 #include "Framework.h"
 #include "JSON.h"
+#include "AssetCache.h"
 
 #include <Urho3D/Core/WorkQueue.h>
 #include <Urho3D/Core/StringUtils.h>
@@ -14,11 +15,46 @@
 #include <curl/curl.h>
 #include "HttpParser/http_parser.h"
 
+#include <cstdio>
+
 namespace Tundra
 {
 
 #define HTTP_INITIAL_BODY_SIZE (256*1024)
 
+/// Returns the directory for the download of @c cacheFile. A subdirectory is used so that
+/// the downloads are not mistaken for cache entries, as AssetCache indexes the files of its directory.
+static String CacheDownloadDirectory(const String &cacheFile)
+{
+    return Urho3D::GetPath(cacheFile) + "http/";
+}
+
+/// The request is part of the name, as several requests may have the same cache file, eg. a content-addressed file in AssetCache.
+static String CacheTempFile(const String &cacheFile, const HttpRequest *request)
+{
+    return CacheDownloadDirectory(cacheFile) + Urho3D::GetFileNameAndExtension(cacheFile) + Urho3D::ToString(".%p.part", request);
+}
+
+/* The C file API is used for the files read and written in the worker threads, as Urho3D::File is an
+   Object and creating and destroying Objects outside the main thread is not safe. */
+static FILE *OpenFileForWriting(const String &filename)
+{
+#ifdef _WIN32
+    return _wfopen(Urho3D::GetWideNativePath(filename).CString(), L"wb");
+#else
+    return fopen(Urho3D::GetNativePath(filename).CString(), "wb");
+#endif
+}
+
+static void RemoveFile(const String &filename)
+{
+#ifdef _WIN32
+    _wremove(Urho3D::GetWideNativePath(filename).CString());
+#else
+    remove(Urho3D::GetNativePath(filename).CString());
+#endif
+}
+
 // HttpRequest
 const Logger HttpRequest::log = Logger("HttpRequest");
 
@@ -36,6 +72,10 @@ HttpRequest::HttpRequest(Framework* framework, int method, const String &url) :
 HttpRequest::~HttpRequest()
 {
     Cleanup();
+
+    // The owner did not take the downloaded file.
+    if (!requestData_.cacheTempFile.Empty())
+        RemoveFile(requestData_.cacheTempFile);
 }
 
 // Public API
@@ -226,10 +266,14 @@ bool HttpRequest::SetCacheFile(const String &filepath, bool useLastModified)
     }
     requestData_.cacheFile = Urho3D::GetInternalPath(filepath);
 
+    Urho3D::FileSystem *fileSystem = framework_->GetSubsystem<Urho3D::FileSystem>();
+    // The worker thread streams the body to a file in this directory, create it here in the main thread.
+    fileSystem->CreateDir(CacheDownloadDirectory(requestData_.cacheFile));
+
     // Read 'If-Modified-Since' from cache file
-    if (useLastModified && framework_->GetSubsystem<Urho3D::FileSystem>()->FileExists(requestData_.cacheFile))
+    if (useLastModified && fileSystem->FileExists(requestData_.cacheFile))
     {
-        uint epoch = framework_->GetSubsystem<Urho3D::FileSystem>()->GetLastModifiedTime(requestData_.cacheFile);
+        uint epoch = fileSystem->GetLastModifiedTime(requestData_.cacheFile);
         String lastModifiedHttpDate = Http::LocalEpochToHttpDate(static_cast<time_t>(epoch)); // GetLastModifiedTime returns local timezoned epoch
         if (!lastModifiedHttpDate.Empty())
             SetHeaderInternal(Http::Header::IfModifiedSince, lastModifiedHttpDate, false, false); // Do not lock inside SetHeaderInternal, already aquired above.
@@ -246,6 +290,7 @@ bool HttpRequest::SetCacheFile(const String &filepath, const String &lastModifie
         return false;
     }
     requestData_.cacheFile = Urho3D::GetInternalPath(filepath);
+    framework_->GetSubsystem<Urho3D::FileSystem>()->CreateDir(CacheDownloadDirectory(requestData_.cacheFile));
 
     if (!lastModifiedHttpDate.Empty())
         SetHeaderInternal(Http::Header::IfModifiedSince, lastModifiedHttpDate, false, false); // Do not lock inside SetHeaderInternal, already aquired above.
@@ -316,6 +361,36 @@ bool HttpRequest::CopyResponseBodyTo(Vector<u8> &dest)
     return true; //(dest.Size() == responseData_.bodyBytes.Size());
 }
 
+bool HttpRequest::MoveResponseBodyTo(Vector<u8> &dest)
+{
+    if (!HasCompleted() || responseData_.bodyBytes.Empty())
+        return false;
+    dest.Clear();
+    dest.Swap(responseData_.bodyBytes);
+    return true;
+}
+
+String HttpRequest::DownloadedFile()
+{
+    if (!HasCompleted())
+        return "";
+    return requestData_.cacheTempFile;
+}
+
+uint HttpRequest::DownloadedFileSize()
+{
+    if (!HasCompleted() || requestData_.cacheTempFile.Empty())
+        return 0;
+    return responseData_.bodyBytesWritten;
+}
+
+u64 HttpRequest::DownloadedFileHash()
+{
+    if (!HasCompleted() || requestData_.cacheTempFile.Empty())
+        return 0;
+    return responseData_.bodyHash;
+}
+
 Vector<u8> HttpRequest::CloneResponseBody()
 {
     if (!HasCompleted())
@@ -532,6 +607,15 @@ uint HttpRequest::HeaderUIntInternal(const String &name, uint defaultValue, bool
 }
 
 void HttpRequest::Perform()
+{
+    // @note Invoked in worker thread context
+    if (!Begin())
+        return;
+
+    Finish(curl_easy_perform(requestData_.curlHandle));
+}
+
+bool HttpRequest::Begin()
 {
     // @note Invoked in worker thread context
     {
@@ -539,17 +623,19 @@ void HttpRequest::Perform()
         executing_ = Prepare();
         completed_ = !executing_;
     }
-    if (!executing_)
-        return;
+    networkTimer_.Reset();
+    return executing_;
+}
 
-    Urho3D::Timer timer;
-    CURLcode res = curl_easy_perform(requestData_.curlHandle);
+void HttpRequest::Finish(CURLcode res)
+{
+    // @note Invoked in worker thread context
     if (res != CURLE_OK)
     {
         requestData_.error = curl_easy_strerror(res);
         log.ErrorF("Failed to initialze request: %s", requestData_.error.CString());
     }
-    requestData_.msecNetwork = timer.GetMSec(false);
+    requestData_.msecNetwork = networkTimer_.GetMSec(false);
 
     /* Compact unused bytes from input buffers. bodyBytes should not have any free
        capacity if Content-Lenght header was provided by the server and correct. */
@@ -574,53 +660,31 @@ void HttpRequest::Perform()
         if (responseData_.status == 200)
         {
             uint contentLenght = HeaderUIntInternal(Http::Header::ContentLength, 0, true, false);
-            if (contentLenght > 0 && responseData_.bodyBytes.Size() != contentLenght)
-                log.WarningF("Content-Lenght %d header does not match size of %d read bytes for %s. Data might be incomplete.", contentLenght, responseData_.bodyBytes.Size(), requestData_.options[Options::Url].value.GetString().CString());
+            uint bodySize = responseData_.bodyBytes.Size() + responseData_.bodyBytesWritten;
+            if (contentLenght > 0 && bodySize != contentLenght)
+                log.WarningF("Content-Lenght %d header does not match size of %d read bytes for %s. Data might be incomplete.", contentLenght, bodySize, requestData_.options[Options::Url].value.GetString().CString());
+        }
+    }
 
-            // Write cache file if designated. File will be written regardless if server sent a 'Last-Modified' header.
-            if (!requestData_.cacheFile.Empty())
-            {
-                String lastModified = HeaderInternal(Http::Header::LastModified, true, false);
-
-                /** @todo Check if this is safe. We are in a secondary thread here. But it *should* be guaranteed by AssetAPI and the HttpClient that
-                    one request is ongoing at a time to a unique URL. The URL designates the filepath where we are writing. Framework and Urho3D
-                    Engine and its subsystem are guaranteed to be up while any worker thread is running (exit blocks waiting for workers to finish).
-                    Still this is dicy, it would be nice to execute the disk write in thread but if not safe it can be moved to main thread. */
-                Urho3D::File file(framework_->GetContext(), requestData_.cacheFile, Urho3D::FILE_WRITE);
-                if (file.IsOpen())
-                {
-                    Urho3D::Timer t;
-                    uint bodySize = responseData_.bodyBytes.Size();
-                    if (file.Write(&responseData_.bodyBytes[0], bodySize) == bodySize)
-                    {
-                        file.Close(); // File shared ptr will close when gets out of scope. Lets just do it here before modifying below last modified on the file.
-                        if (!lastModified.Empty())
-                        {
-                            time_t epoch = Http::HttpDateToUtcEpoch(lastModified);
-                            if (epoch > 0) // SetLastModifiedTime converts utc epoch correctly to local
-                                framework_->GetSubsystem<Urho3D::FileSystem>()->SetLastModifiedTime(requestData_.cacheFile, static_cast<uint>(epoch));
-                        }
-                    }
-                    requestData_.msecDiskWrite = t.GetMSec(false);
-                }
-            }
+    /* Close the file the body was streamed to. The file is left for the owner of the request to move in the main thread,
+       which keeps the main thread the only one modifying the cache. It is not read back, so that the body is never held in memory. */
+    if (requestData_.cacheStream)
+    {
+        Urho3D::HiresTimer t;
+        bool closed = (fclose(requestData_.cacheStream) == 0);
+        requestData_.cacheStream = 0;
+        requestData_.usecDiskWrite += t.GetUSec(false);
+        requestData_.msecDiskWrite = static_cast<int>(requestData_.usecDiskWrite / 1000);
+
+        if (!closed && requestData_.error.Empty())
+        {
+            requestData_.error = "Failed to write cache file " + requestData_.cacheTempFile;
+            log.Error(requestData_.error);
         }
-        else if (responseData_.status == 304)
+        if (res != CURLE_OK || responseData_.status != 200 || !closed)
         {
-            /// See above 200 OK file access comment
-            Urho3D::File file(framework_->GetContext(), requestData_.cacheFile, Urho3D::FILE_READ);
-            if (file.IsOpen())
-            {
-                Urho3D::Timer t;
-                uint fileSize = file.GetSize();
-                responseData_.bodyBytes.Resize(fileSize);
-                if (file.Read(&responseData_.bodyBytes[0], fileSize) != fileSize)
-                {
-                    log.Error("Failed to read cached disk source for '304 not Modified' response.");
-                    responseData_.bodyBytes.Clear();
-                }
-                requestData_.msecDiskRead = t.GetMSec(false);
-            }
+            RemoveFile(requestData_.cacheTempFile);
+            requestData_.cacheTempFile.Clear();
         }
     }
 
@@ -745,6 +809,14 @@ void HttpRequest::Cleanup()
         curl_slist_free_all(requestData_.curlHeaders);
         requestData_.curlHeaders = 0;
     }
+    if (requestData_.cacheStream)
+    {
+        // The request did not finish, discard the partial download.
+        fclose(requestData_.cacheStream);
+        requestData_.cacheStream = 0;
+        RemoveFile(requestData_.cacheTempFile);
+        requestData_.cacheTempFile.Clear();
+    }
 }
 
 void HttpRequest::WriteStats(Http::Stats *stats)
@@ -760,15 +832,15 @@ void HttpRequest::WriteStats(Http::Stats *stats)
         if (requestData_.msecDiskWrite > -1)
         {
             stats->diskWrites += 1;
-            stats->totals.diskWriteBytes += responseData_.bodyBytes.Size();
+            stats->totals.diskWriteBytes += responseData_.bodyBytesWritten;
             stats->totals.msecDiskWrite += requestData_.msecDiskWrite;
             if (stats->averages.msecDiskWrite < 0.0)
                 stats->averages.msecDiskWrite = static_cast<double>(requestData_.msecDiskWrite);
             else
                 stats->averages.msecDiskWrite = (stats->averages.msecDiskWrite + static_cast<double>(requestData_.msecDiskWrite)) / 2.0;
         }
-        /* Disk read and network download exclude each other.
-           Disk is only read on "304 Not Modified" responses. */
+        /* Disk read and network download exclude each other. The cache file of a "304 Not Modified"
+           response is loaded by the owner of the request, so the request itself does not read the disk. */
         if (requestData_.msecDiskRead > -1)
         {
             stats->diskReads += 1;
@@ -783,7 +855,7 @@ void HttpRequest::WriteStats(Http::Stats *stats)
         else
         {
             stats->downloads += 1;
-            stats->totals.downloadBytes += responseData_.bodyBytes.Size();
+            stats->totals.downloadBytes += responseData_.bodyBytes.Size() + responseData_.bodyBytesWritten;
             if (responseData_.downloadBytesPerSec > -1.0)
             {
                 if (stats->averages.bestDownloadBytesPerSec < responseData_.downloadBytesPerSec)
@@ -919,13 +991,43 @@ size_t HttpRequest::ReadBody(void *buffer, uint size)
 {
     /* First body bytes are being received. Parse headers to determine exact size of
        incoming data. This way we don't have to resize the body buffer mid flight. */
-    if (responseData_.bodyBytes.Empty() && !responseData_.headersBytes.Empty())
+    if (!responseData_.headersParsed && !responseData_.headersBytes.Empty())
     {
         if (!ParseHeaders())
             return 0; // Propagates a CURLE_WRITE_ERROR and aborts transfer
 
+        /* A '200 OK' body for a cache file is streamed to disk as it arrives instead of holding it in memory.
+           If the file cannot be opened, fall back to receiving the body to memory without caching it. */
+        if (!requestData_.cacheFile.Empty() && responseData_.status == 200)
+        {
+            requestData_.cacheTempFile = CacheTempFile(requestData_.cacheFile, this);
+            requestData_.cacheStream = OpenFileForWriting(requestData_.cacheTempFile);
+            responseData_.bodyHash = AssetCache::cContentHashSeed;
+            if (!requestData_.cacheStream)
+            {
+                log.WarningF("Failed to open %s for writing, not caching the response.", requestData_.cacheTempFile.CString());
+                requestData_.cacheTempFile.Clear();
+            }
+        }
         // Headers have been parsed. Reserve bodyBytes_ to "Content-Length" size.
-        responseData_.bodyBytes.Reserve(HeaderUIntInternal(Http::Header::ContentLength, HTTP_INITIAL_BODY_SIZE, true, false));
+        if (!requestData_.cacheStream)
+            responseData_.bodyBytes.Reserve(HeaderUIntInternal(Http::Header::ContentLength, HTTP_INITIAL_BODY_SIZE, true, false));
+    }
+
+    if (requestData_.cacheStream)
+    {
+        Urho3D::HiresTimer t;
+        size_t written = fwrite(buffer, 1, size, requestData_.cacheStream);
+        requestData_.usecDiskWrite += t.GetUSec(false);
+        if (written != size)
+        {
+            requestData_.error = "Failed to write cache file " + requestData_.cacheTempFile;
+            log.Error(requestData_.error);
+            return 0; // Propagates a CURLE_WRITE_ERROR and aborts transfer
+        }
+        responseData_.bodyBytesWritten += size;
+        responseData_.bodyHash = AssetCache::ContentHash(static_cast<const u8*>(buffer), size, responseData_.bodyHash);
+        return size;
     }
 
     Vector<u8> data(static_cast<u8*>(buffer), size);
@@ -955,11 +1057,17 @@ bool HttpRequest::ParseHeaders()
         log.Error("Error while parsing headers: " + requestData_.error);
         return false; // Propagates a CURLE_WRITE_ERROR and aborts transfer
     }
+    // The status is needed while receiving the body. Finish reads the final status from curl.
+    responseData_.status = static_cast<int>(parser.status_code);
     return true;
 }
 
 size_t HttpRequest::ReadHeaders(void *buffer, uint size)
 {
+    /* Curl reports the headers of all responses, eg. of followed redirects and '100 Continue'.
+       Only keep the headers of the latest response, which is the one whose body is received. */
+    if (!responseData_.headersParsed && size >= 5 && strncmp(static_cast<const char*>(buffer), "HTTP/", 5) == 0)
+        responseData_.headersBytes.Clear();
     if (responseData_.headersBytes.Empty())
         responseData_.headersBytes.Reserve(HTTP_MAX_HEADER_SIZE);
 
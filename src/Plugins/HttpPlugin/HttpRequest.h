@@ -9,6 +9,7 @@
 #include "LoggingFunctions.h"
 
 #include <Urho3D/Core/Mutex.h>
+#include <Urho3D/Core/Timer.h>
 #include <Urho3D/Container/Str.h>
 #include <Urho3D/Container/HashMap.h>
 #include <Urho3D/Container/RefCounted.h>
@@ -29,6 +30,7 @@ class TUNDRA_HTTP_API HttpRequest : public Urho3D::RefCounted
     /// @cond PRIVATE
     friend class HttpClient;
     friend class HttpWorkThread;
+    friend class HttpMultiThread;
     friend class HttpWorkQueue;
     friend size_t CurlWriteBody(void *buffer, size_t size, size_t items, void *data);
     friend size_t CurlReadBody(void *buffer, size_t size, size_t items, void *data);
@@ -104,12 +106,13 @@ public:
 
     /// Sets the source and destination @c filepath for HTTP cache mechanisms.
     /** @param Filepath to used as the response data if '304 Not Modified' without a body is returned by the server.
-        Or in the case of '200 OK' with a body response, the data is written to this file prior to completion signals.
+        The file is not read, the owner can load it when the request completes. In the case of '200 OK' with a body response,
+        the body is streamed to a temporary file in a 'http' subdirectory next to @c filepath as it is received, instead of
+        ResponseBody(), so that the body is never held in memory. The owner can take the file with DownloadedFile(),
+        otherwise it is deleted with the request.
         @param If true the reqeusts 'If-Modified-Since' header is set from the files last modification date and time.
-        And in the case of writing to the file the responses 'Last-Modified' header is used to set the written files
-        last modified timestamp on the operating system level.
         @note This feature simplifies the common HTTP use case of Tundras AssetAPI and the HttpAssetProvider. Additionally
-        the disk read/write operations can be executed in the HTTP worker thread without blocking the main thread. */
+        the disk read/write operations are executed in the HTTP worker thread without blocking the main thread. */
     bool SetCacheFile(const String &filepath, bool useLastModified);
 
     /// @overload
@@ -155,6 +158,21 @@ public:
     /** This function should be avoided for large body sizes. @see ResponseBody(). */
     Vector<u8> CloneResponseBody();
 
+    /// Moves the response body to @c dest without copying it, if request has completed. The response body is left empty.
+    /** @return False if request has not completed or response body is empty. */
+    bool MoveResponseBodyTo(Vector<u8> &dest);
+
+    /// Returns the file the '200 OK' response body was streamed to, if a cache file was set with SetCacheFile.
+    /** The file can be moved elsewhere, eg. to the asset cache. If it still exists, it is deleted when the request is destroyed.
+        @return Filepath if request has completed and the body was written to disk, otherwise an empty string. */
+    String DownloadedFile();
+
+    /// Returns the size of DownloadedFile() in bytes, or 0 if there is none.
+    uint DownloadedFileSize();
+
+    /// Returns the AssetCache::ContentHash of the data in DownloadedFile(), computed while it was written.
+    u64 DownloadedFileHash();
+
     /// @todo Implement response body to JSONValue and JSON string.
     //JSONValue ResponseJSON();
 
@@ -196,6 +214,12 @@ private:
 
     /// Called by HttpWorkThread in worker thread context.
     void Perform();
+    /// Prepares the request for execution and marks it executing. Returns false if the request failed to prepare and has completed.
+    /** Invoked in worker thread context. */
+    bool Begin();
+    /// Reads the response and marks the request completed after the transfer has finished with @c res.
+    /** Invoked in worker thread context. */
+    void Finish(CURLcode res);
     /// Invoked in worker thread context.
     bool Prepare();
     /// Invoked in worker thread context.
@@ -232,6 +256,7 @@ private:
     Http::ResponseData responseData_;
 
     Urho3D::Mutex mutexExecute_;
+    Urho3D::Timer networkTimer_;
     bool executing_;
     bool completed_;
     bool verbose_;
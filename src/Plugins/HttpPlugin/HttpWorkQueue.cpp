@@ -10,18 +10,30 @@
 #include <Urho3D/Core/ProcessUtils.h>
 #include <Urho3D/Core/StringUtils.h>
 
+#include <curl/curl.h>
+
 namespace Tundra
 {
 
 // HttpWorkQueue
 
 const float DurationKeepAliveThreads = 10.f;
+/// Maximum number of requests the multi engine executes at the same time. More requests wait in the queue.
+const uint MaxMultiTransfers = 256;
 const Logger HttpWorkQueue::log = Logger("HttpRequest");
 
-HttpWorkQueue::HttpWorkQueue() :
+HttpWorkQueue::HttpWorkQueue(bool multiEngine, uint maxHostConnections) :
     durationNoWork_(0.f),
+    multiEngine_(multiEngine),
+    maxHostConnections_(maxHostConnections),
     stats_(new Http::Stats())
 {
+    if (multiEngine_)
+    {
+        numMaxThreads_ = 1; // The multi handle executes all requests in one thread
+        log.DebugF("Using curl multi engine with at most %d connections per host", maxHostConnections_);
+        return;
+    }
     numMaxThreads_ = Urho3D::GetNumLogicalCPUs();
     if (numMaxThreads_ < 1) numMaxThreads_ = 1;         // Need at least one worker
     else if (numMaxThreads_ > 32) numMaxThreads_ = 32;  // Cap to something sensible
@@ -95,9 +107,11 @@ void HttpWorkQueue::Update(float frametime)
     if (numPending + numExecuting == 0)
     {
         /* Don't stop workers immediately. Wait for some time
-           if new work will come in. Spinning up threads is not free. */
+           if new work will come in. Spinning up threads is not free.
+           The multi thread is never stopped, as its multi handle keeps
+           the open connections for the following requests. */
         durationNoWork_ += frametime;
-        if (durationNoWork_ > DurationKeepAliveThreads && threads_.Size() > 0)
+        if (durationNoWork_ > DurationKeepAliveThreads && threads_.Size() > 0 && !multiEngine_)
             StopThreads();
         stats_->current.idle = (threads_.Size() > 0 ? durationNoWork_ : -1.f);
         return;
@@ -121,7 +135,7 @@ void HttpWorkQueue::StartThreads(uint max)
 
     while(threads_.Size() < max)
     {
-        HttpWorkThread *thread = new HttpWorkThread(this);
+        HttpWorkThread *thread = (multiEngine_ ? new HttpMultiThread(this) : new HttpWorkThread(this));
         if (thread->Run())
             threads_.Push(thread);
         else
@@ -221,4 +235,115 @@ void HttpWorkThread::ThreadFunction()
     LogDebug("[HttpWorkThread] Stopping " + String(GetCurrentThreadID()));
 }
 
+// HttpMultiThread
+
+HttpMultiThread::HttpMultiThread(HttpWorkQueue *queue) :
+    HttpWorkThread(queue)
+{
+}
+
+void HttpMultiThread::ThreadFunction()
+{
+    LogDebug("[HttpMultiThread] Starting " + String(GetCurrentThreadID()));
+
+    CURLM *multi = curl_multi_init();
+    if (!multi)
+    {
+        LogError("[HttpMultiThread] Failed to initialize curl multi handle");
+        return;
+    }
+    /* The connections are kept open in the multi handle and reused by the following requests to the same host.
+       HTTP/2 connections are shared by concurrent requests instead of opening a new connection for each. */
+#if LIBCURL_VERSION_NUM >= 0x071E00
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(queue_->maxHostConnections_));
+#endif
+#ifdef CURLPIPE_MULTIPLEX
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
+    PODVector<HttpRequest*> active;
+#if LIBCURL_VERSION_NUM < 0x074200
+    uint numEmptyWaits = 0;
+#endif
+    while(shouldRun_)
+    {
+        while(active.Size() < MaxMultiTransfers)
+        {
+            HttpRequest *request = queue_->Next();
+            if (!request)
+                break;
+            if (!request->Begin())
+            {
+                queue_->Completed(request);
+                continue;
+            }
+            CURL *handle = request->requestData_.curlHandle;
+            curl_easy_setopt(handle, CURLOPT_PRIVATE, request);
+#if LIBCURL_VERSION_NUM >= 0x072B00
+            // Prefer waiting for a connection that can be multiplexed over opening a new one.
+            curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+#endif
+            curl_multi_add_handle(multi, handle);
+            active.Push(request);
+        }
+
+        if (active.Empty())
+        {
+            Urho3D::Time::Sleep(16);
+            continue;
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        int numMessages = 0;
+        while(CURLMsg *msg = curl_multi_info_read(multi, &numMessages))
+        {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            // The message is freed by curl_multi_remove_handle, read it first.
+            CURL *handle = msg->easy_handle;
+            CURLcode res = msg->data.result;
+            char *data = 0;
+            curl_easy_getinfo(handle, CURLINFO_PRIVATE, &data);
+            HttpRequest *request = reinterpret_cast<HttpRequest*>(data);
+
+            curl_multi_remove_handle(multi, handle);
+            active.Remove(request);
+            request->Finish(res);
+            queue_->Completed(request);
+        }
+
+        if (active.Empty())
+            continue;
+
+        // Wakes up on socket activity, or after the timeout to pick up new requests.
+#if LIBCURL_VERSION_NUM >= 0x074200
+        curl_multi_poll(multi, 0, 0, 16, 0);
+#else
+        /* curl_multi_wait returns immediately if curl has no sockets to wait on, eg. while resolving
+           a host name or between transfers. Sleep if that happens repeatedly instead of spinning. */
+        int numFds = 0;
+        if (curl_multi_wait(multi, 0, 0, 16, &numFds) != CURLM_OK || numFds == 0)
+        {
+            if (++numEmptyWaits > 1)
+                Urho3D::Time::Sleep(16);
+        }
+        else
+            numEmptyWaits = 0;
+#endif
+    }
+
+    // Abort the requests that are still executing.
+    for(uint i = 0; i < active.Size(); ++i)
+    {
+        curl_multi_remove_handle(multi, active[i]->requestData_.curlHandle);
+        active[i]->Finish(CURLE_ABORTED_BY_CALLBACK);
+        queue_->Completed(active[i]);
+    }
+    curl_multi_cleanup(multi);
+
+    LogDebug("[HttpMultiThread] Stopping " + String(GetCurrentThreadID()));
+}
+
 }
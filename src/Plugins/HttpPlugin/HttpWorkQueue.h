@@ -16,15 +16,25 @@ namespace Tundra
 {
 
 /// HttpWorkQueue request
+/** The requests are executed either by a pool of threads that each perform one request at a time, or by a single
+    I/O thread that drives all requests with a curl multi handle. The multi engine reuses connections between the
+    requests, multiplexes them over HTTP/2 connections where the server supports it, and limits the number of
+    connections per host. The I/O thread is kept running while idle, so that the connections stay open for the
+    following requests. It is enabled with --httpMultiEngine, and the per-host connection limit can be set with
+    --httpMaxHostConnections <count>. */
 class HttpWorkQueue : public Urho3D::RefCounted
 {
     /// @cond PRIVATE
     friend class HttpClient;
     friend class HttpWorkThread;
+    friend class HttpMultiThread;
     /// @endcond
 
 public:
-    HttpWorkQueue();
+    /// @param multiEngine If true, all requests are executed by a single thread using a curl multi handle.
+    /// @param maxHostConnections Maximum number of simultaneous connections to a single host in the multi engine, 0 for unlimited.
+    /// Requires libcurl 7.30.0 or newer, older versions do not limit the connections.
+    explicit HttpWorkQueue(bool multiEngine = false, uint maxHostConnections = 6);
     ~HttpWorkQueue();
 
     void Schedule(const HttpRequestPtr &request);
@@ -48,6 +58,8 @@ private:
 
     float durationNoWork_;
     uint numMaxThreads_;
+    bool multiEngine_;
+    uint maxHostConnections_;
     HttpWorkThreadList threads_;
 
     Urho3D::Mutex mutexRequests_;
@@ -89,10 +101,19 @@ public:
     /// Urho3D::Thread
     void ThreadFunction() override;
 
-private:
+protected:
     HttpWorkQueue *queue_;
 };
 
+class HttpMultiThread : public HttpWorkThread
+{
+public:
+    HttpMultiThread(HttpWorkQueue *queue);
+
+    /// Urho3D::Thread
+    void ThreadFunction() override;
+};
+
 /// @endcond
 
 }
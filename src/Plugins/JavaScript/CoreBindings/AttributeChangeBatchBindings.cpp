@@ -0,0 +1,55 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "CoreTypes.h"
+#include "BindingsHelpers.h"
+#include "Scene/IComponent.h"
+#include "Scene/Scene.h"
+
+using namespace Tundra;
+
+namespace JSBindings
+{
+
+// Hand-written, as BindingsGenerator can not expose functions that take a script function. Begin/EndAttributeChanges
+// are not exposed, so that an error thrown by a script can not leave the scene or component collecting changes.
+
+template<class T> duk_ret_t BatchAttributeChanges(duk_context* ctx)
+{
+    Urho3D::WeakPtr<T> thisObj(GetThisWeakObject<T>(ctx));
+    duk_require_function(ctx, 0);
+    thisObj->BeginAttributeChanges();
+    duk_dup(ctx, 0);
+    duk_int_t rc = duk_pcall(ctx, 0);
+    if (thisObj)
+        thisObj->EndAttributeChanges();
+    if (rc != DUK_EXEC_SUCCESS)
+        duk_throw(ctx);
+    return 0;
+}
+
+static const duk_function_list_entry IComponent_BatchFunctions[] = {
+    {"BatchAttributeChanges", BatchAttributeChanges<IComponent>, 1}
+    ,{nullptr, nullptr, 0}
+};
+
+static const duk_function_list_entry Scene_BatchFunctions[] = {
+    {"BatchAttributeChanges", BatchAttributeChanges<Scene>, 1}
+    ,{nullptr, nullptr, 0}
+};
+
+static void AddPrototypeFunctions(duk_context* ctx, const char* className, const duk_function_list_entry* functions)
+{
+    duk_get_global_string(ctx, className);
+    duk_get_prop_string(ctx, -1, "prototype");
+    duk_put_function_list(ctx, -1, functions);
+    duk_pop_2(ctx);
+}
+
+void Expose_AttributeChangeBatch(duk_context* ctx)
+{
+    AddPrototypeFunctions(ctx, "IComponent", IComponent_BatchFunctions);
+    AddPrototypeFunctions(ctx, "Scene", Scene_BatchFunctions);
+}
+
+}
@@ -12,6 +12,7 @@ void Expose_Scene(duk_context* ctx);
 void Expose_Framework(duk_context* ctx);
 void Expose_FrameAPI(duk_context* ctx);
 void Expose_SceneAPI(duk_context* ctx);
+void Expose_AttributeChangeBatch(duk_context* ctx);
 
 void ExposeCoreClasses(duk_context* ctx)
 {
@@ -21,6 +22,7 @@ void ExposeCoreClasses(duk_context* ctx)
     Expose_Framework(ctx);
     Expose_FrameAPI(ctx);
     Expose_SceneAPI(ctx);
+    Expose_AttributeChangeBatch(ctx);
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,166 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "EntityGrid.h"
+
+#include <cmath>
+
+namespace Tundra
+{
+
+// Cell coordinates are packed to 21 bits each. Coordinates beyond the range wrap around, which only makes
+// far away cells share a key; the queries still check the exact distance of each entity.
+static const int cCellCoordinateLimit = (1 << 20) - 1;
+
+static int CellCoordinate(float value, float invCellSize)
+{
+    float cell = floorf(value * invCellSize);
+    if (!(cell > -(float)cCellCoordinateLimit)) // Also catches NaN
+        return -cCellCoordinateLimit;
+    if (cell > (float)cCellCoordinateLimit)
+        return cCellCoordinateLimit;
+    return (int)cell;
+}
+
+EntityGrid::EntityGrid(float cellSize) :
+    cellSize_(1.f),
+    invCellSize_(1.f)
+{
+    SetCellSize(cellSize);
+}
+
+void EntityGrid::SetCellSize(float cellSize)
+{
+    if (!(cellSize > 0.f))
+        cellSize = 1.f;
+    if (cellSize == cellSize_)
+        return;
+
+    cellSize_ = cellSize;
+    invCellSize_ = 1.f / cellSize;
+
+    cells_.Clear();
+    for (auto i = entries_.Begin(); i != entries_.End(); ++i)
+        AddToCell(i->first_, i->second_, CellKey(i->second_.pos));
+}
+
+void EntityGrid::Update(entity_id_t id, const float3 &pos)
+{
+    const u64 cell = CellKey(pos);
+    auto i = entries_.Find(id);
+    if (i == entries_.End())
+    {
+        Entry &entry = entries_[id];
+        entry.pos = pos;
+        AddToCell(id, entry, cell);
+        return;
+    }
+
+    Entry &entry = i->second_;
+    entry.pos = pos;
+    if (entry.cell != cell)
+    {
+        RemoveFromCell(entry);
+        AddToCell(id, entry, cell);
+    }
+}
+
+void EntityGrid::Remove(entity_id_t id)
+{
+    auto i = entries_.Find(id);
+    if (i == entries_.End())
+        return;
+    RemoveFromCell(i->second_);
+    entries_.Erase(i);
+}
+
+void EntityGrid::Clear()
+{
+    entries_.Clear();
+    cells_.Clear();
+}
+
+float3 EntityGrid::Position(entity_id_t id) const
+{
+    auto i = entries_.Find(id);
+    return i != entries_.End() ? i->second_.pos : float3::nan;
+}
+
+void EntityGrid::Query(const float3 &center, float radius, PODVector<entity_id_t> &result) const
+{
+    if (!center.IsFinite() || radius < 0.f)
+        return;
+
+    const float radiusSq = radius * radius;
+    const int minX = CellCoordinate(center.x - radius, invCellSize_), maxX = CellCoordinate(center.x + radius, invCellSize_);
+    const int minY = CellCoordinate(center.y - radius, invCellSize_), maxY = CellCoordinate(center.y + radius, invCellSize_);
+    const int minZ = CellCoordinate(center.z - radius, invCellSize_), maxZ = CellCoordinate(center.z + radius, invCellSize_);
+
+    // If the sphere covers more cells than are occupied, it is cheaper to test every occupied cell.
+    const double numCells = (double)(maxX - minX + 1) * (double)(maxY - minY + 1) * (double)(maxZ - minZ + 1);
+    if (numCells >= (double)cells_.Size())
+    {
+        for (auto i = entries_.Begin(); i != entries_.End(); ++i)
+        {
+            if (i->second_.pos.DistanceSq(center) <= radiusSq)
+                result.Push(i->first_);
+        }
+        return;
+    }
+
+    for (int x = minX; x <= maxX; ++x)
+        for (int y = minY; y <= maxY; ++y)
+            for (int z = minZ; z <= maxZ; ++z)
+            {
+                auto cell = cells_.Find(CellKey(x, y, z));
+                if (cell == cells_.End())
+                    continue;
+                const PODVector<entity_id_t> &ids = cell->second_;
+                for (unsigned j = 0; j < ids.Size(); ++j)
+                {
+                    auto entry = entries_.Find(ids[j]);
+                    if (entry->second_.pos.DistanceSq(center) <= radiusSq)
+                        result.Push(ids[j]);
+                }
+            }
+}
+
+u64 EntityGrid::CellKey(const float3 &pos) const
+{
+    return CellKey(CellCoordinate(pos.x, invCellSize_), CellCoordinate(pos.y, invCellSize_), CellCoordinate(pos.z, invCellSize_));
+}
+
+u64 EntityGrid::CellKey(int x, int y, int z)
+{
+    const u64 mask = (1 << 21) - 1;
+    return (((u64)x & mask) << 42) | (((u64)y & mask) << 21) | ((u64)z & mask);
+}
+
+void EntityGrid::AddToCell(entity_id_t id, Entry &entry, u64 cell)
+{
+    PODVector<entity_id_t> &ids = cells_[cell];
+    entry.cell = cell;
+    entry.index = ids.Size();
+    ids.Push(id);
+}
+
+void EntityGrid::RemoveFromCell(const Entry &entry)
+{
+    auto cell = cells_.Find(entry.cell);
+    if (cell == cells_.End())
+        return;
+
+    // Swap the last entity of the cell into the removed slot
+    PODVector<entity_id_t> &ids = cell->second_;
+    const unsigned last = ids.Size() - 1;
+    if (entry.index != last)
+    {
+        ids[entry.index] = ids[last];
+        entries_[ids[last]].index = entry.index;
+    }
+    ids.Pop();
+    if (ids.Empty())
+        cells_.Erase(cell);
+}
+
+}
@@ -0,0 +1,71 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraLogicApi.h"
+#include "TundraLogicFwd.h"
+#include "CoreTypes.h"
+
+#include "Math/float3.h"
+
+#include <Urho3D/Container/HashMap.h>
+
+namespace Tundra
+{
+
+/// Sparse uniform grid of entity world positions, used to find the entities near an observer.
+/** Only the occupied cells are stored, so the grid is unbounded. Inserting, moving and removing an entity are O(1),
+    and a query visits only the cells overlapping the query sphere, so its cost depends on the number of nearby entities
+    instead of the size of the scene.
+    @remark Interest management */
+class TUNDRALOGIC_API EntityGrid
+{
+public:
+    explicit EntityGrid(float cellSize = 100.f);
+
+    /// Sets the cell edge length. Redistributes the existing entities to the new cells.
+    void SetCellSize(float cellSize);
+    /// Returns the cell edge length.
+    float CellSize() const { return cellSize_; }
+
+    /// Inserts the entity @c id at @c pos, or moves it there if it already exists.
+    void Update(entity_id_t id, const float3 &pos);
+    /// Removes the entity @c id. Does nothing if it does not exist.
+    void Remove(entity_id_t id);
+    /// Removes all entities.
+    void Clear();
+
+    /// Returns whether the entity @c id exists in the grid.
+    bool Contains(entity_id_t id) const { return entries_.Contains(id); }
+    /// Returns the position of the entity @c id, or NaN if it does not exist.
+    float3 Position(entity_id_t id) const;
+    /// Returns the number of entities in the grid.
+    unsigned Size() const { return entries_.Size(); }
+
+    /// Appends the IDs of the entities within @c radius of @c center to @c result.
+    void Query(const float3 &center, float radius, PODVector<entity_id_t> &result) const;
+
+private:
+    struct Entry
+    {
+        float3 pos;
+        u64 cell; ///< Key of the cell the entity is in.
+        unsigned index; ///< Index of the entity in the cell.
+    };
+
+    /// Returns the key of the cell containing @c pos.
+    u64 CellKey(const float3 &pos) const;
+    /// Returns the key of the cell at integer cell coordinates.
+    static u64 CellKey(int x, int y, int z);
+    /// Appends @c id to @c cell and updates @c entry accordingly.
+    void AddToCell(entity_id_t id, Entry &entry, u64 cell);
+    /// Removes the entity described by @c entry from its cell.
+    void RemoveFromCell(const Entry &entry);
+
+    float cellSize_;
+    float invCellSize_;
+    HashMap<entity_id_t, Entry> entries_;
+    HashMap<u64, PODVector<entity_id_t> > cells_;
+};
+
+}
@@ -44,6 +44,10 @@ public:
     void ComputeSyncPriorities(EntitySyncState &entityState, const float3 &observerPos, const float3 &observerRot);
 
     SceneWeakPtr scene;
+
+private:
+    /// Computes the priority and relevancy of a single entity.
+    void ComputeSyncPriority(Scene *scn, EntitySyncState &entityState, const float3 &observerPos);
 };
 
 }
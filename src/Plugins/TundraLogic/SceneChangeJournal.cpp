@@ -0,0 +1,174 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "SceneChangeJournal.h"
+#include "SyncState.h"
+#include "LoggingFunctions.h"
+
+#include <Urho3D/Core/Profiler.h>
+
+#include <cstring>
+
+namespace Tundra
+{
+
+static u64 ComponentKey(entity_id_t entityId, component_id_t compId)
+{
+    return ((u64)entityId << 32) | (u64)compId;
+}
+
+SceneChangeJournal::SceneChangeJournal() :
+    firstSequence_(0),
+    numReplayed_(0)
+{
+}
+
+void SceneChangeJournal::RecordEntityChange(ChangeType type, entity_id_t entityId)
+{
+    Change change;
+    change.type = type;
+    change.entityId = entityId;
+    change.compId = 0;
+    change.attrIndex = 0;
+    Append(change);
+}
+
+void SceneChangeJournal::RecordComponentChange(ChangeType type, entity_id_t entityId, component_id_t compId)
+{
+    Change change;
+    change.type = type;
+    change.entityId = entityId;
+    change.compId = compId;
+    change.attrIndex = 0;
+    Append(change);
+}
+
+void SceneChangeJournal::RecordAttributeChange(ChangeType type, entity_id_t entityId, component_id_t compId, u8 attrIndex)
+{
+    if (type == AttributesChanged)
+    {
+        // Coalesce into the latest record of the same component, if it is still open
+        auto existing = attributeChanges_.Find(ComponentKey(entityId, compId));
+        if (existing != attributeChanges_.End())
+        {
+            const u32 offset = existing->second_ - firstSequence_;
+            auto structural = structuralChanges_.Find(entityId);
+            if (offset >= numReplayed_ && offset < changes_.size() &&
+                (structural == structuralChanges_.End() || structural->second_ - firstSequence_ < offset))
+            {
+                changes_[offset].dirtyAttributes[attrIndex >> 3] |= (1 << (attrIndex & 7));
+                return;
+            }
+        }
+    }
+
+    Change change;
+    change.type = type;
+    change.entityId = entityId;
+    change.compId = compId;
+    change.attrIndex = attrIndex;
+    Append(change);
+}
+
+void SceneChangeJournal::Append(const Change &change)
+{
+    // Structural changes must be replayed in order with the attribute changes of the same entity surrounding them,
+    // so they close the entity's attribute records
+    if (change.type != AttributesChanged)
+        structuralChanges_[change.entityId] = Head();
+    else
+        attributeChanges_[ComponentKey(change.entityId, change.compId)] = Head();
+
+    changes_.push_back(change);
+    Change &added = changes_.back();
+    memset(added.dirtyAttributes, 0, sizeof(added.dirtyAttributes));
+    if (added.type == AttributesChanged)
+        added.dirtyAttributes[added.attrIndex >> 3] |= (1 << (added.attrIndex & 7));
+}
+
+void SceneChangeJournal::CatchUp(SceneSyncState &state)
+{
+    u32 offset = state.journalCursor - firstSequence_;
+    if (offset > changes_.size())
+    {
+        LogWarning("SceneChangeJournal::CatchUp: Changes for connection " + String(state.UserConnectionId()) + " have already been dropped from the journal.");
+        offset = (u32)changes_.size();
+    }
+    if (offset == changes_.size())
+    {
+        state.journalCursor = Head();
+        return;
+    }
+
+    URHO3D_PROFILE(SceneChangeJournal_CatchUp);
+
+    for(size_t i = offset; i < changes_.size(); ++i)
+        Replay(state, changes_[i]);
+    state.journalCursor = Head();
+    numReplayed_ = (u32)changes_.size();
+}
+
+void SceneChangeJournal::Replay(SceneSyncState &state, const Change &change)
+{
+    switch(change.type)
+    {
+    case EntityCreated:
+        state.MarkEntityDirty(change.entityId);
+        {
+            EntitySyncState *entityState = state.FindEntitySyncState(change.entityId);
+            if (entityState && entityState->removed)
+                LogWarning("An entity with ID " + String(change.entityId) + " is queued to be deleted, but a new entity is to be added to the scene!");
+        }
+        break;
+    case EntityRemoved:
+        state.MarkEntityRemoved(change.entityId);
+        break;
+    case EntityPropertiesChanged:
+        state.MarkEntityDirty(change.entityId, true);
+        break;
+    case EntityParentChanged:
+        state.MarkEntityDirty(change.entityId, false, true);
+        break;
+    case ComponentAdded:
+        state.MarkComponentDirty(change.entityId, change.compId);
+        break;
+    case ComponentRemoved:
+        state.MarkComponentRemoved(change.entityId, change.compId);
+        break;
+    case AttributesChanged:
+        state.MarkAttributesDirty(change.entityId, change.compId, change.dirtyAttributes);
+        break;
+    case AttributeAdded:
+        state.MarkAttributeCreated(change.entityId, change.compId, change.attrIndex);
+        break;
+    case AttributeRemoved:
+        state.MarkAttributeRemoved(change.entityId, change.compId, change.attrIndex);
+        break;
+    }
+}
+
+void SceneChangeJournal::Trim(u32 sequence)
+{
+    u32 count = sequence - firstSequence_;
+    if (count > changes_.size())
+        count = (u32)changes_.size();
+    if (!count)
+        return;
+
+    // Close the remaining records, so that the lookups never refer to dropped ones
+    attributeChanges_.Clear();
+    structuralChanges_.Clear();
+    numReplayed_ = (numReplayed_ > count ? numReplayed_ - count : 0);
+    if (count == changes_.size())
+        changes_.clear();
+    else
+        changes_.erase(changes_.begin(), changes_.begin() + count);
+    firstSequence_ += count;
+}
+
+void SceneChangeJournal::Clear()
+{
+    Trim(Head());
+}
+
+}
@@ -0,0 +1,92 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraLogicApi.h"
+#include "TundraLogicFwd.h"
+#include "CoreTypes.h"
+
+#include <Urho3D/Container/HashMap.h>
+
+#include <vector>
+
+namespace Tundra
+{
+
+/// Scene-wide, append-only log of the replicated scene changes on the server.
+/** SyncManager records each change once, regardless of the number of connected users. Each SceneSyncState keeps
+    a cursor (SceneSyncState::journalCursor) into the journal and replays the changes it has not yet seen into its
+    dirty state with CatchUp(), normally once per network update tick.
+
+    Repeated attribute changes of the same component are coalesced into one record, so a component that changes many
+    times between two network ticks costs a single record. A record is closed once a state's cursor has passed it,
+    or a structural change (anything but an attribute value change) of the same entity has been recorded after it. */
+class TUNDRALOGIC_API SceneChangeJournal
+{
+public:
+    /// Type of a recorded change.
+    enum ChangeType
+    {
+        EntityCreated = 0,
+        EntityRemoved,
+        EntityPropertiesChanged,
+        EntityParentChanged,
+        ComponentAdded,
+        ComponentRemoved,
+        AttributesChanged,
+        AttributeAdded,
+        AttributeRemoved
+    };
+
+    /// A recorded change.
+    struct Change
+    {
+        ChangeType type;
+        entity_id_t entityId;
+        component_id_t compId; ///< Not used by entity changes.
+        u8 attrIndex; ///< Used by AttributeAdded and AttributeRemoved.
+        u8 dirtyAttributes[32]; ///< Changed attributes bitfield, used by AttributesChanged.
+    };
+
+    SceneChangeJournal();
+
+    /// Records an entity creation, removal, property or parent change.
+    void RecordEntityChange(ChangeType type, entity_id_t entityId);
+    /// Records a component addition or removal.
+    void RecordComponentChange(ChangeType type, entity_id_t entityId, component_id_t compId);
+    /// Records an attribute value change, or a dynamic attribute addition or removal.
+    void RecordAttributeChange(ChangeType type, entity_id_t entityId, component_id_t compId, u8 attrIndex);
+
+    /// Replays all changes @c state has not yet seen into its dirty state and advances its journal cursor to Head().
+    void CatchUp(SceneSyncState &state);
+
+    /// Drops all changes older than @c sequence.
+    /** All states must have replayed the changes before they are dropped. */
+    void Trim(u32 sequence);
+
+    /// Drops all changes. States that have not caught up will skip the dropped changes.
+    void Clear();
+
+    /// Returns the sequence number of the oldest change in the journal.
+    u32 Tail() const { return firstSequence_; }
+    /// Returns the sequence number the next recorded change will get.
+    u32 Head() const { return firstSequence_ + (u32)changes_.size(); }
+    /// Returns the number of changes in the journal.
+    size_t Size() const { return changes_.size(); }
+
+private:
+    void Append(const Change &change);
+    void Replay(SceneSyncState &state, const Change &change);
+
+    std::vector<Change> changes_;
+    /// Sequence number of changes_[0].
+    u32 firstSequence_;
+    /// Sequence number of the latest AttributesChanged record, by entity and component ID.
+    HashMap<u64, u32> attributeChanges_;
+    /// Sequence number of the latest structural change, by entity ID.
+    HashMap<entity_id_t, u32> structuralChanges_;
+    /// Number of changes from firstSequence_ that a state has already replayed. They can not be modified anymore.
+    u32 numReplayed_;
+};
+
+}
@@ -26,6 +26,7 @@
 
 #include <Urho3D/Core/Profiler.h>
 #include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/Core/Timer.h>
 
 #include <cstring>
 
@@ -33,10 +34,48 @@
 static std::set<u32> mismatchingComponentTypes;
 
 static size_t oldAttrDataBufferSize = 16 * 1024;
+// Largest component or attribute message sent for an entity's component changes.
+static const size_t cMaxComponentsMessageBytes = 64 * 1024;
+
+// Bandwidth budget adaptation. A connection is considered congested when messages pile up in its outbound queue,
+// or when its round trip time grows well above the smallest one measured.
+static const size_t cCongestedOutboundMessages = 512;
+static const float cCongestedRoundTripTimeSlack = 50.f; // milliseconds
+static const float cMinBandwidthBudgetFraction = 0.1f;
+static const float cBandwidthBudgetDecrease = 0.75f;
+static const float cBandwidthBudgetIncreaseFraction = 0.05f;
+
+// Entities leave the area of interest only this much further than the relevance radius, so that entities moving
+// along the border are not repeatedly removed from and recreated on the client.
+static const float cAreaOfInterestLeaveFactor = 1.1f;
+
+// Default time the client spends applying received scene changes per frame.
+static const float cDefaultReceiveTimeBudget = 0.005f;
 
 namespace Tundra
 {
 
+// Helper functions for looking up components without taking references, as reference counts must not be modified
+// while the sync states are processed in worker threads.
+static IComponent *ComponentByIdNoRef(Entity *entity, component_id_t id)
+{
+    const Entity::ComponentMap &components = entity->Components();
+    auto i = components.Find(id);
+    return i != components.End() ? i->second_.Get() : 0;
+}
+
+template <class T>
+static T *ComponentNoRef(Entity *entity)
+{
+    const Entity::ComponentMap &components = entity->Components();
+    for (auto i = components.Begin(); i != components.End(); ++i)
+    {
+        if (i->second_->TypeId() == T::TypeIdStatic())
+            return static_cast<T*>(i->second_.Get());
+    }
+    return 0;
+}
+
 // Helper function for optimizing network transfer of position and orientation.
 void WriteOptimizedPosAndRot(kNet::DataSerializer &ds, int posSendType, const float3 &pos, int rotSendType, const float3x3 &rot)
 {
@@ -160,15 +199,283 @@ int DetectRotSendType(bool rotChanged, const float3x3 &rot)
         return 0;
 }
 
-bool SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp)
+// Quantization of the deltas of the delta-compressed rigid body stream. Deltas that fit neither bit width are sent as full floats.
+struct RigidBodyDeltaQuantization
+{
+    float step; ///< Quantization step
+    int smallBits; ///< Bits per component of a small delta
+    int largeBits; ///< Bits per component of a large delta
+};
+static const RigidBodyDeltaQuantization cPosDeltaQuantization = { 1.f / 256.f, 10, 18 }; // +-2 m and +-512 m
+static const RigidBodyDeltaQuantization cVelDeltaQuantization = { 1.f / 64.f, 9, 15 }; // +-4 m/s and +-256 m/s
+static const RigidBodyDeltaQuantization cAngVelDeltaQuantization = { 1.f / 128.f, 9, 13 }; // +-2 rad/s and +-32 rad/s
+
+static const int cRigidBodyDeltaMessageSizeBytes = 1400;
+static const int cMaxRigidBodyDeltaSizeBits = 480; // An update for a single rigid body can take at most this many bits. (conservative bound)
+
+// Send types of a delta-compressed rigid body field.
+enum RigidBodyDeltaSendType
+{
+    DeltaUnchanged = 0, // Same as the baseline
+    DeltaSmall,
+    DeltaLarge,
+    DeltaFull,
+    DeltaZero // Velocities only, exactly zero to put the body to rest.
+};
+
+// The delta of a rigid body state from its baseline, as detected by DetectRigidBodyDelta.
+struct RigidBodyDelta
+{
+    int posSendType;
+    int rotSendType; // As in DetectRotSendType
+    int scaleSendType; // 0 - unchanged, 1 - uniform, 2 - full
+    int velSendType;
+    int angVelSendType;
+    int pos[3];
+    int vel[3];
+    int angVel[3];
+    float3x3 rot;
+};
+
+// Helper function for the delta-compressed rigid body stream: quantizes @c delta and returns its send type.
+static int QuantizeDelta(const float3 &delta, const RigidBodyDeltaQuantization &quantization, int quantized[3])
+{
+    const float largeLimit = (float)(1 << (quantization.largeBits - 1));
+    int maxAbs = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        float value = delta[i] / quantization.step;
+        if (!(Abs(value) < largeLimit - 1.f)) // Also catches NaN
+            return DeltaFull;
+        quantized[i] = (int)floorf(value + 0.5f);
+        maxAbs = Max(maxAbs, Abs(quantized[i]));
+    }
+    return maxAbs < (1 << (quantization.smallBits - 1)) ? DeltaSmall : DeltaLarge;
+}
+
+// Helper function for the delta-compressed rigid body stream: returns the value the receiver reconstructs from a quantized delta.
+static float3 DequantizeDelta(const float3 &baseline, const RigidBodyDeltaQuantization &quantization, const int quantized[3])
+{
+    return baseline + float3((float)quantized[0], (float)quantized[1], (float)quantized[2]) * quantization.step;
+}
+
+static void WriteDeltaField(kNet::DataSerializer &ds, int sendType, const RigidBodyDeltaQuantization &quantization, const int quantized[3], const float3 &value)
+{
+    if (sendType == DeltaSmall || sendType == DeltaLarge)
+    {
+        const int bits = (sendType == DeltaSmall ? quantization.smallBits : quantization.largeBits);
+        for (int i = 0; i < 3; ++i)
+            ds.AppendBits((u32)(quantized[i] + (1 << (bits - 1))), bits);
+    }
+    else if (sendType == DeltaFull)
+    {
+        ds.Add<float>(value.x);
+        ds.Add<float>(value.y);
+        ds.Add<float>(value.z);
+    }
+}
+
+static float3 ReadDeltaField(kNet::DataDeserializer &dd, int sendType, const RigidBodyDeltaQuantization &quantization, const float3 &baseline)
+{
+    if (sendType == DeltaSmall || sendType == DeltaLarge)
+    {
+        const int bits = (sendType == DeltaSmall ? quantization.smallBits : quantization.largeBits);
+        int quantized[3];
+        for (int i = 0; i < 3; ++i)
+            quantized[i] = (int)dd.ReadBits(bits) - (1 << (bits - 1));
+        return DequantizeDelta(baseline, quantization, quantized);
+    }
+    else if (sendType == DeltaFull)
+    {
+        float3 value;
+        value.x = dd.Read<float>();
+        value.y = dd.Read<float>();
+        value.z = dd.Read<float>();
+        return value;
+    }
+    else if (sendType == DeltaZero)
+        return float3::zero;
+    return baseline;
+}
+
+// Helper function for the delta-compressed rigid body stream: detects the fields of @c state that differ from @c baseline
+// and how to send them. Returns false if nothing needs to be sent.
+static bool DetectRigidBodyDelta(const RigidBodySnapshot &baseline, const RigidBodySnapshot &state, RigidBodyDelta &delta)
+{
+    delta.posSendType = (state.pos.DistanceSq(baseline.pos) > 1e-3f ? QuantizeDelta(state.pos - baseline.pos, cPosDeltaQuantization, delta.pos) : DeltaUnchanged);
+
+    delta.rot = state.rot.ToFloat3x3();
+    delta.rotSendType = DetectRotSendType(Abs(state.rot.Dot(baseline.rot)) < 0.99999f, delta.rot); // Changed by more than about half a degree?
+
+    if (state.scale.DistanceSq(baseline.scale) > 1e-3f)
+    {
+        float3 s = state.scale.Abs();
+        delta.scaleSendType = (s.MaxElement() - s.MinElement() <= 1e-3f) ? 1 : 2; // Uniform scale only?
+    }
+    else
+        delta.scaleSendType = 0;
+
+    // A body coming to rest gets its velocities exactly zeroed, so that the client does not extrapolate it away.
+    if (state.linearVelocity.IsZero(1e-4f))
+        delta.velSendType = (baseline.linearVelocity.Equals(float3::zero) ? DeltaUnchanged : DeltaZero);
+    else
+        delta.velSendType = (state.linearVelocity.DistanceSq(baseline.linearVelocity) >= 1e-2f ? QuantizeDelta(state.linearVelocity - baseline.linearVelocity, cVelDeltaQuantization, delta.vel) : DeltaUnchanged);
+    if (state.angularVelocity.IsZero(1e-4f))
+        delta.angVelSendType = (baseline.angularVelocity.Equals(float3::zero) ? DeltaUnchanged : DeltaZero);
+    else
+        delta.angVelSendType = (state.angularVelocity.DistanceSq(baseline.angularVelocity) >= 1e-4f ? QuantizeDelta(state.angularVelocity - baseline.angularVelocity, cAngVelDeltaQuantization, delta.angVel) : DeltaUnchanged);
+
+    return delta.posSendType != DeltaUnchanged || delta.rotSendType != 0 || delta.scaleSendType != 0 ||
+        delta.velSendType != DeltaUnchanged || delta.angVelSendType != DeltaUnchanged;
+}
+
+// Helper function for the delta-compressed rigid body stream: writes @c delta of @c state from @c baseline,
+// and returns the state as the client reconstructs it.
+static RigidBodySnapshot WriteRigidBodyDelta(kNet::DataSerializer &ds, const RigidBodySnapshot &baseline, const RigidBodySnapshot &state, const RigidBodyDelta &delta)
+{
+    ds.AddArithmeticEncoded(11, delta.posSendType, 4, delta.rotSendType, 4, delta.scaleSendType, 3, delta.velSendType, 5, delta.angVelSendType, 5); // Sends fixed 11 bits.
+
+    RigidBodySnapshot sent = baseline;
+    WriteDeltaField(ds, delta.posSendType, cPosDeltaQuantization, delta.pos, state.pos);
+    if (delta.posSendType == DeltaSmall || delta.posSendType == DeltaLarge)
+        sent.pos = DequantizeDelta(baseline.pos, cPosDeltaQuantization, delta.pos);
+    else if (delta.posSendType == DeltaFull)
+        sent.pos = state.pos;
+
+    // Orientations are not delta-encoded, so the exact value is kept for comparing against later states.
+    WriteOptimizedPosAndRot(ds, 0, state.pos, delta.rotSendType, delta.rot);
+    if (delta.rotSendType != 0)
+        sent.rot = state.rot;
+
+    if (delta.scaleSendType == 1) // Sends fixed 32 bits.
+        ds.Add<float>(state.scale.x);
+    else if (delta.scaleSendType == 2) // Sends fixed 96 bits.
+    {
+        ds.Add<float>(state.scale.x);
+        ds.Add<float>(state.scale.y);
+        ds.Add<float>(state.scale.z);
+    }
+    if (delta.scaleSendType == 1)
+        sent.scale = float3::FromScalar(state.scale.x);
+    else if (delta.scaleSendType == 2)
+        sent.scale = state.scale;
+
+    WriteDeltaField(ds, delta.velSendType, cVelDeltaQuantization, delta.vel, state.linearVelocity);
+    if (delta.velSendType == DeltaSmall || delta.velSendType == DeltaLarge)
+        sent.linearVelocity = DequantizeDelta(baseline.linearVelocity, cVelDeltaQuantization, delta.vel);
+    else if (delta.velSendType == DeltaFull)
+        sent.linearVelocity = state.linearVelocity;
+    else if (delta.velSendType == DeltaZero)
+        sent.linearVelocity = float3::zero;
+
+    WriteDeltaField(ds, delta.angVelSendType, cAngVelDeltaQuantization, delta.angVel, state.angularVelocity);
+    if (delta.angVelSendType == DeltaSmall || delta.angVelSendType == DeltaLarge)
+        sent.angularVelocity = DequantizeDelta(baseline.angularVelocity, cAngVelDeltaQuantization, delta.angVel);
+    else if (delta.angVelSendType == DeltaFull)
+        sent.angularVelocity = state.angularVelocity;
+    else if (delta.angVelSendType == DeltaZero)
+        sent.angularVelocity = float3::zero;
+
+    return sent;
+}
+
+// Helper function for the delta-compressed rigid body stream: reads a state written by WriteRigidBodyDelta.
+static RigidBodySnapshot ReadRigidBodyDelta(kNet::DataDeserializer &dd, const RigidBodySnapshot &baseline)
+{
+    int posSendType;
+    int rotSendType;
+    int scaleSendType;
+    int velSendType;
+    int angVelSendType;
+    dd.ReadArithmeticEncoded(11, posSendType, 4, rotSendType, 4, scaleSendType, 3, velSendType, 5, angVelSendType, 5);
+
+    RigidBodySnapshot state = baseline;
+    state.pos = ReadDeltaField(dd, posSendType, cPosDeltaQuantization, baseline.pos);
+
+    float3 unusedPos;
+    ReadOptimizedPosAndRot(dd, 0, unusedPos, rotSendType, state.rot);
+
+    if (scaleSendType == 1)
+        state.scale = float3::FromScalar(dd.Read<float>());
+    else if (scaleSendType == 2)
+    {
+        state.scale.x = dd.Read<float>();
+        state.scale.y = dd.Read<float>();
+        state.scale.z = dd.Read<float>();
+    }
+
+    state.linearVelocity = ReadDeltaField(dd, velSendType, cVelDeltaQuantization, baseline.linearVelocity);
+    state.angularVelocity = ReadDeltaField(dd, angVelSendType, cAngVelDeltaQuantization, baseline.angularVelocity);
+    return state;
+}
+
+SerializedAttributesKey::SerializedAttributesKey(entity_id_t entityId_, component_id_t componentId_, u32 protocolVersion_, const u8 *dirtyAttributes_) :
+    entityId(entityId_),
+    componentId(componentId_),
+    protocolVersion(protocolVersion_),
+    fullUpdate(dirtyAttributes_ == 0)
+{
+    if (dirtyAttributes_)
+        memcpy(dirtyAttributes, dirtyAttributes_, sizeof(dirtyAttributes));
+    else
+        memset(dirtyAttributes, 0, sizeof(dirtyAttributes));
+}
+
+bool SerializedAttributesKey::operator < (const SerializedAttributesKey &rhs) const
+{
+    if (entityId != rhs.entityId)
+        return entityId < rhs.entityId;
+    if (componentId != rhs.componentId)
+        return componentId < rhs.componentId;
+    if (protocolVersion != rhs.protocolVersion)
+        return protocolVersion < rhs.protocolVersion;
+    if (fullUpdate != rhs.fullUpdate)
+        return fullUpdate < rhs.fullUpdate;
+    return memcmp(dirtyAttributes, rhs.dirtyAttributes, sizeof(dirtyAttributes)) < 0;
+}
+
+// Helper function for writing a component full update with the component's full attribute data.
+static void WriteComponentFullUpdate(kNet::DataSerializer& ds, IComponent *comp, const SerializedAttributes &attrData)
 {
     // Component identification
     ds.AddVLE<kNet::VLE8_16_32>(comp->Id() & UniqueIdGenerator::LAST_REPLICATED_ID);
     ds.AddVLE<kNet::VLE8_16_32>(comp->TypeId());
     ds.AddString(comp->Name().CString());
-    
+
+    // Add the attribute array to the main serializer
+    ds.AddVLE<kNet::VLE8_16_32>((u32)attrData.data.size());
+    if (!attrData.data.empty())
+        ds.AddArray<u8>(&attrData.data[0], (u32)attrData.data.size());
+}
+
+// Returns an upper bound for the size of a component full update written by WriteComponentFullUpdate.
+static size_t ComponentFullUpdateMaxBytes(IComponent *comp, const SerializedAttributes &attrData)
+{
+    return 4 * 4 + comp->Name().Length() + attrData.data.size(); // Component ID, type ID, name length and data size are at most 4 bytes each
+}
+
+const SerializedAttributes &SyncManager::CacheAttributeData(const SerializedAttributesKey &key, SerializedAttributes &attrData)
+{
+    Urho3D::MutexLock lock(attrDataCacheMutex_);
+    // If another thread serialized the same data meanwhile, keep the first one. Map nodes are stable, so the reference remains valid.
+    return attrDataCache_.insert(std::make_pair(key, std::move(attrData))).first->second;
+}
+
+const SerializedAttributes &SyncManager::FullAttributeData(IComponent *comp, u32 protocolVersion, SyncBuffers &buffers)
+{
+    Entity *entity = comp->ParentEntity();
+    SerializedAttributesKey key(entity ? entity->Id() : 0, comp->Id(), protocolVersion);
+    {
+        Urho3D::MutexLock lock(attrDataCacheMutex_);
+        auto existing = attrDataCache_.find(key);
+        if (existing != attrDataCache_.end())
+            return existing->second;
+    }
+
+    SerializedAttributes attrData;
+
     // Create a nested dataserializer for the attributes, so we can survive unknown or incompatible components
-    kNet::DataSerializer attrDs(attrDataBuffer_, NUMELEMS(attrDataBuffer_));
+    kNet::DataSerializer attrDs(buffers.attrData, NUMELEMS(buffers.attrData));
 
     // Static-structured attributes
     unsigned numStaticAttrs = comp->NumStaticAttributes();
@@ -188,16 +495,66 @@ bool SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPt
         }
     }
 
-    if (!ValidateAttributeBuffer(false, attrDs, comp))
-        return false;
-    
-    // Add the attribute array to the main serializer
-    ds.AddVLE<kNet::VLE8_16_32>((u32)attrDs.BytesFilled());
-    ds.AddArray<u8>((unsigned char*)attrDataBuffer_, (u32)attrDs.BytesFilled());
-    return true;
+    attrData.valid = ValidateAttributeBuffer(false, attrDs, comp);
+    if (attrData.valid)
+        attrData.data.assign((u8*)buffers.attrData, (u8*)buffers.attrData + attrDs.BytesFilled());
+    return CacheAttributeData(key, attrData);
 }
 
-bool SyncManager::ValidateAttributeBuffer(bool fatal, kNet::DataSerializer& ds, ComponentPtr &comp, size_t maxBytes)
+const SerializedAttributes &SyncManager::EditAttributeData(IComponent *comp, u32 protocolVersion, const u8 *dirtyAttributes, const std::vector<u8> &changedAttributes, SyncBuffers &buffers)
+{
+    Entity *entity = comp->ParentEntity();
+    SerializedAttributesKey key(entity ? entity->Id() : 0, comp->Id(), protocolVersion, dirtyAttributes);
+    {
+        Urho3D::MutexLock lock(attrDataCacheMutex_);
+        auto existing = attrDataCache_.find(key);
+        if (existing != attrDataCache_.end())
+            return existing->second;
+    }
+
+    SerializedAttributes attrData;
+    const AttributeVector& attrs = comp->Attributes();
+
+    // Create a nested dataserializer for the actual attribute data, so we can skip components
+    kNet::DataSerializer attrDataDs(buffers.attrData, NUMELEMS(buffers.attrData));
+
+    // There are changed attributes. Check if it is more optimal to send attribute indices, or the whole bitmask
+    unsigned bitsMethod1 = (unsigned)changedAttributes.size() * 8 + 8;
+    unsigned bitsMethod2 = (unsigned)attrs.Size();
+    // Method 1: indices
+    if (bitsMethod1 <= bitsMethod2)
+    {
+        attrDataDs.Add<kNet::bit>(0);
+        attrDataDs.Add<u8>((u8)changedAttributes.size());
+        for (unsigned i = 0; i < changedAttributes.size(); ++i)
+        {
+            attrDataDs.Add<u8>(changedAttributes[i]);
+            attrs[changedAttributes[i]]->ToBinary(attrDataDs);
+        }
+    }
+    // Method 2: bitmask
+    else
+    {
+        attrDataDs.Add<kNet::bit>(1);
+        for (unsigned i = 0; i < attrs.Size(); ++i)
+        {
+            if (dirtyAttributes[i >> 3] & (1 << (i & 7)))
+            {
+                attrDataDs.Add<kNet::bit>(1);
+                attrs[i]->ToBinary(attrDataDs);
+            }
+            else
+                attrDataDs.Add<kNet::bit>(0);
+        }
+    }
+
+    attrData.valid = ValidateAttributeBuffer(false, attrDataDs, comp);
+    if (attrData.valid)
+        attrData.data.assign((u8*)buffers.attrData, (u8*)buffers.attrData + attrDataDs.BytesFilled());
+    return CacheAttributeData(key, attrData);
+}
+
+bool SyncManager::ValidateAttributeBuffer(bool fatal, kNet::DataSerializer& ds, IComponent *comp, size_t maxBytes)
 {
     if (maxBytes == 0)
         maxBytes = oldAttrDataBufferSize;
@@ -238,9 +595,13 @@ SyncManager::SyncManager(TundraLogic* owner) :
     maxLinExtrapTime_(3.0f),
     noClientPhysicsHandoff_(false),
     componentTypeSender_(0),
+    messageSource_(0),
     prioUpdateAcc_(0.0),
     priorityUpdatePeriod_(1.f),
-    prioritizer_(0)
+    prioritizer_(0),
+    maxBytesPerSecond_(0),
+    relevanceRadius_(0.f),
+    receiveTimeBudget_(cDefaultReceiveTimeBudget)
 {
     if (framework_->HasCommandLineParameter("--interestManagement"))
     {
@@ -251,6 +612,18 @@ SyncManager::SyncManager(TundraLogic* owner) :
 
     if (framework_->HasCommandLineParameter("--noclientphysics"))
         noClientPhysicsHandoff_ = true;
+
+    StringVector bandwidthParam = framework_->CommandLineParameters("--netbandwidth");
+    if (!bandwidthParam.Empty())
+        SetMaxBytesPerSecond(Urho3D::ToUInt(bandwidthParam.Back()));
+
+    StringVector relevanceParam = framework_->CommandLineParameters("--netrelevanceradius");
+    if (!relevanceParam.Empty())
+        SetRelevanceRadius(Urho3D::ToFloat(relevanceParam.Back()));
+
+    StringVector receiveBudgetParam = framework_->CommandLineParameters("--netreceivebudget"); // Milliseconds
+    if (!receiveBudgetParam.Empty())
+        SetReceiveTimeBudget(Urho3D::ToFloat(receiveBudgetParam.Back()) / 1000.f);
     
     GetClientExtrapolationTime();
 
@@ -293,6 +666,183 @@ void SyncManager::SetPrioritizer(EntityPrioritizer *prioritizer)
 {
     SAFE_DELETE(prioritizer_);
     prioritizer_ =  prioritizer;
+    // The areas of interest are updated together with the priorities
+    if (!prioritizer_)
+        ResetAreasOfInterest();
+}
+
+void SyncManager::SetRelevanceRadius(float radius)
+{
+    if (!(radius > 0.f))
+        radius = 0.f;
+    if (radius == relevanceRadius_)
+        return;
+
+    relevanceRadius_ = radius;
+    // With cells the size of the radius, an area of interest query visits at most 3x3x3 cells
+    if (radius > 0.f)
+        spatialIndex_.SetCellSize(radius);
+    RebuildSpatialIndex();
+    if (radius == 0.f)
+        ResetAreasOfInterest();
+}
+
+void SyncManager::SetReceiveTimeBudget(float seconds)
+{
+    receiveTimeBudget_ = (seconds > 0.f ? seconds : 0.f);
+}
+
+void SyncManager::UpdateSpatialIndex(Entity *entity, bool updateChildren)
+{
+    if (!entity || entity->IsLocal())
+        return;
+    Placeable *placeable = ComponentNoRef<Placeable>(entity);
+    if (!placeable)
+    {
+        spatialIndex_.Remove(entity->Id());
+        return;
+    }
+    spatialIndex_.Update(entity->Id(), placeable->WorldPosition());
+
+    // The placeables attached to this one, either by entity parenting or parentRef, move along with it
+    if (updateChildren)
+    {
+        EntityVector children = placeable->Children();
+        for(unsigned i = 0; i < children.Size(); ++i)
+            UpdateSpatialIndex(children[i].Get(), true);
+    }
+}
+
+void SyncManager::RebuildSpatialIndex()
+{
+    spatialIndex_.Clear();
+    ScenePtr scene = scene_.Lock();
+    if (!scene || relevanceRadius_ <= 0.f || !owner_->IsServer())
+        return;
+
+    // Every entity is visited, so the children do not need to be updated along with their parents
+    for(auto i = scene->Begin(); i != scene->End(); ++i)
+        UpdateSpatialIndex(i->second_.Get(), false);
+}
+
+void SyncManager::UpdateAreaOfInterest(SceneSyncState *state)
+{
+    // The whole scene is replicated until the observer position is known
+    if (!state->observerPos.IsFinite())
+        return;
+    ScenePtr scene = scene_.Lock();
+    if (!scene)
+        return;
+
+    URHO3D_PROFILE(SyncManager_UpdateAreaOfInterest);
+
+    const float3 &observerPos = state->observerPos;
+    const float leaveRadius = relevanceRadius_ * cAreaOfInterestLeaveFactor;
+    const float leaveRadiusSq = leaveRadius * leaveRadius;
+
+    // Find the root entities that have left the area. On the first update the user has the whole scene, so check all its entities.
+    areaEntityIds_.Clear();
+    if (!state->areaOfInterestGrid)
+    {
+        for(auto i = state->entities.Begin(); i != state->entities.End(); ++i)
+            areaEntityIds_.Push(i->first_);
+        state->relevantEntities.Clear();
+        state->areaOfInterestGrid = &spatialIndex_;
+    }
+    else
+    {
+        for(auto i = state->relevantEntities.Begin(); i != state->relevantEntities.End(); ++i)
+            areaEntityIds_.Push(*i);
+    }
+    for(unsigned i = 0; i < areaEntityIds_.Size(); ++i)
+    {
+        const entity_id_t id = areaEntityIds_[i];
+        Entity *entity = scene->EntityById(id).Get();
+        // Removed entities, and entities that have been parented or lost their Placeable, are no longer tracked as root entities
+        if (!entity || entity->ParentEntity() || !spatialIndex_.Contains(id))
+        {
+            state->relevantEntities.Erase(id);
+            continue;
+        }
+        if (spatialIndex_.Position(id).DistanceSq(observerPos) <= leaveRadiusSq)
+            state->relevantEntities.Insert(id);
+        else
+        {
+            state->relevantEntities.Erase(id);
+            LeaveAreaOfInterest(state, entity);
+        }
+    }
+
+    // Add the root entities that have entered the area
+    areaEntityIds_.Clear();
+    spatialIndex_.Query(observerPos, relevanceRadius_, areaEntityIds_);
+    for(unsigned i = 0; i < areaEntityIds_.Size(); ++i)
+    {
+        const entity_id_t id = areaEntityIds_[i];
+        if (state->relevantEntities.Contains(id))
+            continue;
+        Entity *entity = scene->EntityById(id).Get();
+        if (!entity || entity->ParentEntity())
+            continue;
+        // If the removal of the entity has not been sent yet, let it enter on a later update
+        EntitySyncState *entityState = state->FindEntitySyncState(id);
+        if (entityState && entityState->removed)
+            continue;
+        state->relevantEntities.Insert(id);
+        EnterAreaOfInterest(state, entity);
+    }
+}
+
+void SyncManager::EnterAreaOfInterest(SceneSyncState *state, Entity *entity)
+{
+    if (entity->IsLocal())
+        return;
+    state->MarkEntityDirty(entity->Id());
+    for(uint i = 0; i < entity->NumChildren(); ++i)
+    {
+        EntityPtr child = entity->Child(i);
+        if (child)
+            EnterAreaOfInterest(state, child.Get());
+    }
+}
+
+void SyncManager::LeaveAreaOfInterest(SceneSyncState *state, Entity *entity)
+{
+    // The client removes the child entities together with the root, so just forget their states
+    for(uint i = 0; i < entity->NumChildren(); ++i)
+    {
+        EntityPtr child = entity->Child(i);
+        if (!child)
+            continue;
+        LeaveAreaOfInterest(state, child.Get());
+        state->RemoveFromQueue(child->Id());
+        state->entities.Erase(child->Id());
+    }
+    if (!entity->ParentEntity())
+        state->MarkEntityRemoved(entity->Id());
+}
+
+void SyncManager::ResetAreasOfInterest()
+{
+    ScenePtr scene = scene_.Lock();
+    if (!scene || !owner_->IsServer())
+        return;
+
+    UserConnectionList& users = owner_->Server()->UserConnections();
+    for(auto i = users.Begin(); i != users.End(); ++i)
+    {
+        SceneSyncState *state = (*i)->syncState.Get();
+        if (!state || !state->areaOfInterestGrid)
+            continue;
+        state->areaOfInterestGrid = 0;
+        state->relevantEntities.Clear();
+        for(auto j = scene->Begin(); j != scene->End(); ++j)
+        {
+            Entity *entity = j->second_.Get();
+            if (!entity->IsLocal() && !state->entities.Contains(entity->Id()))
+                state->MarkEntityDirty(entity->Id());
+        }
+    }
 }
 
 void SyncManager::GetClientExtrapolationTime()
@@ -309,6 +859,46 @@ void SyncManager::GetClientExtrapolationTime()
     }
 }
 
+void SyncManager::UpdateBandwidthBudget(UserConnection* user, SceneSyncState* state)
+{
+    state->bytesSent = 0;
+    state->deferredEntities = 0;
+    if (!maxBytesPerSecond_ || !owner_->IsServer())
+    {
+        state->bandwidthBudget = 0.f;
+        return;
+    }
+
+    const float maxBudget = (float)maxBytesPerSecond_;
+    if (state->bandwidthBudget <= 0.f)
+    {
+        state->bandwidthBudget = maxBudget;
+        state->byteQuota = 0.f;
+    }
+
+    // Let the baseline follow slowly upwards in case the route to the client changes
+    const float rtt = user->RoundTripTime();
+    if (rtt > 0.f)
+    {
+        if (state->minRoundTripTime <= 0.f || rtt < state->minRoundTripTime)
+            state->minRoundTripTime = rtt;
+        else
+            state->minRoundTripTime += (rtt - state->minRoundTripTime) * 0.01f;
+    }
+
+    // Back off multiplicatively on congestion, otherwise probe back up additively
+    const bool congested = user->NumOutboundMessagesPending() > cCongestedOutboundMessages ||
+        (rtt > 0.f && rtt > 2.f * state->minRoundTripTime + cCongestedRoundTripTimeSlack);
+    if (congested)
+        state->bandwidthBudget = Max(state->bandwidthBudget * cBandwidthBudgetDecrease, maxBudget * cMinBandwidthBudgetFraction);
+    else
+        state->bandwidthBudget = Min(state->bandwidthBudget + maxBudget * cBandwidthBudgetIncreaseFraction, maxBudget);
+
+    // Unused quota is kept for at most two ticks, so that an idle connection does not build up a burst
+    const float tickQuota = state->bandwidthBudget * updatePeriod_;
+    state->byteQuota = Min(state->byteQuota + tickQuota, 2.f * tickQuota);
+}
+
 SceneSyncState* SyncManager::SceneState(u32 connectionId) const
 {
     if (!owner_->IsServer())
@@ -347,6 +937,10 @@ void SyncManager::RegisterToScene(ScenePtr scene)
     serverConnection_->syncState->SetParentScene(SceneWeakPtr(scene));
     scene_.Reset();
     componentTypesFromServer_.clear();
+    attrDataCache_.clear();
+    journal_.Clear();
+    receiveQueue_.Clear();
+    spatialIndex_.Clear();
     
     if (!scene)
     {
@@ -366,6 +960,35 @@ void SyncManager::RegisterToScene(ScenePtr scene)
     sceneptr->ActionTriggered.Connect(this, &SyncManager::OnActionTriggered);
     sceneptr->EntityTemporaryStateToggled.Connect(this, &SyncManager::OnEntityPropertiesChanged);
     sceneptr->EntityParentChanged.Connect(this, &SyncManager::OnEntityParentChanged);
+
+    RebuildSpatialIndex();
+}
+
+// Returns whether @c messageId is a message handled by SyncManager.
+static bool IsSyncMessage(kNet::message_id_t messageId)
+{
+    switch(messageId)
+    {
+    case cObserverPositionMessage:
+    case cCreateEntityMessage:
+    case cCreateComponentsMessage:
+    case cCreateAttributesMessage:
+    case cEditAttributesMessage:
+    case cRemoveAttributesMessage:
+    case cRemoveComponentsMessage:
+    case cRemoveEntityMessage:
+    case cCreateEntityReplyMessage:
+    case cCreateComponentsReplyMessage:
+    case cRigidBodyUpdateMessage:
+    case cRigidBodyAckMessage:
+    case cEditEntityPropertiesMessage:
+    case cSetEntityParentMessage:
+    case cEntityActionMessage:
+    case cRegisterComponentTypeMessage:
+        return true;
+    default:
+        return false;
+    }
 }
 
 void SyncManager::HandleNetworkMessage(UserConnection* user, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char* data, size_t numBytes)
@@ -373,6 +996,30 @@ void SyncManager::HandleNetworkMessage(UserConnection* user, kNet::packet_id_t p
     if (!user || !scene_.Get())
         return;
 
+    // On the client, the messages are decoded in the work queue threads and applied in Update(), in the order they were received
+    if (!owner_->IsServer())
+    {
+        if (IsSyncMessage(messageId))
+            receiveQueue_.Push(messageId, packetId, user->ProtocolVersion(), data, numBytes);
+        return;
+    }
+
+    // On the server, keep the sender's sync state up to date with the journal while handling the message,
+    // so that the handlers can mark the changes made on behalf of the sender processed and not echo them back.
+    if (user->syncState)
+    {
+        journal_.CatchUp(*user->syncState);
+        messageSource_ = user;
+    }
+
+    DispatchNetworkMessage(user, packetId, messageId, data, numBytes);
+
+    messageSource_ = 0;
+}
+
+bool SyncManager::DispatchNetworkMessage(UserConnection* user, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char* data, size_t numBytes,
+    const ReceivedEntity *received)
+{
     try
     {
         switch(messageId)
@@ -381,16 +1028,16 @@ void SyncManager::HandleNetworkMessage(UserConnection* user, kNet::packet_id_t p
             HandleObserverPosition(user, data, numBytes);
             break;
         case cCreateEntityMessage:
-            HandleCreateEntity(user, data, numBytes);
+            HandleCreateEntity(user, data, numBytes, received);
             break;
         case cCreateComponentsMessage:
-            HandleCreateComponents(user, data, numBytes);
+            HandleCreateComponents(user, data, numBytes, received);
             break;
         case cCreateAttributesMessage:
             HandleCreateAttributes(user, data, numBytes);
             break;
         case cEditAttributesMessage:
-            HandleEditAttributes(user, data, numBytes);
+            HandleEditAttributes(user, data, numBytes, received);
             break;
         case cRemoveAttributesMessage:
             HandleRemoveAttributes(user, data, numBytes);
@@ -410,6 +1057,9 @@ void SyncManager::HandleNetworkMessage(UserConnection* user, kNet::packet_id_t p
         case cRigidBodyUpdateMessage:
             HandleRigidBodyChanges(user, packetId, data, numBytes);
             break;
+        case cRigidBodyAckMessage:
+            HandleRigidBodyAck(user, data, numBytes);
+            break;
         case cEditEntityPropertiesMessage:
             HandleEditEntityProperties(user, data, numBytes);
             break;
@@ -431,7 +1081,47 @@ void SyncManager::HandleNetworkMessage(UserConnection* user, kNet::packet_id_t p
     {
         LogError("Exception while handling scene sync network message " + String(messageId) + ": " + String(e.what()));
         user->Disconnect();
+        return false;
     }
+    return true;
+}
+
+void SyncManager::ApplyReceivedMessages()
+{
+    URHO3D_PROFILE(SyncManager_ApplyReceivedMessages);
+
+    receiveQueue_.StartDecode(GetSubsystem<Urho3D::WorkQueue>());
+
+    // At least one message is applied per frame, so that the queue always progresses
+    Urho3D::HiresTimer timer;
+    const long long budgetUSec = (long long)(receiveTimeBudget_ * 1000000.f);
+    while (ReceivedSyncMessage *msg = receiveQueue_.Front())
+    {
+        bool handled = msg->valid;
+        if (!handled)
+        {
+            LogError("Malformed scene sync network message " + String(msg->id) + " received from the server");
+            serverConnection_->Disconnect();
+        }
+        else
+            handled = DispatchNetworkMessage(serverConnection_.Get(), msg->packetId, msg->id, msg->data.empty() ? 0 : &msg->data[0], msg->data.size(), &msg->entity);
+        if (!handled)
+        {
+            // The connection is dropped, the rest of the messages would only apply on top of an incomplete state
+            receiveQueue_.Clear();
+            return;
+        }
+
+        receiveQueue_.Pop();
+        if (budgetUSec > 0 && timer.GetUSec(false) >= budgetUSec)
+            break;
+    }
+}
+
+void SyncManager::CatchUpMessageSource()
+{
+    if (messageSource_ && messageSource_->syncState)
+        journal_.CatchUp(*messageSource_->syncState);
 }
 
 void SyncManager::NewUserConnected(const UserConnectionPtr &user)
@@ -454,6 +1144,8 @@ void SyncManager::NewUserConnected(const UserConnectionPtr &user)
     // Mark all entities in the sync state as new so we will send them
     user->syncState = SharedPtr<SceneSyncState>(new SceneSyncState(user->ConnectionId(), owner_->IsServer()));
     user->syncState->SetParentScene(scene_);
+    // The full scene state is marked dirty below, so the changes already in the journal are not needed.
+    user->syncState->journalCursor = journal_.Head();
 
     if (owner_->IsServer())
         SceneStateCreated.Emit(user.Get(), user->syncState.Get());
@@ -468,7 +1160,7 @@ void SyncManager::NewUserConnected(const UserConnectionPtr &user)
         if (prioritizer_)
         {
             // MarkEntityDirty() above has created a proper sync state for the entity.
-            prioritizer_->ComputeSyncPriorities(user->syncState->entities[entity->Id()], user->syncState->observerPos, user->syncState->observerRot);
+            prioritizer_->ComputeSyncPriorities(user->syncState->GetOrCreateEntitySyncState(entity->Id()), user->syncState->observerPos, user->syncState->observerRot);
         }
     }
 }
@@ -480,6 +1172,10 @@ void SyncManager::OnAttributeChanged(IComponent* comp, IAttribute* attr, Attribu
         return;
 
     bool isServer = owner_->IsServer();
+
+    // Keep the spatial index up to date with all transform changes, including the ones that are not replicated as attribute changes
+    if (isServer && relevanceRadius_ > 0.f && comp->TypeId() == Placeable::TypeIdStatic())
+        UpdateSpatialIndex(comp->ParentEntity());
     
     // Client: Check for stopping interpolation, if we change a currently interpolating variable ourselves
     if (!isServer) // Since the server never interpolates attributes, we don't need to do this check on the server at all.
@@ -503,12 +1199,10 @@ void SyncManager::OnAttributeChanged(IComponent* comp, IAttribute* attr, Attribu
     
     if (isServer)
     {
-        // For each client connected to this server, mark this attribute dirty, so it will be updated to the
-        // clients on the next network sync iteration.
-        UserConnectionList& users = owner_->Server()->UserConnections();
-        for(auto i = users.Begin(); i != users.End(); ++i)
-            if ((*i)->syncState)
-                (*i)->syncState->MarkAttributeDirty(entity->Id(), comp->Id(), attr->Index());
+        // Record the change once to the journal. All clients connected to this server will mark the attribute dirty
+        // from the journal, so it will be updated to the clients on the next network sync iteration.
+        journal_.RecordAttributeChange(SceneChangeJournal::AttributesChanged, entity->Id(), comp->Id(), attr->Index());
+        CatchUpMessageSource();
     }
     else
     {
@@ -537,9 +1231,8 @@ void SyncManager::OnAttributeAdded(IComponent* comp, IAttribute* attr, Attribute
     
     if (isServer)
     {
-        UserConnectionList& users = owner_->Server()->UserConnections();
-        for(auto i = users.Begin(); i != users.End(); ++i)
-            if ((*i)->syncState) (*i)->syncState->MarkAttributeCreated(entity->Id(), comp->Id(), attr->Index());
+        journal_.RecordAttributeChange(SceneChangeJournal::AttributeAdded, entity->Id(), comp->Id(), attr->Index());
+        CatchUpMessageSource();
     }
     else
     {
@@ -566,9 +1259,8 @@ void SyncManager::OnAttributeRemoved(IComponent* comp, IAttribute* attr, Attribu
     
     if (isServer)
     {
-        UserConnectionList& users = owner_->Server()->UserConnections();
-        for(auto i = users.Begin(); i != users.End(); ++i)
-            if ((*i)->syncState) (*i)->syncState->MarkAttributeRemoved(entity->Id(), comp->Id(), attr->Index());
+        journal_.RecordAttributeChange(SceneChangeJournal::AttributeRemoved, entity->Id(), comp->Id(), attr->Index());
+        CatchUpMessageSource();
     }
     else
     {
@@ -582,6 +1274,9 @@ void SyncManager::OnComponentAdded(Entity* entity, IComponent* comp, AttributeCh
     if (!entity || !comp)
         return;
 
+    if (relevanceRadius_ > 0.f && comp->TypeId() == Placeable::TypeIdStatic() && owner_->IsServer())
+        UpdateSpatialIndex(entity);
+
     if ((change != AttributeChange::Replicate) || (comp->IsLocal()))
         return;
     if (entity->IsLocal())
@@ -589,9 +1284,8 @@ void SyncManager::OnComponentAdded(Entity* entity, IComponent* comp, AttributeCh
     
     if (owner_->IsServer())
     {
-        UserConnectionList& users = owner_->Server()->UserConnections();
-        for(auto i = users.Begin(); i != users.End(); ++i)
-            if ((*i)->syncState) (*i)->syncState->MarkComponentDirty(entity->Id(), comp->Id());
+        journal_.RecordComponentChange(SceneChangeJournal::ComponentAdded, entity->Id(), comp->Id());
+        CatchUpMessageSource();
     }
     else
     {
@@ -604,6 +1298,10 @@ void SyncManager::OnComponentRemoved(Entity* entity, IComponent* comp, Attribute
     assert(entity && comp);
     if (!entity || !comp)
         return;
+
+    if (comp->TypeId() == Placeable::TypeIdStatic())
+        spatialIndex_.Remove(entity->Id());
+
     if ((change != AttributeChange::Replicate) || (comp->IsLocal()))
         return;
     if (entity->IsLocal())
@@ -611,9 +1309,8 @@ void SyncManager::OnComponentRemoved(Entity* entity, IComponent* comp, Attribute
     
     if (owner_->IsServer())
     {
-        UserConnectionList& users = owner_->Server()->UserConnections();
-        for(auto i = users.Begin(); i != users.End(); ++i)
-            if ((*i)->syncState) (*i)->syncState->MarkComponentRemoved(entity->Id(), comp->Id());
+        journal_.RecordComponentChange(SceneChangeJournal::ComponentRemoved, entity->Id(), comp->Id());
+        CatchUpMessageSource();
     }
     else
     {
@@ -626,24 +1323,17 @@ void SyncManager::OnEntityCreated(Entity* entity, AttributeChange::Type change)
     assert(entity);
     if (!entity)
         return;
+
+    if (relevanceRadius_ > 0.f && owner_->IsServer())
+        UpdateSpatialIndex(entity);
+
     if ((change != AttributeChange::Replicate) || (entity->IsLocal()))
         return;
 
     if (owner_->IsServer())
     {
-        UserConnectionList& users = owner_->Server()->UserConnections();
-        for(auto i = users.Begin(); i != users.End(); ++i)
-        {
-            if ((*i)->syncState)
-            {
-                (*i)->syncState->MarkEntityDirty(entity->Id());
-                if ((*i)->syncState->entities[entity->Id()].removed)
-                {
-                    LogWarning("An entity with ID " + String(entity->Id()) + " is queued to be deleted, but a new entity \"" + 
-                        entity->Name() + "\" is to be added to the scene!");
-                }
-            }
-        }
+        journal_.RecordEntityChange(SceneChangeJournal::EntityCreated, entity->Id());
+        CatchUpMessageSource();
     }
     else
     {
@@ -656,6 +1346,9 @@ void SyncManager::OnEntityRemoved(Entity* entity, AttributeChange::Type change)
     assert(entity);
     if (!entity)
         return;
+
+    spatialIndex_.Remove(entity->Id());
+
     if (change != AttributeChange::Replicate)
         return;
     if (entity->IsLocal())
@@ -663,9 +1356,8 @@ void SyncManager::OnEntityRemoved(Entity* entity, AttributeChange::Type change)
     
     if (owner_->IsServer())
     {
-        UserConnectionList& users = owner_->Server()->UserConnections();
-        for(auto i = users.Begin(); i != users.End(); ++i)
-            if ((*i)->syncState) (*i)->syncState->MarkEntityRemoved(entity->Id());
+        journal_.RecordEntityChange(SceneChangeJournal::EntityRemoved, entity->Id());
+        CatchUpMessageSource();
     }
     else
     {
@@ -746,12 +1438,8 @@ void SyncManager::OnEntityPropertiesChanged(Entity* entity, AttributeChange::Typ
 
     if (owner_->IsServer())
     {
-        UserConnectionList& users = owner_->Server()->UserConnections();
-        for(auto i = users.Begin(); i != users.End(); ++i)
-        {
-            if ((*i)->syncState)
-                (*i)->syncState->MarkEntityDirty(entity->Id(), true);
-        }
+        journal_.RecordEntityChange(SceneChangeJournal::EntityPropertiesChanged, entity->Id());
+        CatchUpMessageSource();
     }
     else
     {
@@ -764,6 +1452,11 @@ void SyncManager::OnEntityParentChanged(Entity* entity, Entity* newParent, Attri
     assert(entity);
     if (!entity)
         return;
+
+    // Reparenting changes the world positions of the entity and its children
+    if (relevanceRadius_ > 0.f && owner_->IsServer())
+        UpdateSpatialIndex(entity);
+
     if ((change != AttributeChange::Replicate) || (entity->IsLocal()))
         return;
     if (newParent && newParent->IsLocal())
@@ -774,12 +1467,8 @@ void SyncManager::OnEntityParentChanged(Entity* entity, Entity* newParent, Attri
 
     if (owner_->IsServer())
     {
-        UserConnectionList& users = owner_->Server()->UserConnections();
-        for(auto i = users.Begin(); i != users.End(); ++i)
-        {
-            if ((*i)->syncState)
-                (*i)->syncState->MarkEntityDirty(entity->Id(), false, true);
-        }
+        journal_.RecordEntityChange(SceneChangeJournal::EntityParentChanged, entity->Id());
+        CatchUpMessageSource();
     }
     else
     {
@@ -986,9 +1675,12 @@ void SyncManager::Update(float frametime)
 {
     URHO3D_PROFILE(SyncManager_Update);
 
-    // For the client, smoothly update all rigid bodies by interpolating.
+    // For the client, apply the received changes and smoothly update all rigid bodies by interpolating.
     if (!owner_->IsServer())
+    {
+        ApplyReceivedMessages();
         InterpolateRigidBodies(frametime, serverConnection_->syncState.Get());
+    }
 
     // Check if it is yet time to perform a network update tick.
     updateAcc_ += frametime;
@@ -998,6 +1690,9 @@ void SyncManager::Update(float frametime)
 
     // If multiple updates passed, update still just once.
     updateAcc_ = fmod(updateAcc_, updatePeriod_);
+
+    // Attribute values may have changed since the last tick, forget the previously serialized data.
+    attrDataCache_.clear();
     
     ScenePtr scene = scene_.Lock();
     if (!scene)
@@ -1009,133 +1704,230 @@ void SyncManager::Update(float frametime)
         // SyncState is not added to the user before it's authenticated, so using UserConnections() instead of
         // AuthenticatedUsers() and checking for SyncState's existence does the same thing in a little more efficient fashion.
         UserConnectionList& users = owner_->Server()->UserConnections();
+        /// @todo Do priority update independently from regular sync update.
+        const bool updatePriorities = (prioritizer_ && prioUpdateAcc_ >= priorityUpdatePeriod_);
+        if (updatePriorities)
+            prioUpdateAcc_ = fmod(prioUpdateAcc_, priorityUpdatePeriod_);
+        syncUsers_.Clear();
         for(auto i = users.Begin(); i != users.End(); ++i)
         {
             SceneSyncState *syncState = (*i)->syncState.Get();
             if (syncState)
             {
-                // First sort the dirty queue according to priority if IM enabled
-                if (prioritizer_) /**< @todo Move all code in this block behind EntityPrioritizer? */
+                // Mark the changes recorded since the last tick dirty. This may emit the state's change request signals,
+                // and the prioritizer takes references to the scene's components, so both are done here in the main thread.
+                journal_.CatchUp(*syncState);
+
+                if (updatePriorities) /**< @todo Move all code in this block behind EntityPrioritizer? */
                 {
-                    /// @todo Do priority update independently from regular sync update.
-                    if (prioUpdateAcc_ >= priorityUpdatePeriod_)
-                    {
-                        prioUpdateAcc_ = fmod(prioUpdateAcc_, priorityUpdatePeriod_);
-                        if (prioritizer_)
-                            prioritizer_->ComputeSyncPriorities(syncState->entities, syncState->observerPos, syncState->observerRot);
-                    }
-                    URHO3D_PROFILE(SyncManager_Update_SortDirtyQueue);
-                    syncState->dirtyQueue.sort();
+                    // Limit the state to the observer's area of interest first, so that priorities are computed only for the nearby entities
+                    if (relevanceRadius_ > 0.f)
+                        UpdateAreaOfInterest(syncState);
+                    prioritizer_->ComputeSyncPriorities(syncState->entities, syncState->observerPos, syncState->observerRot);
+                    syncState->RefreshUpdateIntervals(updatePeriod_);
                 }
 
-                // Then send out all changes to rigid bodies.
-                // After processing this function, the bits related to rigid body states have been cleared,
-                // so the generic sync will not double-replicate the rigid body positions and velocities.
-                /// @note As of now only native clients understand the optimized rigid body sync message.
-                /// This may change with future protocol versions
-                if (dynamic_cast<KNetUserConnection*>(i->Get()) || (*i)->protocolVersion >= ProtocolWebClientRigidBodyMessage)
-                    ReplicateRigidBodyChanges((*i).Get());
-                // Finally send out changes to other attributes via the generic sync mechanism.
-                ProcessSyncState((*i).Get());
-            }
-        }
+                UpdateBandwidthBudget((*i).Get(), syncState);
+                syncUsers_.Push((*i).Get());
+            }
+        }
+
+        ProcessUserSyncStates();
+
+        // Drop the changes that all states have replayed
+        u32 replayed = journal_.Head();
+        for(auto i = users.Begin(); i != users.End(); ++i)
+        {
+            SceneSyncState *syncState = (*i)->syncState.Get();
+            if (syncState && syncState->journalCursor - journal_.Tail() < replayed - journal_.Tail())
+                replayed = syncState->journalCursor;
+        }
+        journal_.Trim(replayed);
+    }
+    else
+    {
+        // If we are client and the connection is current, process just the server sync state
+        if (Urho3D::StaticCast<KNetUserConnection>(serverConnection_)->connection)
+        {
+            UpdateBandwidthBudget(serverConnection_.Get(), serverConnection_->syncState.Get());
+            if (syncBuffers_.empty())
+                syncBuffers_.resize(1);
+            ProcessSyncState(serverConnection_.Get(), syncBuffers_[0], serverConnection_->bytesSent);
+            SendRigidBodyAck(serverConnection_.Get(), serverConnection_->syncState.Get());
+            if (prioritizer_ && prioUpdateAcc_ >= priorityUpdatePeriod_)
+            {
+                prioUpdateAcc_ = fmod(prioUpdateAcc_, priorityUpdatePeriod_);
+                SendObserverPosition(serverConnection_.Get(), serverConnection_->syncState.Get());
+            }
+        }
+    }
+}
+
+void SyncManager::ProcessUserSyncStates()
+{
+    URHO3D_PROFILE(SyncManager_ProcessUserSyncStates);
+
+    Urho3D::WorkQueue *workQueue = GetSubsystem<Urho3D::WorkQueue>();
+    const unsigned numThreads = (workQueue ? workQueue->GetNumThreads() : 0) + 1;
+    if (syncBuffers_.size() < numThreads)
+        syncBuffers_.resize(numThreads);
+
+    if (numThreads == 1 || syncUsers_.Size() < 2)
+    {
+        for (unsigned i = 0; i < syncUsers_.Size(); ++i)
+            ProcessUserSyncState(syncUsers_[i], syncBuffers_[0]);
+        return;
+    }
+
+    // The connections collect their messages while the workers run, and they are queued to the network here in the main thread
+    for (unsigned i = 0; i < syncUsers_.Size(); ++i)
+    {
+        syncUsers_[i]->BeginDeferredSend();
+
+        SharedPtr<Urho3D::WorkItem> item(new Urho3D::WorkItem());
+        item->workFunction_ = &SyncManager::ProcessUserSyncStateWork;
+        item->start_ = syncUsers_[i];
+        item->aux_ = this;
+        item->priority_ = Urho3D::M_MAX_UNSIGNED;
+        workQueue->AddWorkItem(item);
+    }
+    workQueue->Complete(Urho3D::M_MAX_UNSIGNED);
+
+    for (unsigned i = 0; i < syncUsers_.Size(); ++i)
+        syncUsers_[i]->FlushDeferredSend();
+}
+
+void SyncManager::ProcessUserSyncStateWork(const Urho3D::WorkItem* item, unsigned threadIndex)
+{
+    SyncManager *syncManager = static_cast<SyncManager*>(item->aux_);
+    UserConnection *user = static_cast<UserConnection*>(item->start_);
+    syncManager->ProcessUserSyncState(user, syncManager->syncBuffers_[threadIndex]);
+}
+
+void SyncManager::ProcessUserSyncState(UserConnection* user, SyncBuffers &buffers)
+{
+    SceneSyncState *syncState = user->syncState.Get();
+
+    // Move the entities whose update interval has elapsed to the dirty queue. Without interest management all entities are due.
+    syncState->ReleaseDueEntities(prioritizer_ ? kNet::Clock::Tick() : ~(kNet::tick_t)0);
+
+    // Then sort the dirty queue according to priority if IM enabled
+    if (prioritizer_)
+    {
+        URHO3D_PROFILE(SyncManager_Update_SortDirtyQueue);
+        syncState->dirtyQueue.SortByPriority();
     }
-    else
+
+    // Bytes sent for the rigid body stream count against the bandwidth budget of the generic sync
+    const unsigned long long tickStartBytes = user->bytesSent;
+
+    // Then send out all changes to rigid bodies.
+    // After processing this function, the bits related to rigid body states have been cleared,
+    // so the generic sync will not double-replicate the rigid body positions and velocities.
+    /// @note As of now only native clients understand the optimized rigid body sync message.
+    /// This may change with future protocol versions
+    if (dynamic_cast<KNetUserConnection*>(user) || user->protocolVersion >= ProtocolWebClientRigidBodyMessage)
+        ReplicateRigidBodyChanges(user);
+    // Finally send out changes to other attributes via the generic sync mechanism.
+    ProcessSyncState(user, buffers, tickStartBytes);
+}
+
+// Helper function for the rigid body stream: clears the dirty bits of the Placeable transform and the RigidBody velocities in @c ess,
+// so that the generic sync does not replicate them again, and returns which of them were set. Returns whether the RigidBody
+// velocities are replicated by the stream, ie. the RigidBody exists on the client.
+static bool ConsumeRigidBodyDirtyBits(EntitySyncState &ess, Placeable *placeable, RigidBody *rigidBody, bool &transformDirty, bool &velocityDirty, bool &angularVelocityDirty)
+{
+    transformDirty = false;
+    velocityDirty = false;
+    angularVelocityDirty = false;
+
+    ComponentSyncState *placeableComp = ess.components.Find(placeable->Id());
+    if (placeableComp)
     {
-        // If we are client and the connection is current, process just the server sync state
-        if (Urho3D::StaticCast<KNetUserConnection>(serverConnection_)->connection)
+        ComponentSyncState &pss = *placeableComp;
+        if (!pss.isNew && !pss.removed) // Newly created and deleted components are handled through the traditional sync mechanism.
         {
-            ProcessSyncState(serverConnection_.Get());
-            if (prioritizer_ && prioUpdateAcc_ >= priorityUpdatePeriod_)
-            {
-                prioUpdateAcc_ = fmod(prioUpdateAcc_, priorityUpdatePeriod_);
-                SendObserverPosition(serverConnection_.Get(), serverConnection_->syncState.Get());
-            }
+            transformDirty = (pss.dirtyAttributes[0] & 1) != 0; // The Transform of an EC_Placeable is the first attibute in the component.
+            pss.dirtyAttributes[0] &= ~1;
         }
     }
+
+    ComponentSyncState *rigidBodyComp = (rigidBody ? ess.components.Find(rigidBody->Id()) : 0);
+    if (!rigidBodyComp)
+        return false;
+    ComponentSyncState &rss = *rigidBodyComp;
+    if (rss.isNew || rss.removed) // Newly created and deleted components are handled through the traditional sync mechanism.
+        return false;
+
+    velocityDirty = (rss.dirtyAttributes[1] & (1 << 5)) != 0;
+    angularVelocityDirty = (rss.dirtyAttributes[1] & (1 << 6)) != 0;
+
+    rss.dirtyAttributes[1] &= ~(1 << 5);
+    rss.dirtyAttributes[1] &= ~(1 << 6);
+    return true;
 }
 
 void SyncManager::ReplicateRigidBodyChanges(UserConnection* user)
 {
     URHO3D_PROFILE(SyncManager_ReplicateRigidBodyChanges);
     
-    ScenePtr scene = scene_.Lock();
-    if (!scene)
+    if (scene_.Expired())
         return;
 
+    if (user->ProtocolVersion() >= ProtocolRigidBodyDelta)
+    {
+        ReplicateRigidBodyDeltas(user);
+        return;
+    }
+
     const int maxMessageSizeBytes = 1400;
-    kNet::DataSerializer ds(maxMessageSizeBytes);
+    kNet::DataSerializer ds(user->StartMessage(cRigidBodyUpdateMessage, maxMessageSizeBytes), maxMessageSizeBytes);
     bool msgReliable = false;
     SceneSyncState* state = user->syncState.Get();
 
-    /// \todo In interest management mode, this doesn't skip entities that shouldn't be updated according to their priority-based interval
-    for (std::list<EntitySyncState*>::iterator it = state->dirtyQueue.begin(); it != state->dirtyQueue.end(); ++it)
+    // In interest management mode, the dirty queue holds only the entities whose priority-based update interval has elapsed
+    for (EntitySyncState *it = state->dirtyQueue.Front(); it; it = it->nextDirty)
     {
         const int maxRigidBodyMessageSizeBits = 350; // An update for a single rigid body can take at most this many bits. (conservative bound)
         // If we filled up this message, send it out and start crafting anothero one.
         if (maxMessageSizeBytes * 8 - (int)ds.BitsFilled() <= maxRigidBodyMessageSizeBits)
         {
-            user->Send(cRigidBodyUpdateMessage, msgReliable, true, ds);
-            ds = kNet::DataSerializer(maxMessageSizeBytes);
+            user->EndMessage(ds.BytesFilled(), msgReliable, true);
+            ds = kNet::DataSerializer(user->StartMessage(cRigidBodyUpdateMessage, maxMessageSizeBytes), maxMessageSizeBytes);
             msgReliable = false;
         }
 
-        EntitySyncState &ess = *(*it);
+        EntitySyncState &ess = *it;
 
         if (ess.isNew || ess.removed)
             continue; // Newly created and removed entities are handled through the traditional sync mechanism.
 
-        EntityPtr e = ess.weak.Lock();
-        SharedPtr<Placeable> placeable = (e.Get() ? e->Component<Placeable>() : SharedPtr<Placeable>());
-        if (!placeable.Get())
+        Entity *e = ess.weak.Get();
+        Placeable *placeable = (e ? ComponentNoRef<Placeable>(e) : 0);
+        if (!placeable)
             continue;
 
-        std::map<component_id_t, ComponentSyncState>::iterator placeableComp = ess.components.find(placeable->Id());
+        bool transformDirty;
+        bool velocityDirty;
+        bool angularVelocityDirty;
 
-        bool transformDirty = false;
-        if (placeableComp != ess.components.end())
+        RigidBody *rigidBody = ComponentNoRef<RigidBody>(e);
+        if (ConsumeRigidBodyDirtyBits(ess, placeable, rigidBody, transformDirty, velocityDirty, angularVelocityDirty))
         {
-            ComponentSyncState &pss = placeableComp->second;
-            if (!pss.isNew && !pss.removed) // Newly created and deleted components are handled through the traditional sync mechanism.
+            velocityDirty = velocityDirty && (rigidBody->linearVelocity.Get().DistanceSq(ess.linearVelocity) >= 1e-2f);
+            angularVelocityDirty = angularVelocityDirty && (rigidBody->angularVelocity.Get().DistanceSq(ess.angularVelocity) >= 1e-1f);
+
+            // If the object enters rest, force an update, and force the update to be sent as reliable, so that the client
+            // is guaranteed to receive the message, and will put the object to rest, instead of extrapolating it away indefinitely.
+            if (rigidBody->linearVelocity.Get().IsZero(1e-4f) && !ess.linearVelocity.IsZero(1e-4f))
             {
-                transformDirty = (pss.dirtyAttributes[0] & 1) != 0; // The Transform of an EC_Placeable is the first attibute in the component.
-                pss.dirtyAttributes[0] &= ~1;
+                velocityDirty = true;
+                msgReliable = true;
             }
-        }
-        bool velocityDirty = false;
-        bool angularVelocityDirty = false;
-        
-        SharedPtr<RigidBody> rigidBody = e->Component<RigidBody>();
-        if (rigidBody)
-        {
-            std::map<component_id_t, ComponentSyncState>::iterator rigidBodyComp = ess.components.find(rigidBody->Id());
-            if (rigidBodyComp != ess.components.end())
+            if (rigidBody->angularVelocity.Get().IsZero(1e-4f) && !ess.angularVelocity.IsZero(1e-4f))
             {
-                ComponentSyncState &rss = rigidBodyComp->second;
-                if (!rss.isNew && !rss.removed) // Newly created and deleted components are handled through the traditional sync mechanism.
-                {
-                    velocityDirty = (rss.dirtyAttributes[1] & (1 << 5)) != 0;
-                    angularVelocityDirty = (rss.dirtyAttributes[1] & (1 << 6)) != 0;
-
-                    rss.dirtyAttributes[1] &= ~(1 << 5);
-                    rss.dirtyAttributes[1] &= ~(1 << 6);
-
-                    velocityDirty = velocityDirty && (rigidBody->linearVelocity.Get().DistanceSq(ess.linearVelocity) >= 1e-2f);
-                    angularVelocityDirty = angularVelocityDirty && (rigidBody->angularVelocity.Get().DistanceSq(ess.angularVelocity) >= 1e-1f);
-
-                    // If the object enters rest, force an update, and force the update to be sent as reliable, so that the client
-                    // is guaranteed to receive the message, and will put the object to rest, instead of extrapolating it away indefinitely.
-                    if (rigidBody->linearVelocity.Get().IsZero(1e-4f) && !ess.linearVelocity.IsZero(1e-4f))
-                    {
-                        velocityDirty = true;
-                        msgReliable = true;
-                    }
-                    if (rigidBody->angularVelocity.Get().IsZero(1e-4f) && !ess.angularVelocity.IsZero(1e-4f))
-                    {
-                        angularVelocityDirty = true;
-                        msgReliable = true;
-                    }
-                }
+                angularVelocityDirty = true;
+                msgReliable = true;
             }
         }
 
@@ -1244,11 +2036,137 @@ void SyncManager::ReplicateRigidBodyChanges(UserConnection* user)
         ess.lastNetworkSendTime = kNet::Clock::Tick();
     }
     if (ds.BytesFilled() > 0)
-        user->Send(cRigidBodyUpdateMessage, msgReliable, true, ds);
+        user->EndMessage(ds.BytesFilled(), msgReliable, true);
+    else
+        user->AbortMessage();
+}
+
+void SyncManager::ReplicateRigidBodyDeltas(UserConnection* user)
+{
+    SceneSyncState* state = user->syncState.Get();
+    kNet::DataSerializer ds(user->StartMessage(cRigidBodyUpdateMessage, cRigidBodyDeltaMessageSizeBytes), cRigidBodyDeltaMessageSizeBytes);
+    RigidBodyPacketRecord *record = 0;
+    const kNet::tick_t now = kNet::Clock::Tick();
+
+    // In interest management mode, the dirty queue holds only the entities whose priority-based update interval has elapsed
+    for (EntitySyncState *it = state->dirtyQueue.Front(); it; it = it->nextDirty)
+    {
+        EntitySyncState &ess = *it;
+        if (ess.isNew || ess.removed)
+            continue; // Newly created and removed entities are handled through the traditional sync mechanism.
+
+        Entity *e = ess.weak.Get();
+        Placeable *placeable = (e ? ComponentNoRef<Placeable>(e) : 0);
+        if (!placeable)
+            continue;
+
+        bool transformDirty;
+        bool velocityDirty;
+        bool angularVelocityDirty;
+        RigidBody *rigidBody = ComponentNoRef<RigidBody>(e);
+        if (!ConsumeRigidBodyDirtyBits(ess, placeable, rigidBody, transformDirty, velocityDirty, angularVelocityDirty))
+            rigidBody = 0;
+        if (transformDirty || velocityDirty || angularVelocityDirty)
+            WriteRigidBodyUpdate(user, ess, placeable, rigidBody, ds, record, now);
+    }
+
+    // Repeat the bodies that have come to rest, until the client has acknowledged them at rest
+    for (auto i = state->restingRigidBodies.Begin(); i != state->restingRigidBodies.End();)
+    {
+        EntitySyncState *ess = state->FindEntitySyncState(*i);
+        Entity *e = (ess && !ess->isNew && !ess->removed ? ess->weak.Get() : 0);
+        Placeable *placeable = (e ? ComponentNoRef<Placeable>(e) : 0);
+        bool resting = (placeable && ess->rigidBodyRestSends > 0);
+        if (resting && ess->lastNetworkSendTime != now) // Not sent already on this tick
+            resting = WriteRigidBodyUpdate(user, *ess, placeable, ComponentNoRef<RigidBody>(e), ds, record, now) && ess->rigidBodyRestSends > 0;
+        if (resting)
+            ++i;
+        else
+            i = state->restingRigidBodies.Erase(i);
+    }
+
+    if (record)
+        user->EndMessage(ds.BytesFilled(), false, true);
+    else
+        user->AbortMessage();
+}
+
+bool SyncManager::WriteRigidBodyUpdate(UserConnection* user, EntitySyncState &ess, Placeable *placeable, RigidBody *rigidBody,
+    kNet::DataSerializer &ds, RigidBodyPacketRecord *&record, kNet::tick_t now)
+{
+    SceneSyncState* state = user->syncState.Get();
+
+    const Transform &t = placeable->transform.Get();
+    RigidBodySnapshot current;
+    current.pos = t.pos;
+    current.rot = t.Orientation();
+    current.scale = t.scale;
+    if (rigidBody)
+    {
+        current.linearVelocity = rigidBody->linearVelocity.Get();
+        current.angularVelocity = DegToRad(rigidBody->angularVelocity.Get());
+    }
+
+    // If this message is full, the update goes to the next one
+    const bool messageFull = record && cRigidBodyDeltaMessageSizeBytes * 8 - (int)ds.BitsFilled() <= cMaxRigidBodyDeltaSizeBits;
+    const u16 sequence = (record && !messageFull ? record->sequence : state->rigidBodySequence);
+    const RigidBodySnapshot *baseline = state->RigidBodyBaseline(ess, sequence);
+    const RigidBodySnapshot defaultState;
+
+    RigidBodyDelta delta;
+    if (!DetectRigidBodyDelta(baseline ? *baseline : defaultState, current, delta))
+        return false;
+
+    if (!record || messageFull)
+    {
+        // The first message has already been started by the caller
+        if (record)
+        {
+            user->EndMessage(ds.BytesFilled(), false, true);
+            ds = kNet::DataSerializer(user->StartMessage(cRigidBodyUpdateMessage, cRigidBodyDeltaMessageSizeBytes), cRigidBodyDeltaMessageSizeBytes);
+        }
+        record = &state->BeginRigidBodyPacket();
+        ds.Add<u16>(record->sequence);
+    }
+
+    ds.AddVLE<kNet::VLE8_16_32>(ess.id); // Sends max. 32 bits.
+    ds.AppendBits(baseline ? 1 : 0, 1);
+    if (baseline)
+        ds.AppendBits((u16)(sequence - ess.rigidBodyBaselineSequence) - 1, 5); // Sends fixed 5 bits, as cRigidBodyBaselineWindow is 32.
+
+    RigidBodyPacketRecord::Entry entry;
+    entry.id = ess.id;
+    entry.sendIndex = ess.rigidBodySendIndex++;
+    entry.state = WriteRigidBodyDelta(ds, baseline ? *baseline : defaultState, current, delta);
+    record->entries.Push(entry);
+
+    // A body that comes to rest is repeated on the next ticks, instead of sending it reliably
+    const bool atRest = entry.state.linearVelocity.Equals(float3::zero) && entry.state.angularVelocity.Equals(float3::zero);
+    if (!atRest)
+        ess.rigidBodyRestSends = 0;
+    else if (!ess.linearVelocity.Equals(float3::zero) || !ess.angularVelocity.Equals(float3::zero))
+    {
+        ess.rigidBodyRestSends = cRigidBodyRestRedundancy;
+        state->restingRigidBodies.Insert(ess.id);
+    }
+    else if (ess.rigidBodyRestSends > 0)
+        --ess.rigidBodyRestSends;
+
+    ess.transform = t;
+    ess.linearVelocity = entry.state.linearVelocity;
+    ess.angularVelocity = entry.state.angularVelocity;
+    ess.lastNetworkSendTime = now;
+    return true;
 }
 
 void SyncManager::HandleRigidBodyChanges(UserConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes)
 {
+    if (source->ProtocolVersion() >= ProtocolRigidBodyDelta)
+    {
+        HandleRigidBodyDeltas(source, data, numBytes);
+        return;
+    }
+
     ScenePtr scene = scene_.Lock();
     if (!scene)
         return;
@@ -1434,6 +2352,113 @@ void SyncManager::HandleRigidBodyChanges(UserConnection* source, kNet::packet_id
     }
 }
 
+void SyncManager::HandleRigidBodyDeltas(UserConnection* source, const char* data, size_t numBytes)
+{
+    ScenePtr scene = scene_.Lock();
+    if (!scene)
+        return;
+
+    SceneSyncState* state = source->syncState.Get();
+    if (!state)
+        return;
+
+    kNet::DataDeserializer dd(data, numBytes);
+    const u16 sequence = dd.Read<u16>();
+    bool decoded = true; // Whether all the bodies in the packet could be decoded
+    while(dd.BitsLeft() >= 9)
+    {
+        entity_id_t entityID = dd.ReadVLE<kNet::VLE8_16_32>();
+        const bool hasBaseline = dd.ReadBits(1) != 0;
+        const u16 baselineSequence = (hasBaseline ? (u16)(sequence - 1 - dd.ReadBits(5)) : 0);
+
+        std::map<entity_id_t, RigidBodyInterpolationState>::iterator iter = state->entityInterpolations.find(entityID);
+        const RigidBodySnapshot *baseline = 0;
+        if (hasBaseline && iter != state->entityInterpolations.end())
+            baseline = iter->second.FindBaseline(baselineSequence);
+        const RigidBodySnapshot received = ReadRigidBodyDelta(dd, baseline ? *baseline : RigidBodySnapshot());
+
+        EntityPtr e = scene->EntityById(entityID);
+        Placeable* placeable = e ? e->Component<Placeable>().Get() : nullptr;
+        if (!placeable || (hasBaseline && !baseline))
+        {
+            // Discard the update, and leave the packet unacknowledged, so that the server does not use it as a baseline
+            // and eventually falls back to sending the body in full.
+            decoded = false;
+            continue;
+        }
+
+        const bool hadInterpolation = (iter != state->entityInterpolations.end());
+        RigidBodyInterpolationState &interp = (hadInterpolation ? iter->second : state->entityInterpolations[entityID]);
+        interp.StoreBaseline(sequence, received);
+        if (hadInterpolation && RigidBodySequenceIsNewerThan((u16)interp.lastReceivedPacketCounter, sequence))
+            continue; // This is an out-of-order received packet. Keep it only as a baseline. (latest-data-guarantee)
+
+        SharedPtr<RigidBody> rigidBody = e->Component<RigidBody>();
+        const Transform orig = placeable->transform.Get();
+        if (hadInterpolation)
+        {
+            const float interpPeriod = updatePeriod_; // Time in seconds how long interpolating the Hermite spline from [0,1] should take.
+            if (interp.interpTime < 1.0f)
+                interp.interpStart.vel = HermiteDerivative(interp.interpStart.pos, interp.interpStart.vel*interpPeriod, interp.interpEnd.pos, interp.interpEnd.vel*interpPeriod, interp.interpTime);
+            else
+                interp.interpStart.vel = interp.interpEnd.vel;
+            interp.interpStart.angVel = float3::zero; ///\todo
+        }
+        else
+        {
+            interp.interpStart.vel = rigidBody ? rigidBody->linearVelocity.Get() : float3::zero;
+            interp.interpStart.angVel = rigidBody ? rigidBody->angularVelocity.Get() : float3::zero;
+        }
+        interp.interpStart.pos = orig.pos;
+        interp.interpStart.rot = orig.Orientation();
+        interp.interpStart.scale = orig.scale;
+        interp.interpEnd.pos = received.pos;
+        interp.interpEnd.rot = received.rot;
+        interp.interpEnd.scale = received.scale;
+        interp.interpEnd.vel = received.linearVelocity;
+        interp.interpEnd.angVel = RadToDeg(received.angularVelocity);
+        interp.interpTime = 0.f;
+        interp.lastReceivedPacketCounter = sequence;
+        interp.interpolatorActive = true;
+
+        // Objects without a rigidbody, or with mass 0 never extrapolate (objects with mass 0 are stationary for Bullet).
+        const bool isNewtonian = rigidBody && rigidBody->mass.Get() > 0;
+        if (!isNewtonian)
+            interp.interpStart.vel = interp.interpEnd.vel = float3::zero;
+    }
+
+    if (decoded)
+        state->MarkRigidBodyPacketReceived(sequence);
+}
+
+void SyncManager::HandleRigidBodyAck(UserConnection* source, const char* data, size_t numBytes)
+{
+    SceneSyncState* state = source->syncState.Get();
+    if (!state)
+        return;
+
+    kNet::DataDeserializer dd(data, numBytes);
+    const u16 sequence = dd.Read<u16>();
+    const u32 receivedBits = dd.Read<u32>();
+    state->AckRigidBodyPacket(sequence);
+    for (u16 i = 0; i < 32; ++i)
+        if (receivedBits & (1u << i))
+            state->AckRigidBodyPacket((u16)(sequence - 1 - i));
+}
+
+void SyncManager::SendRigidBodyAck(UserConnection* connection, SceneSyncState *senderState)
+{
+    if (!senderState->rigidBodyAckPending)
+        return;
+    senderState->rigidBodyAckPending = false;
+
+    const size_t maxDataSize = sizeof(u16) + sizeof(u32);
+    kNet::DataSerializer ds(connection->StartMessage(cRigidBodyAckMessage, maxDataSize), maxDataSize);
+    ds.Add<u16>(senderState->rigidBodyAckSequence);
+    ds.Add<u32>(senderState->rigidBodyAckBits);
+    connection->EndMessage(ds.BytesFilled(), false, false);
+}
+
 void SyncManager::HandleEditEntityProperties(UserConnection* source, const char* data, size_t numBytes)
 {
     assert(source);
@@ -1592,11 +2617,11 @@ void SyncManager::HandleRegisterComponentType(UserConnection* source, const char
     componentTypeSender_ = 0;
 }
 
-void SyncManager::ProcessSyncState(UserConnection* user)
+void SyncManager::ProcessSyncState(UserConnection* user, SyncBuffers &buffers, unsigned long long tickStartBytes)
 {
     URHO3D_PROFILE(SyncManager_ProcessSyncState);
     
-    ScenePtr scene = scene_.Lock();
+    Scene *scene = scene_.Get();
     bool isServer = owner_->IsServer();
 
     SceneSyncState* state = user->syncState.Get();
@@ -1614,29 +2639,39 @@ void SyncManager::ProcessSyncState(UserConnection* user)
         state->MarkPlaceholderComponentsSent();
     }
 
-    // Process the state's dirty entity queue.
-    /// \todo Limit and prioritize the data sent. For now the whole queue is processed, regardless of whether the connection is being saturated.
-   // Interest management sync priorization performed only on the server
-    const bool serverImEnabled = (isServer && prioritizer_);
+    // The budget is spent when the user's sent byte count reaches the limit
+    const bool budgetEnabled = (isServer && state->bandwidthBudget > 0.f);
+    unsigned long long byteLimit = ~0ULL;
+    if (budgetEnabled)
+        byteLimit = tickStartBytes + (state->byteQuota > 0.f ? (unsigned long long)state->byteQuota : 0);
 
-    // Process the state's dirty entity queue.
-    /// @todo Ideally, the server should be able to define an output per user threshold, 
-    /// which the server could automatically adjust accordingly to the number of concurrent users.
-    std::list<EntitySyncState*>::iterator it = state->dirtyQueue.begin();
-    while(it != state->dirtyQueue.end())
+    // Process the state's dirty entity queue. When interest management is enabled the queue holds only the entities that are due,
+    // sorted by priority, so that when the bandwidth budget runs out, the rest of the queue left for the next tick has the least important entities.
+    EntitySyncState *entityState = state->dirtyQueue.Front();
+    while (entityState)
     {
-        EntitySyncState& entityState = **it;
-        // See if we need to sync yet.
-        float timeSinceLastSend = kNet::Clock::SecondsSinceF(entityState.lastNetworkSendTime);
-        if (serverImEnabled && timeSinceLastSend < entityState.ComputePrioritizedUpdateInterval(updatePeriod_))
+        if (user->bytesSent >= byteLimit)
         {
-            ++it;
-            continue;
+            state->deferredEntities += state->dirtyQueue.Size();
+            break;
+        }
+        EntitySyncState *next = entityState->nextDirty;
+        entity_id_t nextId = next ? next->id : 0;
+        // Note: depending on entity parenting this may process other entities, including the next one.
+        // In that case the next state has left the queue or been erased, so continue from the front.
+        if (!ProcessEntitySyncState(isServer, user, scene, state, entityState, buffers, byteLimit))
+        {
+            // The budget ran out in the middle of the entity's changes, the rest of them stay in the queue
+            state->deferredEntities += state->dirtyQueue.Size();
+            break;
+        }
+        if (next)
+        {
+            next = state->FindEntitySyncState(nextId);
+            if (!next || !next->isInQueue)
+                next = state->dirtyQueue.Front();
         }
-        std::list<EntitySyncState*>::iterator next = ++it;
-        // Note: depending on entity parenting this may process other entities
-        ProcessEntitySyncState(isServer, user, scene.Get(), state, &entityState);
-        it = next;
+        entityState = next;
     }
 
     // Send queued entity actions after scene sync
@@ -1647,14 +2682,18 @@ void SyncManager::ProcessSyncState(UserConnection* user)
 
         state->queuedActions.clear();
     }
+
+    state->bytesSent = (u32)(user->bytesSent - tickStartBytes);
+    if (budgetEnabled)
+        state->byteQuota -= (float)state->bytesSent;
 }
 
-void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Scene *scene, SceneSyncState *sceneState, EntitySyncState* entityState)
+bool SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Scene *scene, SceneSyncState *sceneState, EntitySyncState* entityState, SyncBuffers &buffers, unsigned long long byteLimit)
 {
     unsigned sceneId = 0;       /// @todo Replace with proper scene ID once multiscene support is in place.
     bool removeState = false;
 
-    EntityPtr entity = entityState->weak.Lock();
+    Entity *entity = entityState->weak.Get();
     if (!entity)
     {
         if (!entityState->removed)
@@ -1666,7 +2705,7 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
     {
         // Make sure we don't send data for local entities, or unacked entities after the create
         if (entity->IsLocal() || (!entityState->isNew && entity->IsUnacked()))
-            return;
+            return true;
     }
     
     // Remove entity
@@ -1693,22 +2732,25 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
 
         removeState = true;
 
-        kNet::DataSerializer ds(removeEntityBuffer_, NUMELEMS(removeEntityBuffer_));
+        const size_t maxBytes = 2 * 4;
+        kNet::DataSerializer ds(user->StartMessage(cRemoveEntityMessage, maxBytes), maxBytes);
         ds.AddVLE<kNet::VLE8_16_32>(sceneId);
         ds.AddVLE<kNet::VLE8_16_32>(entityState->id & UniqueIdGenerator::LAST_REPLICATED_ID);
-        user->Send(cRemoveEntityMessage, true, true, ds);
+        user->EndMessage(ds.BytesFilled(), true, true);
     }
     // New entity
     else if (entityState->isNew)
     {
         // Check if parent is dirty as a new state and send it first.
-        // Must be done prior to below code using the createEntityBuffer_.
+        // Must be done prior to below code using the componentData buffer.
         if (user->ProtocolVersion() >= ProtocolHierarchicScene)
         {
-            entity_id_t parentId = (entity->Parent() ? entity->Parent()->Id() : 0);
+            Entity *parent = entity->ParentEntity();
+            entity_id_t parentId = (parent ? parent->Id() : 0);
 
             // Check if parent is dirty as a new state and send it first.
-            if (parentId > 0 && sceneState->dirtyEntities.Contains(parentId))
+            EntitySyncState *parentState = (parentId > 0 ? sceneState->FindEntitySyncState(parentId) : 0);
+            if (parentState && parentState->isInQueue)
             {
                 /* This will clear the .isNew etc. booleans in the queue,
                    once the main iteration reaches this parent it will do no
@@ -1716,55 +2758,57 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
                    the parent chain is deeper than one level, it will recurse
                    here untill a unparented Entity is found and sent them in the
                    correct order. */
-                EntitySyncState *parentState = sceneState->dirtyEntities[parentId];
-                if (parentState && parentState->isNew)
-                    ProcessEntitySyncState(isServer, user, scene, sceneState, parentState);
+                if (parentState->isNew)
+                    ProcessEntitySyncState(isServer, user, scene, sceneState, parentState, buffers, byteLimit);
             }
         }
         
-        kNet::DataSerializer ds(createEntityBuffer_, NUMELEMS(createEntityBuffer_));
-        
-        // Entity identification and temporary flag
-        ds.AddVLE<kNet::VLE8_16_32>(sceneId);
-        ds.AddVLE<kNet::VLE8_16_32>(entityState->id & UniqueIdGenerator::LAST_REPLICATED_ID);
-        // Do not write the temporary flag as a bit to not desync the byte alignment at this point, as a lot of data potentially follows
-        ds.Add<u8>(entity->IsTemporary() ? 1 : 0);
-        // If hierarchic scene is supported, send parent entity ID or 0 if unparented. Note that this is a full 32bit ID to handle the unacked range if necessary
-        if (user->ProtocolVersion() >= ProtocolHierarchicScene)
-        {
-            if (entity->Parent() && entity->Parent()->IsLocal())
-                LogWarning("Replicated entity " + String(entityState->id) + " is parented to a local entity, can not replicate parenting properly over the network");
+        Entity *parent = entity->ParentEntity();
+        if (user->ProtocolVersion() >= ProtocolHierarchicScene && parent && parent->IsLocal())
+            LogWarning("Replicated entity " + String(entityState->id) + " is parented to a local entity, can not replicate parenting properly over the network");
 
-            ds.Add<u32>(entity->Parent() ? entity->Parent()->Id() : 0);
-        }
-        
+        // Serialize the replicated components first, so that the message is reserved with its final size and written in place
         const Entity::ComponentMap& components = entity->Components();
-        // Count the amount of replicated components
-        uint numReplicatedComponents = 0;
-        for (auto i = components.Begin(); i != components.End(); ++i)
-        {
-            if (i->second_->IsReplicated())
-                ++numReplicatedComponents;
-        }
-        ds.AddVLE<kNet::VLE8_16_32>(numReplicatedComponents);
-        
-        // Serialize each replicated component
+        std::vector<const SerializedAttributes*> &componentData = buffers.componentData;
+        componentData.clear();
         bool bufferValid = true;
+        size_t maxBytes = 4 * 4 + 1; // Scene ID, entity ID, temporary flag, parent ID and the number of components
         for (auto i = components.Begin(); i != components.End(); ++i)
         {
-            ComponentPtr comp = i->second_;
+            IComponent *comp = i->second_.Get();
             if (!comp->IsReplicated())
                 continue;
-            if (bufferValid && !WriteComponentFullUpdate(ds, comp))
-            {
-                bufferValid = false;
-                ds.ResetFill();
-            }
+            const SerializedAttributes &attrData = FullAttributeData(comp, user->ProtocolVersion(), buffers);
+            bufferValid = bufferValid && attrData.valid;
+            componentData.push_back(&attrData);
+            maxBytes += ComponentFullUpdateMaxBytes(comp, attrData);
             // Mark the component undirty in the receiver's syncstate
             sceneState->MarkComponentProcessed(entity->Id(), comp->Id());
         }
+
         if (bufferValid)
-            user->Send(cCreateEntityMessage, true, true, ds);
+        {
+            kNet::DataSerializer ds(user->StartMessage(cCreateEntityMessage, maxBytes), maxBytes);
+
+            // Entity identification and temporary flag
+            ds.AddVLE<kNet::VLE8_16_32>(sceneId);
+            ds.AddVLE<kNet::VLE8_16_32>(entityState->id & UniqueIdGenerator::LAST_REPLICATED_ID);
+            // Do not write the temporary flag as a bit to not desync the byte alignment at this point, as a lot of data potentially follows
+            ds.Add<u8>(entity->IsTemporary() ? 1 : 0);
+            // If hierarchic scene is supported, send parent entity ID or 0 if unparented. Note that this is a full 32bit ID to handle the unacked range if necessary
+            if (user->ProtocolVersion() >= ProtocolHierarchicScene)
+                ds.Add<u32>(parent ? parent->Id() : 0);
+
+            ds.AddVLE<kNet::VLE8_16_32>((u32)componentData.size());
+            size_t ci = 0;
+            for (auto i = components.Begin(); i != components.End(); ++i)
+            {
+                IComponent *comp = i->second_.Get();
+                if (comp->IsReplicated())
+                    WriteComponentFullUpdate(ds, comp, *componentData[ci++]);
+            }
+            user->EndMessage(ds.BytesFilled(), true, true);
+        }
 
         // The create has been processed fully. Clear dirty flags.
         sceneState->MarkEntityProcessed(entity->Id());
@@ -1775,28 +2819,58 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
         {
             LogError("SyncManager: Failed to send new Entity to the server due to invalid buffer state. " + entity->ToString() + " will be forcefully destroyed from Scene.");
             sceneState->RemoveFromQueue(entity->Id());
-            sceneState->entities.erase(entity->Id());
+            sceneState->entities.Erase(entity->Id());
             scene->RemoveEntity(entity->Id(), AttributeChange::LocalOnly);
+            // The state has been erased already
+            return true;
         }
     }
     else if (entity)
     {
-        if (!entityState->dirtyQueue.Empty())
+        if (entityState->HasDirtyComponents())
         {
-            // Components or attributes have been added, changed, or removed. Prepare the dataserializers
-            kNet::DataSerializer removeCompsDs(removeCompsBuffer_, NUMELEMS(removeCompsBuffer_));
-            kNet::DataSerializer removeAttrsDs(removeAttrsBuffer_, NUMELEMS(removeAttrsBuffer_));
-            kNet::DataSerializer createCompsDs(createCompsBuffer_, NUMELEMS(createCompsBuffer_));
-            kNet::DataSerializer createAttrsDs(createAttrsBuffer_, NUMELEMS(createAttrsBuffer_));
-            kNet::DataSerializer editAttrsDs(editAttrsBuffer_, NUMELEMS(editAttrsBuffer_));
+            /* Components or attributes have been added, changed, or removed. Collect the changes first, so that
+               each message is reserved with its final size and serialized in place. */
+            std::vector<component_id_t> &removedComponents = buffers.removedComponents;
+            std::vector<std::pair<component_id_t, u8> > &removedAttributes = buffers.removedAttributes;
+            std::vector<std::pair<IComponent*, const SerializedAttributes*> > &createdComponents = buffers.createdComponents;
+            std::vector<std::pair<IComponent*, u8> > &createdAttributes = buffers.createdAttributes;
+            std::vector<std::pair<IComponent*, const SerializedAttributes*> > &editedComponents = buffers.editedComponents;
+            removedComponents.clear();
+            removedAttributes.clear();
+            createdComponents.clear();
+            createdAttributes.clear();
+            editedComponents.clear();
+            size_t editBytes = 2 * 4; // Scene ID and entity ID
+            // Estimated size of the messages collected so far, checked against the bandwidth budget
+            size_t pendingBytes = 0;
+            bool deferred = false;
+
+            // Snapshot the dirty component IDs, as removed component states are erased from the vector while processing
+            std::vector<component_id_t> &dirtyComponentIds = buffers.dirtyComponentIds;
+            dirtyComponentIds.clear();
+            for (auto i = entityState->components.Begin(); i != entityState->components.End(); ++i)
+            {
+                if (i->isInQueue)
+                    dirtyComponentIds.push_back(i->id);
+            }
 
-            while (!entityState->dirtyQueue.Empty())
+            for (size_t ci = 0; ci < dirtyComponentIds.size(); ++ci)
             {
-                ComponentSyncState& compState = *entityState->dirtyQueue.Front();
-                entityState->dirtyQueue.PopFront();
+                // Once the budget is spent, leave the remaining components dirty for the next tick
+                if (pendingBytes && user->bytesSent + pendingBytes >= byteLimit)
+                {
+                    deferred = true;
+                    break;
+                }
+
+                ComponentSyncState *compStatePtr = entityState->components.Find(dirtyComponentIds[ci]);
+                if (!compStatePtr)
+                    continue;
+                ComponentSyncState& compState = *compStatePtr;
                 compState.isInQueue = false;
                 
-                ComponentPtr comp = entity->ComponentById(compState.id);
+                IComponent *comp = ComponentByIdNoRef(entity, compState.id);
                 bool removeCompState = false;
                 if (!comp)
                 {
@@ -1816,28 +2890,19 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
                 if (compState.removed)
                 {
                     removeCompState = true;
-                    
-                    // If first component, write the entity ID first
-                    if (!removeCompsDs.BytesFilled())
-                    {
-                        removeCompsDs.AddVLE<kNet::VLE8_16_32>(sceneId);
-                        removeCompsDs.AddVLE<kNet::VLE8_16_32>(entityState->id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                    }
-                    // Then add component ID
-                    removeCompsDs.AddVLE<kNet::VLE8_16_32>(compState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
+                    removedComponents.push_back(compState.id);
+                    pendingBytes += 4;
                 }
                 // New component
                 else if (compState.isNew)
                 {
-                    // If first component, write the entity ID first
-                    if (!createCompsDs.BytesFilled())
-                    {
-                        createCompsDs.AddVLE<kNet::VLE8_16_32>(sceneId);
-                        createCompsDs.AddVLE<kNet::VLE8_16_32>(entityState->id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                    }
-                    // Then add the component data
-                    if (!WriteComponentFullUpdate(createCompsDs, comp))
-                        createCompsDs.ResetFill();
+                    // Invalid component data drops the whole message
+                    const SerializedAttributes &attrData = FullAttributeData(comp, user->ProtocolVersion(), buffers);
+                    if (attrData.valid)
+                        createdComponents.push_back(std::make_pair(comp, &attrData));
+                    else
+                        createdComponents.clear();
+                    pendingBytes += ComponentFullUpdateMaxBytes(comp, attrData);
                     // Mark the component undirty in the receiver's syncstate
                     sceneState->MarkComponentProcessed(entity->Id(), comp->Id());
                 }
@@ -1846,14 +2911,21 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
                 {
                     const AttributeVector& attrs = comp->Attributes();
 
-                    bool attrBufferValid = true;
-                    for (auto i = compState.newAndRemovedAttributes.Begin(); i != compState.newAndRemovedAttributes.End(); ++i)
+                    for (unsigned ai = 0; ai < 256; ++ai)
                     {
-                        u8 attrIndex = i->first_;
+                        u8 attrIndex = (u8)ai;
+                        const bool created = compState.IsAttributeCreated(attrIndex);
+                        if (!created && !compState.IsAttributeRemoved(attrIndex))
+                        {
+                            // Skip whole empty bytes of both bitsets
+                            if ((ai & 7) == 0 && !compState.createdAttributes[ai >> 3] && !compState.removedAttributes[ai >> 3])
+                                ai += 7;
+                            continue;
+                        }
                         // Clear the corresponding dirty flags, so that we don't redundantly send attribute edited data.
                         compState.dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
                         
-                        if (i->second_)
+                        if (created)
                         {
                             // Create attribute. Make sure it exists and is dynamic.
                             if (attrIndex >= attrs.Size() || !attrs[attrIndex])
@@ -1862,47 +2934,22 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
                                 LogError("CreateAttribute for a static attribute index " + String((int)attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
                             else
                             {
-                                if (attrBufferValid)
-                                {
-                                    // If first attribute, write the entity ID first
-                                    if (!createAttrsDs.BytesFilled())
-                                    {
-                                        createAttrsDs.AddVLE<kNet::VLE8_16_32>(sceneId);
-                                        createAttrsDs.AddVLE<kNet::VLE8_16_32>(entityState->id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                                    }
-
-                                    IAttribute* attr = attrs[attrIndex];
-                                    createAttrsDs.AddVLE<kNet::VLE8_16_32>(compState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                                    createAttrsDs.Add<u8>(attrIndex); // Index
-                                    createAttrsDs.Add<u8>((u8)attr->TypeId());
-                                    createAttrsDs.AddString(attr->Name().CString());
-                                    attr->ToBinary(createAttrsDs);
-
-                                    attrBufferValid = ValidateAttributeBuffer(false, createAttrsDs, comp);
-                                }
+                                createdAttributes.push_back(std::make_pair(comp, attrIndex));
+                                pendingBytes += 4 + 2 + attrs[attrIndex]->Name().Length() + 1;
                             }
                         }
                         else
                         {
-                            // Remove attribute
-                            // If first attribute, write the entity ID first
-                            if (!removeAttrsDs.BytesFilled())
-                            {
-                                removeAttrsDs.AddVLE<kNet::VLE8_16_32>(sceneId);
-                                removeAttrsDs.AddVLE<kNet::VLE8_16_32>(entityState->id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                            }
-                            removeAttrsDs.AddVLE<kNet::VLE8_16_32>(compState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                            removeAttrsDs.Add<u8>(attrIndex);
+                            removedAttributes.push_back(std::make_pair(compState.id, attrIndex));
+                            pendingBytes += 4 + 1;
                         }
                     }
-                    compState.newAndRemovedAttributes.Clear();
-
-                    // Buffer in invalid state, reset data so it wont be sent to network.
-                    if (!attrBufferValid)
-                        createAttrsDs.ResetFill();
+                    memset(compState.createdAttributes, 0, sizeof(compState.createdAttributes));
+                    memset(compState.removedAttributes, 0, sizeof(compState.removedAttributes));
 
                     // Now, if remaining dirty bits exist, they must be sent in the edit attributes message. These are the majority of our network data.
-                    changedAttributes_.clear();
+                    std::vector<u8> &changedAttributes = buffers.changedAttributes;
+                    changedAttributes.clear();
                     unsigned numBytes = ((unsigned)attrs.Size() + 7) >> 3;
                     for (unsigned ib = 0; ib < numBytes; ++ib)
                     {
@@ -1915,24 +2962,24 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
                                 {
                                     u8 attrIndex = (u8)((ib * 8) + j);
                                     if (attrIndex < attrs.Size() && attrs[attrIndex])
-                                        changedAttributes_.push_back(attrIndex);
+                                        changedAttributes.push_back(attrIndex);
                                     else
                                         LogError("Attribute change for a nonexisting attribute index " + String((int)attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
                                 }
                             }
                         }
                     }
-                    if (changedAttributes_.size())
+                    if (changedAttributes.size())
                     {
                         /// Hack for web clients that don't support ReplicateRigidBodyChanges()
                         /// Don't send out minuscule pos/rot/scale changes as it spams the network.
                         bool sendChanges = true;
                         if (dynamic_cast<KNetUserConnection*>(user) == 0 && user->protocolVersion < ProtocolWebClientRigidBodyMessage)
                         {
-                            if (comp->TypeId() == Placeable::TypeIdStatic() && changedAttributes_.size() == 1 && changedAttributes_[0] == 0)
+                            if (comp->TypeId() == Placeable::TypeIdStatic() && changedAttributes.size() == 1 && changedAttributes[0] == 0)
                             {
                                 // Placeable::Transform is the only change!
-                                Placeable *placeable = dynamic_cast<Placeable*>(comp.Get());
+                                Placeable *placeable = dynamic_cast<Placeable*>(comp);
                                 if (placeable)
                                 {
                                     const Transform &t = placeable->transform.Get();
@@ -1953,59 +3000,19 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
 
                         if (sendChanges)
                         {
-                            // If first component for which attribute changes are sent, write the entity ID first
-                            if (!editAttrsDs.BytesFilled())
-                            {
-                                editAttrsDs.AddVLE<kNet::VLE8_16_32>(sceneId);
-                                editAttrsDs.AddVLE<kNet::VLE8_16_32>(entityState->id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                            }
-                            editAttrsDs.AddVLE<kNet::VLE8_16_32>(compState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                        
-                            // Create a nested dataserializer for the actual attribute data, so we can skip components
-                            kNet::DataSerializer attrDataDs(attrDataBuffer_, NUMELEMS(attrDataBuffer_));
-                        
-                            // There are changed attributes. Check if it is more optimal to send attribute indices, or the whole bitmask
-                            unsigned bitsMethod1 = (unsigned)changedAttributes_.size() * 8 + 8;
-                            unsigned bitsMethod2 = (unsigned)attrs.Size();
-                            // Method 1: indices
-                            if (bitsMethod1 <= bitsMethod2)
-                            {
-                                attrDataDs.Add<kNet::bit>(0);
-                                attrDataDs.Add<u8>((u8)changedAttributes_.size());
-                                for (unsigned i = 0; i < changedAttributes_.size(); ++i)
-                                {
-                                    attrDataDs.Add<u8>(changedAttributes_[i]);
-                                    attrs[changedAttributes_[i]]->ToBinary(attrDataDs);
-                                }
-                            }
-                            // Method 2: bitmask
-                            else
-                            {
-                                attrDataDs.Add<kNet::bit>(1);
-                                for (unsigned i = 0; i < attrs.Size(); ++i)
-                                {
-                                    if (compState.dirtyAttributes[i >> 3] & (1 << (i & 7)))
-                                    {
-                                        attrDataDs.Add<kNet::bit>(1);
-                                        attrs[i]->ToBinary(attrDataDs);
-                                    }
-                                    else
-                                        attrDataDs.Add<kNet::bit>(0);
-                                }
-                            }
-                            // Add the attribute data array to the main serializer
-                            if (ValidateAttributeBuffer(false, attrDataDs, comp))
-                            {
-                                editAttrsDs.AddVLE<kNet::VLE8_16_32>((u32)attrDataDs.BytesFilled());
-                                editAttrsDs.AddArray<u8>((unsigned char*)attrDataBuffer_, (u32)attrDataDs.BytesFilled());
-
-                                if (!ValidateAttributeBuffer(false, editAttrsDs, comp, NUMELEMS(editAttrsBuffer_)))
-                                    editAttrsDs.ResetFill();
-                            }
+                            // Users with the same pending changes share the serialized attribute data.
+                            // Invalid data, or data that does not fit in the message, drops the whole message.
+                            const SerializedAttributes &attrData = EditAttributeData(comp, user->ProtocolVersion(), compState.dirtyAttributes, changedAttributes, buffers);
+                            editBytes += 2 * 4 + attrData.data.size(); // Component ID, data size and data
+                            pendingBytes += 2 * 4 + attrData.data.size();
+                            if (attrData.valid && editBytes <= cMaxComponentsMessageBytes)
+                                editedComponents.push_back(std::make_pair(comp, &attrData));
                             else
                             {
-                                attrDataDs.ResetFill();
-                                editAttrsDs.ResetFill();
+                                if (attrData.valid)
+                                    LogError("SyncManager: Attribute changes of " + entity->ToString() + " exceed " + String((uint)cMaxComponentsMessageBytes) + " bytes, not sending them.");
+                                editedComponents.clear();
+                                editBytes = 2 * 4;
                             }
                         }
 
@@ -2016,43 +3023,116 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
                 }
                 
                 if (removeCompState)
-                    entityState->components.erase(compState.id);
+                    entityState->components.Erase(compState.id);
             }
             
-            // Send the messages which have data
-            if (removeCompsDs.BytesFilled())
-                user->Send(cRemoveComponentsMessage, true, true, removeCompsDs);
+            // Send the messages which have data. Each one starts with the scene and entity IDs.
+            const u32 entityId = entityState->id & UniqueIdGenerator::LAST_REPLICATED_ID;
+            if (!removedComponents.empty())
+            {
+                const size_t maxBytes = 2 * 4 + removedComponents.size() * 4;
+                kNet::DataSerializer ds(user->StartMessage(cRemoveComponentsMessage, maxBytes), maxBytes);
+                ds.AddVLE<kNet::VLE8_16_32>(sceneId);
+                ds.AddVLE<kNet::VLE8_16_32>(entityId);
+                for (size_t i = 0; i < removedComponents.size(); ++i)
+                    ds.AddVLE<kNet::VLE8_16_32>(removedComponents[i] & UniqueIdGenerator::LAST_REPLICATED_ID);
+                user->EndMessage(ds.BytesFilled(), true, true);
+            }
+
+            if (!removedAttributes.empty())
+            {
+                const size_t maxBytes = 2 * 4 + removedAttributes.size() * (4 + 1);
+                kNet::DataSerializer ds(user->StartMessage(cRemoveAttributesMessage, maxBytes), maxBytes);
+                ds.AddVLE<kNet::VLE8_16_32>(sceneId);
+                ds.AddVLE<kNet::VLE8_16_32>(entityId);
+                for (size_t i = 0; i < removedAttributes.size(); ++i)
+                {
+                    ds.AddVLE<kNet::VLE8_16_32>(removedAttributes[i].first & UniqueIdGenerator::LAST_REPLICATED_ID);
+                    ds.Add<u8>(removedAttributes[i].second);
+                }
+                user->EndMessage(ds.BytesFilled(), true, true);
+            }
 
-            if (removeAttrsDs.BytesFilled())
-                user->Send(cRemoveAttributesMessage, true, true, removeAttrsDs);
+            if (!createdComponents.empty())
+            {
+                size_t maxBytes = 2 * 4;
+                for (size_t i = 0; i < createdComponents.size(); ++i)
+                    maxBytes += ComponentFullUpdateMaxBytes(createdComponents[i].first, *createdComponents[i].second);
+                kNet::DataSerializer ds(user->StartMessage(cCreateComponentsMessage, maxBytes), maxBytes);
+                ds.AddVLE<kNet::VLE8_16_32>(sceneId);
+                ds.AddVLE<kNet::VLE8_16_32>(entityId);
+                for (size_t i = 0; i < createdComponents.size(); ++i)
+                    WriteComponentFullUpdate(ds, createdComponents[i].first, *createdComponents[i].second);
+                user->EndMessage(ds.BytesFilled(), true, true);
+            }
 
-            if (createCompsDs.BytesFilled())
-                user->Send(cCreateComponentsMessage, true, true, createCompsDs);
+            if (!createdAttributes.empty())
+            {
+                // The attribute values are serialized here, so the size is not known beforehand. Attributes are created rarely.
+                const size_t maxBytes = cMaxComponentsMessageBytes;
+                kNet::DataSerializer ds(user->StartMessage(cCreateAttributesMessage, maxBytes), maxBytes);
+                ds.AddVLE<kNet::VLE8_16_32>(sceneId);
+                ds.AddVLE<kNet::VLE8_16_32>(entityId);
+                bool attrBufferValid = true;
+                for (size_t i = 0; i < createdAttributes.size() && attrBufferValid; ++i)
+                {
+                    IComponent *comp = createdAttributes[i].first;
+                    IAttribute *attr = comp->Attributes()[createdAttributes[i].second];
+                    ds.AddVLE<kNet::VLE8_16_32>(comp->Id() & UniqueIdGenerator::LAST_REPLICATED_ID);
+                    ds.Add<u8>(createdAttributes[i].second); // Index
+                    ds.Add<u8>((u8)attr->TypeId());
+                    ds.AddString(attr->Name().CString());
+                    attr->ToBinary(ds);
+
+                    attrBufferValid = ValidateAttributeBuffer(false, ds, comp);
+                }
+                // Buffer in invalid state, drop the message so it wont be sent to network.
+                if (attrBufferValid)
+                    user->EndMessage(ds.BytesFilled(), true, true);
+                else
+                    user->AbortMessage();
+            }
 
-            if (createAttrsDs.BytesFilled())
-                user->Send(cCreateAttributesMessage, true, true, createAttrsDs);
+            if (!editedComponents.empty())
+            {
+                kNet::DataSerializer ds(user->StartMessage(cEditAttributesMessage, editBytes), editBytes);
+                ds.AddVLE<kNet::VLE8_16_32>(sceneId);
+                ds.AddVLE<kNet::VLE8_16_32>(entityId);
+                for (size_t i = 0; i < editedComponents.size(); ++i)
+                {
+                    const SerializedAttributes &attrData = *editedComponents[i].second;
+                    ds.AddVLE<kNet::VLE8_16_32>(editedComponents[i].first->Id() & UniqueIdGenerator::LAST_REPLICATED_ID);
+                    ds.AddVLE<kNet::VLE8_16_32>((u32)attrData.data.size());
+                    if (!attrData.data.empty())
+                        ds.AddArray<u8>(&attrData.data[0], (u32)attrData.data.size());
+                }
+                user->EndMessage(ds.BytesFilled(), true, true);
+            }
 
-            if (editAttrsDs.BytesFilled())
-                user->Send(cEditAttributesMessage, true, true, editAttrsDs);
+            // The entity stays in the queue with its remaining changes
+            if (deferred)
+                return false;
         }
         
         // Check if entity has other property changes (temporary flag)
         if (entityState->hasPropertyChanges)
         {
-            kNet::DataSerializer editPropertiesDs(editAttrsBuffer_, NUMELEMS(editAttrsBuffer_));
+            const size_t maxBytes = 2 * 4 + 1;
+            kNet::DataSerializer editPropertiesDs(user->StartMessage(cEditEntityPropertiesMessage, maxBytes), maxBytes);
             editPropertiesDs.AddVLE<kNet::VLE8_16_32>(sceneId);
             editPropertiesDs.AddVLE<kNet::VLE8_16_32>(entityState->id & UniqueIdGenerator::LAST_REPLICATED_ID);
             editPropertiesDs.Add<u8>(entity->IsTemporary() ? 1 : 0);
-            user->Send(cEditEntityPropertiesMessage, true, true, editPropertiesDs);
+            user->EndMessage(editPropertiesDs.BytesFilled(), true, true);
         }
         if (entityState->hasParentChange && user->ProtocolVersion() >= ProtocolHierarchicScene)
         {
-            EntityPtr parent = entity->Parent();
-            kNet::DataSerializer editParentDs(editAttrsBuffer_, 1024);
+            Entity *parent = entity->ParentEntity();
+            const size_t maxBytes = 3 * 4;
+            kNet::DataSerializer editParentDs(user->StartMessage(cSetEntityParentMessage, maxBytes), maxBytes);
             editParentDs.AddVLE<kNet::VLE8_16_32>(sceneId);
             editParentDs.Add<u32>(entityState->id);
             editParentDs.Add<u32>(parent ? parent->Id() : 0);
-            user->Send(cSetEntityParentMessage, true, true, editParentDs);
+            user->EndMessage(editParentDs.BytesFilled(), true, true);
         }
         
         // The entity has been processed fully. Clear dirty flags.
@@ -2061,9 +3141,14 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
     
     sceneState->RemoveFromQueue(entityState->id);
 
+    // Interest management sync priorization performed only on the server: further changes wait for the prioritized update interval
+    if (isServer && prioritizer_)
+        entityState->nextSendTime = sceneState->scheduleTime + (kNet::tick_t)(entityState->updateInterval * kNet::Clock::TicksPerSec());
+
     // Entity removal has been sent to the client, remove it from the SceneState.
     if (removeState)
-        sceneState->entities.erase(entityState->id);
+        sceneState->entities.Erase(entityState->id);
+    return true;
 }
 
 bool SyncManager::ValidateAction(UserConnection* source, unsigned /*messageID*/, entity_id_t /*entityID*/)
@@ -2095,8 +3180,7 @@ void SyncManager::SendObserverPosition(UserConnection *connection, SceneSyncStat
             senderState->observerRot = rot;
 
             const size_t maxDataSize = sizeof(uint) + 1 + 6 * sizeof(float); /** <@todo use scene_id_t instead of uint when available */
-            char dataBuffer[maxDataSize];
-            kNet::DataSerializer ds(dataBuffer, maxDataSize);
+            kNet::DataSerializer ds(connection->StartMessage(cObserverPositionMessage, maxDataSize), maxDataSize);
             ds.AddVLE<kNet::VLE8_16_32>((uint)0/*scene->Id()*/);/** <@todo Use proper scene ID when available */
 
             // Detect whether to send compact or full states for each variable.
@@ -2109,7 +3193,7 @@ void SyncManager::SendObserverPosition(UserConnection *connection, SceneSyncStat
 
             WriteOptimizedPosAndRot(ds, posSendType, pos, rotSendType, rot3x3);
             /// @todo Idea: could have inOrder true and use frame number as the contentID?
-            connection->Send(cObserverPositionMessage, false, false, ds);
+            connection->EndMessage(ds.BytesFilled(), false, false);
         }
     }
 }
@@ -2140,7 +3224,7 @@ void SyncManager::HandleObserverPosition(UserConnection* source, const char* dat
     /// @todo if (posSendType || rotSendType) -> notify current prioritizer that new observer position is available
 }
 
-void SyncManager::HandleCreateEntity(UserConnection* source, const char* data, size_t numBytes)
+void SyncManager::HandleCreateEntity(UserConnection* source, const char* data, size_t numBytes, const ReceivedEntity *received)
 {
     assert(source);
     
@@ -2160,9 +3244,14 @@ void SyncManager::HandleCreateEntity(UserConnection* source, const char* data, s
     bool isServer = owner_->IsServer();
     AttributeChange::Type change = isServer ? AttributeChange::Replicate : AttributeChange::LocalOnly;
     
-    kNet::DataDeserializer ds(data, numBytes);
-    unsigned sceneID = ds.ReadVLE<kNet::VLE8_16_32>(); ///\todo Dummy ID. Lookup scene once multiscene is properly supported
-    entity_id_t entityID = ds.ReadVLE<kNet::VLE8_16_32>();
+    // The client has decoded the message in the receive queue already
+    if (!received)
+    {
+        SyncReceiveQueue::DecodeCreateEntity(data, numBytes, source->ProtocolVersion(), receivedEntity_);
+        received = &receivedEntity_;
+    }
+    unsigned sceneID = received->sceneId; ///\todo Dummy ID. Lookup scene once multiscene is properly supported
+    entity_id_t entityID = received->id;
     entity_id_t senderEntityID = entityID;
     
     if (!ValidateAction(source, cCreateEntityMessage, entityID))
@@ -2207,14 +3296,12 @@ void SyncManager::HandleCreateEntity(UserConnection* source, const char* data, s
 
     try
     {    
-        // Read the temporary flag
-        bool temporary = ds.Read<u8>() != 0;
-        entity->SetTemporary(temporary);
+        entity->SetTemporary(received->temporary);
 
-        // In hierarchic scene protocol, read the parent entity ID
+        // In hierarchic scene protocol, set the parent entity
         if (source->ProtocolVersion() >= ProtocolHierarchicScene)
         {
-            parentEntityID = ds.Read<u32>();
+            parentEntityID = received->parentId;
             
             // Convert unacked ID if we can
             if (isServer && parentEntityID >= UniqueIdGenerator::FIRST_UNACKED_ID && parentEntityID < UniqueIdGenerator::FIRST_LOCAL_ID)
@@ -2234,32 +3321,18 @@ void SyncManager::HandleCreateEntity(UserConnection* source, const char* data, s
             }
         }
 
-        // Read the components
-        unsigned numComponents = ds.ReadVLE<kNet::VLE8_16_32>();
-        for(uint i = 0; i < numComponents; ++i)
+        // Read the components. The attribute data is read in place from the message.
+        for(size_t i = 0; i < received->components.size(); ++i)
         {
-            component_id_t compID = ds.ReadVLE<kNet::VLE8_16_32>();
+            const ReceivedComponent &receivedComp = received->components[i];
+            component_id_t compID = receivedComp.id;
             component_id_t senderCompID = compID;
             // If we are server, rewrite the ID
             if (isServer) compID = 0;
             
-            u32 typeID = ds.ReadVLE<kNet::VLE8_16_32>();
-            String compName = String(ds.ReadString().c_str());
-            unsigned attrDataSize = ds.ReadVLE<kNet::VLE8_16_32>();
-            if (attrDataSize > NUMELEMS(attrDataBuffer_))
-            {
-                /// @todo Inspect if 'state' should be updated or a more fatal error would be appropriate here.
-                LogError(String("SyncManager::HandleCreateEntity: Attribute data size " + String(attrDataSize) + " bytes is bigger than the destination buffer of " + 
-                    String(NUMELEMS(attrDataBuffer_)) + " bytes. In " + framework_->Scene()->ComponentTypeNameForTypeId(typeID) + 
-                    " in Entity " + String(entity->Id()) + ". Entity will be ignored!"));
-
-                state->RemoveFromQueue(entity->Id());
-                state->entities.erase(entity->Id());
-                scene->RemoveEntity(entity->Id(), AttributeChange::LocalOnly);
-                return;
-            }
-            ds.ReadArray<u8>((u8*)&attrDataBuffer_[0], attrDataSize);
-            kNet::DataDeserializer attrDs(attrDataBuffer_, attrDataSize);
+            u32 typeID = receivedComp.typeId;
+            const String &compName = receivedComp.name;
+            kNet::DataDeserializer attrDs(data + receivedComp.attrDataOffset, receivedComp.attrDataSize);
             
             // If client gets a component that already exists, destroy it forcibly
             if (!isServer && entity->ComponentById(compID))
@@ -2347,7 +3420,7 @@ void SyncManager::HandleCreateEntity(UserConnection* source, const char* data, s
     // Send CreateEntityReply (server only)
     if (isServer)
     {
-        kNet::DataSerializer replyDs(createEntityBuffer_, NUMELEMS(createEntityBuffer_));
+        kNet::DataSerializer replyDs(attrDataBuffer_, NUMELEMS(attrDataBuffer_));
         replyDs.AddVLE<kNet::VLE8_16_32>(sceneID);
         replyDs.AddVLE<kNet::VLE8_16_32>(senderEntityID & UniqueIdGenerator::LAST_REPLICATED_ID);
         replyDs.AddVLE<kNet::VLE8_16_32>(entityID & UniqueIdGenerator::LAST_REPLICATED_ID);
@@ -2364,7 +3437,7 @@ void SyncManager::HandleCreateEntity(UserConnection* source, const char* data, s
     state->MarkEntityProcessed(entityID);
 }
 
-void SyncManager::HandleCreateComponents(UserConnection* source, const char* data, size_t numBytes)
+void SyncManager::HandleCreateComponents(UserConnection* source, const char* data, size_t numBytes, const ReceivedEntity *received)
 {
     assert(source);
     // Get matching syncstate for reflecting the changes
@@ -2387,11 +3460,17 @@ void SyncManager::HandleCreateComponents(UserConnection* source, const char* dat
     u32 sceneID;
     entity_id_t entityID;
 
+    // The client has decoded the message in the receive queue already
+    if (!received)
+    {
+        SyncReceiveQueue::DecodeCreateComponents(data, numBytes, receivedEntity_);
+        received = &receivedEntity_;
+    }
+
     try
     {
-        kNet::DataDeserializer ds(data, numBytes);
-        sceneID = ds.ReadVLE<kNet::VLE8_16_32>(); ///\todo Dummy ID. Lookup scene once multiscene is properly supported
-        entityID = ds.ReadVLE<kNet::VLE8_16_32>();
+        sceneID = received->sceneId; ///\todo Dummy ID. Lookup scene once multiscene is properly supported
+        entityID = received->id;
         
         if (!ValidateAction(source, cCreateComponentsMessage, entityID))
             return;
@@ -2407,28 +3486,18 @@ void SyncManager::HandleCreateComponents(UserConnection* source, const char* dat
         if (!scene->AllowModifyEntity(source, entity.Get()))
             return;
         
-        // Read the components
-        while (ds.BitsLeft() > 2 * 8)
+        // Read the components. The attribute data is read in place from the message.
+        for (size_t ci = 0; ci < received->components.size(); ++ci)
         {
-            component_id_t compID = ds.ReadVLE<kNet::VLE8_16_32>();
+            const ReceivedComponent &receivedComp = received->components[ci];
+            component_id_t compID = receivedComp.id;
             component_id_t senderCompID = compID;
             // If we are server, rewrite the ID
             if (isServer) compID = 0;
             
-            u32 typeID = ds.ReadVLE<kNet::VLE8_16_32>();
-            String name = String(ds.ReadString().c_str());
-            unsigned attrDataSize = ds.ReadVLE<kNet::VLE8_16_32>();
-            if (attrDataSize > NUMELEMS(attrDataBuffer_))
-            {
-                /// @todo Inspect if 'state' should be updated or a more fatal error would be appropriate here.
-                state->MarkEntityProcessed(entityID);
-                LogError("SyncManager::HandleCreateComponents: Attribute data size " + String(attrDataSize) +
-                    " bytes is bigger than the destination buffer of " + String(NUMELEMS(attrDataBuffer_)) +
-                    " bytes. In " + framework_->Scene()->ComponentTypeNameForTypeId(typeID) + " in Entity " + String(entity->Id()) + ". Component(s) will be ignored!");
-                return;
-            }
-            ds.ReadArray<u8>((u8*)&attrDataBuffer_[0], attrDataSize);
-            kNet::DataDeserializer attrDs(attrDataBuffer_, attrDataSize);
+            u32 typeID = receivedComp.typeId;
+            const String &name = receivedComp.name;
+            kNet::DataDeserializer attrDs(data + receivedComp.attrDataOffset, receivedComp.attrDataSize);
             
             // If client gets a component that already exists, destroy it forcibly
             if (!isServer && entity->ComponentById(compID))
@@ -2513,7 +3582,7 @@ void SyncManager::HandleCreateComponents(UserConnection* source, const char* dat
     // Send CreateComponentsReply (server only)
     if (isServer)
     {
-        kNet::DataSerializer replyDs(createEntityBuffer_, NUMELEMS(createEntityBuffer_));
+        kNet::DataSerializer replyDs(attrDataBuffer_, NUMELEMS(attrDataBuffer_));
         replyDs.AddVLE<kNet::VLE8_16_32>(sceneID);
         replyDs.AddVLE<kNet::VLE8_16_32>(entityID & UniqueIdGenerator::LAST_REPLICATED_ID);
         replyDs.AddVLE<kNet::VLE8_16_32>((u32)componentIdRewrites.size());
@@ -2568,7 +3637,7 @@ void SyncManager::HandleRemoveEntity(UserConnection* source, const char* data, s
 
     // Delete from the sender's syncstate so that we don't echo the delete back needlessly
     state->RemoveFromQueue(entityID);
-    state->entities.erase(entityID);
+    state->entities.Erase(entityID);
 }
 
 void SyncManager::HandleRemoveComponents(UserConnection* source, const char* data, size_t numBytes)
@@ -2617,7 +3686,7 @@ void SyncManager::HandleRemoveComponents(UserConnection* source, const char* dat
         entity->RemoveComponent(comp, change);
 
         entityState.RemoveFromQueue(compID);
-        entityState.components.erase(compID);
+        entityState.components.Erase(compID);
     }
 }
 
@@ -2701,7 +3770,7 @@ void SyncManager::HandleCreateAttributes(UserConnection* source, const char* dat
         }
         
         // Remove the corresponding add command from the sender's syncstate, so that the attribute add is not echoed back
-        entityState.components[compID].newAndRemovedAttributes.Erase(attrIndex);
+        entityState.components[compID].ClearAttributeCreatedOrRemoved(attrIndex);
     }
     
     // Signal attribute changes after creating and reading all
@@ -2765,11 +3834,11 @@ void SyncManager::HandleRemoveAttributes(UserConnection* source, const char* dat
         comp->RemoveAttribute(attrIndex, change);
 
         // Remove the corresponding remove command from the sender's syncstate, so that the attribute remove is not echoed back
-        entityState.components[compID].newAndRemovedAttributes.Erase(attrIndex);
+        entityState.components[compID].ClearAttributeCreatedOrRemoved(attrIndex);
     }
 }
 
-void SyncManager::HandleEditAttributes(UserConnection* source, const char* data, size_t numBytes)
+void SyncManager::HandleEditAttributes(UserConnection* source, const char* data, size_t numBytes, const ReceivedEntity *received)
 {
     assert(source);
     // Get matching syncstate for reflecting the changes
@@ -2785,10 +3854,13 @@ void SyncManager::HandleEditAttributes(UserConnection* source, const char* data,
     bool isServer = owner_->IsServer();
     AttributeChange::Type change = isServer ? AttributeChange::Replicate : AttributeChange::LocalOnly;
     
-    kNet::DataDeserializer ds(data, numBytes);
-    unsigned sceneID = ds.ReadVLE<kNet::VLE8_16_32>(); ///\todo Dummy ID. Lookup scene once multiscene is properly supported
-    UNREFERENCED_PARAM(sceneID)
-    entity_id_t entityID = ds.ReadVLE<kNet::VLE8_16_32>();
+    // The client has decoded the message in the receive queue already
+    if (!received)
+    {
+        SyncReceiveQueue::DecodeEditAttributes(data, numBytes, receivedEntity_);
+        received = &receivedEntity_;
+    }
+    entity_id_t entityID = received->id;
     
     if (!ValidateAction(source, cRemoveAttributesMessage, entityID))
         return;
@@ -2805,33 +3877,19 @@ void SyncManager::HandleEditAttributes(UserConnection* source, const char* data,
     
     // Record the update time for calculating the update interval
     float updateInterval = updatePeriod_; // Default update interval if state not found or interval not measured yet
-    std::map<entity_id_t, EntitySyncState>::iterator it = state->entities.find(entityID);
-    if (it != state->entities.end())
-    {
-        it->second.RefreshAvgUpdateInterval();
-        if (it->second.avgUpdateInterval > 0.0f)
-            updateInterval = it->second.avgUpdateInterval;
-    }
+    entityState.RefreshAvgUpdateInterval();
+    if (entityState.avgUpdateInterval > 0.0f)
+        updateInterval = entityState.avgUpdateInterval;
     // Add a fudge factor in case there is jitter in packet receipt or the server is too taxed
     updateInterval *= 1.25f;
 
     std::vector<IAttribute*> changedAttrs;
-    while (ds.BitsLeft() >= 8)
+    for (size_t ci = 0; ci < received->components.size(); ++ci)
     {
-        component_id_t compID = ds.ReadVLE<kNet::VLE8_16_32>();
-        unsigned attrDataSize = ds.ReadVLE<kNet::VLE8_16_32>();
-        if (attrDataSize > NUMELEMS(attrDataBuffer_))
-        {
-            /// @todo Inspect if 'state' should be updated or a more fatal error would be appropriate here.
-            state->MarkEntityProcessed(entityID);
-            
-            LogError("SyncManager::HandleEditAttributes: Attribute data size " + String(attrDataSize) +
-                " bytes is bigger than the destination buffer of " + String(NUMELEMS(attrDataBuffer_)) +
-                " bytes. Component id " + String(compID) + " in Entity " + String(entity->Id()) + ". Attribute(s) will be ignored!");
-            return;
-        }
-        ds.ReadArray<u8>((u8*)&attrDataBuffer_[0], attrDataSize);
-        kNet::DataDeserializer attrDs(attrDataBuffer_, attrDataSize);
+        // The attribute data is read in place from the message
+        const ReceivedComponent &receivedComp = received->components[ci];
+        component_id_t compID = receivedComp.id;
+        kNet::DataDeserializer attrDs(data + receivedComp.attrDataOffset, receivedComp.attrDataSize);
 
         ComponentPtr comp = entity->ComponentById(compID);
         if (!comp)
@@ -2910,15 +3968,23 @@ void SyncManager::HandleEditAttributes(UserConnection* source, const char* data,
         }
     }
     
-    // Signal attribute changes after reading all
+    // Signal attribute changes after reading all, each component reacting to its changes at once
+    std::vector<std::pair<component_id_t, u8> > signalledAttrs;
+    signalledAttrs.reserve(changedAttrs.size());
+    scene->BeginAttributeChanges();
     for (unsigned i = 0; i < changedAttrs.size(); ++i)
     {
         IComponent* owner = changedAttrs[i]->Owner();
-        u8 attrIndex = changedAttrs[i]->Index();
+        signalledAttrs.push_back(std::make_pair(owner->Id(), changedAttrs[i]->Index()));
         owner->EmitAttributeChanged(changedAttrs[i], change);
+    }
+    scene->EndAttributeChanges();
 
-        // Remove the dirty bit from sender's syncstate so that we do not echo the change back
-        entityState.components[owner->Id()].dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+    // Remove the dirty bits from sender's syncstate so that we do not echo the changes back
+    for (unsigned i = 0; i < signalledAttrs.size(); ++i)
+    {
+        u8 attrIndex = signalledAttrs[i].second;
+        entityState.components[signalledAttrs[i].first].dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
     }
 }
 
@@ -2952,7 +4018,7 @@ void SyncManager::HandleCreateEntityReply(UserConnection* source, const char* da
     state->entities[entityID] = state->entities[senderEntityID];    // Copy the sync state to the new ID
     state->entities[entityID].id = entityID;                        // Must remember to change ID manually
     state->entities[entityID].weak = scene->EntityById(entityID);   // Refresh the weak ptr
-    state->entities.erase(senderEntityID);                          // Remove old id from the state
+    state->entities.Erase(senderEntityID);                          // Remove old id from the state
     
     //std::cout << "CreateEntityReply, entity " << senderEntityID << " -> " << entityID << std::endl;
 
@@ -2973,9 +4039,7 @@ void SyncManager::HandleCreateEntityReply(UserConnection* source, const char* da
         //std::cout << "CreateEntityReply, component " << senderCompID << " -> " << compID << std::endl;
         
         entity->ChangeComponentId(senderCompID, compID);
-        entityState.components[compID] = entityState.components[senderCompID]; // Copy the sync state to the new ID
-        entityState.components[compID].id = compID; // Must remember to change ID manually
-        entityState.components.erase(senderCompID);
+        entityState.components.ChangeId(senderCompID, compID); // Move the sync state to the new ID
         
         // Send notification
         IComponent* comp = entity->ComponentById(compID).Get();
@@ -2986,8 +4050,8 @@ void SyncManager::HandleCreateEntityReply(UserConnection* source, const char* da
     scene->EmitEntityAcked(entity.Get(), senderEntityID);
 
     // Now mark every component dirty so they will be inspected for changes on the next update
-    for (std::map<component_id_t, ComponentSyncState>::iterator i = entityState.components.begin(); i != entityState.components.end(); ++i)
-        state->MarkComponentDirty(entityID, i->first);
+    for (auto i = entityState.components.Begin(); i != entityState.components.End(); ++i)
+        state->MarkComponentDirty(entityID, i->id);
 }
 
 void SyncManager::HandleCreateComponentsReply(UserConnection* source, const char* data, size_t numBytes)
@@ -3031,19 +4095,17 @@ void SyncManager::HandleCreateComponentsReply(UserConnection* source, const char
         //std::cout << "CreateComponentReply, component " << senderCompID << " -> " << compID << std::endl;
         
         entity->ChangeComponentId(senderCompID, compID);
-        entityState.components[compID] = entityState.components[senderCompID]; // Copy the sync state to the new ID
-        entityState.components[compID].id = compID; // Must remember to change ID manually
-        entityState.components.erase(senderCompID);
+        entityState.components.ChangeId(senderCompID, compID); // Move the sync state to the new ID
         
         // Send notification
         IComponent* comp = entity->ComponentById(compID).Get();
         scene->EmitComponentAcked(comp, senderCompID);
     }
     
-    for (auto i = entityState.components.begin(); i != entityState.components.end(); ++i)
+    for (auto i = entityState.components.Begin(); i != entityState.components.End(); ++i)
     {
         // Now mark every component dirty so they will be inspected for changes on the next update
-        state->MarkComponentDirty(entityID, i->first);
+        state->MarkComponentDirty(entityID, i->id);
     }
 }
 
@@ -11,16 +11,63 @@
 #include "Signals.h"
 
 #include "SyncState.h"
+#include "SceneChangeJournal.h"
 #include "SceneFwd.h"
 #include "AttributeChangeType.h"
 #include "EntityAction.h"
 #include "EntityPrioritizer.h"
+#include "EntityGrid.h"
+#include "SyncReceiveQueue.h"
 
+#include <Urho3D/Core/Mutex.h>
 #include <Urho3D/Core/Object.h>
+#include <Urho3D/Core/WorkQueue.h>
 
 namespace Tundra
 {
 
+class Placeable;
+class RigidBody;
+
+/// Identifies a component's serialized attribute data in the SyncManager's per-tick serialization cache.
+struct SerializedAttributesKey
+{
+    SerializedAttributesKey(entity_id_t entityId_, component_id_t componentId_, u32 protocolVersion_, const u8 *dirtyAttributes_ = 0);
+
+    bool operator < (const SerializedAttributesKey &rhs) const;
+
+    entity_id_t entityId;
+    component_id_t componentId;
+    u32 protocolVersion;
+    bool fullUpdate; ///< All attributes serialized for a component create, dirtyAttributes is not used.
+    u8 dirtyAttributes[32]; ///< The dirty attributes bitfield the data was serialized for.
+};
+
+/// Serialized attribute data shared by all user connections that have the same component changes pending.
+struct SerializedAttributes
+{
+    SerializedAttributes() : valid(false) {}
+
+    std::vector<u8> data;
+    bool valid; ///< False if the attribute buffer overflowed. The data should not be sent in that case.
+};
+
+/// Buffers for crafting sync messages. Each thread processing sync states uses its own set.
+/** The messages are serialized in place into the user connection's send buffers. These hold the attribute data
+    before it is cached, and the changes of an entity's components collected before their messages are serialized. */
+struct SyncBuffers
+{
+    char attrData[64 * 1024];
+    std::vector<u8> changedAttributes;
+    std::vector<component_id_t> dirtyComponentIds;
+    std::vector<const SerializedAttributes*> componentData;
+    std::vector<component_id_t> removedComponents;
+    std::vector<std::pair<component_id_t, u8> > removedAttributes; ///< Component ID and attribute index
+    std::vector<std::pair<IComponent*, const SerializedAttributes*> > createdComponents;
+    std::vector<std::pair<IComponent*, u8> > createdAttributes; ///< Component and attribute index
+    std::vector<std::pair<IComponent*, const SerializedAttributes*> > editedComponents;
+};
+
 /// Performs synchronization of the changes in a scene between the server and the client.
 /** SyncManager and SceneSyncState combined can be used to implement prioritization logic on how and when
     a sync state is filled per client connection. SyncManager object is only exposed to scripting on the server. */
@@ -81,6 +128,34 @@ public:
     /// Returns the prioritizer, if any. @remark Interest management
     EntityPrioritizer *Prioritizer() const { return prioritizer_; }
 
+    /// Sets the maximum outbound bandwidth per user connection in bytes per second, 0 for unlimited (server only).
+    /** Each connection's budget adapts below this to the measured round trip time and outbound queue depth.
+        The budget is checked before each entity and each of its changed components. Dirty entities and component changes
+        that do not fit into it are carried over to the next network tick.
+        See SceneSyncState::bandwidthBudget, SceneSyncState::bytesSent and SceneSyncState::deferredEntities.
+        @remark Bandwidth budget */
+    void SetMaxBytesPerSecond(u32 bytesPerSecond) { maxBytesPerSecond_ = bytesPerSecond; }
+    /// Returns the maximum outbound bandwidth per user connection in bytes per second. @remark Bandwidth budget
+    u32 MaxBytesPerSecond() const { return maxBytesPerSecond_; }
+
+    /// Sets the radius of the observers' area of interest in world units, 0 to replicate the whole scene (server only).
+    /** Requires interest management. A root entity with a Placeable, together with its child entities, is replicated to a user
+        only while it is within the radius of the observer position received from the client. Entities leaving the area are removed
+        from the client, and created again in full when they re-enter it. The area is updated on the priority update period.
+        The whole scene is replicated to a client until it has sent its observer position.
+        @remark Interest management */
+    void SetRelevanceRadius(float radius);
+    /// Returns the radius of the observers' area of interest, or 0 if the whole scene is replicated. @remark Interest management
+    float RelevanceRadius() const { return relevanceRadius_; }
+
+    /// Sets the time in seconds the client may spend applying received scene changes per frame, 0 for unlimited.
+    /** The received messages are decoded in the work queue threads, and the changes that do not fit into the budget
+        are applied on the following frames, so that joining a large scene does not stall the client.
+        @remark Client receive pipeline */
+    void SetReceiveTimeBudget(float seconds);
+    /// Returns the time in seconds the client may spend applying received scene changes per frame. @remark Client receive pipeline
+    float ReceiveTimeBudget() const { return receiveTimeBudget_; }
+
     // signals
     /// This signal is emitted when a new user connects and a new SceneSyncState is created for the connection.
     /// @note See signals of the SceneSyncState object to build prioritization logic how the sync state is filled.
@@ -90,6 +165,18 @@ private:
     /// Network message received from an user connection
     void HandleNetworkMessage(UserConnection* user, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char* data, size_t numBytes);
 
+    /// Handles a scene sync network message. Disconnects the user and returns false if the message is malformed.
+    /** @param received The entity and components decoded by the receive queue, or null to decode them from @c data. */
+    bool DispatchNetworkMessage(UserConnection* user, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char* data, size_t numBytes,
+        const ReceivedEntity *received = 0);
+
+    /// Starts decoding the newly received messages and applies the decoded ones within the receive time budget (client only).
+    /** @remark Client receive pipeline */
+    void ApplyReceivedMessages();
+
+    /// Replays new journal changes to the sync state of the user whose network message is being handled (server only).
+    void CatchUpMessageSource();
+
     /// Trigger EC sync because of component attributes changing
     void OnAttributeChanged(IComponent* comp, IAttribute* attr, AttributeChange::Type change);
 
@@ -127,20 +214,28 @@ private:
     void OnPlaceholderComponentTypeRegistered(u32 typeId, const String& typeName, AttributeChange::Type change);
 
 private:
-    /// Craft a component full update, with all static and dynamic attributes.
-    bool WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp);
+    /// Returns the cached full attribute data of a component, serializing it first if this is the first request during this network tick.
+    const SerializedAttributes &FullAttributeData(IComponent *comp, u32 protocolVersion, SyncBuffers &buffers);
+    /// Returns the cached attribute data for the dirty attributes of a component, serializing it first if this is the first request during this network tick.
+    /** @param changedAttributes Indices of the changed attributes, generated from @c dirtyAttributes. */
+    const SerializedAttributes &EditAttributeData(IComponent *comp, u32 protocolVersion, const u8 *dirtyAttributes, const std::vector<u8> &changedAttributes, SyncBuffers &buffers);
+    /// Moves serialized attribute data to the cache, unless another thread stored it first. Returns the cached data.
+    const SerializedAttributes &CacheAttributeData(const SerializedAttributesKey &key, SerializedAttributes &attrData);
     /// Handle entity action message.
     void HandleEntityAction(UserConnection* source, MsgEntityAction& msg);
     /// Handle create entity message.
-    void HandleCreateEntity(UserConnection* source, const char* data, size_t numBytes);
+    /** @param received The decoded message, or null to decode it from @c data. */
+    void HandleCreateEntity(UserConnection* source, const char* data, size_t numBytes, const ReceivedEntity *received);
     /// Handle create components message.
-    void HandleCreateComponents(UserConnection* source, const char* data, size_t numBytes);
+    /** @param received The decoded message, or null to decode it from @c data. */
+    void HandleCreateComponents(UserConnection* source, const char* data, size_t numBytes, const ReceivedEntity *received);
     /// Handle a Camera Orientation Update message
     void HandleCameraOrientation(UserConnection* source, const char* data, size_t numBytes);
     /// Handle create attributes message.
     void HandleCreateAttributes(UserConnection* source, const char* data, size_t numBytes);
     /// Handle edit attributes message.
-    void HandleEditAttributes(UserConnection* source, const char* data, size_t numBytes);
+    /** @param received The decoded message, or null to decode it from @c data. */
+    void HandleEditAttributes(UserConnection* source, const char* data, size_t numBytes, const ReceivedEntity *received);
     /// Handle remove attributes message.
     void HandleRemoveAttributes(UserConnection* source, const char* data, size_t numBytes);
     /// Handle remove components message.
@@ -159,8 +254,20 @@ private:
     void HandleSetEntityParent(UserConnection* source, const char* data, size_t numBytes);
 
     void HandleRigidBodyChanges(UserConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes);
+    /// Handles a delta-compressed rigid body update message (client only). @remark Rigid body delta stream
+    void HandleRigidBodyDeltas(UserConnection* source, const char* data, size_t numBytes);
+    /// Handles a rigid body packet acknowledgement message (server only). @remark Rigid body delta stream
+    void HandleRigidBodyAck(UserConnection* source, const char* data, size_t numBytes);
+    /// Acknowledges the rigid body packets received since the last acknowledgement (client only). @remark Rigid body delta stream
+    void SendRigidBodyAck(UserConnection* connection, SceneSyncState *senderState);
     
     void ReplicateRigidBodyChanges(UserConnection* user);
+    /// Sends the rigid body changes delta-compressed against the states the client has acknowledged. @remark Rigid body delta stream
+    void ReplicateRigidBodyDeltas(UserConnection* user);
+    /// Writes the rigid body update of @c ess to @c ds, or to a new message in @c ds and @c record if the current one is full.
+    /** @return False if the client already has the current state, and nothing was written. @remark Rigid body delta stream */
+    bool WriteRigidBodyUpdate(UserConnection* user, EntitySyncState &ess, Placeable *placeable, RigidBody *rigidBody,
+        kNet::DataSerializer &ds, RigidBodyPacketRecord *&record, kNet::tick_t now);
 
     void InterpolateRigidBodies(float frametime, SceneSyncState* state);
 
@@ -169,13 +276,45 @@ private:
     /// Read client extrapolation time parameter from command line and match it to the current sync period.
     void GetClientExtrapolationTime();
 
+    /// Adapts the bandwidth budget of a user connection and refills its byte quota for this network tick (server only). @remark Bandwidth budget
+    void UpdateBandwidthBudget(UserConnection* user, SceneSyncState* state);
+
+    /// Inserts, moves or removes @c entity in the spatial index according to its Placeable. @remark Interest management
+    /** @param updateChildren Whether to also move the entities whose Placeables are attached to the entity's Placeable. */
+    void UpdateSpatialIndex(Entity *entity, bool updateChildren = true);
+    /// Rebuilds the spatial index from the scene, or clears it if the area of interest is not in use. @remark Interest management
+    void RebuildSpatialIndex();
+    /// Adds the entities entering the observer's area of interest to @c state and removes the ones that left it. @remark Interest management
+    void UpdateAreaOfInterest(SceneSyncState *state);
+    /// Marks @c entity and its child entities dirty, so that they are created on the client. @remark Interest management
+    void EnterAreaOfInterest(SceneSyncState *state, Entity *entity);
+    /// Removes the root entity @c entity from the client, and the states of its child entities, which the client removes with it. @remark Interest management
+    void LeaveAreaOfInterest(SceneSyncState *state, Entity *entity);
+    /// Stops limiting the users' sync states to their areas of interest and marks the entities outside them dirty. @remark Interest management
+    void ResetAreasOfInterest();
+
     /// Process one user connection's sync state for changes in the scene. Note that on the client the server is a "virtual" user
-    /** @param user User connection to process */
-    void ProcessSyncState(UserConnection* user);
+    /** @param user User connection to process
+        @param buffers Message buffers of the calling thread
+        @param tickStartBytes The user's UserConnection::bytesSent at the start of the network tick. Everything sent since counts against the bandwidth budget. */
+    void ProcessSyncState(UserConnection* user, SyncBuffers &buffers, unsigned long long tickStartBytes);
 
     /// Process @c entityState that belongs to @c sceneState.
-    /** This function must only be called if @c entityState is in the @c sceneStates dirtyQueue. */
-    void ProcessEntitySyncState(bool isServer, UserConnection* user, Scene *scene, SceneSyncState *sceneState, EntitySyncState* entityState);
+    /** This function must only be called if @c entityState is in the @c sceneStates dirtyQueue.
+        @param byteLimit The user's UserConnection::bytesSent at which the bandwidth budget is spent. Component changes that do not fit are left dirty.
+        @return False if the entity was left in the queue with some of its changes unsent. */
+    bool ProcessEntitySyncState(bool isServer, UserConnection* user, Scene *scene, SceneSyncState *sceneState, EntitySyncState* entityState, SyncBuffers &buffers, unsigned long long byteLimit);
+
+    /// Sorts the dirty queue and sends out the rigid body and generic changes of an user connection (server only).
+    /** Only reads the scene and writes to the user's own sync state, so the users can be processed in parallel
+        as long as the connection is deferring its sends. */
+    void ProcessUserSyncState(UserConnection* user, SyncBuffers &buffers);
+
+    /// Work queue function for processing the sync state of the user connection in @c item->start_.
+    static void ProcessUserSyncStateWork(const Urho3D::WorkItem* item, unsigned threadIndex);
+
+    /// Processes the sync states of syncUsers_, in parallel in the work queue threads if available (server only).
+    void ProcessUserSyncStates();
     
     /// Validate the scene manipulation action. If returns false, it is ignored
     /** @param source Where the action came from
@@ -183,7 +322,7 @@ private:
         @param entityID What entity it affects */
     bool ValidateAction(UserConnection* source, unsigned messageID, entity_id_t entityID);
     
-    bool ValidateAttributeBuffer(bool fatal, kNet::DataSerializer& ds, ComponentPtr &comp, size_t maxBytes = 0);
+    bool ValidateAttributeBuffer(bool fatal, kNet::DataSerializer& ds, IComponent *comp, size_t maxBytes = 0);
     
     ScenePtr GetRegisteredScene() const { return scene_.Lock(); }
 
@@ -214,16 +353,25 @@ private:
     /// "User" representing the server connection (client only)
     KNetUserConnectionPtr serverConnection_;
     
-    /// Fixed buffers for crafting messages
-    char createEntityBuffer_[64 * 1024];
-    char createCompsBuffer_[64 * 1024];
-    char editAttrsBuffer_[64 * 1024];
-    char createAttrsBuffer_[64 * 1024];
+    /// Fixed buffer for reading received attribute data and crafting the replies
     char attrDataBuffer_[64 * 1024];
-    char removeCompsBuffer_[1024];
-    char removeEntityBuffer_[1024];
-    char removeAttrsBuffer_[1024];
-    std::vector<u8> changedAttributes_;
+    /// Message buffers for each thread that processes sync states. Index 0 is used by the main thread.
+    std::vector<SyncBuffers> syncBuffers_;
+    /// User connections whose sync states are processed on the current network tick (server only).
+    PODVector<UserConnection*> syncUsers_;
+
+    /// Attribute data serialized during the current network tick. Cleared at the start of each tick.
+    /** As the same changes are usually pending for all user connections, each changed component is serialized only once per tick
+        and the bytes are copied to the messages of all users. */
+    std::map<SerializedAttributesKey, SerializedAttributes> attrDataCache_;
+    /// Guards attrDataCache_ while the users are processed in parallel.
+    Urho3D::Mutex attrDataCacheMutex_;
+
+    /// Replicated scene changes pending to be marked dirty in the users' sync states (server only).
+    SceneChangeJournal journal_;
+
+    /// The user whose network message is currently being handled (server only).
+    UserConnection* messageSource_;
 
     /// The sender of a component type. Used to avoid sending component description back to sender
     UserConnection* componentTypeSender_;
@@ -241,6 +389,24 @@ private:
     EntityWeakPtr observer_;
     /// @remark Interest management
     EntityPrioritizer *prioritizer_;
+
+    /// Maximum outbound bandwidth per user connection in bytes per second, 0 for unlimited. @remark Bandwidth budget
+    u32 maxBytesPerSecond_;
+
+    /// Radius of the observers' area of interest, 0 if not in use. @remark Interest management
+    float relevanceRadius_;
+    /// World positions of the scene's entities that have a Placeable, maintained while the area of interest is in use (server only).
+    /** @remark Interest management */
+    EntityGrid spatialIndex_;
+    /// Work buffer for the entity IDs of an area of interest update. @remark Interest management
+    PODVector<entity_id_t> areaEntityIds_;
+
+    /// Scene messages received from the server, waiting to be decoded and applied (client only). @remark Client receive pipeline
+    SyncReceiveQueue receiveQueue_;
+    /// Time in seconds the client may spend applying received messages per frame, 0 for unlimited. @remark Client receive pipeline
+    float receiveTimeBudget_;
+    /// Decoded entity and components of the message being handled on the server.
+    ReceivedEntity receivedEntity_;
 };
 
 }
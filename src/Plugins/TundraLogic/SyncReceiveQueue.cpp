@@ -0,0 +1,266 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "SyncReceiveQueue.h"
+#include "TundraMessages.h"
+#include "UserConnection.h"
+
+#include <kNet/DataDeserializer.h>
+#include <kNet/NetException.h>
+
+namespace Tundra
+{
+
+// Number of messages decoded by one work item. A join burst is split to all worker threads in batches of this size.
+static const unsigned cDecodeBatchSize = 32;
+// The decoding runs at the lowest priority, so that it does not delay the engine's own per-frame work.
+static const unsigned cDecodePriority = 0;
+
+// Reads the size of a component's attribute data, and skips over the data.
+static void ReadAttributeData(kNet::DataDeserializer &ds, ReceivedComponent &comp)
+{
+    const u32 attrDataSize = ds.ReadVLE<kNet::VLE8_16_32>();
+    if (attrDataSize > ds.BytesLeft())
+        throw kNet::NetException("Attribute data size exceeds the message size");
+    comp.attrDataOffset = ds.BytePos();
+    comp.attrDataSize = attrDataSize;
+    ds.SkipBytes(attrDataSize);
+}
+
+SyncReceiveQueue::SyncReceiveQueue() :
+    head_(0),
+    tail_(0),
+    undecoded_(0),
+    size_(0),
+    workQueue_(0)
+{
+}
+
+SyncReceiveQueue::~SyncReceiveQueue()
+{
+    Clear();
+    for (size_t i = 0; i < free_.size(); ++i)
+        delete free_[i];
+}
+
+void SyncReceiveQueue::Push(kNet::message_id_t id, kNet::packet_id_t packetId, u32 protocolVersion, const char *data, size_t numBytes)
+{
+    ReceivedSyncMessage *msg;
+    if (!free_.empty())
+    {
+        msg = free_.back();
+        free_.pop_back();
+    }
+    else
+        msg = new ReceivedSyncMessage();
+
+    msg->id = id;
+    msg->packetId = packetId;
+    msg->protocolVersion = protocolVersion;
+    msg->data.assign(data, data + numBytes);
+    msg->decoded = false;
+    msg->valid = false;
+    msg->next = 0;
+
+    if (tail_)
+        tail_->next = msg;
+    else
+        head_ = msg;
+    tail_ = msg;
+    if (!undecoded_)
+        undecoded_ = msg;
+    ++size_;
+}
+
+void SyncReceiveQueue::StartDecode(Urho3D::WorkQueue *workQueue)
+{
+    // Forget the work items that have finished
+    for (unsigned i = 0; i < decodeItems_.Size();)
+    {
+        if (decodeItems_[i]->completed_)
+            decodeItems_.EraseSwap(i);
+        else
+            ++i;
+    }
+
+    if (!undecoded_)
+        return;
+
+    if (!workQueue || !workQueue->GetNumThreads())
+    {
+        for (ReceivedSyncMessage *msg = undecoded_; msg; msg = msg->next)
+            Decode(*msg);
+        undecoded_ = 0;
+        return;
+    }
+
+    workQueue_ = workQueue;
+    while (undecoded_)
+    {
+        ReceivedSyncMessage *last = undecoded_;
+        for (unsigned i = 1; i < cDecodeBatchSize && last->next; ++i)
+            last = last->next;
+
+        SharedPtr<Urho3D::WorkItem> item(new Urho3D::WorkItem());
+        item->workFunction_ = &SyncReceiveQueue::DecodeWork;
+        item->start_ = undecoded_;
+        item->end_ = last;
+        item->priority_ = cDecodePriority;
+        undecoded_ = last->next;
+        decodeItems_.Push(item);
+        workQueue->AddWorkItem(item);
+    }
+}
+
+ReceivedSyncMessage *SyncReceiveQueue::Front() const
+{
+    return (head_ && head_->decoded ? head_ : 0);
+}
+
+void SyncReceiveQueue::Pop()
+{
+    ReceivedSyncMessage *msg = head_;
+    if (!msg)
+        return;
+
+    head_ = msg->next;
+    if (!head_)
+        tail_ = 0;
+    if (undecoded_ == msg)
+        undecoded_ = head_;
+    --size_;
+
+    msg->entity.components.clear();
+    free_.push_back(msg);
+}
+
+void SyncReceiveQueue::Clear()
+{
+    CompleteDecode();
+    while (head_)
+    {
+        // Every message is decoded now, so the queue can be emptied without decoding the rest
+        head_->decoded = true;
+        Pop();
+    }
+    undecoded_ = 0;
+}
+
+void SyncReceiveQueue::CompleteDecode()
+{
+    if (workQueue_)
+    {
+        for (unsigned i = 0; i < decodeItems_.Size(); ++i)
+        {
+            if (!decodeItems_[i]->completed_)
+            {
+                workQueue_->Complete(cDecodePriority);
+                break;
+            }
+        }
+    }
+    decodeItems_.Clear();
+}
+
+void SyncReceiveQueue::DecodeWork(const Urho3D::WorkItem *item, unsigned /*threadIndex*/)
+{
+    ReceivedSyncMessage *msg = static_cast<ReceivedSyncMessage*>(item->start_);
+    ReceivedSyncMessage *end = static_cast<ReceivedSyncMessage*>(item->end_);
+    for (;;)
+    {
+        // Read the link before decoding, as the main thread may recycle a decoded message.
+        // The link of the last message is not read, as the main thread may be appending to it.
+        const bool last = (msg == end);
+        ReceivedSyncMessage *next = (last ? 0 : msg->next);
+        Decode(*msg);
+        if (last)
+            break;
+        msg = next;
+    }
+}
+
+void SyncReceiveQueue::Decode(ReceivedSyncMessage &msg)
+{
+    const char *data = (msg.data.empty() ? 0 : &msg.data[0]);
+    msg.valid = true;
+    try
+    {
+        switch(msg.id)
+        {
+        case cCreateEntityMessage:
+            DecodeCreateEntity(data, msg.data.size(), msg.protocolVersion, msg.entity);
+            break;
+        case cCreateComponentsMessage:
+            DecodeCreateComponents(data, msg.data.size(), msg.entity);
+            break;
+        case cEditAttributesMessage:
+            DecodeEditAttributes(data, msg.data.size(), msg.entity);
+            break;
+        }
+    }
+    catch (kNet::NetException &/*e*/)
+    {
+        msg.valid = false;
+    }
+    msg.decoded = true;
+}
+
+void SyncReceiveQueue::DecodeCreateEntity(const char *data, size_t numBytes, u32 protocolVersion, ReceivedEntity &entity)
+{
+    kNet::DataDeserializer ds(data, numBytes);
+    entity.components.clear();
+    entity.sceneId = ds.ReadVLE<kNet::VLE8_16_32>();
+    entity.id = ds.ReadVLE<kNet::VLE8_16_32>();
+    entity.temporary = ds.Read<u8>() != 0;
+    entity.parentId = (protocolVersion >= ProtocolHierarchicScene ? ds.Read<u32>() : 0);
+
+    const u32 numComponents = ds.ReadVLE<kNet::VLE8_16_32>();
+    // Each component takes at least four bytes, do not trust the count further than that
+    entity.components.reserve(Min(numComponents, (u32)ds.BytesLeft() / 4));
+    for (u32 i = 0; i < numComponents; ++i)
+    {
+        ReceivedComponent comp;
+        comp.id = ds.ReadVLE<kNet::VLE8_16_32>();
+        comp.typeId = ds.ReadVLE<kNet::VLE8_16_32>();
+        comp.name = String(ds.ReadString().c_str());
+        ReadAttributeData(ds, comp);
+        entity.components.push_back(comp);
+    }
+}
+
+void SyncReceiveQueue::DecodeCreateComponents(const char *data, size_t numBytes, ReceivedEntity &entity)
+{
+    kNet::DataDeserializer ds(data, numBytes);
+    entity.components.clear();
+    entity.sceneId = ds.ReadVLE<kNet::VLE8_16_32>();
+    entity.id = ds.ReadVLE<kNet::VLE8_16_32>();
+
+    while (ds.BitsLeft() > 2 * 8)
+    {
+        ReceivedComponent comp;
+        comp.id = ds.ReadVLE<kNet::VLE8_16_32>();
+        comp.typeId = ds.ReadVLE<kNet::VLE8_16_32>();
+        comp.name = String(ds.ReadString().c_str());
+        ReadAttributeData(ds, comp);
+        entity.components.push_back(comp);
+    }
+}
+
+void SyncReceiveQueue::DecodeEditAttributes(const char *data, size_t numBytes, ReceivedEntity &entity)
+{
+    kNet::DataDeserializer ds(data, numBytes);
+    entity.components.clear();
+    entity.sceneId = ds.ReadVLE<kNet::VLE8_16_32>();
+    entity.id = ds.ReadVLE<kNet::VLE8_16_32>();
+
+    while (ds.BitsLeft() >= 8)
+    {
+        ReceivedComponent comp;
+        comp.id = ds.ReadVLE<kNet::VLE8_16_32>();
+        comp.typeId = 0;
+        ReadAttributeData(ds, comp);
+        entity.components.push_back(comp);
+    }
+}
+
+}
@@ -0,0 +1,129 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraLogicApi.h"
+#include "TundraLogicFwd.h"
+#include "CoreTypes.h"
+
+#include <kNet/Types.h>
+
+#include <Urho3D/Container/Str.h>
+#include <Urho3D/Core/WorkQueue.h>
+
+#include <vector>
+
+namespace Tundra
+{
+
+/// A component in a received CreateEntity, CreateComponents or EditAttributes message.
+struct ReceivedComponent
+{
+    component_id_t id;
+    u32 typeId; ///< Not used by EditAttributes.
+    String name; ///< Not used by EditAttributes.
+    size_t attrDataOffset; ///< Offset of the component's attribute data in the message.
+    size_t attrDataSize; ///< Size of the component's attribute data in bytes.
+};
+
+/// The entity and components of a received CreateEntity, CreateComponents or EditAttributes message.
+/** The attribute data is left in the message, as decoding it requires the component's attributes. */
+struct ReceivedEntity
+{
+    ReceivedEntity() : sceneId(0), id(0), temporary(false), parentId(0) {}
+
+    u32 sceneId;
+    entity_id_t id;
+    bool temporary; ///< Used by CreateEntity.
+    entity_id_t parentId; ///< Used by CreateEntity on hierarchic scene protocol.
+    std::vector<ReceivedComponent> components;
+};
+
+/// A scene sync network message waiting in SyncReceiveQueue.
+struct ReceivedSyncMessage
+{
+    ReceivedSyncMessage() : id(0), packetId(0), protocolVersion(0), decoded(false), valid(false), next(0) {}
+
+    kNet::message_id_t id;
+    kNet::packet_id_t packetId;
+    u32 protocolVersion; ///< Protocol version of the connection the message was received from.
+    std::vector<char> data;
+    /// Decoded CreateEntity, CreateComponents or EditAttributes message.
+    ReceivedEntity entity;
+    /// Set when the message has been decoded. Written last by the decoding thread.
+    volatile bool decoded;
+    /// False if the message is malformed. In that case it should not be applied, and the peer should be disconnected.
+    bool valid;
+    /// The next message in the queue.
+    ReceivedSyncMessage *next;
+};
+
+/// Queue of received scene sync messages that are decoded in the work queue threads and applied in the main thread (client only).
+/** The network messages are copied to the queue as they are received. StartDecode() hands the new messages to the worker
+    threads, which parse the framing of the entity and component messages into ReceivedEntity records and validate it.
+    Front() returns the messages in the order they were received, as soon as they have been decoded, so SyncManager can apply
+    them to the scene with a per-frame time budget.
+
+    The messages are recycled to avoid reallocating their buffers during a join burst.
+    @remark Client receive pipeline */
+class TUNDRALOGIC_API SyncReceiveQueue
+{
+public:
+    SyncReceiveQueue();
+    ~SyncReceiveQueue();
+
+    /// Copies a received message to the end of the queue.
+    void Push(kNet::message_id_t id, kNet::packet_id_t packetId, u32 protocolVersion, const char *data, size_t numBytes);
+
+    /// Starts decoding the messages pushed since the previous call in the work queue threads.
+    /** If @c workQueue is null or has no threads, the messages are decoded immediately. */
+    void StartDecode(Urho3D::WorkQueue *workQueue);
+
+    /// Returns the oldest message if it has been decoded, or null if the queue is empty or the message is still being decoded.
+    ReceivedSyncMessage *Front() const;
+    /// Removes the message returned by Front().
+    void Pop();
+
+    /// Removes all messages. Waits for the messages that are being decoded first.
+    void Clear();
+
+    /// Returns the number of messages in the queue.
+    size_t Size() const { return size_; }
+    /// Returns whether the queue is empty.
+    bool Empty() const { return size_ == 0; }
+
+    /// Decodes @c msg, and marks it decoded. Malformed messages are marked invalid.
+    static void Decode(ReceivedSyncMessage &msg);
+
+    /// Decodes the entity and component framing of a CreateEntity message to @c entity.
+    /** @throw kNet::NetException if the message is malformed. */
+    static void DecodeCreateEntity(const char *data, size_t numBytes, u32 protocolVersion, ReceivedEntity &entity);
+    /// Decodes the entity and component framing of a CreateComponents message to @c entity.
+    /** @throw kNet::NetException if the message is malformed. */
+    static void DecodeCreateComponents(const char *data, size_t numBytes, ReceivedEntity &entity);
+    /// Decodes the entity and component framing of an EditAttributes message to @c entity.
+    /** @throw kNet::NetException if the message is malformed. */
+    static void DecodeEditAttributes(const char *data, size_t numBytes, ReceivedEntity &entity);
+
+private:
+    /// Work queue function for decoding the messages from @c item->start_ to @c item->end_, inclusive.
+    static void DecodeWork(const Urho3D::WorkItem *item, unsigned threadIndex);
+    /// Waits for the decoding messages to finish and forgets the work items.
+    void CompleteDecode();
+
+    /// Oldest message in the queue.
+    ReceivedSyncMessage *head_;
+    /// Newest message in the queue.
+    ReceivedSyncMessage *tail_;
+    /// Oldest message that has not been handed to decoding.
+    ReceivedSyncMessage *undecoded_;
+    size_t size_;
+    /// Popped messages, reused by Push().
+    std::vector<ReceivedSyncMessage*> free_;
+    /// Work items of the messages being decoded.
+    Vector<SharedPtr<Urho3D::WorkItem> > decodeItems_;
+    /// The work queue the items were added to.
+    Urho3D::WorkQueue *workQueue_;
+};
+
+}
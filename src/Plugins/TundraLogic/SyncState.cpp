@@ -5,12 +5,15 @@
 #include "UserConnection.h"
 #include "Scene/Scene.h"
 #include "Entity.h"
+#include "EntityGrid.h"
 #include "IComponent.h"
 #include "LoggingFunctions.h"
 
 #include <kNet.h>
 #include <Urho3D/Core/Profiler.h>
 
+#include <algorithm>
+
 namespace Tundra
 {
 
@@ -21,6 +24,181 @@ typedef EntityIdList::iterator PendingIter;
 
 const float EntitySyncState::MinUpdateRate = 5.f;
 
+void EntitySyncStateQueue::PushBack(EntitySyncState *state)
+{
+    state->prevDirty = back_;
+    state->nextDirty = 0;
+    if (back_)
+        back_->nextDirty = state;
+    else
+        front_ = state;
+    back_ = state;
+    ++size_;
+    sorted_ = false;
+}
+
+void EntitySyncStateQueue::Remove(EntitySyncState *state)
+{
+    if (state->prevDirty)
+        state->prevDirty->nextDirty = state->nextDirty;
+    else
+        front_ = state->nextDirty;
+    if (state->nextDirty)
+        state->nextDirty->prevDirty = state->prevDirty;
+    else
+        back_ = state->prevDirty;
+    state->prevDirty = 0;
+    state->nextDirty = 0;
+    --size_;
+}
+
+void EntitySyncStateQueue::Clear()
+{
+    EntitySyncState *state = front_;
+    while (state)
+    {
+        EntitySyncState *next = state->nextDirty;
+        state->prevDirty = 0;
+        state->nextDirty = 0;
+        state = next;
+    }
+    front_ = 0;
+    back_ = 0;
+    size_ = 0;
+    sorted_ = true;
+}
+
+static bool HigherFinalPriority(const EntitySyncState *lhs, const EntitySyncState *rhs)
+{
+    return lhs->FinalPriority() > rhs->FinalPriority();
+}
+
+void EntitySyncStateQueue::SortByPriority()
+{
+    if (sorted_ || size_ < 2)
+    {
+        sorted_ = true;
+        return;
+    }
+
+    sortBuffer_.Clear();
+    for (EntitySyncState *state = front_; state; state = state->nextDirty)
+        sortBuffer_.Push(state);
+    std::stable_sort(sortBuffer_.Begin(), sortBuffer_.End(), HigherFinalPriority);
+
+    front_ = 0;
+    back_ = 0;
+    size_ = 0;
+    for (unsigned i = 0; i < sortBuffer_.Size(); ++i)
+        PushBack(sortBuffer_[i]);
+    sorted_ = true;
+}
+
+void EntitySyncStateHeap::Push(EntitySyncState *state)
+{
+    states_.Push(state);
+    state->heapIndex = states_.Size() - 1;
+    SiftUp(state->heapIndex);
+}
+
+void EntitySyncStateHeap::Remove(EntitySyncState *state)
+{
+    const unsigned index = state->heapIndex;
+    EntitySyncState *last = states_.Back();
+    states_.Pop();
+    state->heapIndex = NotInHeap;
+    if (last == state)
+        return;
+
+    // Move the last state to the hole, then restore the order in whichever direction it is violated
+    Place(last, index);
+    Update(last);
+}
+
+void EntitySyncStateHeap::Update(EntitySyncState *state)
+{
+    const unsigned index = state->heapIndex;
+    if (index > 0 && state->nextSendTime < states_[(index - 1) / 2]->nextSendTime)
+        SiftUp(index);
+    else
+        SiftDown(index);
+}
+
+EntitySyncState *EntitySyncStateHeap::Pop()
+{
+    EntitySyncState *top = Top();
+    if (top)
+        Remove(top);
+    return top;
+}
+
+void EntitySyncStateHeap::Clear()
+{
+    for (unsigned i = 0; i < states_.Size(); ++i)
+        states_[i]->heapIndex = NotInHeap;
+    states_.Clear();
+}
+
+void EntitySyncStateHeap::SiftUp(unsigned index)
+{
+    EntitySyncState *state = states_[index];
+    while (index > 0)
+    {
+        unsigned parent = (index - 1) / 2;
+        if (!(state->nextSendTime < states_[parent]->nextSendTime))
+            break;
+        Place(states_[parent], index);
+        index = parent;
+    }
+    Place(state, index);
+}
+
+void EntitySyncStateHeap::SiftDown(unsigned index)
+{
+    EntitySyncState *state = states_[index];
+    const unsigned size = states_.Size();
+    for (;;)
+    {
+        unsigned child = index * 2 + 1;
+        if (child >= size)
+            break;
+        if (child + 1 < size && states_[child + 1]->nextSendTime < states_[child]->nextSendTime)
+            ++child;
+        if (!(states_[child]->nextSendTime < state->nextSendTime))
+            break;
+        Place(states_[child], index);
+        index = child;
+    }
+    Place(state, index);
+}
+
+void RigidBodyInterpolationState::StoreBaseline(u16 sequence, const RigidBodySnapshot &state)
+{
+    unsigned index = numBaselines;
+    if (numBaselines < cRigidBodyBaselineHistory)
+        ++numBaselines;
+    else
+    {
+        // Replace the oldest state, unless this one is older than all of them
+        index = 0;
+        for (unsigned i = 1; i < numBaselines; ++i)
+            if (RigidBodySequenceIsNewerThan(baselineSequences[index], baselineSequences[i]))
+                index = i;
+        if (!RigidBodySequenceIsNewerThan(sequence, baselineSequences[index]))
+            return;
+    }
+    baselineSequences[index] = sequence;
+    baselines[index] = state;
+}
+
+const RigidBodySnapshot *RigidBodyInterpolationState::FindBaseline(u16 sequence) const
+{
+    for (unsigned i = 0; i < numBaselines; ++i)
+        if (baselineSequences[i] == sequence)
+            return &baselines[i];
+    return 0;
+}
+
 StateChangeRequest::StateChangeRequest(u32 connectionID) :
     connectionID_(connectionID)
 { 
@@ -33,8 +211,21 @@ SceneSyncState::SceneSyncState(u32 userConnectionID, bool isServer) :
     changeRequest_(userConnectionID),
     isServer_(isServer),
     placeholderComponentsSent_(false),
+    journalCursor(0),
+    scheduleTime(0),
     observerPos(float3::nan),
-    observerRot(float3::nan)
+    observerRot(float3::nan),
+    bandwidthBudget(0.f),
+    byteQuota(0.f),
+    minRoundTripTime(0.f),
+    bytesSent(0),
+    deferredEntities(0),
+    areaOfInterestGrid(0),
+    rigidBodySequence(0),
+    rigidBodyAckSequence(0),
+    rigidBodyAckBits(0),
+    hasRigidBodyAck(false),
+    rigidBodyAckPending(false)
 {
     Clear();
 }
@@ -92,8 +283,7 @@ void SceneSyncState::MarkEntityPending(entity_id_t id)
 
     // If user does not have the entity in the first place, do nothing.
     // Its going to be asked to be added to the state via the permission signals later.
-    auto i = entities.find(id);
-    if (i == entities.end())
+    if (!entities.Contains(id))
         return;
 
     MarkEntityRemoved(id);  // Remove from current sync state (removes entity from client)
@@ -145,6 +335,12 @@ void SceneSyncState::SetParentScene(SceneWeakPtr scene)
     scene_ = scene;
 }
 
+EntitySyncState *SceneSyncState::FindEntitySyncState(entity_id_t id)
+{
+    auto i = entities.Find(id);
+    return i != entities.End() ? &i->second_ : 0;
+}
+
 EntitySyncState &SceneSyncState::GetOrCreateEntitySyncState(entity_id_t id)
 {
     EntitySyncState &state = entities[id];
@@ -160,31 +356,151 @@ EntitySyncState &SceneSyncState::GetOrCreateEntitySyncState(entity_id_t id)
 
 void SceneSyncState::Clear()
 {
-    dirtyEntities.Clear();
-    dirtyQueue.clear();
-    entities.clear();
+    dirtyQueue.Clear();
+    waitingQueue.Clear();
+    entities.Clear();
     pendingEntities_.clear();
     changeRequest_.Reset();
+    relevantEntities.Clear();
+    areaOfInterestGrid = 0;
+    rigidBodyPackets.Clear();
+    restingRigidBodies.Clear();
+    hasRigidBodyAck = false;
+    rigidBodyAckPending = false;
     scene_.Reset();
     placeholderComponentsSent_ = false;
 }
 
+bool SceneSyncState::IsInAreaOfInterest(Entity *entity) const
+{
+    if (!areaOfInterestGrid)
+        return true;
+    // The whole entity hierarchy is replicated based on the position of its root
+    while (entity->ParentEntity())
+        entity = entity->ParentEntity();
+    return !areaOfInterestGrid->Contains(entity->Id()) || relevantEntities.Contains(entity->Id());
+}
+
 void SceneSyncState::RemoveFromQueue(entity_id_t id)
 {
-    auto i = entities.find(id);
-    if (i != entities.end())
+    EntitySyncState *entityState = FindEntitySyncState(id);
+    if (entityState && entityState->isInQueue)
     {
-        if (i->second.isInQueue)
-        {
-            i->second.isInQueue = false;
-            for (auto j = i->second.components.begin(); j != i->second.components.end(); ++j)
-                j->second.isInQueue = false;
-            i->second.dirtyQueue.Clear();
+        entityState->isInQueue = false;
+        for (auto j = entityState->components.Begin(); j != entityState->components.End(); ++j)
+            j->isInQueue = false;
+
+        if (entityState->heapIndex != EntitySyncStateHeap::NotInHeap)
+            waitingQueue.Remove(entityState);
+        else
+            dirtyQueue.Remove(entityState);
+    }
+}
 
-            dirtyEntities.Erase(id);
-            dirtyQueue.remove(&i->second);
+void SceneSyncState::ReleaseDueEntities(kNet::tick_t now)
+{
+    scheduleTime = now;
+    while (!waitingQueue.Empty() && waitingQueue.Top()->nextSendTime <= now)
+        dirtyQueue.PushBack(waitingQueue.Pop());
+}
+
+void SceneSyncState::RefreshUpdateIntervals(float maxUpdateRate)
+{
+    const float ticksPerSec = (float)kNet::Clock::TicksPerSec();
+    for (auto i = entities.Begin(); i != entities.End(); ++i)
+    {
+        EntitySyncState &entityState = i->second_;
+        const float interval = entityState.ComputePrioritizedUpdateInterval(maxUpdateRate);
+        if (entityState.nextSendTime)
+        {
+            // Keep the time of the last send, and move the due time according to the new interval
+            const kNet::tick_t lastSendTime = entityState.nextSendTime - (kNet::tick_t)(entityState.updateInterval * ticksPerSec);
+            entityState.nextSendTime = lastSendTime + (kNet::tick_t)(interval * ticksPerSec);
+            if (entityState.heapIndex != EntitySyncStateHeap::NotInHeap)
+                waitingQueue.Update(&entityState);
         }
+        entityState.updateInterval = interval;
     }
+    dirtyQueue.MarkPrioritiesChanged();
+}
+
+RigidBodyPacketRecord &SceneSyncState::BeginRigidBodyPacket()
+{
+    if (rigidBodyPackets.Empty())
+        rigidBodyPackets.Resize(cRigidBodyBaselineWindow);
+    RigidBodyPacketRecord &record = rigidBodyPackets[rigidBodySequence % cRigidBodyBaselineWindow];
+    record.sequence = rigidBodySequence++;
+    record.valid = true;
+    record.entries.Clear();
+    return record;
+}
+
+const RigidBodySnapshot *SceneSyncState::RigidBodyBaseline(const EntitySyncState &entityState, u16 sequence) const
+{
+    if (!entityState.hasRigidBodyBaseline)
+        return 0;
+    // The baseline sequence is encoded relative to the packet, and the client keeps only the latest states of each body
+    if ((u16)(sequence - entityState.rigidBodyBaselineSequence) - 1u >= cRigidBodyBaselineWindow)
+        return 0;
+    if ((u8)(entityState.rigidBodySendIndex - entityState.rigidBodyBaselineSendIndex) > cRigidBodyBaselineHistory)
+        return 0;
+    return &entityState.rigidBodyBaseline;
+}
+
+void SceneSyncState::AckRigidBodyPacket(u16 sequence)
+{
+    if (rigidBodyPackets.Empty())
+        return;
+    RigidBodyPacketRecord &record = rigidBodyPackets[sequence % cRigidBodyBaselineWindow];
+    if (!record.valid || record.sequence != sequence)
+        return; // Already acknowledged, or too old
+    record.valid = false;
+
+    for (unsigned i = 0; i < record.entries.Size(); ++i)
+    {
+        const RigidBodyPacketRecord::Entry &entry = record.entries[i];
+        EntitySyncState *entityState = FindEntitySyncState(entry.id);
+        if (!entityState || entityState->isNew || entityState->removed)
+            continue;
+        if (entityState->hasRigidBodyBaseline && !RigidBodySequenceIsNewerThan(sequence, entityState->rigidBodyBaselineSequence))
+            continue;
+        entityState->rigidBodyBaseline = entry.state;
+        entityState->rigidBodyBaselineSequence = sequence;
+        entityState->rigidBodyBaselineSendIndex = entry.sendIndex;
+        entityState->hasRigidBodyBaseline = true;
+    }
+    record.entries.Clear();
+}
+
+void SceneSyncState::MarkRigidBodyPacketReceived(u16 sequence)
+{
+    if (!hasRigidBodyAck)
+    {
+        rigidBodyAckSequence = sequence;
+        rigidBodyAckBits = 0;
+        hasRigidBodyAck = true;
+    }
+    else if (RigidBodySequenceIsNewerThan(sequence, rigidBodyAckSequence))
+    {
+        const unsigned shift = (u16)(sequence - rigidBodyAckSequence);
+        rigidBodyAckBits = (shift <= 32 ? (u32)((((u64)rigidBodyAckBits << 1) | 1) << (shift - 1)) : 0);
+        rigidBodyAckSequence = sequence;
+    }
+    else
+    {
+        const unsigned age = (u16)(rigidBodyAckSequence - sequence);
+        if (age >= 1 && age <= 32)
+            rigidBodyAckBits |= 1u << (age - 1);
+    }
+    rigidBodyAckPending = true;
+}
+
+void SceneSyncState::QueueEntity(EntitySyncState &entityState)
+{
+    if (entityState.nextSendTime > scheduleTime)
+        waitingQueue.Push(&entityState);
+    else
+        dirtyQueue.PushBack(&entityState);
 }
 
 void SceneSyncState::MarkEntityProcessed(entity_id_t id)
@@ -197,8 +513,6 @@ void SceneSyncState::MarkComponentProcessed(entity_id_t id, component_id_t compI
 {
     EntitySyncState& entityState = GetOrCreateEntitySyncState(id);
     ComponentSyncState& compState = entityState.components[compId];
-    if (!compState.id)
-        compState.id = compId;
     compState.DirtyProcessed();
 }
 
@@ -220,8 +534,7 @@ bool SceneSyncState::MarkEntityDirty(entity_id_t id, bool hasPropertyChanges, bo
     EntitySyncState& entityState = GetOrCreateEntitySyncState(id);
     if (!entityState.isInQueue)
     {
-        dirtyEntities.Insert(Urho3D::MakePair(id, &entityState));
-        dirtyQueue.push_back(&entityState);
+        QueueEntity(entityState);
         entityState.isInQueue = true;
     }
     if (hasPropertyChanges)
@@ -238,24 +551,24 @@ void SceneSyncState::MarkEntityRemoved(entity_id_t id)
         RemovePendingEntity(id);
 
     // If user did not have the entity in the first place, do nothing
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i == entities.end())
+    EntitySyncState *entityState = FindEntitySyncState(id);
+    if (!entityState)
         return;
     // If entity is marked new, it was not sent yet and can be simply removed from the sync state
-    if (i->second.isNew)
+    if (entityState->isNew)
     {
         RemoveFromQueue(id);
-        entities.erase(id);
+        entities.Erase(id);
         return;
     }
-    // Else mark as removed and queue the update
-    i->second.removed = true;
-    if (!i->second.isInQueue)
-    {
-        dirtyEntities.Insert(Urho3D::MakePair(id, &i->second));
-        dirtyQueue.push_back(&i->second);
-        i->second.isInQueue = true;
-    }
+    // Else mark as removed and queue the update. Removals are sent without waiting for the update interval.
+    entityState->removed = true;
+    if (entityState->heapIndex != EntitySyncStateHeap::NotInHeap)
+        waitingQueue.Remove(entityState);
+    else if (entityState->isInQueue)
+        return;
+    dirtyQueue.PushBack(entityState);
+    entityState->isInQueue = true;
 }
 
 void SceneSyncState::MarkComponentDirty(entity_id_t id, component_id_t compId)
@@ -270,11 +583,11 @@ void SceneSyncState::MarkComponentDirty(entity_id_t id, component_id_t compId)
 void SceneSyncState::MarkComponentRemoved(entity_id_t id, component_id_t compId)
 {
     // If user did not have the entity or component in the first place, do nothing
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i != entities.end())
+    EntitySyncState *entityState = FindEntitySyncState(id);
+    if (entityState)
     {
         MarkEntityDirty(id);
-        i->second.MarkComponentRemoved(compId);
+        entityState->MarkComponentRemoved(compId);
     }
 }
 
@@ -289,6 +602,18 @@ void SceneSyncState::MarkAttributeDirty(entity_id_t id, component_id_t compId, u
     }
 }
 
+void SceneSyncState::MarkAttributesDirty(entity_id_t id, component_id_t compId, const u8 *dirtyAttributes)
+{
+    if (MarkEntityDirty(id))
+    {
+        EntitySyncState& entityState = GetOrCreateEntitySyncState(id);
+        entityState.MarkComponentDirty(compId);
+        ComponentSyncState& compState = entityState.components[compId];
+        for (unsigned i = 0; i < 32; ++i)
+            compState.dirtyAttributes[i] |= dirtyAttributes[i];
+    }
+}
+
 void SceneSyncState::MarkAttributeCreated(entity_id_t id, component_id_t compId, u8 attrIndex)
 {
     if (MarkEntityDirty(id))
@@ -325,13 +650,16 @@ bool SceneSyncState::ShouldMarkAsDirty(entity_id_t id)
     // Only request if this entity does not have a sync state yet.
     // Otherwise this id will spam the signal handler on every change if
     // the addition to sync state was accepted.
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i == entities.end())
+    if (!entities.Contains(id))
     {
         // Scene or entity null, do not process yet.
         if (!FillRequest(id))
             return false;
 
+        // Entities outside the area of interest are not tracked at all. They are marked dirty when they enter it.
+        if (!IsInAreaOfInterest(changeRequest_.GetEntity()))
+            return false;
+
         AboutToDirtyEntity.Emit(&changeRequest_);
 
         // Rejected, mark entity as pending.
@@ -413,19 +741,17 @@ EntitySyncState& SceneSyncState::MarkEntityDirtySilent(entity_id_t id)
     // Verify that this entity is not known to this client state.
     // If it is we need to remove the ptr from any queues and remove the entity state.
     // This ensures the below creates a new EntitySyncState with isNew == true.
-    std::map<entity_id_t, EntitySyncState>::iterator existingIter = entities.find(id);
-    if (existingIter != entities.end())
+    if (entities.Contains(id))
     {
         LogWarning(String("SceneSyncState::MarkEntityDirtySilent: State for Entity " + String(id) + " already exist, removing for full recreation."));
         RemoveFromQueue(id);
-        entities.erase(existingIter);
+        entities.Erase(id);
     }
 
     EntitySyncState& entityState = GetOrCreateEntitySyncState(id);
     if (!entityState.isInQueue)
     {
-        dirtyEntities.Insert(Urho3D::MakePair(id, &entityState));
-        dirtyQueue.push_back(&entityState);
+        dirtyQueue.PushBack(&entityState);
         entityState.isInQueue = true;
     }
     return entityState;
@@ -22,6 +22,8 @@
 #include <Urho3D/Core/Variant.h>
 #include <Urho3D/Container/List.h>
 #include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/HashSet.h>
+#include <Urho3D/Container/Vector.h>
 //#include <list>
 #include <map>
 #include <set>
@@ -41,7 +43,11 @@ struct ComponentSyncState
         id(0)
     {
         for (unsigned i = 0; i < 32; ++i)
+        {
             dirtyAttributes[i] = 0;
+            createdAttributes[i] = 0;
+            removedAttributes[i] = 0;
+        }
     }
     
     void MarkAttributeDirty(u8 attrIndex)
@@ -51,30 +57,156 @@ struct ComponentSyncState
     
     void MarkAttributeCreated(u8 attrIndex)
     {
-        newAndRemovedAttributes[attrIndex] = true;
+        createdAttributes[attrIndex >> 3] |= (1 << (attrIndex & 7));
+        removedAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
     }
     
     void MarkAttributeRemoved(u8 attrIndex)
     {
-        newAndRemovedAttributes[attrIndex] = false;
+        removedAttributes[attrIndex >> 3] |= (1 << (attrIndex & 7));
+        createdAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
     }
+
+    /// Forgets a pending dynamic attribute creation or removal.
+    void ClearAttributeCreatedOrRemoved(u8 attrIndex)
+    {
+        createdAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+        removedAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+    }
+
+    bool IsAttributeCreated(u8 attrIndex) const { return (createdAttributes[attrIndex >> 3] & (1 << (attrIndex & 7))) != 0; }
+    bool IsAttributeRemoved(u8 attrIndex) const { return (removedAttributes[attrIndex >> 3] & (1 << (attrIndex & 7))) != 0; }
     
     void DirtyProcessed()
     {
         for (unsigned i = 0; i < 32; ++i)
+        {
             dirtyAttributes[i] = 0;
-        newAndRemovedAttributes.Clear();
+            createdAttributes[i] = 0;
+            removedAttributes[i] = 0;
+        }
         isNew = false;
     }
     
     u8 dirtyAttributes[32]; ///< Dirty attributes bitfield. A maximum of 256 attributes are supported.
-    Urho3D::HashMap<u8, bool> newAndRemovedAttributes; ///< Dynamic attributes by index that have been removed or created since last update. True = create, false = delete
+    u8 createdAttributes[32]; ///< Dynamic attributes that have been created since last update, bitfield.
+    u8 removedAttributes[32]; ///< Dynamic attributes that have been removed since last update, bitfield.
     component_id_t id; ///< Component ID. Duplicated here intentionally to allow recognizing the component without the parent map.
     bool removed; ///< The component has been removed since last update
     bool isNew; ///< The client does not have the component and it must be serialized in full
-    bool isInQueue; ///< The component is already in the entity's dirty queue
+    bool isInQueue; ///< The component is dirty and will be processed on the next update
 };
 
+/// Entity's component sync states, stored contiguously and ordered by component ID.
+/** Entities have only a handful of components, so a binary search over a dense array is both
+    faster and considerably smaller than a node-based map. References are invalidated when a state is added or erased. */
+class ComponentSyncStateVector
+{
+public:
+    typedef Vector<ComponentSyncState>::Iterator Iterator;
+    typedef Vector<ComponentSyncState>::ConstIterator ConstIterator;
+
+    /// Returns the state of component @c id, or null if it does not exist.
+    ComponentSyncState *Find(component_id_t id)
+    {
+        unsigned index = LowerBound(id);
+        return (index < states_.Size() && states_[index].id == id) ? &states_[index] : 0;
+    }
+
+    /// Returns the state of component @c id, creating it if it does not exist.
+    ComponentSyncState &operator [](component_id_t id)
+    {
+        unsigned index = LowerBound(id);
+        if (index >= states_.Size() || states_[index].id != id)
+        {
+            ComponentSyncState state;
+            state.id = id;
+            states_.Insert(index, state);
+        }
+        return states_[index];
+    }
+
+    /// Erases the state of component @c id. Returns false if it did not exist.
+    bool Erase(component_id_t id)
+    {
+        unsigned index = LowerBound(id);
+        if (index >= states_.Size() || states_[index].id != id)
+            return false;
+        states_.Erase(index);
+        return true;
+    }
+
+    /// Moves the state of component @c oldId to @c newId.
+    void ChangeId(component_id_t oldId, component_id_t newId)
+    {
+        ComponentSyncState state = (*this)[oldId];
+        Erase(oldId);
+        state.id = newId;
+        (*this)[newId] = state;
+    }
+
+    void Clear() { states_.Clear(); }
+    unsigned Size() const { return states_.Size(); }
+    bool Empty() const { return states_.Empty(); }
+
+    Iterator Begin() { return states_.Begin(); }
+    Iterator End() { return states_.End(); }
+    ConstIterator Begin() const { return states_.Begin(); }
+    ConstIterator End() const { return states_.End(); }
+
+private:
+    unsigned LowerBound(component_id_t id) const
+    {
+        unsigned first = 0;
+        unsigned count = states_.Size();
+        while (count > 0)
+        {
+            unsigned step = count / 2;
+            if (states_[first + step].id < id)
+            {
+                first += step + 1;
+                count -= step + 1;
+            }
+            else
+                count = step;
+        }
+        return first;
+    }
+
+    Vector<ComponentSyncState> states_;
+};
+
+/// Rigid body state as the client reconstructs it from the delta-compressed rigid body stream.
+/** The default state is the implicit baseline of the bodies that have no acknowledged baseline yet.
+    @remark Rigid body delta stream */
+struct RigidBodySnapshot
+{
+    RigidBodySnapshot() :
+        pos(float3::zero),
+        rot(Quat::identity),
+        scale(float3::one),
+        linearVelocity(float3::zero),
+        angularVelocity(float3::zero)
+    {
+    }
+
+    float3 pos;
+    Quat rot;
+    float3 scale;
+    float3 linearVelocity;
+    float3 angularVelocity; ///< Euler ZYX in radians.
+};
+
+/// Number of the most recent rigid body packets that can serve as a delta baseline. @remark Rigid body delta stream
+static const unsigned cRigidBodyBaselineWindow = 32;
+/// Number of the most recently received states of each rigid body the client keeps as possible baselines. @remark Rigid body delta stream
+static const unsigned cRigidBodyBaselineHistory = 8;
+/// Number of times a body that has come to rest is sent unreliably, unless acknowledged sooner. @remark Rigid body delta stream
+static const unsigned cRigidBodyRestRedundancy = 3;
+
+/// Returns whether the rigid body packet sequence number @c a is newer than @c b, accounting for the wrap-around.
+inline bool RigidBodySequenceIsNewerThan(u16 a, u16 b) { return (s16)(u16)(a - b) > 0; }
+
 /// Entity's per-user network sync state
 struct EntitySyncState
 {
@@ -85,7 +217,18 @@ struct EntitySyncState
         hasPropertyChanges(false),
         hasParentChange(false),
         id(0),
+        prevDirty(0),
+        nextDirty(0),
+        heapIndex(0xffffffff),
+        nextSendTime(0),
+        updateInterval(0.f),
         avgUpdateInterval(0.0f),
+        lastNetworkSendTime(0),
+        hasRigidBodyBaseline(false),
+        rigidBodyBaselineSequence(0),
+        rigidBodyBaselineSendIndex(0),
+        rigidBodySendIndex(0),
+        rigidBodyRestSends(0),
         priority(-1.f),
         relevancy(-1.f)
     {
@@ -93,66 +236,50 @@ struct EntitySyncState
     
     void RemoveFromQueue(component_id_t id)
     {
-        auto i = components.find(id);
-        if (i != components.end())
-        {
-            if (i->second.isInQueue)
-            {
-                for (auto j = dirtyQueue.Begin(); j != dirtyQueue.End(); ++j)
-                {
-                    if ((*j) == &i->second)
-                    {
-                        dirtyQueue.Erase(j);
-                        break;
-                    }
-                }
-                i->second.isInQueue = false;
-            }
-        }
+        ComponentSyncState *compState = components.Find(id);
+        if (compState)
+            compState->isInQueue = false;
     }
     
     void MarkComponentDirty(component_id_t id)
     {
         ComponentSyncState& compState = components[id]; // Creates new if did not exist
-        if (!compState.id)
-            compState.id = id;
-        if (!compState.isInQueue)
-        {
-            dirtyQueue.Push(&compState);
-            compState.isInQueue = true;
-        }
+        compState.isInQueue = true;
     }
     
     void MarkComponentRemoved(component_id_t id)
     {
         // If user did not have the component in the first place, do nothing
-        auto i = components.find(id);
-        if (i == components.end())
+        ComponentSyncState *compState = components.Find(id);
+        if (!compState)
             return;
         // If component is marked new, it was not sent yet and can be simply removed from the sync state
-        if (i->second.isNew)
+        if (compState->isNew)
         {
-            RemoveFromQueue(id);
-            components.erase(id);
+            components.Erase(id);
             return;
         }
         // Else mark as removed and queue the update
-        i->second.removed = true;
-        if (!i->second.isInQueue)
-        {
-            dirtyQueue.Push(&i->second);
-            i->second.isInQueue = true;
-        }
+        compState->removed = true;
+        compState->isInQueue = true;
+    }
+
+    /// Returns whether any component is queued for processing.
+    bool HasDirtyComponents() const
+    {
+        for (auto i = components.Begin(); i != components.End(); ++i)
+            if (i->isInQueue)
+                return true;
+        return false;
     }
     
     void DirtyProcessed()
     {
-        for (auto i = components.begin(); i != components.end(); ++i)
+        for (auto i = components.Begin(); i != components.End(); ++i)
         {
-            i->second.DirtyProcessed();
-            i->second.isInQueue = false;
+            i->DirtyProcessed();
+            i->isInQueue = false;
         }
-        dirtyQueue.Clear();
         isNew = false;
         hasPropertyChanges = false;
         hasParentChange = false;
@@ -187,17 +314,27 @@ struct EntitySyncState
     static const float MinUpdateRate; ///< 5 (in seconds)
 //    static const float MaxUpdateRate; ///< 0.005 (in seconds)
 
-    Urho3D::List<ComponentSyncState*> dirtyQueue; ///< Dirty components
-    std::map<component_id_t, ComponentSyncState> components; ///< Component syncstates
+    ComponentSyncStateVector components; ///< Component syncstates. Dirty components have isInQueue set.
 
     entity_id_t id; ///< Entity ID. Duplicated here intentionally to allow recognizing the entity without the parent map.
     EntityWeakPtr weak; ///< Entity weak ptr.
 
     bool removed; ///< The entity has been removed since last update
     bool isNew; ///< The client does not have the entity and it must be serialized in full
-    bool isInQueue; ///< The entity is already in the scene's dirty queue
+    bool isInQueue; ///< The entity is dirty, and in either the scene's dirty queue or its waiting queue
     bool hasPropertyChanges; ///< The entity has changes into its other properties, such as temporary flag
     bool hasParentChange; ///> The entity's parent has changed
+
+    EntitySyncState *prevDirty; ///< Previous state in the scene's dirty queue, if isInQueue.
+    EntitySyncState *nextDirty; ///< Next state in the scene's dirty queue, if isInQueue.
+    unsigned heapIndex; ///< Position in the scene's waiting queue, or EntitySyncStateHeap::NotInHeap.
+
+    /// Time the entity is due to be sent again, 0 if due immediately (server only).
+    /** Dirty entities wait in SceneSyncState::waitingQueue until then. @remark Interest management */
+    kNet::tick_t nextSendTime;
+    /// Prioritized network update interval in seconds, cached from ComputePrioritizedUpdateInterval() when the priorities are updated.
+    /** @remark Interest management */
+    float updateInterval;
     
     kNet::PolledTimer updateTimer; ///< Last update received timer, for calculating avgUpdateInterval.
     float avgUpdateInterval; ///< Average network update interval in seconds, used for interpolation.
@@ -209,6 +346,14 @@ struct EntitySyncState
     float3 angularVelocity;
     kNet::tick_t lastNetworkSendTime; /**< @note Shared usage by rigid body optimization and interest management. */
 
+    /// Newest rigid body state the client has acknowledged, if hasRigidBodyBaseline (server only). @remark Rigid body delta stream
+    RigidBodySnapshot rigidBodyBaseline;
+    bool hasRigidBodyBaseline; ///< Whether rigidBodyBaseline is set. @remark Rigid body delta stream
+    u16 rigidBodyBaselineSequence; ///< Sequence number of the packet rigidBodyBaseline was sent in. @remark Rigid body delta stream
+    u8 rigidBodyBaselineSendIndex; ///< Value of rigidBodySendIndex when rigidBodyBaseline was sent. @remark Rigid body delta stream
+    u8 rigidBodySendIndex; ///< Number of times the rigid body has been sent, wrapping around. @remark Rigid body delta stream
+    u8 rigidBodyRestSends; ///< Redundant sends left for the rigid body that has come to rest. @remark Rigid body delta stream
+
     /// Priority = size / distance for visible entities, inf for non-visible.
     /** Larger number means larger importancy. If this value has not been yet calculated it's < 0.
         Used to determinate the prioritized update interval of the entity together with relevancy.
@@ -223,7 +368,7 @@ struct EntitySyncState
     float relevancy;
 };
 
-struct RigidBodyInterpolationState
+struct TUNDRALOGIC_API RigidBodyInterpolationState
 {
     // On the client side, remember the state for performing Hermite interpolation (C1, i.e. pos and vel are continuous).
     struct RigidBodyState
@@ -245,7 +390,108 @@ struct RigidBodyInterpolationState
 
     /// Remembers the packet id of the most recently received network sync packet. Used to enforce
     /// proper ordering (generate latest-data-guarantee messaging) for the received movement packets.
+    /// With the delta-compressed rigid body stream, the sequence number of the rigid body packet instead.
     kNet::packet_id_t lastReceivedPacketCounter;
+
+    RigidBodyInterpolationState() : numBaselines(0) {}
+
+    /// Stores @c state received in the rigid body packet @c sequence as a possible delta baseline.
+    /** Keeps the cRigidBodyBaselineHistory newest states, so that a late packet never evicts a newer state.
+        @remark Rigid body delta stream */
+    void StoreBaseline(u16 sequence, const RigidBodySnapshot &state);
+    /// Returns the state received in the rigid body packet @c sequence, or null if it is not stored. @remark Rigid body delta stream
+    const RigidBodySnapshot *FindBaseline(u16 sequence) const;
+
+private:
+    RigidBodySnapshot baselines[cRigidBodyBaselineHistory];
+    u16 baselineSequences[cRigidBodyBaselineHistory];
+    unsigned numBaselines;
+};
+
+/// Record of the rigid bodies sent in a rigid body packet, used to set their baselines when the client acknowledges the packet (server only).
+/** @remark Rigid body delta stream */
+struct RigidBodyPacketRecord
+{
+    RigidBodyPacketRecord() : sequence(0), valid(false) {}
+
+    struct Entry
+    {
+        entity_id_t id;
+        u8 sendIndex; ///< EntitySyncState::rigidBodySendIndex of the send.
+        RigidBodySnapshot state;
+    };
+
+    u16 sequence;
+    bool valid; ///< False if the record is unused or already acknowledged.
+    PODVector<Entry> entries;
+};
+
+/// Intrusive queue of dirty entity sync states, linked through EntitySyncState::prevDirty and EntitySyncState::nextDirty.
+/** Pushing and removing are O(1) and never allocate memory. A state can be in at most one queue at a time,
+    SceneSyncState tracks the membership with EntitySyncState::isInQueue. */
+class TUNDRALOGIC_API EntitySyncStateQueue
+{
+public:
+    EntitySyncStateQueue() : front_(0), back_(0), size_(0), sorted_(true) {}
+
+    /// Appends @c state to the end of the queue.
+    void PushBack(EntitySyncState *state);
+    /// Unlinks @c state from the queue. The state must be in this queue.
+    void Remove(EntitySyncState *state);
+    /// Unlinks all states.
+    void Clear();
+    /// Sorts the queue by descending EntitySyncState::FinalPriority(), keeping the order of equal priority states.
+    void SortByPriority();
+
+    /// Forces the next SortByPriority() to sort, after the priorities of the queued states have changed.
+    void MarkPrioritiesChanged() { sorted_ = false; }
+
+    EntitySyncState *Front() const { return front_; }
+    EntitySyncState *Back() const { return back_; }
+    unsigned Size() const { return size_; }
+    bool Empty() const { return size_ == 0; }
+
+private:
+    EntitySyncState *front_;
+    EntitySyncState *back_;
+    unsigned size_;
+    /// Whether the queue is in priority order, ie. nothing has been pushed and no priority has changed since the last sort.
+    bool sorted_;
+    /// Work buffer for sorting.
+    PODVector<EntitySyncState*> sortBuffer_;
+};
+
+/// Binary min-heap of entity sync states ordered by EntitySyncState::nextSendTime.
+/** Each state stores its position in EntitySyncState::heapIndex, so removing or rescheduling a state is O(log n).
+    @remark Interest management */
+class TUNDRALOGIC_API EntitySyncStateHeap
+{
+public:
+    /// EntitySyncState::heapIndex of a state that is not in a heap.
+    static const unsigned NotInHeap = 0xffffffff;
+
+    /// Adds @c state to the heap.
+    void Push(EntitySyncState *state);
+    /// Removes @c state from the heap. The state must be in this heap.
+    void Remove(EntitySyncState *state);
+    /// Restores the heap order after the EntitySyncState::nextSendTime of @c state has changed.
+    void Update(EntitySyncState *state);
+    /// Removes and returns the state due first, or null if empty.
+    EntitySyncState *Pop();
+    /// Removes all states.
+    void Clear();
+
+    /// Returns the state due first, or null if empty.
+    EntitySyncState *Top() const { return states_.Empty() ? 0 : states_.Front(); }
+    unsigned Size() const { return states_.Size(); }
+    bool Empty() const { return states_.Empty(); }
+
+private:
+    void SiftUp(unsigned index);
+    void SiftDown(unsigned index);
+    void Place(EntitySyncState *state, unsigned index) { states_[index] = state; state->heapIndex = index; }
+
+    PODVector<EntitySyncState*> states_;
 };
 
 /// State change request to permit/deny changes.
@@ -309,14 +555,22 @@ public:
     /// Entity sync states
     EntitySyncStateMap entities; 
 
-    /// Dirty entity states by ID pending processing
-    Urho3D::HashMap<entity_id_t,EntitySyncState*> dirtyEntities;
-    /// Dirty entity list pending processing. @remark Interest management
-    std::list<EntitySyncState*> dirtyQueue;
+    /// Dirty entity states pending processing. Sorted by priority when interest management is enabled.
+    EntitySyncStateQueue dirtyQueue;
+
+    /// Dirty entity states that are not due to be sent yet, ordered by EntitySyncState::nextSendTime (server only).
+    /** ReleaseDueEntities() moves them to dirtyQueue, so the states that are not due are not touched on a network tick.
+        @remark Interest management */
+    EntitySyncStateHeap waitingQueue;
+    /// Time of the latest network tick. States dirtied after it that are due later wait in waitingQueue. @remark Interest management
+    kNet::tick_t scheduleTime;
 
     /// Entity interpolations
     std::map<entity_id_t, RigidBodyInterpolationState> entityInterpolations;
 
+    /// Sequence number of the next SceneChangeJournal change this state has not yet replayed (server only).
+    u32 journalCursor;
+
     /// Queued EntityAction messages. These will be sent to the user on the next network update tick.
     std::vector<MsgEntityAction> queuedActions;
 
@@ -327,6 +581,45 @@ public:
     /** If !IsFinite() ObserverPosition message has not been been received from the client. */
     float3 observerRot;
 
+    /// Outbound bandwidth budget of the connection in bytes per second, or 0 if unlimited (server only).
+    /** Adapted on each network tick to the measured round trip time and outbound queue depth of the connection.
+        @remark Bandwidth budget */
+    float bandwidthBudget;
+    /// Bytes the connection may still send. Refilled from the budget on each network tick, negative if the previous ticks overran it. @remark Bandwidth budget
+    float byteQuota;
+    /// Smallest round trip time measured for the connection in milliseconds, used as the congestion baseline. @remark Bandwidth budget
+    float minRoundTripTime;
+    /// Bytes sent to the connection on the last network tick.
+    u32 bytesSent;
+    /// Number of dirty entities carried over to the next network tick on the last tick, because the bandwidth budget was spent.
+    u32 deferredEntities;
+
+    /// Spatial index of the scene limiting the replicated entities to the observer's area of interest, or null if not in use (server only).
+    /** Set by SyncManager once the observer position is known, see SyncManager::SetRelevanceRadius.
+        @remark Interest management */
+    const EntityGrid *areaOfInterestGrid;
+    /// Root entities within the observer's area of interest. Their entity hierarchies are replicated to the user (server only).
+    /** Root entities that are not in areaOfInterestGrid, ie. have no Placeable, are always replicated.
+        @remark Interest management */
+    HashSet<entity_id_t> relevantEntities;
+
+    /// Sequence number of the next rigid body packet (server only). @remark Rigid body delta stream
+    u16 rigidBodySequence;
+    /// Records of the recently sent rigid body packets, indexed by sequence number modulo cRigidBodyBaselineWindow (server only).
+    /** @remark Rigid body delta stream */
+    Vector<RigidBodyPacketRecord> rigidBodyPackets;
+    /// Rigid bodies that have come to rest, sent redundantly until acknowledged or cRigidBodyRestRedundancy times (server only).
+    /** @remark Rigid body delta stream */
+    HashSet<entity_id_t> restingRigidBodies;
+
+    /// Newest rigid body packet received and decoded, if hasRigidBodyAck (client only). @remark Rigid body delta stream
+    u16 rigidBodyAckSequence;
+    /// Bitmask of the received and decoded packets preceding rigidBodyAckSequence, bit 0 being the one just before it (client only).
+    /** @remark Rigid body delta stream */
+    u32 rigidBodyAckBits;
+    bool hasRigidBodyAck; ///< Whether a rigid body packet has been received (client only). @remark Rigid body delta stream
+    bool rigidBodyAckPending; ///< Whether packets have been received since the last acknowledgement was sent (client only). @remark Rigid body delta stream
+
     // signals
 
     /// This signal is emitted when a entity is being added to the client sync state.
@@ -369,12 +662,35 @@ public:
     void SetParentScene(SceneWeakPtr scene);
     void Clear();
 
+    /// Returns the entity sync state, or null if it does not exist.
+    EntitySyncState *FindEntitySyncState(entity_id_t id);
+
     /// Gets or creates a new entity sync state.
     /** If a new state is created it will get initialized with id and EntityWeakPtr. */
     EntitySyncState &GetOrCreateEntitySyncState(entity_id_t id);
     
     void RemoveFromQueue(entity_id_t id);
 
+    /// Moves the states whose send time has come from waitingQueue to dirtyQueue, and sets scheduleTime to @c now.
+    /** @remark Interest management */
+    void ReleaseDueEntities(kNet::tick_t now);
+    /// Caches the prioritized update intervals of all entities after their priorities have been computed, and reschedules the waiting ones.
+    /** @remark Interest management */
+    void RefreshUpdateIntervals(float maxUpdateRate);
+
+    /// Starts recording the next rigid body packet. The packet is sent with the sequence number of the returned record (server only).
+    /** @remark Rigid body delta stream */
+    RigidBodyPacketRecord &BeginRigidBodyPacket();
+    /// Returns the acknowledged state of @c entityState to encode the rigid body packet @c sequence against, or null if the client may no longer have it.
+    /** @remark Rigid body delta stream */
+    const RigidBodySnapshot *RigidBodyBaseline(const EntitySyncState &entityState, u16 sequence) const;
+    /// Makes the states sent in the rigid body packet @c sequence the baselines of their entities, as the client has received it (server only).
+    /** @remark Rigid body delta stream */
+    void AckRigidBodyPacket(u16 sequence);
+    /// Records that the rigid body packet @c sequence was received and decoded, to be acknowledged to the server (client only).
+    /** @remark Rigid body delta stream */
+    void MarkRigidBodyPacketReceived(u16 sequence);
+
     void MarkEntityProcessed(entity_id_t id);
     void MarkComponentProcessed(entity_id_t id, component_id_t compId);
 
@@ -389,6 +705,8 @@ public:
     void MarkComponentRemoved(entity_id_t id, component_id_t compId);
 
     void MarkAttributeDirty(entity_id_t id, component_id_t compId, u8 attrIndex);
+    /// Marks all attributes set in the @c dirtyAttributes bitfield (32 bytes) dirty.
+    void MarkAttributesDirty(entity_id_t id, component_id_t compId, const u8 *dirtyAttributes);
     void MarkAttributeCreated(entity_id_t id, component_id_t compId, u8 attrIndex);
     void MarkAttributeRemoved(entity_id_t id, component_id_t compId, u8 attrIndex);
 
@@ -398,10 +716,20 @@ public:
     // Removes entity from pending lists.
     void RemovePendingEntity(entity_id_t id);
 
+    /// Returns the connection ID of the user this state belongs to.
+    u32 UserConnectionId() const { return userConnectionID_; }
+
+    /// Returns whether @c entity is within the observer's area of interest, or if the area of interest is not in use.
+    /** @remark Interest management */
+    bool IsInAreaOfInterest(Entity *entity) const;
+
     bool NeedSendPlaceholderComponents() const { return !placeholderComponentsSent_; }
     void MarkPlaceholderComponentsSent() { placeholderComponentsSent_ = true; }
 
 private:
+    /// Adds the state to waitingQueue if it is not due yet, and to dirtyQueue otherwise.
+    void QueueEntity(EntitySyncState &entityState);
+
     // Returns if entity with id should be added to the sync state.
     bool ShouldMarkAsDirty(entity_id_t id);
 
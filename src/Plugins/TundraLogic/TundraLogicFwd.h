@@ -16,6 +16,7 @@ namespace Tundra
     class KNetUserConnection;
     class SceneSyncState;
     struct EntitySyncState;
+    class EntityGrid;
     
 
     struct MsgLoginReply;
@@ -31,6 +32,6 @@ namespace Tundra
 
     typedef Urho3D::HashMap<String, Variant> LoginPropertyMap;
 
-    typedef std::map<entity_id_t, EntitySyncState> EntitySyncStateMap;
+    typedef Urho3D::HashMap<entity_id_t, EntitySyncState> EntitySyncStateMap;
 }
 
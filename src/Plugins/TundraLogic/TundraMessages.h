@@ -45,6 +45,9 @@ const unsigned long cRegisterComponentTypeMessage = 123;
 // Entity parenting
 const unsigned long cSetEntityParentMessage = 124;
 
+// Rigid body delta stream
+const unsigned long cRigidBodyAckMessage = 125; // Client->server only
+
 // In case of network message structs are regenerated and descriptions get deleted., saving their descriptions here.
 // MsgAssetDeleted: Network message informing that asset has been deleted from storage.
 // MsgAssetDiscovery: Network message informing that new asset has been discovered in storage.
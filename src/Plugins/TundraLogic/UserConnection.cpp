@@ -8,14 +8,164 @@
 
 #include <kNet.h>
 
+// Messages larger than this are not serialized in place into kNet messages, but into a staging buffer that is copied
+// to a message of the final size. kNet keeps the capacity of its pooled messages, so each pooled message may hold up to
+// this many bytes. The limit covers the component and attribute messages of SyncManager, so that only the creates of
+// entities with very large component data take the copy.
+static const size_t cMaxInPlaceKNetMessageBytes = 64 * 1024;
+
+// Initial capacity of the buffer of deferred messages the networking implementation can not hold back. The capacity is kept
+// between ticks, so that reserving a message at the end of the buffer does not reallocate and copy the earlier messages.
+static const size_t cDeferredDataReserveBytes = 64 * 1024;
+
 namespace Tundra
 {
 
 UserConnection::UserConnection() : 
     userID(0),
-    protocolVersion(ProtocolOriginal)
+    protocolVersion(ProtocolOriginal),
+    bytesSent(0),
+    deferSend_(false),
+    reservation_(NoReservation),
+    reservedId_(0),
+    reservedBytes_(0),
+    reservedOffset_(0)
 {}
 
+void UserConnection::Send(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority, unsigned long contentID)
+{
+    if (!data && numBytes)
+    {
+        LogError("UserConnection::Send: can not queue message, null data pointer with nonzero data size specified");
+        return;
+    }
+
+    if (deferSend_)
+    {
+        // Collect the message like a reserved one, so that all collected messages are queued in order
+        char *dest = StartMessage(id, numBytes);
+        if (numBytes)
+            memcpy(dest, data, numBytes);
+        EndMessage(numBytes, reliable, inOrder, priority, contentID);
+        return;
+    }
+
+    bytesSent += numBytes;
+    SendNetworkMessage(id, data, numBytes, reliable, inOrder, priority, contentID);
+}
+
+char *UserConnection::StartMessage(kNet::message_id_t id, size_t maxBytes)
+{
+    // If serializing the previous message threw, it was never ended
+    if (reservation_ != NoReservation)
+        AbortMessage();
+
+    reservedId_ = id;
+    reservedBytes_ = maxBytes;
+    if (deferSend_)
+    {
+        char *data = StartDeferredNetworkMessage(id, maxBytes);
+        if (data)
+        {
+            reservation_ = ReservedDeferredNetwork;
+            return data;
+        }
+
+        // Serialize directly after the previously collected messages
+        reservation_ = ReservedDeferred;
+        reservedOffset_ = deferredData_.size();
+        deferredData_.resize(reservedOffset_ + maxBytes + 1);
+        return &deferredData_[reservedOffset_];
+    }
+
+    char *data = StartNetworkMessage(id, maxBytes);
+    if (data)
+    {
+        reservation_ = ReservedNetwork;
+        return data;
+    }
+
+    reservation_ = ReservedStaging;
+    if (stagingData_.size() < maxBytes + 1)
+        stagingData_.resize(maxBytes + 1);
+    return &stagingData_[0];
+}
+
+void UserConnection::EndMessage(size_t numBytes, bool reliable, bool inOrder, unsigned long priority, unsigned long contentID)
+{
+    if (reservation_ == NoReservation)
+    {
+        LogError("UserConnection::EndMessage: can not queue message, no message has been started");
+        return;
+    }
+    if (numBytes > reservedBytes_)
+    {
+        LogError("UserConnection::EndMessage: can not queue message, " + String((uint)numBytes) + " bytes exceed the reserved " + String((uint)reservedBytes_) + " bytes");
+        AbortMessage();
+        return;
+    }
+
+    bytesSent += numBytes;
+    const MessageReservation reservation = reservation_;
+    reservation_ = NoReservation;
+    if (reservation == ReservedDeferred || reservation == ReservedDeferredNetwork)
+    {
+        if (reservation == ReservedDeferredNetwork)
+            EndNetworkMessage(numBytes, reliable, inOrder, priority, contentID);
+        else
+            deferredData_.resize(reservedOffset_ + numBytes);
+
+        DeferredMessage msg;
+        msg.networkMessage = (reservation == ReservedDeferredNetwork);
+        msg.id = reservedId_;
+        msg.offset = reservedOffset_;
+        msg.numBytes = numBytes;
+        msg.reliable = reliable;
+        msg.inOrder = inOrder;
+        msg.priority = priority;
+        msg.contentID = contentID;
+        deferredMessages_.push_back(msg);
+    }
+    else if (reservation == ReservedNetwork)
+        EndNetworkMessage(numBytes, reliable, inOrder, priority, contentID);
+    else
+        SendNetworkMessage(reservedId_, &stagingData_[0], numBytes, reliable, inOrder, priority, contentID);
+}
+
+void UserConnection::AbortMessage()
+{
+    if (reservation_ == ReservedDeferred)
+        deferredData_.resize(reservedOffset_);
+    else if (reservation_ == ReservedNetwork || reservation_ == ReservedDeferredNetwork)
+        AbortNetworkMessage();
+    reservation_ = NoReservation;
+}
+
+void UserConnection::BeginDeferredSend()
+{
+    deferSend_ = true;
+    deferredData_.reserve(cDeferredDataReserveBytes);
+}
+
+void UserConnection::FlushDeferredSend()
+{
+    // Messages held back by the networking implementation were serialized in place and are only queued here. The rest are
+    // copied once from the deferred buffer to the network messages.
+    deferSend_ = false;
+    if (reservation_ == ReservedDeferred || reservation_ == ReservedDeferredNetwork)
+        AbortMessage();
+    for (size_t i = 0; i < deferredMessages_.size(); ++i)
+    {
+        const DeferredMessage &msg = deferredMessages_[i];
+        if (msg.networkMessage)
+            QueueDeferredNetworkMessage();
+        else
+            SendNetworkMessage(msg.id, msg.numBytes ? &deferredData_[msg.offset] : 0, msg.numBytes, msg.reliable, msg.inOrder, msg.priority, msg.contentID);
+    }
+    deferredMessages_.clear();
+    deferredData_.clear(); // Keeps the capacity for the next tick
+}
+
 void UserConnection::Send(kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer& ds, unsigned long priority, unsigned long contentID)
 {
     Send(id, ds.GetData(), ds.BytesFilled(), reliable, inOrder, priority, contentID);
@@ -74,28 +224,102 @@ void UserConnection::DenyConnection(const String &reason)
     properties["reason"] = reason;
 }
 
-void KNetUserConnection::Send(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority, unsigned long contentID)
+void KNetUserConnection::SendNetworkMessage(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority, unsigned long contentID)
 {
-    if (!data && numBytes)
+    if (!connection)
     {
-        LogError("KNetUserConnection::Send: can not queue message, null data pointer with nonzero data size specified");
+        LogError("KNetUserConnection::Send: can not queue message as MessageConnection is null");
         return;
     }
 
+    kNet::NetworkMessage* msg = connection->StartNewMessage(id, numBytes);
+    if (numBytes)
+        memcpy(msg->data, data, numBytes); // StartMessage serializes in place instead, avoiding this copy
+    msg->reliable = reliable;
+    msg->inOrder = inOrder;
+    msg->priority = priority;
+    msg->contentID = contentID;
+    connection->EndAndQueueMessage(msg);
+}
+
+char *KNetUserConnection::StartNetworkMessage(kNet::message_id_t id, size_t maxBytes)
+{
+    if (!connection || maxBytes > cMaxInPlaceKNetMessageBytes)
+        return 0;
+
+    pendingMessage_ = connection->StartNewMessage(id, maxBytes);
+    pendingDeferred_ = false;
+    return pendingMessage_->data;
+}
+
+char *KNetUserConnection::StartDeferredNetworkMessage(kNet::message_id_t id, size_t maxBytes)
+{
+    char *data = StartNetworkMessage(id, maxBytes);
+    pendingDeferred_ = (data != 0);
+    return data;
+}
+
+void KNetUserConnection::EndNetworkMessage(size_t numBytes, bool reliable, bool inOrder, unsigned long priority, unsigned long contentID)
+{
+    kNet::NetworkMessage* msg = pendingMessage_;
+    pendingMessage_ = 0;
+    if (pendingDeferred_)
+    {
+        pendingDeferred_ = false;
+        msg->reliable = reliable;
+        msg->inOrder = inOrder;
+        msg->priority = priority;
+        msg->contentID = contentID;
+        deferredNetworkMessages_.push_back(std::make_pair(msg, numBytes));
+        return;
+    }
     if (!connection)
     {
         LogError("KNetUserConnection::Send: can not queue message as MessageConnection is null");
         return;
     }
 
-    kNet::NetworkMessage* msg = connection->StartNewMessage(id, numBytes);
-    if (numBytes)
-        memcpy(msg->data, data, numBytes); /// \todo Copy should be optimized out
     msg->reliable = reliable;
     msg->inOrder = inOrder;
     msg->priority = priority;
     msg->contentID = contentID;
-    connection->EndAndQueueMessage(msg);
+    connection->EndAndQueueMessage(msg, numBytes);
+}
+
+void KNetUserConnection::AbortNetworkMessage()
+{
+    if (connection)
+        connection->FreeMessage(pendingMessage_);
+    pendingMessage_ = 0;
+    pendingDeferred_ = false;
+}
+
+void KNetUserConnection::QueueDeferredNetworkMessage()
+{
+    if (numQueuedDeferred_ >= deferredNetworkMessages_.size())
+        return;
+
+    const std::pair<kNet::NetworkMessage*, size_t> &msg = deferredNetworkMessages_[numQueuedDeferred_++];
+    if (connection)
+        connection->EndAndQueueMessage(msg.first, msg.second);
+    else
+        LogError("KNetUserConnection::Send: can not queue message as MessageConnection is null");
+
+    if (numQueuedDeferred_ == deferredNetworkMessages_.size())
+    {
+        deferredNetworkMessages_.clear();
+        numQueuedDeferred_ = 0;
+    }
+}
+
+float KNetUserConnection::RoundTripTime() const
+{
+    return connection ? connection->RoundTripTime() : 0.f;
+}
+
+size_t KNetUserConnection::NumOutboundMessagesPending() const
+{
+    return connection ? connection->NumOutboundMessagesPending() : 0;
 }
 
 void KNetUserConnection::Disconnect()
@@ -24,11 +24,12 @@ enum NetworkProtocolVersion
     ProtocolOriginal = 0x1,         // Original
     ProtocolCustomComponents = 0x2, // Adds support for transmitting new static-structured component types without actual C++ implementation, using EC_PlaceholderComponent
     ProtocolHierarchicScene = 0x3,  // Adds support for hierarchic scene, ie. entities having child entities
-    ProtocolWebClientRigidBodyMessage = 0x4 // WebSocket client that supports the rigid body optimization message
+    ProtocolWebClientRigidBodyMessage = 0x4, // WebSocket client that supports the rigid body optimization message
+    ProtocolRigidBodyDelta = 0x5    // Rigid body updates are delta-compressed against the states the client has acknowledged with RigidBodyAck messages
 };
 
 /// Highest supported protocol version in the build. Update this when a new protocol version is added
-const NetworkProtocolVersion cHighestSupportedProtocolVersion = ProtocolWebClientRigidBodyMessage;
+const NetworkProtocolVersion cHighestSupportedProtocolVersion = ProtocolRigidBodyDelta;
 
 /// Represents a client connection on the server side. Subclassed by networking implementations.
 class TUNDRALOGIC_API UserConnection : public RefCounted
@@ -55,9 +56,17 @@ public:
     NetworkProtocolVersion protocolVersion;
     /// Map of the unacked entity IDs a user has sent, and the real entity IDs they have been assigned
     std::map<u32, u32> unackedIdsToRealIds;
+    /// Total number of message payload bytes queued for sending to the client.
+    unsigned long long bytesSent;
+
+    /// Returns the estimated round trip time in milliseconds, or 0 if not measured by the networking implementation.
+    virtual float RoundTripTime() const { return 0.f; }
+
+    /// Returns the number of messages queued but not yet sent, or 0 if not known by the networking implementation.
+    virtual size_t NumOutboundMessagesPending() const { return 0; }
 
     /// Queue a network message to be sent to the client. All implementations may not use the reliable, inOrder, priority and contentID parameters.
-    virtual void Send(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority = 100, unsigned long contentID = 0) = 0;
+    void Send(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority = 100, unsigned long contentID = 0);
 
     /// Queue a network message to be sent to the client, with the data to be sent in a DataSerializer. All implementations may not use the reliable, inOrder, priority and contentID parameters.
     void Send(kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer& ds, unsigned long priority = 100, unsigned long contentID = 0);
@@ -65,11 +74,25 @@ public:
     /// Queue a typed network message to be sent to the client.
     template<typename SerializableMessage> void Send(const SerializableMessage &data)
     {
-        kNet::DataSerializer ds(data.Size());
+        const size_t maxBytes = data.Size();
+        kNet::DataSerializer ds(StartMessage(SerializableMessage::messageID, maxBytes), maxBytes);
         data.SerializeTo(ds);
-        Send(SerializableMessage::messageID, data.reliable, data.inOrder, ds);
+        EndMessage(ds.BytesFilled(), data.reliable, data.inOrder);
     }
 
+    /// Reserves a payload buffer of @c maxBytes for a network message, to serialize the message in place without copying it afterwards.
+    /** Queue the message with EndMessage, or drop it with AbortMessage. Only one message can be reserved at a time,
+        starting another one drops the previous reservation, and no other messages can be sent meanwhile.
+        The buffer is valid until the message is ended or dropped. */
+    char *StartMessage(kNet::message_id_t id, size_t maxBytes);
+
+    /// Queue the message reserved with StartMessage, with the first @c numBytes bytes of the buffer as the payload.
+    /** All implementations may not use the reliable, inOrder, priority and contentID parameters. */
+    void EndMessage(size_t numBytes, bool reliable, bool inOrder, unsigned long priority = 100, unsigned long contentID = 0);
+
+    /// Drops the message reserved with StartMessage.
+    void AbortMessage();
+
     /// Trigger a network message signal. Called by the networking implementation.
     void EmitNetworkMessageReceived(kNet::packet_id_t packetId, kNet::message_id_t messageId, const char* data, size_t numBytes);
 
@@ -101,12 +124,72 @@ public:
     /// Forcibly kills this connection without notifying the peer.
     virtual void Close() = 0;
 
+    /// Starts collecting the messages passed to Send instead of queuing them to the network.
+    /** Used by the SyncManager to process the connection's sync state in a worker thread. Call in the main thread. */
+    void BeginDeferredSend();
+
+    /// Queues the messages collected since BeginDeferredSend to the network in order, and resumes sending directly. Call in the main thread.
+    void FlushDeferredSend();
+
     // signals:
     
     /// Emitted when action has been triggered for this specific user connection.
     Signal4<UserConnection* ARG(connection), Entity* ARG(entity), const String& ARG(action), const StringVector& ARG(params)> ActionTriggered;
     /// Emitted when the client has sent a network message. PacketId will be 0 if not supported by the networking implementation.
     Signal5<UserConnection* ARG(connection), kNet::packet_id_t ARG(packetId), kNet::message_id_t ARG(messageId), const char* ARG(data), size_t ARG(numBytes)> NetworkMessageReceived;
+
+protected:
+    /// Queue a network message to the networking implementation.
+    virtual void SendNetworkMessage(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority, unsigned long contentID) = 0;
+
+    /// Returns a payload buffer of @c maxBytes in the networking implementation's own message, or null if not supported.
+    /** If null is returned, the message is serialized into a buffer of the connection and passed to SendNetworkMessage. */
+    virtual char *StartNetworkMessage(kNet::message_id_t /*id*/, size_t /*maxBytes*/) { return 0; }
+    /// Queue the message started with StartNetworkMessage.
+    virtual void EndNetworkMessage(size_t /*numBytes*/, bool /*reliable*/, bool /*inOrder*/, unsigned long /*priority*/, unsigned long /*contentID*/) {}
+    /// Drops the message started with StartNetworkMessage.
+    virtual void AbortNetworkMessage() {}
+
+    /// Returns a payload buffer of @c maxBytes in the networking implementation's own message, which EndNetworkMessage holds back
+    /// instead of queuing, or null if not supported. Called in a worker thread while sending is deferred.
+    /** If null is returned, the message is serialized into a buffer of the connection and passed to SendNetworkMessage when flushed. */
+    virtual char *StartDeferredNetworkMessage(kNet::message_id_t /*id*/, size_t /*maxBytes*/) { return 0; }
+    /// Queue the oldest message held back since StartDeferredNetworkMessage. Called in the main thread.
+    virtual void QueueDeferredNetworkMessage() {}
+
+private:
+    /// Where the message reserved with StartMessage is serialized.
+    enum MessageReservation
+    {
+        NoReservation,
+        ReservedDeferred, ///< At the end of deferredData_
+        ReservedDeferredNetwork, ///< In the networking implementation's message, held back until flushed
+        ReservedNetwork, ///< In the networking implementation's message
+        ReservedStaging ///< In stagingData_
+    };
+
+    /// A message collected while sending is deferred. The payload is stored in deferredData_, or in the networking implementation's message.
+    struct DeferredMessage
+    {
+        bool networkMessage; ///< Held back by the networking implementation, queued with QueueDeferredNetworkMessage.
+        kNet::message_id_t id;
+        size_t offset;
+        size_t numBytes;
+        bool reliable;
+        bool inOrder;
+        unsigned long priority;
+        unsigned long contentID;
+    };
+
+    bool deferSend_;
+    std::vector<DeferredMessage> deferredMessages_;
+    std::vector<char> deferredData_;
+
+    MessageReservation reservation_;
+    kNet::message_id_t reservedId_;
+    size_t reservedBytes_;
+    size_t reservedOffset_; ///< Offset of the reserved message in deferredData_.
+    std::vector<char> stagingData_;
 };
 
 /// A kNet user connection.
@@ -118,14 +201,42 @@ public:
     /// Message connection.
     Ptr(kNet::MessageConnection) connection;
 
-    /// Queue a network message to be sent to the client. 
-    virtual void Send(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority = 100, unsigned long contentID = 0);
+    /// Returns the round trip time estimated by kNet in milliseconds.
+    virtual float RoundTripTime() const;
+
+    /// Returns the number of messages in the kNet outbound queue.
+    virtual size_t NumOutboundMessagesPending() const;
 
     /// Starts a benign disconnect procedure (one which waits for the peer acknowledge procedure).
     virtual void Disconnect();
 
     /// Forcibly kills this connection without notifying the peer.
     virtual void Close();
+
+    KNetUserConnection() : pendingMessage_(0), pendingDeferred_(false), numQueuedDeferred_(0) {}
+
+protected:
+    /// Queue a network message to be sent to the client.
+    virtual void SendNetworkMessage(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority, unsigned long contentID);
+
+    /// Starts a kNet message for serializing in place. Returns null for messages too large to keep in kNet's message pool.
+    virtual char *StartNetworkMessage(kNet::message_id_t id, size_t maxBytes);
+    /// Queues the message started with StartNetworkMessage to kNet.
+    virtual void EndNetworkMessage(size_t numBytes, bool reliable, bool inOrder, unsigned long priority, unsigned long contentID);
+    /// Frees the message started with StartNetworkMessage.
+    virtual void AbortNetworkMessage();
+
+    /// Starts a kNet message for serializing in place in a worker thread. kNet's message pool is lock-free, but its outbound queue
+    /// is fed only from the main thread, so the ended message is held back. Returns null for messages too large to keep in kNet's message pool.
+    virtual char *StartDeferredNetworkMessage(kNet::message_id_t id, size_t maxBytes);
+    /// Queues the oldest held back message to kNet.
+    virtual void QueueDeferredNetworkMessage();
+
+private:
+    kNet::NetworkMessage *pendingMessage_;
+    bool pendingDeferred_; ///< Whether pendingMessage_ is held back when ended.
+    std::vector<std::pair<kNet::NetworkMessage*, size_t> > deferredNetworkMessages_; ///< Held back messages and their sizes, oldest first.
+    size_t numQueuedDeferred_; ///< Number of held back messages already queued.
 };
 
 }
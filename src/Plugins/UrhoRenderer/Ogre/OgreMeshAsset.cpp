@@ -46,6 +46,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "LoggingFunctions.h"
 #include "OgreMeshAsset.h"
 #include "OgreMeshDefines.h"
+#include "AssetDecodeQueue.h"
 
 #include <Urho3D/Graphics/Model.h>
 #include <Urho3D/Core/Profiler.h>
@@ -1141,24 +1142,73 @@ static SharedPtr<Urho3D::VertexBuffer> MakeVertexBuffer(Urho3D::Context* context
     return ret;
 }
 
+/// Parses the data of an OgreMeshAsset in a work queue thread.
+class OgreMeshDecodeJob : public IAssetDecodeJob
+{
+public:
+    OgreMeshDecodeJob(OgreMeshAsset *asset_, const u8 *data_, uint numBytes) :
+        asset(asset_),
+        data(data_, numBytes)
+    {
+    }
+
+    bool Decode() override
+    {
+        return OgreMeshAsset::ParseMesh(&data[0], data.Size(), mesh, error);
+    }
+
+    bool Commit() override
+    {
+        return asset->CommitMesh(mesh);
+    }
+
+private:
+    OgreMeshAsset *asset;
+    PODVector<u8> data;
+    SharedPtr<Ogre::Mesh> mesh;
+};
+
 OgreMeshAsset::OgreMeshAsset(AssetAPI *owner, const String &type_, const String &name_) :
     IMeshAsset(owner, type_, name_)
 {
 }
 
-bool OgreMeshAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool /*allowAsynchronous*/)
+bool OgreMeshAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool allowAsynchronous)
 {
     URHO3D_PROFILE(OgreMeshAsset_LoadFromFileInMemory);
 
     /// Force an unload of previous data first.
     Unload();
 
-    Urho3D::MemoryBuffer buffer(data_, numBytes);
+    if (allowAsynchronous)
+    {
+        // Parse the mesh in a worker thread. The model and its GPU buffers are created when the parsing is done.
+        assetAPI->DecodeQueue()->Queue(this, AssetDecodeJobPtr(new OgreMeshDecodeJob(this, data_, numBytes)));
+        return true;
+    }
+
+    SharedPtr<Ogre::Mesh> mesh;
+    String error;
+    if (!ParseMesh(data_, numBytes, mesh, error))
+    {
+        LogError("OgreMeshAsset::DeserializeFromData: " + error + " in " + Name());
+        return false;
+    }
+    if (!CommitMesh(mesh))
+        return false;
+
+    assetAPI->AssetLoadCompleted(Name());
+    return true;
+}
+
+bool OgreMeshAsset::ParseMesh(const u8 *data, uint numBytes, SharedPtr<Ogre::Mesh> &mesh, String &error)
+{
+    Urho3D::MemoryBuffer buffer(data, numBytes);
 
     u16 id = ReadHeader(buffer, false);
     if (id != HEADER_CHUNK_ID)
     {
-        LogError("OgreMeshAsset::DeserializeFromData: Invalid Ogre Mesh file header in " + Name());
+        error = "Invalid Ogre Mesh file header";
         return false;
     }
 
@@ -1170,21 +1220,26 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool /*a
     id = ReadHeader(buffer);
     if (id != M_MESH)
     {
-        LogError("OgreMeshAsset::DeserializeFromData: header was not followed by M_MESH chunk in " + Name());
+        error = "header was not followed by M_MESH chunk";
         return false;
     }
 
-    SharedPtr<Ogre::Mesh> mesh(new Ogre::Mesh());
+    mesh = new Ogre::Mesh();
     try
     {
         ReadMesh(buffer, mesh, version);
     }
     catch (std::exception& e)
     {
-        LogError("OgreMeshAsset::DeserializeFromData: " + String(e.what()));
+        error = e.what();
+        mesh.Reset();
         return false;
     }
+    return true;
+}
 
+bool OgreMeshAsset::CommitMesh(Ogre::Mesh *mesh)
+{
     model = new Urho3D::Model(GetContext());
     uint subMeshCount = mesh->NumSubMeshes();
     model->SetNumGeometries(subMeshCount);
@@ -1369,8 +1424,6 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool /*a
     // Set the vertex & index buffers so that morph data copying and model saving will work correctly
     model->SetVertexBuffers(vbs, morphRangeStarts, morphRangeCounts);
     model->SetIndexBuffers(ibs);
-
-    assetAPI->AssetLoadCompleted(Name());
     return true;
 }
 
@@ -20,6 +20,14 @@ public:
 
     /// Load mesh from memory. IAsset override.
     bool DeserializeFromData(const u8 *data_, uint numBytes, bool allowAsynchronous) override;
+
+private:
+    friend class OgreMeshDecodeJob;
+
+    /// Parses Ogre binary mesh data. Thread-safe, used by both synchronous and asynchronous loading.
+    static bool ParseMesh(const u8 *data, uint numBytes, SharedPtr<Ogre::Mesh> &mesh, String &error);
+    /// Creates the Urho model and its GPU buffers from the parsed mesh. Main thread only.
+    bool CommitMesh(Ogre::Mesh *mesh);
 };
 
 }
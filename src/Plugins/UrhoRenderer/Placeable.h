@@ -55,6 +55,7 @@ namespace Tundra
 class URHORENDERER_API Placeable : public IComponent
 {
     COMPONENT_NAME(Placeable, 20)
+    COMPONENT_POOL_ALLOCATED(Placeable)
 
 public:
     /// @cond PRIVATE
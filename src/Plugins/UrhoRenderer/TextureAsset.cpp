@@ -6,6 +6,7 @@
 #include <Urho3D/Core/Profiler.h>
 #include "LoggingFunctions.h"
 #include "TextureAsset.h"
+#include "AssetDecodeQueue.h"
 
 #include "Crunch/crn_decomp.h"
 #include "Crunch/dds_defs.h"
@@ -21,6 +22,35 @@
 namespace Tundra
 {
 
+/// Decodes the image of a TextureAsset in a work queue thread.
+class TextureDecodeJob : public IAssetDecodeJob
+{
+public:
+    TextureDecodeJob(TextureAsset *asset_, const u8 *data_, uint numBytes, bool crn_) :
+        asset(asset_),
+        data(data_, numBytes),
+        crn(crn_),
+        image(new Urho3D::Image(asset_->GetContext()))
+    {
+    }
+
+    bool Decode() override
+    {
+        return TextureAsset::DecodeImage(&data[0], data.Size(), crn, image, error);
+    }
+
+    bool Commit() override
+    {
+        return asset->CommitImage(image);
+    }
+
+private:
+    TextureAsset *asset;
+    PODVector<u8> data;
+    bool crn;
+    SharedPtr<Urho3D::Image> image;
+};
+
 TextureAsset::TextureAsset(AssetAPI *owner, const String &type_, const String &name_) :
     IAsset(owner, type_, name_)
 {
@@ -31,75 +61,88 @@ TextureAsset::~TextureAsset()
     Unload();
 }
 
-bool TextureAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool /*allowAsynchronous*/)
+bool TextureAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool allowAsynchronous)
 {
     URHO3D_PROFILE(TextureAsset_LoadFromFileInMemory);
 
-    bool success = false;
-
     // Delete previous data first
     Unload();
-    texture = new Urho3D::Texture2D(context_);
 
-    if (!Name().EndsWith(".crn", false))
+    const bool crn = Name().EndsWith(".crn", false);
+    if (allowAsynchronous)
     {
-        Urho3D::MemoryBuffer imageBuffer(data_, numBytes);
-        SharedPtr<Urho3D::Image> image(new Urho3D::Image(context_));
-        success = image->Load(imageBuffer);
-        if (success)
-        {
-            DetermineMipsToSkip(image, texture);
-            success = texture->SetData(image);
-        }
+        // Decompress and decode the image in a worker thread. The texture is created when the decoding is done.
+        assetAPI->DecodeQueue()->Queue(this, AssetDecodeJobPtr(new TextureDecodeJob(this, data_, numBytes, crn)));
+        return true;
+    }
+
+    String error;
+    SharedPtr<Urho3D::Image> image(new Urho3D::Image(context_));
+    if (!DecodeImage(data_, numBytes, crn, image, error) || !CommitImage(image))
+    {
+        LogError("TextureAsset::DeserializeFromData: Failed to load texture asset " + Name() + (error.Empty() ? String() : ": " + error));
+        return false;
     }
-    else
+
+    assetAPI->AssetLoadCompleted(Name());
+    return true;
+}
+
+bool TextureAsset::DecodeImage(const u8 *data, uint numBytes, bool crn, Urho3D::Image *image, String &error)
+{
+    // Uses BeginLoad instead of Load, which also touches the main thread profiler, as Urho's own background loading does.
+    if (!crn)
     {
-        Vector<u8> ddsData;
-        success = DecompressCRNtoDDS(data_, numBytes, ddsData);
-        if (success)
+        Urho3D::MemoryBuffer imageBuffer(data, numBytes);
+        if (!image->BeginLoad(imageBuffer))
         {
-            Urho3D::MemoryBuffer imageBuffer(&ddsData[0], ddsData.Size());
-            SharedPtr<Urho3D::Image> image(new Urho3D::Image(context_));
-            success = image->Load(imageBuffer);
-            if (success)
-            {
-                DetermineMipsToSkip(image, texture);
-                success = texture->SetData(image);
-            }
+            error = "Image decoding failed.";
+            return false;
         }
+        return true;
     }
 
-    if (success)
+    Vector<u8> ddsData;
+    if (!DecompressCRNtoDDS(data, numBytes, ddsData, error))
+        return false;
+    Urho3D::MemoryBuffer imageBuffer(&ddsData[0], ddsData.Size());
+    if (!image->BeginLoad(imageBuffer))
     {
-        // Once data has been loaded, subscribe to device reset events to be able to restore the data if necessary
-        SubscribeToEvent(Urho3D::E_DEVICERESET, URHO3D_HANDLER(TextureAsset, HandleDeviceReset));
-        assetAPI->AssetLoadCompleted(Name());
+        error = "DDS image decoding failed.";
+        return false;
     }
-    else
+    return true;
+}
+
+bool TextureAsset::CommitImage(Urho3D::Image *image)
+{
+    texture = new Urho3D::Texture2D(context_);
+    DetermineMipsToSkip(image, texture);
+    if (!texture->SetData(image))
     {
-        LogError("TextureAsset::DeserializeFromData: Failed to load texture asset " + Name());
         texture.Reset();
+        return false;
     }
 
-    return success;
+    // Once data has been loaded, subscribe to device reset events to be able to restore the data if necessary
+    SubscribeToEvent(Urho3D::E_DEVICERESET, URHO3D_HANDLER(TextureAsset, HandleDeviceReset));
+    return true;
 }
 
-bool TextureAsset::DecompressCRNtoDDS(const u8 *crnData, uint crnNumBytes, Vector<u8> &ddsData) const
+bool TextureAsset::DecompressCRNtoDDS(const u8 *crnData, uint crnNumBytes, Vector<u8> &ddsData, String &error)
 {
-    URHO3D_PROFILE(TextureAsset_DecompressCRNtoDDS);
-
     // Texture data
     crnd::crn_texture_info textureInfo;
     if (!crnd::crnd_get_texture_info((void*)crnData, (crnd::uint32)crnNumBytes, &textureInfo))
     {
-        LogError("CRN texture info parsing failed, invalid input data.");
+        error = "CRN texture info parsing failed, invalid input data.";
         return false;
     }
     // Begin unpack
     crnd::crnd_unpack_context crnContext = crnd::crnd_unpack_begin((void*)crnData, (crnd::uint32)crnNumBytes);
     if (!crnContext)
     {
-        LogError("CRN texture data unpacking failed, invalid input data.");
+        error = "CRN texture data unpacking failed, invalid input data.";
         return false;
     }
 
@@ -177,7 +220,7 @@ bool TextureAsset::DecompressCRNtoDDS(const u8 *crnData, uint crnNumBytes, Vecto
 
     if (ddsData.Empty())
     {
-        LogError("CRN uncompression failed!");
+        error = "CRN uncompression failed!";
         return false;
     }
     return true;
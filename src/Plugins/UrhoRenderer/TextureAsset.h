@@ -42,9 +42,15 @@ protected:
     SharedPtr<Urho3D::Texture2D> texture;
 
 private:
+    friend class TextureDecodeJob;
+
     void HandleDeviceReset(StringHash eventType, VariantMap& eventData);
 
-    bool DecompressCRNtoDDS(const u8 *crnData, uint crnNumBytes, Vector<u8> &ddsData) const;
+    /// Decodes the image data, decompressing CRN data to DDS first. Thread-safe, used by both synchronous and asynchronous loading.
+    static bool DecodeImage(const u8 *data, uint numBytes, bool crn, Urho3D::Image *image, String &error);
+    static bool DecompressCRNtoDDS(const u8 *crnData, uint crnNumBytes, Vector<u8> &ddsData, String &error);
+    /// Creates the texture from the decoded image. Main thread only.
+    bool CommitImage(Urho3D::Image *image);
 
     int MaxTextureSize() const;
     void DetermineMipsToSkip(Urho3D::Image* image, Urho3D::Texture2D* texture) const;
@@ -31,6 +31,7 @@
 #include "Ogre/DefaultOgreMaterialProcessor.h"
 #include "Ogre/OgreParticleAsset.h"
 #include "GenericAssetFactory.h"
+#include "ViewAssetTransferPrioritizer.h"
 
 #include <Urho3D/Core/CoreEvents.h>
 #include <Urho3D/Core/ProcessUtils.h>
@@ -97,6 +98,10 @@ void UrhoRenderer::Initialize()
     framework->Scene()->SceneCreated.Connect(this, &UrhoRenderer::CreateGraphicsWorld);
     framework->Scene()->SceneAboutToBeRemoved.Connect(this, &UrhoRenderer::RemoveGraphicsWorld);
 
+    // Transfer the assets of the entities that are large on the screen first.
+    transferPrioritizer = new ViewAssetTransferPrioritizer(this);
+    framework->Asset()->SetAssetTransferPrioritizer(AssetTransferPrioritizerPtr(transferPrioritizer.Get()));
+
     // Enable the main (full-screen) viewport
     Urho3D::Renderer* rend = GetSubsystem<Urho3D::Renderer>();
     if (rend)
@@ -121,6 +126,10 @@ void UrhoRenderer::Initialize()
 void UrhoRenderer::Uninitialize()
 {
     framework->RegisterRenderer(0);
+    // The prioritizer refers to the renderer, restore the default one if it was not replaced meanwhile.
+    if (transferPrioritizer && framework->Asset()->AssetTransferPrioritizer().Get() == transferPrioritizer.Get())
+        framework->Asset()->SetAssetTransferPrioritizer(AssetTransferPrioritizerPtr(new DefaultAssetTransferPrioritizer()));
+    transferPrioritizer.Reset();
     Urho3D::Renderer* rend = GetSubsystem<Urho3D::Renderer>();
     // Let go of the viewport that we created. If done later at Urho Context destruction time, may cause a crash
     if (rend)
@@ -74,6 +74,9 @@ private:
 
     /// Registered Ogre material processors.
     Vector<SharedPtr<IOgreMaterialProcessor> > materialProcessors;
+
+    /// Asset transfer prioritizer installed to AssetAPI while the renderer is initialized.
+    SharedPtr<ViewAssetTransferPrioritizer> transferPrioritizer;
 };
 
 }
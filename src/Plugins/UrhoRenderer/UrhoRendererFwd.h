@@ -33,6 +33,7 @@ namespace Tundra
     class IOgreMaterialProcessor;
     class IMaterialAsset;
     class IMeshAsset;
+    class ViewAssetTransferPrioritizer;
 
     typedef SharedPtr<GraphicsWorld> GraphicsWorldPtr;
     typedef WeakPtr<GraphicsWorld> GraphicsWorldWeakPtr;
@@ -42,5 +43,6 @@ namespace Tundra
     namespace Ogre
     {
         class MaterialParser;
+        class Mesh;
     }
 }
@@ -0,0 +1,92 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "ViewAssetTransferPrioritizer.h"
+#include "UrhoRenderer.h"
+#include "Camera.h"
+#include "Placeable.h"
+#include "Mesh.h"
+#include "Entity.h"
+#include "IAssetTransfer.h"
+
+#include "Geometry/AABB.h"
+#include "Geometry/Sphere.h"
+
+namespace Tundra
+{
+
+/// Screen size multiplier for entities outside the view frustum, so that the assets behind the camera are transferred last.
+static const float cOutsideViewFactor = 0.1f;
+/// Lowest view multiplier of a transfer with referring entities, so that far away assets keep their relative order by type.
+static const float cMinViewFactor = 0.01f;
+/// View multiplier of the transfers without referring entities, eg. scripts and assets requested by code.
+static const float cNoEntityViewFactor = 0.5f;
+
+ViewAssetTransferPrioritizer::ViewAssetTransferPrioritizer(UrhoRenderer *renderer) :
+    renderer_(renderer),
+    hasCamera_(false),
+    tanHalfFov_(1.f)
+{
+}
+
+AssetTransferPtrVector ViewAssetTransferPrioritizer::Prioritize(const AssetTransferPtrVector &transfers)
+{
+    Camera *camera = renderer_->MainCameraComponent();
+    Entity *cameraEntity = camera ? camera->ParentEntity() : 0;
+    Placeable *cameraPlaceable = cameraEntity ? cameraEntity->Component<Placeable>().Get() : 0;
+    hasCamera_ = (cameraPlaceable != 0);
+    if (hasCamera_)
+    {
+        frustum_ = camera->ToFrustum();
+        cameraPos_ = cameraPlaceable->WorldPosition();
+        tanHalfFov_ = Max(tan(DegToRad(camera->verticalFov.Get()) * 0.5f), 1e-3f);
+    }
+    return DefaultAssetTransferPrioritizer::Prioritize(transfers);
+}
+
+float ViewAssetTransferPrioritizer::Priority(const IAssetTransfer &transfer)
+{
+    float priority = DefaultAssetTransferPrioritizer::Priority(transfer);
+    if (!hasCamera_)
+        return priority;
+
+    float viewFactor = -1.f;
+    for(uint i = 0; i < transfer.referringEntities.Size() && viewFactor < 1.f; ++i)
+    {
+        Entity *entity = transfer.referringEntities[i].Get();
+        if (entity)
+            viewFactor = Max(viewFactor, ScreenSize(entity));
+    }
+    if (viewFactor < 0.f)
+        viewFactor = cNoEntityViewFactor;
+    return priority * Max(viewFactor, cMinViewFactor);
+}
+
+float ViewAssetTransferPrioritizer::ScreenSize(Entity *entity) const
+{
+    Placeable *placeable = entity->Component<Placeable>().Get();
+    if (!placeable)
+        return 1.f;
+
+    Sphere bounds;
+    Mesh *mesh = entity->Component<Mesh>().Get();
+    AABB aabb = mesh ? mesh->WorldAABB() : AABB(float3::inf, -float3::inf);
+    if (aabb.IsFinite() && !aabb.IsDegenerate())
+        bounds = aabb.MinimalEnclosingSphere();
+    else
+    {
+        // The mesh is not loaded yet, assume an unit sized mesh.
+        const float3 scale = placeable->WorldScale().Abs();
+        bounds = Sphere(placeable->WorldPosition(), 0.5f * Max(scale.x, Max(scale.y, scale.z)));
+    }
+
+    const float distance = bounds.pos.Distance(cameraPos_);
+    if (distance <= bounds.r)
+        return 1.f;
+    float size = Min(bounds.r / (distance * tanHalfFov_), 1.f);
+    if (frustum_.IsFinite() && !frustum_.Intersects(bounds))
+        size *= cOutsideViewFactor;
+    return size;
+}
+
+}
@@ -0,0 +1,46 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "DefaultAssetTransferPrioritizer.h"
+#include "UrhoRendererApi.h"
+#include "UrhoRendererFwd.h"
+#include "Math/float3.h"
+#include "Geometry/Frustum.h"
+
+namespace Tundra
+{
+
+/// Prioritizes the asset transfers by the screen size of the entities that refer to them.
+/** Scales the DefaultAssetTransferPrioritizer priority by the largest projected screen size of the referring entities,
+    as seen from the main camera, and favors the entities inside the view frustum. The screen size is estimated from
+    the mesh bounds if the entity's mesh is already loaded, and otherwise from the Placeable scale, as the bounds of
+    an asset are not known before it has been transferred. Referring entities without a Placeable, eg. the sky,
+    are considered to fill the screen. Transfers without referring entities, and all transfers when there is no
+    main camera, are prioritized as by DefaultAssetTransferPrioritizer. */
+class URHORENDERER_API ViewAssetTransferPrioritizer : public DefaultAssetTransferPrioritizer
+{
+public:
+    explicit ViewAssetTransferPrioritizer(UrhoRenderer *renderer);
+
+    /// IAssetTransferPrioritizer override
+    AssetTransferPtrVector Prioritize(const AssetTransferPtrVector &transfers) override;
+
+protected:
+    /// DefaultAssetTransferPrioritizer override
+    float Priority(const IAssetTransfer &transfer) override;
+
+private:
+    /// Returns the fraction of the screen height @c entity covers, in the range [0, 1].
+    float ScreenSize(Entity *entity) const;
+
+    UrhoRenderer *renderer_;
+
+    /// Main camera state captured at the start of Prioritize.
+    bool hasCamera_;
+    Frustum frustum_;
+    float3 cameraPos_;
+    float tanHalfFov_;
+};
+
+}
@@ -11,6 +11,7 @@
 #include "Server.h"
 
 #include "kNet/DataDeserializer.h"
+#include "kNet/Clock.h"
 
 #include <websocketpp/frame.hpp>
 
@@ -20,6 +21,7 @@
 #include "JSON.h"
 
 #include <algorithm>
+#include <cstring>
 
 #ifdef WIN32
 #include "Win.h"
@@ -38,6 +40,9 @@ using namespace Tundra;
 
 namespace WebSocket
 {
+/// Interval of the pings sent to measure the connections' round trip times, in seconds.
+static const float cPingInterval = 1.f;
+
 // ServerThread
 
 
@@ -70,7 +75,8 @@ Server::Server(Framework *framework) :
     Object(framework->GetContext()),
     LC("[WebSocketServer]: "),
     framework_(framework),
-    port_(2345)
+    port_(2345),
+    pingAccumulator_(0.f)
 {
     // Port
     StringList portParam = framework->CommandLineParameters("--port");
@@ -122,6 +128,15 @@ void Server::Update(float frametime)
             }
         }
     }
+
+    // Ping the connections periodically, the pongs are handled below as events
+    pingAccumulator_ += frametime;
+    if (pingAccumulator_ >= cPingInterval)
+    {
+        pingAccumulator_ = 0.f;
+        for (UserConnectionList::Iterator iter = connections_.Begin(); iter != connections_.End(); ++iter)
+            (*iter)->Ping();
+    }
     
     Vector<SocketEvent*> processEvents;
     {
@@ -171,6 +186,13 @@ void Server::Update(float frametime)
                 }
             }
         }
+        // Pong to a ping sent by the user connection
+        else if (event->type == SocketEvent::Pong)
+        {
+            WebSocket::UserConnectionPtr userConnection = UserConnection(event->connection);
+            if (userConnection)
+                userConnection->UpdateRoundTripTime(event->roundTripTime);
+        }
         // Data message
         else if (event->type == SocketEvent::Data && event->data.get())
         {
@@ -272,6 +294,7 @@ bool Server::Start()
         server_->set_open_handler(boost::bind(&Server::OnConnected, this, ::_1));
         server_->set_close_handler(boost::bind(&Server::OnDisconnected, this, ::_1));
         server_->set_message_handler(boost::bind(&Server::OnMessage, this, ::_1, ::_2));
+        server_->set_pong_handler(boost::bind(&Server::OnPong, this, ::_1, ::_2));
         server_->set_socket_init_handler(boost::bind(&Server::OnSocketInit, this, ::_1, ::_2));
 
         // Setup logging
@@ -412,6 +435,21 @@ void Server::OnMessage(ConnectionHandle connection, MessagePtr data)
     }
 }
 
+void Server::OnPong(ConnectionHandle connection, std::string payload)
+{
+    // Measure here in the websocket thread, so that the main thread frame rate does not add to the round trip time
+    kNet::tick_t sent;
+    if (payload.size() != sizeof(sent))
+        return;
+    memcpy(&sent, payload.data(), sizeof(sent));
+
+    Urho3D::MutexLock lock(mutexEvents_);
+
+    SocketEvent *event = new SocketEvent(server_->get_con_from_hdl(connection), SocketEvent::Pong);
+    event->roundTripTime = kNet::Clock::TimespanToMillisecondsF(sent, kNet::Clock::Tick());
+    events_.Push(event);
+}
+
 /// \todo Implement actual registering of http handlers, for now disabled
 /*
 void Server::OnHttpRequest(WebSocket::ConnectionHandle connection)
@@ -49,15 +49,17 @@ namespace WebSocket
             None = 0,
             Connected,
             Disconnected,
-            Data
+            Data,
+            Pong
         };
 
         WebSocket::ConnectionPtr connection;
         DataSerializerPtr data;
         EventType type;
+        float roundTripTime; ///< Round trip time of a Pong event in milliseconds.
 
-        SocketEvent() : type(None) {}
-        SocketEvent(WebSocket::ConnectionPtr connection_, EventType type_) : connection(connection_), type(type_) {}
+        SocketEvent() : type(None), roundTripTime(0.f) {}
+        SocketEvent(WebSocket::ConnectionPtr connection_, EventType type_) : connection(connection_), type(type_), roundTripTime(0.f) {}
     };
 
     /// Server run thread
@@ -114,6 +116,7 @@ namespace WebSocket
         void OnConnected(WebSocket::ConnectionHandle connection);
         void OnDisconnected(WebSocket::ConnectionHandle connection);
         void OnMessage(WebSocket::ConnectionHandle connection, WebSocket::MessagePtr data);
+        void OnPong(WebSocket::ConnectionHandle connection, std::string payload);
         void OnHttpRequest(WebSocket::ConnectionHandle connection);
         void OnSocketInit(WebSocket::ConnectionHandle connection, boost::asio::ip::tcp::socket& s);
         
@@ -130,6 +133,9 @@ namespace WebSocket
 
         ServerThread thread_;
 
+        /// Time since the connections were last pinged to measure their round trip times.
+        float pingAccumulator_;
+
         Urho3D::Mutex mutexEvents_;
         Tundra::Vector<SocketEvent*> events_;
     };
@@ -5,6 +5,7 @@
 
 #include "kNet/DataDeserializer.h"
 #include "kNet/DataSerializer.h"
+#include "kNet/Clock.h"
 
 #include <boost/system/error_code.hpp>
 #ifdef BOOST_SYSTEM_NOEXCEPT
@@ -16,7 +17,9 @@
 namespace WebSocket
 {
 
-UserConnection::UserConnection(ConnectionPtr connection_)
+UserConnection::UserConnection(ConnectionPtr connection_) :
+    numMessagesSent_(0),
+    roundTripTime_(0.f)
 {
     webSocketConnection = ConnectionWeakPtr(connection_);
 }
@@ -27,7 +30,7 @@ UserConnection::~UserConnection()
     syncState.Reset();
 }
 
-void UserConnection::Send(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority, unsigned long contentID)
+void UserConnection::SendNetworkMessage(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority, unsigned long contentID)
 {
     kNet::DataSerializer ds(numBytes + 2);
     ds.Add<u16>(id);
@@ -36,6 +39,23 @@ void UserConnection::Send(kNet::message_id_t id, const char* data, size_t numByt
     Send(ds);
 }
 
+char *UserConnection::StartNetworkMessage(kNet::message_id_t id, size_t maxBytes)
+{
+    if (sendBuffer_.size() < maxBytes + 2)
+        sendBuffer_.resize(maxBytes + 2);
+    kNet::DataSerializer ds(&sendBuffer_[0], 2);
+    ds.Add<u16>(id);
+    return &sendBuffer_[2];
+}
+
+void UserConnection::EndNetworkMessage(size_t numBytes, bool /*reliable*/, bool /*inOrder*/, unsigned long /*priority*/, unsigned long /*contentID*/)
+{
+    if (webSocketConnection.expired())
+        return;
+    webSocketConnection.lock()->send(static_cast<void*>(&sendBuffer_[0]), static_cast<uint64_t>(numBytes + 2));
+    ++numMessagesSent_;
+}
+
 ConnectionPtr UserConnection::WebSocketConnection() const
 {
     return webSocketConnection.lock();
@@ -49,6 +69,42 @@ void UserConnection::Send(const kNet::DataSerializer &data)
         return;
     
     webSocketConnection.lock()->send(static_cast<void*>(data.GetData()), static_cast<uint64_t>(data.BytesFilled()));
+    ++numMessagesSent_;
+}
+
+size_t UserConnection::NumOutboundMessagesPending() const
+{
+    ConnectionPtr connection = webSocketConnection.lock();
+    if (!connection || !numMessagesSent_)
+        return 0;
+    unsigned long long averageBytes = bytesSent / numMessagesSent_;
+    if (!averageBytes)
+        averageBytes = 1;
+    return (size_t)(connection->get_buffered_amount() / averageBytes);
+}
+
+void UserConnection::Ping()
+{
+    ConnectionPtr connection = webSocketConnection.lock();
+    if (!connection)
+        return;
+    const kNet::tick_t now = kNet::Clock::Tick();
+    try
+    {
+        connection->ping(std::string(reinterpret_cast<const char*>(&now), sizeof(now)));
+    }
+    catch (...)
+    {
+        // The connection is closing, it will be removed by the server
+    }
+}
+
+void UserConnection::UpdateRoundTripTime(float roundTripTime)
+{
+    if (roundTripTime_ <= 0.f)
+        roundTripTime_ = roundTripTime;
+    else
+        roundTripTime_ += (roundTripTime - roundTripTime_) * 0.2f;
 }
 
 void UserConnection::Disconnect()
@@ -25,15 +25,43 @@ namespace WebSocket
 
         ConnectionPtr WebSocketConnection() const;
 
+        using Tundra::UserConnection::Send;
         void Send(const kNet::DataSerializer &data);
 
-        /// Queue a network message to be sent to the client. All implementations may not use the reliable, inOrder, priority and contentID parameters.
-        virtual void Send(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority = 100, unsigned long contentID = 0);
+        /// Returns the round trip time measured with WebSocket pings in milliseconds, or 0 if no pong has been received yet.
+        virtual float RoundTripTime() const { return roundTripTime_; }
+
+        /// Returns an estimate of the messages in the WebSocket send buffer.
+        /** websocketpp reports only the buffered bytes, so they are divided by the average size of the messages sent. */
+        virtual size_t NumOutboundMessagesPending() const;
+
+        /// Sends a ping carrying the current time. Called periodically by the server.
+        void Ping();
+
+        /// Updates the round trip time with one measured from a pong. Called by the server.
+        void UpdateRoundTripTime(float roundTripTime);
 
         ConnectionWeakPtr webSocketConnection;
 
     public:
         virtual void Disconnect();
         virtual void Close();
+
+    protected:
+        /// Queue a network message to be sent to the client. The reliable, inOrder, priority and contentID parameters are not used.
+        virtual void SendNetworkMessage(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority, unsigned long contentID);
+
+        /// Starts a message in the send buffer after its message ID, so that the payload is serialized in place.
+        virtual char *StartNetworkMessage(kNet::message_id_t id, size_t maxBytes);
+        /// Sends the message started with StartNetworkMessage. The reliable, inOrder, priority and contentID parameters are not used.
+        virtual void EndNetworkMessage(size_t numBytes, bool reliable, bool inOrder, unsigned long priority, unsigned long contentID);
+
+    private:
+        /// Message ID and payload of the message started with StartNetworkMessage.
+        std::vector<char> sendBuffer_;
+        /// Number of messages sent, for the average message size.
+        unsigned long long numMessagesSent_;
+        /// Smoothed round trip time in milliseconds.
+        float roundTripTime_;
     };
 }
@@ -0,0 +1,330 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "ZipArchive.h"
+
+#include <Urho3D/IO/FileSystem.h>
+
+#include <zlib.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Tundra
+{
+
+static const uint cLocalHeaderSignature = 0x04034b50;
+static const uint cCentralHeaderSignature = 0x02014b50;
+static const uint cEndOfCentralDirectorySignature = 0x06054b50;
+static const uint cLocalHeaderSize = 30;
+static const uint cCentralHeaderSize = 46;
+static const uint cEndOfCentralDirectorySize = 22;
+static const uint cMaxCommentSize = 0xFFFF;
+
+static const unsigned short cMethodStored = 0;
+static const unsigned short cMethodDeflated = 8;
+
+static inline uint ReadU16(const u8 *p)
+{
+    return (uint)p[0] | ((uint)p[1] << 8);
+}
+
+static inline uint ReadU32(const u8 *p)
+{
+    return (uint)p[0] | ((uint)p[1] << 8) | ((uint)p[2] << 16) | ((uint)p[3] << 24);
+}
+
+ZipArchive::ZipArchive() :
+    data_(0),
+    size_(0),
+#ifdef _WIN32
+    file_(INVALID_HANDLE_VALUE),
+    mapping_(0),
+#endif
+    mapped_(false)
+{
+}
+
+ZipArchive::~ZipArchive()
+{
+    Close();
+}
+
+bool ZipArchive::OpenFile(const String &filename)
+{
+    Close();
+
+#ifdef _WIN32
+    file_ = CreateFileW(Urho3D::GetWideNativePath(filename).CString(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file_ == INVALID_HANDLE_VALUE)
+    {
+        error_ = "Failed to open " + filename;
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file_, &fileSize) || fileSize.HighPart != 0)
+    {
+        error_ = "Failed to read the size of " + filename + ", or it is larger than 4GB";
+        Unmap();
+        return false;
+    }
+    size_ = (uint)fileSize.LowPart;
+    if (size_ > 0)
+    {
+        mapping_ = CreateFileMappingW(file_, 0, PAGE_READONLY, 0, 0, 0);
+        if (mapping_)
+            data_ = (const u8*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    }
+#else
+    int fd = open(Urho3D::GetNativePath(filename).CString(), O_RDONLY);
+    if (fd < 0)
+    {
+        error_ = "Failed to open " + filename;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (unsigned long long)st.st_size > 0xFFFFFFFFull)
+    {
+        error_ = "Failed to read the size of " + filename + ", or it is larger than 4GB";
+        close(fd);
+        return false;
+    }
+    size_ = (uint)st.st_size;
+    if (size_ > 0)
+    {
+        void *mapped = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED)
+            data_ = (const u8*)mapped;
+    }
+    // The mapping keeps the file referenced.
+    close(fd);
+#endif
+
+    if (!data_)
+    {
+        error_ = "Failed to memory map " + filename;
+        Unmap();
+        return false;
+    }
+    mapped_ = true;
+
+    if (!ReadCentralDirectory())
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool ZipArchive::OpenData(const u8 *data, uint numBytes)
+{
+    Close();
+
+    if (!data || numBytes == 0)
+    {
+        error_ = "No data";
+        return false;
+    }
+    memory_.Resize(numBytes);
+    memcpy(&memory_[0], data, numBytes);
+    data_ = &memory_[0];
+    size_ = numBytes;
+
+    if (!ReadCentralDirectory())
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void ZipArchive::Close()
+{
+    Unmap();
+    memory_.Clear();
+    data_ = 0;
+    size_ = 0;
+    entries_.Clear();
+    index_.Clear();
+}
+
+void ZipArchive::Unmap()
+{
+#ifdef _WIN32
+    if (mapped_ && data_)
+        UnmapViewOfFile(data_);
+    if (mapping_)
+    {
+        CloseHandle(mapping_);
+        mapping_ = 0;
+    }
+    if (file_ != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(file_);
+        file_ = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (mapped_ && data_)
+        munmap((void*)data_, size_);
+#endif
+    if (mapped_)
+    {
+        data_ = 0;
+        size_ = 0;
+    }
+    mapped_ = false;
+}
+
+const ZipArchive::Entry *ZipArchive::FindEntry(const String &name) const
+{
+    HashMap<String, uint>::ConstIterator iter = index_.Find(name.ToLower());
+    return iter != index_.End() ? &entries_[iter->second_] : 0;
+}
+
+const u8 *ZipArchive::StoredData(const Entry &entry) const
+{
+    if (entry.method != cMethodStored || entry.compressedSize != entry.uncompressedSize)
+        return 0;
+    return EntryData(entry);
+}
+
+bool ZipArchive::Read(const Entry &entry, Vector<u8> &dst) const
+{
+    const u8 *src = EntryData(entry);
+    if (!src)
+        return false;
+
+    dst.Resize(entry.uncompressedSize);
+    if (entry.uncompressedSize == 0)
+        return true;
+
+    if (entry.method == cMethodStored)
+    {
+        if (entry.compressedSize != entry.uncompressedSize)
+            return false;
+        memcpy(&dst[0], src, entry.uncompressedSize);
+    }
+    else if (entry.method == cMethodDeflated)
+    {
+        // Raw deflate stream without a zlib header
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+            return false;
+        stream.next_in = (Bytef*)src;
+        stream.avail_in = entry.compressedSize;
+        stream.next_out = &dst[0];
+        stream.avail_out = entry.uncompressedSize;
+        int result = inflate(&stream, Z_FINISH);
+        inflateEnd(&stream);
+        if (result != Z_STREAM_END || stream.total_out != entry.uncompressedSize)
+            return false;
+    }
+    else
+        return false;
+
+    return crc32(crc32(0L, Z_NULL, 0), &dst[0], entry.uncompressedSize) == entry.crc;
+}
+
+const u8 *ZipArchive::EntryData(const Entry &entry) const
+{
+    if (!data_ || (unsigned long long)entry.localHeaderOffset + cLocalHeaderSize > size_)
+        return 0;
+    const u8 *header = data_ + entry.localHeaderOffset;
+    if (ReadU32(header) != cLocalHeaderSignature)
+        return 0;
+    // The name and extra field lengths of the local header may differ from the central directory.
+    unsigned long long dataOffset = (unsigned long long)entry.localHeaderOffset + cLocalHeaderSize + ReadU16(header + 26) + ReadU16(header + 28);
+    if (dataOffset + entry.compressedSize > size_)
+        return 0;
+    return data_ + dataOffset;
+}
+
+bool ZipArchive::ReadCentralDirectory()
+{
+    if (size_ < cEndOfCentralDirectorySize)
+    {
+        error_ = "Not a zip archive";
+        return false;
+    }
+
+    // The end of central directory record is followed by a variable length comment, search backwards for it.
+    const u8 *end = 0;
+    const uint searchStart = size_ - cEndOfCentralDirectorySize;
+    const uint searchEnd = (searchStart > cMaxCommentSize ? searchStart - cMaxCommentSize : 0);
+    for(uint pos = searchStart + 1; pos-- > searchEnd;)
+    {
+        if (ReadU32(data_ + pos) == cEndOfCentralDirectorySignature)
+        {
+            end = data_ + pos;
+            break;
+        }
+    }
+    if (!end)
+    {
+        error_ = "Not a zip archive";
+        return false;
+    }
+
+    const uint numEntries = ReadU16(end + 10);
+    const uint directorySize = ReadU32(end + 12);
+    const uint directoryOffset = ReadU32(end + 16);
+    if (numEntries == 0xFFFF || directoryOffset == 0xFFFFFFFF)
+    {
+        error_ = "ZIP64 archives are not supported";
+        return false;
+    }
+    if ((unsigned long long)directoryOffset + directorySize > size_)
+    {
+        error_ = "Corrupted archive";
+        return false;
+    }
+
+    entries_.Reserve(numEntries);
+    const u8 *p = data_ + directoryOffset;
+    const u8 *directoryEnd = p + directorySize;
+    for(uint i = 0; i < numEntries; ++i)
+    {
+        if (p + cCentralHeaderSize > directoryEnd || ReadU32(p) != cCentralHeaderSignature)
+        {
+            error_ = "Corrupted archive";
+            entries_.Clear();
+            index_.Clear();
+            return false;
+        }
+        const uint flags = ReadU16(p + 8);
+        const uint nameLength = ReadU16(p + 28);
+        const uint extraLength = ReadU16(p + 30);
+        const uint commentLength = ReadU16(p + 32);
+        if (p + cCentralHeaderSize + nameLength > directoryEnd)
+        {
+            error_ = "Corrupted archive";
+            entries_.Clear();
+            index_.Clear();
+            return false;
+        }
+
+        Entry entry;
+        entry.name = String((const char*)p + cCentralHeaderSize, nameLength);
+        entry.method = (unsigned short)ReadU16(p + 10);
+        entry.crc = ReadU32(p + 16);
+        entry.compressedSize = ReadU32(p + 20);
+        entry.uncompressedSize = ReadU32(p + 24);
+        entry.localHeaderOffset = ReadU32(p + 42);
+        p += cCentralHeaderSize + nameLength + extraLength + commentLength;
+
+        // Skip directories and encrypted entries
+        if (entry.name.Empty() || entry.name.EndsWith("/") || (flags & 0x1))
+            continue;
+        entry.name = Urho3D::GetInternalPath(entry.name);
+        index_[entry.name.ToLower()] = entries_.Size();
+        entries_.Push(entry);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,77 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "ZipPluginApi.h"
+#include "ZipPluginFwd.h"
+
+#include <Urho3D/Container/HashMap.h>
+
+namespace Tundra
+{
+
+/// Read-only zip archive, memory mapped from a file or held in memory.
+/** Only the central directory is read when the archive is opened, the entries are decompressed on demand.
+    Read() does not modify the archive, so different entries can be read in parallel from worker threads.
+    Stored (uncompressed) entries can be accessed in place with StoredData().
+    ZIP64 archives and encrypted entries are not supported. */
+class TUNDRA_ZIP_API ZipArchive
+{
+public:
+    /// File entry of the central directory. Directories are not listed.
+    struct Entry
+    {
+        String name;
+        uint compressedSize;
+        uint uncompressedSize;
+        uint crc;
+        uint localHeaderOffset;
+        unsigned short method;
+    };
+
+    ZipArchive();
+    ~ZipArchive();
+
+    /// Memory maps @c filename and reads its central directory.
+    bool OpenFile(const String &filename);
+    /// Copies @c data and reads its central directory.
+    bool OpenData(const u8 *data, uint numBytes);
+    /// Closes the archive. The entries and the data returned by StoredData() are no longer valid.
+    void Close();
+
+    bool IsOpen() const { return data_ != 0; }
+    /// Returns the reason the archive failed to open.
+    const String &Error() const { return error_; }
+
+    const Vector<Entry> &Entries() const { return entries_; }
+    /// Returns the entry with @c name, compared case-insensitively, or null if not found.
+    const Entry *FindEntry(const String &name) const;
+
+    /// Returns the data of @c entry if it is stored uncompressed, otherwise null. Valid while the archive is open.
+    const u8 *StoredData(const Entry &entry) const;
+    /// Decompresses @c entry to @c dst and verifies its checksum. Safe to call from worker threads.
+    bool Read(const Entry &entry, Vector<u8> &dst) const;
+
+private:
+    bool ReadCentralDirectory();
+    /// Returns the start of the data of @c entry, or null if the local header is invalid.
+    const u8 *EntryData(const Entry &entry) const;
+    void Unmap();
+
+    const u8 *data_;
+    uint size_;
+    /// Owned copy of the archive, if opened with OpenData.
+    Vector<u8> memory_;
+#ifdef _WIN32
+    void *file_;
+    void *mapping_;
+#endif
+    bool mapped_;
+
+    Vector<Entry> entries_;
+    /// Maps lowercase entry names to indices of entries_.
+    HashMap<String, uint> index_;
+    String error_;
+};
+
+}
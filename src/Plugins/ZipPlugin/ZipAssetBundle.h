@@ -4,26 +4,22 @@
 
 #include "ZipPluginApi.h"
 #include "ZipPluginFwd.h"
+#include "ZipArchive.h"
 
 #include "AssetAPI.h"
 #include "IAssetBundle.h"
 
-#include <Urho3D/Core/Mutex.h>
-
-namespace Urho3D
-{
-    class Context;
-    class FileSystem;
-}
-
-/// @cond PRIVATE
-struct zzip_dir;
-/// @endcond
+#include <Urho3D/Container/RefCounted.h>
+#include <Urho3D/Core/WorkQueue.h>
 
 namespace Tundra
 {
 
 /// Provides zip packed asset bundles.
+/** The archive is memory mapped from its disk source, or copied from memory if there is none, and only its
+    central directory is read when the bundle is loaded. The sub assets are not extracted to disk; each one is
+    decompressed when its data is queried. The sub assets AssetAPI is about to load are decompressed in parallel
+    in the work queue threads, and sub assets stored without compression are provided in place without copying. */
 class TUNDRA_ZIP_API ZipAssetBundle : public IAssetBundle
 {
     URHO3D_OBJECT(ZipAssetBundle, IAssetBundle);
@@ -36,74 +32,68 @@ public:
     bool IsLoaded() const override;
 
     /// IAssetBundle override.
-    /** Our current zziplib implementation requires disk source for processing. */
-    bool RequiresDiskSource() override { return true; }
+    bool RequiresDiskSource() override { return false; }
 
     /// IAssetBundle override.
-    /** Our current zziplib implementation requires disk source for processing.
-        So we fail DeserializeFromData and try our best here to.
-        This function unpacks the archive content to asset cache to normal cache files
-        and provides the sub asset data via GetSubAssetData and GetSubAssetDiskSource. */
+    /** Memory maps the disk source and reads the central directory of the archive. */
     bool DeserializeFromDiskSource() override;
 
     /// IAssetBundle override.
-    /** @todo If we must support this in memory method with zzip 
-        we could store the data to disk and open it. Be sure to change RequiresDiskSource to false.
-        @return Currently not applicable, so false always. */
+    /** Copies @c data and reads the central directory of the archive, eg. for bundles that have no disk source. */
     bool DeserializeFromData(const u8 *data, uint numBytes) override;
 
     /// IAssetBundle override.
     /** This does not include sub folders inside the zip file to this count, files in sub folders will be counted. */
-    int SubAssetCount() const override { return fileCount_; }
+    int SubAssetCount() const override;
 
     /// IAssetBundle override.
     Vector<u8> GetSubAssetData(const String &subAssetName) override;
 
     /// IAssetBundle override.
+    /** The sub assets are not extracted to disk, so this always returns an empty string. */
     String GetSubAssetDiskSource(const String &subAssetName) override;
-    
-private:
-    friend class ZipWorker;
 
-    /// Returns full asset reference for a sub asset.
-    String GetFullAssetReference(const String &subAssetName);
-    
     /// IAssetBundle override.
-    void DoUnload() override;
+    /** Provides the sub assets that are stored without compression. */
+    bool GetSubAssetDataInPlace(const String &subAssetName, const u8 *&data, uint &numBytes) override;
 
-    /// Closes zip file.
-    void Close();
+    /// IAssetBundle override.
+    /** Starts decompressing the sub assets in the work queue threads. */
+    void PrepareSubAssets(const StringVector &subAssetNames) override;
 
-    /// Check if worker has completed.
-    void CheckDone(float frametime);
+private:
+    /// Sub asset being decompressed in a work queue thread.
+    struct Inflate : public RefCounted
+    {
+        Inflate() : archive(0), entry(0), success(false) {}
 
-    /// Handler for asynch loading completion.
-    /** Invoked in worker thread context. */
-    void WorkerDone(bool successful);
+        const ZipArchive *archive;
+        const ZipArchive::Entry *entry;
+        Vector<u8> data;
+        bool success;
+        SharedPtr<Urho3D::WorkItem> item;
+    };
+    typedef SharedPtr<Inflate> InflatePtr;
 
-    /// Stops and destroys thread.
-    /** @note Only call in main thread context. */
-    void StopThread();
+    /// Work queue function for decompressing the sub asset in @c item->aux_.
+    static void InflateWork(const Urho3D::WorkItem *item, unsigned threadIndex);
 
-    Urho3D::Context *Context() const;
-    Urho3D::FileSystem *FileSystem() const;
+    /// Waits for the sub assets being decompressed.
+    void CompleteInflates();
 
-    /// Zziplib ptr to the zip file.
-    zzip_dir *archive_;
+    /// Logs the load result and emits Loaded.
+    bool Opened(bool success);
 
-    /// Zip sub assets.
-    ZipFileVector files_;
+    /// IAssetBundle override.
+    void DoUnload() override;
 
-    /// Worker
-    ZipWorker *worker_;
+    ZipArchive archive_;
 
-    /// Count of files inside this zip.
-    int fileCount_;
+    /// Sub assets prepared by PrepareSubAssets, by entry name. Removed when their data is queried.
+    HashMap<String, InflatePtr> inflates_;
 
-    /// Mutex for polling completion of worker thread.
-    Urho3D::Mutex mutexDone_;
-    bool done_;
-    bool success_;
+    /// The work queue the sub assets are decompressed in.
+    WeakPtr<Urho3D::WorkQueue> workQueue_;
 };
 typedef SharedPtr<ZipAssetBundle> ZipAssetBundlePtr;
 
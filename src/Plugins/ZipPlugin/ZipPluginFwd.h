@@ -11,18 +11,5 @@ namespace Tundra
 {
     class ZipBundleFactory;
     class ZipAssetBundle;
-    class ZipWorker;
-    
-    /// @cond PRIVATE
-    struct ZipArchiveFile
-    {
-        String relativePath;
-        String cachePath;
-        uint compressedSize;
-        uint uncompressedSize;
-        uint lastModified;
-        bool doExtract;
-    };
-    typedef Vector<ZipArchiveFile> ZipFileVector;
-    /// @endcond
+    class ZipArchive;
 }
@@ -39,9 +39,14 @@ AssetAPI::AssetAPI(Framework *framework, bool headless) :
     Object(framework->GetContext()),
     fw(framework),
     isHeadless(headless),
+    asynchronousLoading(true),
+    decodeQueue(0),
+    transferScheduler(0),
     assetCache(0)
 {
     transferPrioritizer_ = new DefaultAssetTransferPrioritizer();
+    decodeQueue = new AssetDecodeQueue(this);
+    transferScheduler = new AssetTransferScheduler(this);
 
     AssetProviderPtr local(new LocalAssetProvider(fw));
     RegisterAssetProvider(local);
@@ -59,6 +64,17 @@ AssetAPI::AssetAPI(Framework *framework, bool headless) :
         LogWarning("--accept_unknown_local_sources: this format of the command-line parameter is deprecated and support for it will be removed. Use --acceptUnknownLocalSources instead.");
     if (fw->HasCommandLineParameter("--no_async_asset_load"))
         LogWarning("--no_async_asset_load: this format of the command-line parameter is deprecated and support for it will be removed. Use --noAsyncAssetLoad instead.");
+    if (fw->HasCommandLineParameter("--noAsyncAssetLoad") || fw->HasCommandLineParameter("--no_async_asset_load"))
+        asynchronousLoading = false;
+    StringVector decodeBudgetParam = fw->CommandLineParameters("--assetDecodeBudget"); // Milliseconds
+    if (!decodeBudgetParam.Empty())
+        decodeQueue->SetTimeBudget(Urho3D::ToFloat(decodeBudgetParam.Back()) / 1000.f);
+    StringVector transferLimitParam = fw->CommandLineParameters("--assetTransferLimit");
+    if (!transferLimitParam.Empty())
+        transferScheduler->SetMaxInFlight(Urho3D::ToUInt(transferLimitParam.Back()));
+    StringVector providerLimitParam = fw->CommandLineParameters("--assetTransferProviderLimit");
+    if (!providerLimitParam.Empty())
+        transferScheduler->SetMaxInFlightPerProvider(Urho3D::ToUInt(providerLimitParam.Back()));
     if (fw->HasCommandLineParameter("--clear-asset-cache"))
         LogWarning("--clear-asset-cache: this format of the command-line parameter is deprecated and support for it will be removed. Use --clearAssetCache instead.");
 }
@@ -66,6 +82,8 @@ AssetAPI::AssetAPI(Framework *framework, bool headless) :
 AssetAPI::~AssetAPI()
 {
     Reset();
+    delete transferScheduler;
+    delete decodeQueue;
 }
 
 void AssetAPI::OpenAssetCache(String directory)
@@ -512,12 +530,19 @@ bool AssetAPI::ForgetAsset(AssetPtr asset, bool removeDiskSource)
 
     // Do an explicit unload of the asset before deletion (the dtor of each asset has to do unload as well, but this handles the cases where
     // some object left a dangling strong ref to an asset).
+    decodeQueue->Cancel(asset.Get());
     asset->Unload();
+    asset->Unloaded.Disconnect(this, &AssetAPI::OnAssetUnloaded);
+    RemoveAssetDependencies(asset->Name());
 
     // Remove any pending transfers for this asset.
     AssetTransferMap::iterator transferIter = FindTransferIterator(asset->Name());
     if (transferIter != currentTransfers.end())
+    {
+        // The provider will not report a forgotten transfer, so release its slot in the scheduler here.
+        transferScheduler->Finished(transferIter->second.Get(), false);
         currentTransfers.erase(transferIter);
+    }
 
     // Remove the asset from internal state.
     AssetMap::iterator iter = assets.find(asset->Name());
@@ -698,6 +723,7 @@ AssetUploadTransferPtr AssetAPI::UploadAssetFromFileInMemory(const u8 *data, uin
 
 void AssetAPI::ForgetAllAssets()
 {
+    transferScheduler->Clear();
     readyTransfers.Clear();
     readySubTransfers.Clear();
 
@@ -736,6 +762,7 @@ void AssetAPI::ForgetAllAssets()
 
 void AssetAPI::Reset()
 {
+    decodeQueue->Clear();
     ForgetAllAssets();
     assetCache.Reset();
     assets.clear();
@@ -985,8 +1012,8 @@ AssetTransferPtr AssetAPI::RequestAsset(String assetRef, String assetType, bool
     // will return the same request pointer, so we'll avoid multiple downloads to the exact same asset.
     currentTransfers[assetRef] = transfer;
 
-    // Push to pending transfers. These will be sorted by IAssetTransferPrioritizer prior to actual execution.
-    pendingTransfers_.Push(transfer);
+    // Queue the transfer. The scheduler starts it in the order of IAssetTransferPrioritizer when the in-flight limits allow.
+    transferScheduler->Queue(transfer);
 
     // Request for a direct asset reference.
     if (!isSubAsset)
@@ -1284,6 +1311,7 @@ AssetPtr AssetAPI::CreateNewAsset(String type, String name, AssetStoragePtr stor
 
     // Remember this asset in the global AssetAPI storage.
     assets[name] = asset;
+    asset->Unloaded.Connect(this, &AssetAPI::OnAssetUnloaded);
 
     ///\bug DiskSource and DiskSourceType are not set yet.
     {
@@ -1370,8 +1398,10 @@ bool AssetAPI::LoadSubAssetToTransfer(AssetTransferPtr transfer, IAssetBundle *b
     // Avoid data shuffling if disk source is valid. IAsset loading can 
     // manage with one of these, it does not need them both.
     Vector<u8> subAssetData;
+    const u8 *subAssetDataPtr = 0;
+    uint subAssetDataSize = 0;
     String subAssetDiskSource = bundle->GetSubAssetDiskSource(subAssetRef);
-    if (subAssetDiskSource.Empty()) 
+    if (subAssetDiskSource.Empty() && !bundle->GetSubAssetDataInPlace(subAssetRef, subAssetDataPtr, subAssetDataSize))
     {
         subAssetData = bundle->GetSubAssetData(subAssetRef);
         if (subAssetData.Size() == 0)
@@ -1381,6 +1411,8 @@ bool AssetAPI::LoadSubAssetToTransfer(AssetTransferPtr transfer, IAssetBundle *b
             transfer->EmitAssetFailed(error);
             return false;
         }
+        subAssetDataPtr = &subAssetData[0];
+        subAssetDataSize = subAssetData.Size();
     }
 
     if (!transfer->asset)
@@ -1411,8 +1443,8 @@ bool AssetAPI::LoadSubAssetToTransfer(AssetTransferPtr transfer, IAssetBundle *b
     transfer->EmitAssetDownloaded();
 
     bool success = false;
-    if (subAssetData.Size() > 0)
-        success = transfer->asset->LoadFromFileInMemory(&subAssetData[0], subAssetData.Size());
+    if (subAssetDataPtr && subAssetDataSize > 0)
+        success = transfer->asset->LoadFromFileInMemory(subAssetDataPtr, subAssetDataSize, asynchronousLoading);
     else if (!transfer->asset->DiskSource().Empty())
         success = transfer->asset->LoadFromFile(subAssetDiskSource);
 
@@ -1482,27 +1514,7 @@ void AssetAPI::Update(float frametime)
     URHO3D_PROFILE(AssetAPI_Update);
 
     // Prioritize and execute pending transfers
-    if (!pendingTransfers_.Empty())
-    {
-        URHO3D_PROFILE(AssetAPI_PrioritizeTransfers);
-
-        if (transferPrioritizer_)
-        {
-            AssetTransferPtrVector sorted = transferPrioritizer_->Prioritize(pendingTransfers_);
-            if (sorted.Size() == pendingTransfers_.Size())
-                pendingTransfers_ = sorted;
-            else
-                LogErrorF("AssetAPI: IAssetTransferPrioritizer implementation returned incorrect amount of transfers. Returned %d when expecting %d", sorted.Size(), pendingTransfers_.Size());
-        }
-        foreach(AssetTransferPtr transfer, pendingTransfers_)
-        {
-            if (transfer->provider)
-                transfer->provider->ExecuteTransfer(transfer);
-            else
-                LogErrorF("AssetAPI: Cannot execute asset transfer '%s' as it has no provider", transfer->SourceUrl().CString());
-        }
-        pendingTransfers_.Clear();
-    }
+    transferScheduler->Update(frametime, transferPrioritizer_.Get());
 
     // Update providers
     for(uint i = 0, num = providers.Size(); i<num; ++i)
@@ -1542,6 +1554,9 @@ void AssetAPI::Update(float frametime)
         }
         readySubTransfers.Clear();
     }
+
+    // Commit the assets that have been decoded in the work queue threads.
+    decodeQueue->Update();
 }
 
 String GuaranteeTrailingSlash(const String &source)
@@ -1630,6 +1645,7 @@ void AssetAPI::AssetTransferCompleted(IAssetTransfer *transfer_)
     // 3) It could be an AssetTransfer that was fulfilled from the disk cache, in which case no AssetProvider was invoked to get here. (we used the readyTransfers queue for this).
         
     AssetTransferPtr transfer(transfer_); // Elevate to a SharedPtr immediately to keep at least one ref alive of this transfer for the duration of this function call.
+    transferScheduler->Finished(transfer_, true);
     //LogDebug("Transfer of asset \"" + transfer->assetType + "\", name \"" + transfer->source.ref + "\" succeeded.");
 
     // This is a duplicated transfer to an asset that has already been previously loaded. Only signal that the asset's been loaded and finish.
@@ -1723,6 +1739,9 @@ void AssetAPI::AssetTransferCompleted(IAssetTransfer *transfer_)
         String assetDiskSource = transfer->DiskSource(); // The asset provider may have specified an explicit filename to use as a disk source.
         if (transfer->CachingAllowed() && transfer->rawAssetData.Size() > 0 && assetCache)
             assetDiskSource = assetCache->StoreAsset(&transfer->rawAssetData[0], transfer->rawAssetData.Size(), transfer->source.ref);
+        // The provider may have written the cache file itself, in which case the cache needs to know about it to account for its size.
+        else if (!assetDiskSource.Empty() && assetCache && assetDiskSource == assetCache->DiskSourceByRef(transfer->source.ref))
+            assetCache->AddFile(transfer->source.ref);
 
         // If disksource is still empty, forcibly look up if the asset exists in the cache now.
         if (assetDiskSource.Empty() && assetCache)
@@ -1740,9 +1759,9 @@ void AssetAPI::AssetTransferCompleted(IAssetTransfer *transfer_)
         bool success = false;
         const u8 *data = (transfer->rawAssetData.Size() > 0 ? &transfer->rawAssetData[0] : 0);
         if (data)
-            success = transfer->asset->LoadFromFileInMemory(data, transfer->rawAssetData.Size());
+            success = transfer->asset->LoadFromFileInMemory(data, transfer->rawAssetData.Size(), asynchronousLoading);
         else
-            success = transfer->asset->LoadFromFile(transfer->asset->DiskSource());
+            success = transfer->asset->LoadFromFile(transfer->asset->DiskSource(), asynchronousLoading);
 
         // If the load from either of in memory data or file data failed, update the internal state.
         // Otherwise the transfer will be left dangling in currentTransfers. For successful loads
@@ -1759,6 +1778,7 @@ void AssetAPI::AssetTransferFailed(IAssetTransfer *transfer, String reason)
         return;
         
     LogError("Transfer of asset \"" + transfer->assetType + "\", name \"" + transfer->source.ref + "\" failed! Reason: \"" + reason + "\"");
+    transferScheduler->Finished(transfer, false);
 
     ///\todo In this function, there is a danger of reaching an infinite recursion. Remember recursion parents and avoid infinite loops. (A -> B -> C -> A)
 
@@ -1794,6 +1814,7 @@ void AssetAPI::AssetTransferAborted(IAssetTransfer *transfer)
     // Don't log any errors for aborted transfers. This is unwanted spam when we disconnect 
     // from a server and have x amount of pending transfers that get aborter.
     AssetTransferMap::iterator iter = currentTransfers.find(transfer->source.ref);
+    transferScheduler->Finished(transfer, false);
     
     transfer->EmitAssetFailed("Transfer aborted.");   
 
@@ -1835,6 +1856,10 @@ void AssetAPI::AssetLoadCompleted(const String assetRef)
 
     if (asset.Get())
     {
+        // Update the dependency graph before LoadCompleted, which checks for pending dependencies.
+        NotifyAssetDependenciesChanged(asset);
+        assetDependencies.SetLoaded(asset->Name(), asset->IsLoaded());
+
         asset->LoadCompleted();
 
         // Add to watch this path for changed, note this does nothing if the path is already added
@@ -1895,6 +1920,17 @@ void AssetAPI::AssetBundleLoadCompleted(IAssetBundle *bundle)
         Vector<AssetTransferPtr> subTransfers = bundleMonitor->SubAssetTransfers();
         bundleMonitors.erase(monitorIter);
         
+        // Let the bundle unpack the requested sub assets in parallel before they are loaded one by one.
+        StringVector subAssetNames;
+        subAssetNames.Reserve(subTransfers.Size());
+        for (Vector<AssetTransferPtr>::Iterator subIter = subTransfers.Begin(); subIter != subTransfers.End(); ++subIter)
+        {
+            String subAssetName;
+            ParseAssetRef((*subIter)->source.ref, 0, 0, 0, 0, 0, 0, 0, &subAssetName);
+            subAssetNames.Push(subAssetName);
+        }
+        bundle->PrepareSubAssets(subAssetNames);
+
         // Start the load process for all sub asset transfers now. From here on out the normal asset request flow should followed.
         for (Vector<AssetTransferPtr>::Iterator subIter = subTransfers.Begin(); subIter != subTransfers.End(); ++subIter)
             LoadSubAssetToTransfer((*subIter), bundle, (*subIter)->source.ref);
@@ -1972,20 +2008,37 @@ void AssetAPI::NotifyAssetDependenciesChanged(AssetPtr asset)
 {
     URHO3D_PROFILE(AssetAPI_NotifyAssetDependenciesChanged);
 
-    /// Delete all old stored asset dependencies for this asset.
-    RemoveAssetDependencies(asset->Name());
-
     Vector<AssetReference> refs = asset->FindReferences();
+    StringVector dependencies;
+    dependencies.Reserve(refs.Size());
     for(uint i = 0; i < refs.Size(); ++i)
     {
-        // Turn named storage (and default storage) specifiers to absolute specifiers.
-        String ref = refs[i].ref;
-        if (ref.Empty())
+        if (refs[i].ref.Empty())
+            continue;
+
+        // We silently ignore this dependency if the asset type in question is disabled.
+        if (dynamic_cast<NullAssetFactory*>(AssetTypeFactory(ResourceTypeForAssetRef(refs[i])).Get()))
             continue;
 
-        // Remember this assetref for future lookup.
-        assetDependencies.Push(MakePair(asset->Name(), ref));
+        // Turn named storage (and default storage) specifiers to absolute specifiers, the same way FindAsset does,
+        // so that the graph node of the dependency is the one the asset will be stored with.
+        String ref = refs[i].ref;
+        AssetMap::const_iterator iter = assets.find(ref);
+        if (iter == assets.end())
+        {
+            ref = ResolveAssetRef("", ref);
+            iter = assets.find(ref);
+        }
+        if (iter != assets.end())
+        {
+            ref = iter->first;
+            assetDependencies.SetLoaded(ref, iter->second->IsLoaded());
+        }
+        dependencies.Push(ref);
     }
+
+    // Replaces all old stored asset dependencies for this asset.
+    assetDependencies.SetDependencies(asset->Name(), dependencies);
 }
 
 void AssetAPI::RequestAssetDependencies(AssetPtr asset)
@@ -1994,6 +2047,10 @@ void AssetAPI::RequestAssetDependencies(AssetPtr asset)
     // Make sure we have most up-to-date internal view of the asset dependencies.
     NotifyAssetDependenciesChanged(asset);
 
+    // The dependencies are prioritized by the entities that refer to the asset.
+    AssetTransferMap::iterator parentIter = FindTransferIterator(asset->Name());
+    IAssetTransfer *parent = (parentIter != currentTransfers.end() ? parentIter->second.Get() : 0);
+
     Vector<AssetReference> refs = asset->FindReferences();
     for(uint i = 0; i < refs.Size(); ++i)
     {
@@ -2005,7 +2062,9 @@ void AssetAPI::RequestAssetDependencies(AssetPtr asset)
         if (!existing || !existing->IsLoaded())
         {
 //            LogDebug("Asset " + asset->ToString() + " depends on asset " + ref.ref + " (type=\"" + ref.type + "\") which has not been loaded yet. Requesting..");
-            RequestAsset(ref);
+            AssetTransferPtr transfer = RequestAsset(ref);
+            if (transfer && parent && transfer.Get() != parent)
+                transfer->InheritReferrers(*parent);
         }
     }
 }
@@ -2013,27 +2072,21 @@ void AssetAPI::RequestAssetDependencies(AssetPtr asset)
 void AssetAPI::RemoveAssetDependencies(String asset)
 {
     URHO3D_PROFILE(AssetAPI_RemoveAssetDependencies);
-    for(uint i = 0; i < assetDependencies.Size(); ++i)
-        if (String::Compare(assetDependencies[i].first_.CString(), asset.CString(), false) == 0)
-        {
-            assetDependencies.Erase(assetDependencies.Begin() + i);
-            --i;
-        }
+    assetDependencies.RemoveDependencies(asset);
 }
 
 Vector<AssetPtr> AssetAPI::FindDependents(String dependee)
 {
     URHO3D_PROFILE(AssetAPI_FindDependents);
 
+    StringVector dependentRefs = assetDependencies.Dependents(dependee);
     Vector<AssetPtr> dependents;
-    for(uint i = 0; i < assetDependencies.Size(); ++i)
+    dependents.Reserve(dependentRefs.Size());
+    for(uint i = 0; i < dependentRefs.Size(); ++i)
     {
-        if (String::Compare(assetDependencies[i].second_.CString(), dependee.CString(), false) == 0)
-        {
-            AssetMap::iterator iter = assets.find(assetDependencies[i].first_);
-            if (iter != assets.end())
-                dependents.Push(iter->second);
-        }
+        AssetMap::iterator iter = assets.find(dependentRefs[i]);
+        if (iter != assets.end())
+            dependents.Push(iter->second);
     }
     return dependents;
 }
@@ -2041,81 +2094,12 @@ Vector<AssetPtr> AssetAPI::FindDependents(String dependee)
 int AssetAPI::NumPendingDependencies(AssetPtr asset) const
 {
     URHO3D_PROFILE(AssetAPI_NumPendingDependencies);
-    int numDependencies = 0;
-
-    Vector<AssetReference> refs = asset->FindReferences();
-    for(uint i = 0; i < refs.Size(); ++i)
-    {
-        String ref = refs[i].ref;
-        if (ref.Empty())
-            continue;
-
-        // We silently ignore this dependency if the asset type in question is disabled.
-        if (dynamic_cast<NullAssetFactory*>(AssetTypeFactory(ResourceTypeForAssetRef(refs[i])).Get()))
-            continue;
-
-        AssetPtr existing = FindAsset(refs[i].ref);
-        if (!existing)
-        {
-            // Not loaded, just mark the single one
-            ++numDependencies;
-        }
-        else
-        {
-            // If asset is empty, count it as an unloaded dependency
-            if (existing->IsEmpty())
-                ++numDependencies;
-            else
-            {
-                if (!existing->IsLoaded())
-                    ++numDependencies;
-                // Ask the dependencies of the dependency, we want all of the asset
-                // down the chain to be loaded before we load the base asset
-                // Note: if the dependency is unloaded, it may or may not be able to tell the dependencies correctly
-                numDependencies += NumPendingDependencies(existing);
-            }
-        }
-    }
-
-    return numDependencies;
+    return asset ? (int)assetDependencies.NumPendingDependencies(asset->Name()) : 0;
 }
 
 bool AssetAPI::HasPendingDependencies(AssetPtr asset) const
 {
-    URHO3D_PROFILE(AssetAPI_HasPendingDependencies);
-
-    Vector<AssetReference> refs = asset->FindReferences();
-    for(uint i = 0; i < refs.Size(); ++i)
-    {
-        if (refs[i].ref.Empty())
-            continue;
-
-        // We silently ignore this dependency if the asset type in question is disabled.
-        if (dynamic_cast<NullAssetFactory*>(AssetTypeFactory(ResourceTypeForAssetRef(refs[i])).Get()))
-            continue;
-
-        AssetPtr existing = FindAsset(refs[i].ref);
-        if (!existing) // Not loaded, just mark the single one
-            return true;
-        else
-        {            
-            if (existing->IsEmpty())
-                return true; // If asset is empty, count it as an unloaded dependency
-            else
-            {
-                if (!existing->IsLoaded())
-                    return true;
-                // Ask the dependencies of the dependency, we want all of the asset
-                // down the chain to be loaded before we load the base asset
-                // Note: if the dependency is unloaded, it may or may not be able to tell the dependencies correctly
-                bool dependencyHasDependencies = HasPendingDependencies(existing);
-                if (dependencyHasDependencies)
-                    return true;
-            }
-        }
-    }
-
-    return false;
+    return asset && assetDependencies.HasPendingDependencies(asset->Name());
 }
 
 void AssetAPI::HandleAssetDiscovery(const String &assetRef, const String &assetType)
@@ -2221,6 +2205,11 @@ void AssetAPI::OnAssetLoaded(AssetPtr asset)
     }
 }
 
+void AssetAPI::OnAssetUnloaded(IAsset *asset)
+{
+    assetDependencies.SetLoaded(asset->Name(), false);
+}
+
 void AssetAPI::OnAssetDiskSourceChanged(const String &path)
 {
     Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
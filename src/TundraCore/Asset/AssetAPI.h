@@ -10,6 +10,9 @@
 #include "IAssetTypeFactory.h"
 #include "IAssetTransfer.h"
 #include "IAssetBundle.h"
+#include "AssetDependencyGraph.h"
+#include "AssetDecodeQueue.h"
+#include "AssetTransferScheduler.h"
 #include "CoreStringUtils.h"
 #include "Signals.h"
 
@@ -177,8 +180,6 @@ public:
         String *outPath_Filename_SubAssetName = 0, String *outPath_Filename = 0, String *outPath = 0, String *outFilename = 0, String *outSubAssetName = 0,
         String *outFullRef = 0, String *outFullRefNoSubAssetName = 0);
 
-    typedef Vector<Pair<String, String> > AssetDependenciesMap;
-    
     /// Sanitates an assetref so that it can be used as a filename for caching.
     /** Characters like ':'. '/', '\' and '*' will be replaced with $1, $2, $3, $4 .. respectively, in a reversible way.
         Note that sanitated assetrefs will not work when querying from the asset system, for that you need the desanitated form.
@@ -274,6 +275,15 @@ public:
     /// Returns the asset cache object that generates a disk source for all assets.
     AssetCache *Cache() const { return assetCache; }
 
+    /// Returns the queue that decodes asset data in the work queue threads for the asset types that support asynchronous loading.
+    /** The time budget for committing the decoded assets per frame can be set with --assetDecodeBudget <milliseconds>.
+        Asynchronous loading can be disabled altogether with --noAsyncAssetLoad. @remark Asset decode pipeline */
+    AssetDecodeQueue *DecodeQueue() const { return decodeQueue; }
+
+    /// Returns the scheduler that starts the requested asset transfers within the in-flight limits.
+    /** The limits can be set with --assetTransferLimit <count> and --assetTransferProviderLimit <count>, 0 for unlimited. */
+    AssetTransferScheduler *TransferScheduler() const { return transferScheduler; }
+
     /// Returns the asset storage of the given name.
     /// @param name The name of the storage to get. Remember that Asset Storage names are case-insensitive.
     AssetStoragePtr AssetStorageByName(const String &name) const;
@@ -438,8 +448,8 @@ public:
     /// A utility function that counts the number of current asset transfers.
     size_t NumCurrentTransfers() const { return currentTransfers.size(); }
     
-    /// Return the current asset dependency map (debugging)
-    const AssetDependenciesMap& DebugGetAssetDependencies() const { return assetDependencies; }
+    /// Return the current asset dependency graph (debugging)
+    const AssetDependencyGraph& DebugGetAssetDependencies() const { return assetDependencies; }
     
     /// Return ready asset transfers (debugging)
     const Vector<AssetTransferPtr>& DebugGetReadyTransfers() const { return readyTransfers; }
@@ -482,6 +492,9 @@ private:
     /// The Asset API listens on each asset when they get loaded, to track the completion of the dependencies of other loaded assets.
     void OnAssetLoaded(AssetPtr asset);
 
+    /// Marks the asset unloaded in the dependency graph, so that its dependents become pending again.
+    void OnAssetUnloaded(IAsset *asset);
+
     /// The Asset API reloads all assets from file when their disk source contents change.
     void OnAssetDiskSourceChanged(const String &path);
 
@@ -506,7 +519,7 @@ private:
         Deletes the asset cache and the disk watcher. Called by Framework. */
     void Reset();
 
-    /// Removes from AssetDependenciesMap all dependencies the given asset has.
+    /// Removes from the dependency graph all dependencies the given asset has.
     void RemoveAssetDependencies(String asset);
 
     /// Handle discovery of a new asset, when the storage is already known. This is used internally for optimization, so that providers don't need to be queried
@@ -523,11 +536,17 @@ private:
 
     bool isHeadless;
 
+    /// Whether downloaded assets may be loaded asynchronously. Disabled with --noAsyncAssetLoad.
+    bool asynchronousLoading;
+
+    /// Decodes asset data in the work queue threads.
+    AssetDecodeQueue *decodeQueue;
+
     /// Stores all the currently ongoing asset transfers.
     AssetTransferMap currentTransfers;
 
-    /// Stores all currently pending transfers.
-    AssetTransferPtrVector pendingTransfers_;
+    /// Starts the pending transfers in priority order within the in-flight limits.
+    AssetTransferScheduler *transferScheduler;
 
     /// Asset transfer prioritizer.
     AssetTransferPrioritizerPtr transferPrioritizer_;
@@ -539,9 +558,8 @@ private:
     /// Stores all the currently ongoing asset uploads, maps full assetRefs to the asset upload transfer structures.
     AssetUploadTransferMap currentUploadTransfers;
 
-    /// Keeps track of all the dependencies each asset has to each other asset.
-    /// \todo Find a more effective data structure for this. Needs something like boost::bimap but for multi-indices.
-    AssetDependenciesMap assetDependencies;
+    /// Keeps track of all the dependencies each asset has to each other asset, and which assets have pending dependencies.
+    AssetDependencyGraph assetDependencies;
 
     /// Stores a list of asset requests to assets that have already been downloaded into the system. These requests don't go to the asset providers
     /// to process, but are internally filled by the Asset API. This member vector is needed to be able to delay the requests and virtual completions
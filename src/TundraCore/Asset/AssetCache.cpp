@@ -10,15 +10,90 @@
 #include "Framework.h"
 #include "LoggingFunctions.h"
 
+#include <Urho3D/Core/Profiler.h>
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/IO/File.h>
 #include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#include <Urho3D/Container/HashSet.h>
+
+#include <cstring>
 
 namespace Tundra
 {
 
+/// Identifier and version of the saved index file.
+static const char *cIndexFileID = "TACI";
+static const unsigned cIndexVersion = 3;
+/// Subdirectory of the content-addressed objects.
+static const char *cObjectDirectory = "objects/";
+/// Journal record types.
+static const u8 cJournalSet = 'S';
+static const u8 cJournalRemove = 'R';
+/// The index is saved when the journal has this many more records than there are entries.
+static const uint cMaxExtraJournalRecords = 1024;
+
+/// Size of the chunks in which files are compared.
+static const uint cCompareChunkBytes = 16 * 1024;
+
+/// Returns the filename of the object holding data with the content hash @c hash.
+static String ObjectName(u64 hash, uint numBytes)
+{
+    return cObjectDirectory + Urho3D::ToString("%08x%08x", (unsigned)(hash >> 32), (unsigned)hash) + "_" + String(numBytes);
+}
+
+/// Returns whether the file @c path holds the @c numBytes of @c data, or the same bytes as the file @c other if @c data is null.
+/** The files are read in chunks, so that large files are not held in memory. */
+static bool HasContent(Urho3D::Context *context, const String &path, const u8 *data, uint numBytes, const String &other)
+{
+    Urho3D::File file(context, path, Urho3D::FILE_READ);
+    if (!file.IsOpen() || file.GetSize() != numBytes)
+        return false;
+    if (data)
+    {
+        u8 chunk[cCompareChunkBytes];
+        for(uint pos = 0; pos < numBytes; pos += cCompareChunkBytes)
+        {
+            const uint chunkBytes = Min(numBytes - pos, cCompareChunkBytes);
+            if (file.Read(chunk, chunkBytes) != chunkBytes || memcmp(chunk, data + pos, chunkBytes) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    Urho3D::File otherFile(context, other, Urho3D::FILE_READ);
+    if (!otherFile.IsOpen() || otherFile.GetSize() != numBytes)
+        return false;
+    u8 chunk[cCompareChunkBytes], otherChunk[cCompareChunkBytes];
+    for(uint pos = 0; pos < numBytes; pos += cCompareChunkBytes)
+    {
+        const uint chunkBytes = Min(numBytes - pos, cCompareChunkBytes);
+        if (file.Read(chunk, chunkBytes) != chunkBytes || otherFile.Read(otherChunk, chunkBytes) != chunkBytes ||
+            memcmp(chunk, otherChunk, chunkBytes) != 0)
+            return false;
+    }
+    return true;
+}
+
+u64 AssetCache::ContentHash(const u8 *data, uint numBytes, u64 hash)
+{
+    for(uint i = 0; i < numBytes; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
 AssetCache::AssetCache(AssetAPI *owner, String assetCacheDirectory) : 
     Object(owner->GetContext()),
     assetAPI(owner),
-    cacheDirectory(GuaranteeTrailingSlash(Urho3D::GetInternalPath(assetCacheDirectory)))
+    cacheDirectory(GuaranteeTrailingSlash(Urho3D::GetInternalPath(assetCacheDirectory))),
+    useCounter(0),
+    totalSize(0),
+    maxSize(0),
+    numJournalRecords(0)
 {
     Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
     if (!Urho3D::IsAbsolutePath(cacheDirectory))
@@ -27,6 +102,15 @@ AssetCache::AssetCache(AssetAPI *owner, String assetCacheDirectory) :
     // Check that the main directory exists
     if (!fileSystem->DirExists(cacheDirectory))
         fileSystem->CreateDir(cacheDirectory);
+    if (!fileSystem->DirExists(cacheDirectory + cObjectDirectory))
+        fileSystem->CreateDir(cacheDirectory + cObjectDirectory);
+
+    // A crash while the index was being replaced may leave only the new index, written to a temporary file.
+    if (!LoadIndex(IndexFilename()))
+        LoadIndex(IndexFilename() + ".tmp");
+    ReplayJournal();
+    Reconcile();
+    SaveIndex();
 
     // Check --clearAssetCache start param
     if (owner->GetFramework()->HasCommandLineParameter("--clearAssetCache") ||
@@ -35,14 +119,36 @@ AssetCache::AssetCache(AssetAPI *owner, String assetCacheDirectory) :
         LogInfo("AssetCache: Removing all data and metadata files from cache, found 'clearAssetCache' from the startup params!");
         ClearAssetCache();
     }
+
+    StringVector maxSizeParam = owner->GetFramework()->CommandLineParameters("--assetCacheMaxSize"); // Megabytes
+    if (!maxSizeParam.Empty())
+        SetMaxSize((u64)Urho3D::ToUInt(maxSizeParam.Back()) * 1024 * 1024);
+}
+
+AssetCache::~AssetCache()
+{
+    SaveIndex();
 }
 
 String AssetCache::FindInCache(const String &assetRef)
 {
+    const String key = AssetAPI::SanitateAssetRef(assetRef);
+    HashMap<String, Entry>::Iterator iter = entries.Find(key);
+    if (iter != entries.End())
+    {
+        Touch(key, iter->second_);
+        return EntryPath(key, iter->second_);
+    }
+
+    // The file may have been written directly to DiskSourceByRef().
     Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
-    String absolutePath = DiskSourceByRef(assetRef);
+    String absolutePath = cacheDirectory + key;
     if (fileSystem->FileExists(absolutePath))
+    {
+        AddFileEntry(key, absolutePath);
+        Evict(key);
         return absolutePath;
+    }
     else // The file is not in cache, return an empty string to denote that.
         return "";
 }
@@ -68,34 +174,132 @@ String AssetCache::StoreAsset(AssetPtr asset)
 
 String AssetCache::StoreAsset(const u8 *data, uint numBytes, const String &assetName)
 {
-    String absolutePath = DiskSourceByRef(assetName);
-    bool success = SaveAssetFromMemoryToFile(data, numBytes, absolutePath);
-    if (success)
-        return absolutePath;
-    return "";
+    return Store(data, numBytes, ContentHash(data, numBytes), String(), assetName);
 }
 
-unsigned AssetCache::LastModified(const String &assetRef)
+String AssetCache::StoreFile(const String &filename, u64 contentHash, uint numBytes, const String &assetName)
 {
+    return Store(0, numBytes, contentHash, filename, assetName);
+}
+
+String AssetCache::Store(const u8 *data, uint numBytes, u64 contentHash, const String &filename, const String &assetName)
+{
+    const String key = AssetAPI::SanitateAssetRef(assetName);
+    const String objectName = ObjectName(contentHash, numBytes);
+    const String objectPath = cacheDirectory + objectName;
     Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
+
+    HashMap<String, ContentObject>::Iterator objectIter = objects.Find(objectName);
+    if (objectIter != objects.End())
+    {
+        // Confirm that the data is identical before sharing the object.
+        if (!HasContent(GetContext(), objectPath, data, numBytes, filename))
+        {
+            // A hash collision, or the object has been modified on disk. Store the data in the file of the asset ref instead.
+            RemoveEntry(key);
+            String absolutePath = DiskSourceByRef(assetName);
+            if (!WriteData(data, numBytes, filename, absolutePath))
+                return "";
+            Entry entry;
+            entry.size = numBytes;
+            InsertEntry(key, entry);
+            WriteJournal(key);
+            Evict(key);
+            return absolutePath;
+        }
+    }
+    else
+    {
+        if (!WriteData(data, numBytes, filename, objectPath))
+            return "";
+        objectIter = objects.Insert(MakePair(objectName, ContentObject()));
+        objectIter->second_.size = numBytes;
+        totalSize += numBytes;
+    }
+
+    // The data was in the cache already, so the file was not moved.
+    if (!filename.Empty() && fileSystem->FileExists(filename))
+        fileSystem->Delete(filename);
+
+    // Hold a reference to the object while removing the old entry, which may refer to the same object.
+    ++objectIter->second_.numRefs;
+    RemoveEntry(key);
+    --objectIter->second_.numRefs;
+
+    // A file written earlier to DiskSourceByRef() would be hidden by the object, so delete it.
+    if (fileSystem->FileExists(cacheDirectory + key))
+        fileSystem->Delete(cacheDirectory + key);
+
+    Entry entry;
+    entry.object = objectName;
+    entry.size = numBytes;
+    InsertEntry(key, entry);
+    WriteJournal(key);
+    Evict(key);
+    return objectPath;
+}
+
+void AssetCache::AddFile(const String &assetRef)
+{
+    const String key = AssetAPI::SanitateAssetRef(assetRef);
+    HashMap<String, Entry>::Iterator iter = entries.Find(key);
+    // An object is deleted if this was its last entry, as the file of the asset ref replaces it. The file itself is kept.
+    if (iter != entries.End())
+        EraseEntry(key, !iter->second_.object.Empty());
+    if (GetSubsystem<Urho3D::FileSystem>()->FileExists(cacheDirectory + key))
+    {
+        AddFileEntry(key, cacheDirectory + key);
+        Evict(key);
+    }
+    else
+        WriteJournal(key);
+}
+
+unsigned AssetCache::LastModified(const String &assetRef)
+{
     String absolutePath = FindInCache(assetRef);
     if (absolutePath.Empty())
         return 0;
-    return fileSystem->GetLastModifiedTime(absolutePath);
+    HashMap<String, Entry>::ConstIterator iter = entries.Find(AssetAPI::SanitateAssetRef(assetRef));
+    if (iter != entries.End() && iter->second_.lastModified != 0)
+        return iter->second_.lastModified;
+    return GetSubsystem<Urho3D::FileSystem>()->GetLastModifiedTime(absolutePath);
 }
 
 bool AssetCache::SetLastModified(const String & assetRef, unsigned dateTime)
 {
-    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
-    String absolutePath = FindInCache(assetRef);
-    if (absolutePath.Empty())
+    if (FindInCache(assetRef).Empty())
+        return false;
+    // The time is not set to the file, as an object is shared by the asset refs with identical data.
+    const String key = AssetAPI::SanitateAssetRef(assetRef);
+    entries[key].lastModified = dateTime;
+    WriteJournal(key);
+    return true;
+}
+
+String AssetCache::ETag(const String &assetRef) const
+{
+    HashMap<String, Entry>::ConstIterator iter = entries.Find(AssetAPI::SanitateAssetRef(assetRef));
+    return (iter != entries.End() ? iter->second_.etag : String());
+}
+
+bool AssetCache::SetETag(const String &assetRef, const String &etag)
+{
+    const String key = AssetAPI::SanitateAssetRef(assetRef);
+    HashMap<String, Entry>::Iterator iter = entries.Find(key);
+    if (iter == entries.End())
         return false;
-    return fileSystem->SetLastModifiedTime(absolutePath, dateTime);
+    iter->second_.etag = etag;
+    WriteJournal(key);
+    return true;
 }
 
 void AssetCache::DeleteAsset(const String &assetRef)
 {
-    String absolutePath = DiskSourceByRef(assetRef);
+    const String key = AssetAPI::SanitateAssetRef(assetRef);
+    RemoveEntry(key);
+
+    String absolutePath = cacheDirectory + key;
     Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
     if (fileSystem->FileExists(absolutePath))
         fileSystem->Delete(absolutePath);
@@ -103,12 +307,343 @@ void AssetCache::DeleteAsset(const String &assetRef)
 
 void AssetCache::ClearAssetCache()
 {
+    journal.Reset();
+
     Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
     StringVector filenames;
     fileSystem->ScanDir(filenames, cacheDirectory, "*.*", Urho3D::SCAN_FILES, true);
     foreach(String file, filenames)
         fileSystem->Delete(cacheDirectory + file);
+
+    entries.Clear();
+    objects.Clear();
+    lruOrder.clear();
+    unreferencedObjects.Clear();
+    totalSize = 0;
+    SaveIndex();
+}
+
+void AssetCache::SetMaxSize(u64 bytes)
+{
+    maxSize = bytes;
+    Evict(String());
+}
+
+bool AssetCache::WriteData(const u8 *data, uint numBytes, const String &filename, const String &destination)
+{
+    if (filename.Empty())
+        return SaveAssetFromMemoryToFile(data, numBytes, destination);
+
+    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
+    if (fileSystem->FileExists(destination))
+        fileSystem->Delete(destination);
+    return fileSystem->Rename(filename, destination);
+}
+
+String AssetCache::EntryPath(const String &key, const Entry &entry) const
+{
+    return cacheDirectory + (entry.object.Empty() ? key : entry.object);
+}
+
+void AssetCache::AddFileEntry(const String &key, const String &absolutePath)
+{
+    Urho3D::File file(GetContext(), absolutePath, Urho3D::FILE_READ);
+    Entry entry;
+    entry.size = file.GetSize();
+    InsertEntry(key, entry);
+    WriteJournal(key);
+}
+
+void AssetCache::Touch(const String &key, Entry &entry)
+{
+    if (entry.lastUse)
+        lruOrder.erase(entry.lastUse);
+    entry.lastUse = ++useCounter;
+    lruOrder[entry.lastUse] = key;
 }
 
+void AssetCache::InsertEntry(const String &key, const Entry &newEntry)
+{
+    Entry &entry = entries[key];
+    entry = newEntry;
+    entry.lastUse = 0;
+    if (entry.object.Empty())
+        totalSize += entry.size;
+    else
+    {
+        HashMap<String, ContentObject>::Iterator objectIter = objects.Find(entry.object);
+        if (objectIter == objects.End())
+        {
+            objectIter = objects.Insert(MakePair(entry.object, ContentObject()));
+            objectIter->second_.size = entry.size;
+            totalSize += entry.size;
+        }
+        ++objectIter->second_.numRefs;
+    }
+    Touch(key, entry);
+}
+
+void AssetCache::EraseEntry(const String &key, bool deleteData)
+{
+    HashMap<String, Entry>::Iterator iter = entries.Find(key);
+    if (iter == entries.End())
+        return;
+
+    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
+    const Entry &entry = iter->second_;
+    lruOrder.erase(entry.lastUse);
+    if (entry.object.Empty())
+    {
+        if (deleteData)
+            fileSystem->Delete(cacheDirectory + key);
+        totalSize -= entry.size;
+    }
+    else
+    {
+        HashMap<String, ContentObject>::Iterator objectIter = objects.Find(entry.object);
+        if (objectIter != objects.End() && --objectIter->second_.numRefs == 0)
+        {
+            if (deleteData)
+                fileSystem->Delete(cacheDirectory + entry.object);
+            totalSize -= objectIter->second_.size;
+            objects.Erase(objectIter);
+        }
+    }
+    entries.Erase(iter);
+}
+
+void AssetCache::RemoveEntry(const String &key)
+{
+    if (!entries.Contains(key))
+        return;
+    EraseEntry(key, true);
+    WriteJournal(key);
+}
+
+void AssetCache::Evict(const String &keep)
+{
+    if (maxSize == 0 || totalSize <= maxSize)
+        return;
+
+    URHO3D_PROFILE(AssetCache_Evict);
+
+    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
+    while(totalSize > maxSize && !unreferencedObjects.Empty())
+    {
+        // StoreAsset may have taken the object into use since.
+        HashMap<String, ContentObject>::Iterator objectIter = objects.Find(unreferencedObjects.Back());
+        unreferencedObjects.Pop();
+        if (objectIter != objects.End() && objectIter->second_.numRefs == 0)
+        {
+            fileSystem->Delete(cacheDirectory + objectIter->first_);
+            totalSize -= objectIter->second_.size;
+            objects.Erase(objectIter);
+        }
+    }
+
+    std::map<unsigned long long, String>::iterator iter = lruOrder.begin();
+    while(totalSize > maxSize && iter != lruOrder.end())
+    {
+        // RemoveEntry erases the entry from lruOrder, so step over it first.
+        const String key = iter->second;
+        ++iter;
+        if (key != keep)
+            RemoveEntry(key);
+    }
+}
+
+static void WriteEntry(Urho3D::Serializer &dest, const String &key, const String &object, uint size, unsigned lastModified, const String &etag)
+{
+    dest.WriteString(key);
+    dest.WriteString(object);
+    dest.WriteUInt(size);
+    dest.WriteUInt(lastModified);
+    dest.WriteString(etag);
+}
+
+bool AssetCache::LoadIndex(const String &filename)
+{
+    if (!GetSubsystem<Urho3D::FileSystem>()->FileExists(filename))
+        return false;
+
+    Urho3D::File file(GetContext(), filename, Urho3D::FILE_READ);
+    if (!file.IsOpen() || file.ReadFileID() != cIndexFileID || file.ReadUInt() != cIndexVersion)
+        return false;
+
+    // The entries are saved from the least to the most recently used.
+    const uint numEntries = file.ReadUInt();
+    for(uint i = 0; i < numEntries && !file.IsEof(); ++i)
+    {
+        const String key = file.ReadString();
+        Entry entry;
+        entry.object = file.ReadString();
+        entry.size = file.ReadUInt();
+        entry.lastModified = file.ReadUInt();
+        entry.etag = file.ReadString();
+        EraseEntry(key, false);
+        InsertEntry(key, entry);
+    }
+    return true;
+}
+
+void AssetCache::ReplayJournal()
+{
+    if (!GetSubsystem<Urho3D::FileSystem>()->FileExists(JournalFilename()))
+        return;
+
+    Urho3D::File file(GetContext(), JournalFilename(), Urho3D::FILE_READ);
+    Vector<u8> data;
+    while(file.GetSize() - file.GetPosition() >= sizeof(unsigned))
+    {
+        // A record cut short by a crash ends the journal.
+        const uint size = file.ReadUInt();
+        if (size == 0 || file.GetSize() - file.GetPosition() < size)
+            break;
+        data.Resize(size);
+        file.Read(&data[0], size);
+
+        Urho3D::MemoryBuffer record(&data[0], size);
+        const u8 type = record.ReadUByte();
+        const String key = record.ReadString();
+        EraseEntry(key, false);
+        if (type == cJournalSet)
+        {
+            Entry entry;
+            entry.object = record.ReadString();
+            entry.size = record.ReadUInt();
+            entry.lastModified = record.ReadUInt();
+            entry.etag = record.ReadString();
+            InsertEntry(key, entry);
+        }
+        ++numJournalRecords;
+    }
+    LogDebug("AssetCache: Replayed " + String(numJournalRecords) + " changes from the journal in " + cacheDirectory + ".");
+}
+
+void AssetCache::Reconcile()
+{
+    URHO3D_PROFILE(AssetCache_Reconcile);
+
+    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
+
+    // Objects that are not in the index may have been written before a crash. They are kept if their content matches their name,
+    // so that storing the same data again reuses them, but no entry refers to them.
+    HashSet<String> files;
+    StringVector filenames;
+    fileSystem->ScanDir(filenames, cacheDirectory + cObjectDirectory, "*.*", Urho3D::SCAN_FILES, false);
+    foreach(const String &file, filenames)
+    {
+        const String objectName = cObjectDirectory + file;
+        files.Insert(objectName);
+        if (objects.Contains(objectName))
+            continue;
+        Vector<u8> data;
+        if (LoadFileToVector(cacheDirectory + objectName, data) && ObjectName(ContentHash(data.Size() > 0 ? &data[0] : 0, data.Size()), data.Size()) == objectName)
+        {
+            ContentObject &object = objects[objectName];
+            object.size = data.Size();
+            totalSize += object.size;
+            unreferencedObjects.Push(objectName);
+        }
+        else
+            fileSystem->Delete(cacheDirectory + objectName);
+    }
+
+    // The files of the asset refs have sanitated names, which always contain '$'. This skips for example the temporary files.
+    fileSystem->ScanDir(filenames, cacheDirectory, "*.*", Urho3D::SCAN_FILES, false);
+    foreach(const String &file, filenames)
+    {
+        if (!file.Contains('$'))
+            continue;
+        files.Insert(file);
+        if (!entries.Contains(file))
+            AddFileEntry(file, cacheDirectory + file);
+    }
+
+    StringVector missing;
+    for(HashMap<String, Entry>::ConstIterator iter = entries.Begin(); iter != entries.End(); ++iter)
+        if (!files.Contains(iter->second_.object.Empty() ? iter->first_ : iter->second_.object))
+            missing.Push(iter->first_);
+    foreach(const String &key, missing)
+        EraseEntry(key, false);
+
+    LogDebug("AssetCache: Indexed " + String(entries.Size()) + " entries and " + String(unreferencedObjects.Size()) +
+        " unreferenced objects in " + cacheDirectory + ".");
+}
+
+void AssetCache::SaveIndex()
+{
+    URHO3D_PROFILE(AssetCache_SaveIndex);
+
+    // The new index is written to a temporary file first, so that a crash leaves either the old or the new index in place.
+    const String tempFilename = IndexFilename() + ".tmp";
+    {
+        Urho3D::File file(GetContext(), tempFilename, Urho3D::FILE_WRITE);
+        if (!file.IsOpen())
+        {
+            LogWarning("AssetCache: Could not save index to " + IndexFilename() + ".");
+            return;
+        }
+
+        file.WriteFileID(cIndexFileID);
+        file.WriteUInt(cIndexVersion);
+        file.WriteUInt(entries.Size());
+        for(std::map<unsigned long long, String>::const_iterator iter = lruOrder.begin(); iter != lruOrder.end(); ++iter)
+        {
+            const Entry &entry = entries[iter->second];
+            WriteEntry(file, iter->second, entry.object, entry.size, entry.lastModified, entry.etag);
+        }
+    }
+
+    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
+    if (fileSystem->FileExists(IndexFilename()))
+        fileSystem->Delete(IndexFilename());
+    if (!fileSystem->Rename(tempFilename, IndexFilename()))
+    {
+        LogWarning("AssetCache: Could not save index to " + IndexFilename() + ".");
+        return;
+    }
+
+    // The journal is only emptied once the index has all of its changes.
+    journal.Reset();
+    if (fileSystem->FileExists(JournalFilename()))
+        fileSystem->Delete(JournalFilename());
+    numJournalRecords = 0;
 }
 
+void AssetCache::WriteJournal(const String &key)
+{
+    if (!journal)
+    {
+        journal = new Urho3D::File(GetContext(), JournalFilename(), Urho3D::FILE_READWRITE);
+        if (!journal->IsOpen())
+        {
+            LogWarning("AssetCache: Could not open journal " + JournalFilename() + ", the index is saved on exit only.");
+            journal.Reset();
+            return;
+        }
+        journal->Seek(journal->GetSize());
+    }
+
+    Urho3D::VectorBuffer record;
+    HashMap<String, Entry>::ConstIterator iter = entries.Find(key);
+    if (iter != entries.End())
+    {
+        record.WriteUByte(cJournalSet);
+        WriteEntry(record, key, iter->second_.object, iter->second_.size, iter->second_.lastModified, iter->second_.etag);
+    }
+    else
+    {
+        record.WriteUByte(cJournalRemove);
+        record.WriteString(key);
+    }
+    // The record is written whole and flushed, so that a crash can at most cut the last record short.
+    journal->WriteUInt(record.GetSize());
+    journal->Write(record.GetData(), record.GetSize());
+    journal->Flush();
+
+    if (++numJournalRecords > entries.Size() + cMaxExtraJournalRecords)
+        SaveIndex();
+}
+
+}
@@ -7,17 +7,33 @@
 #include "AssetFwd.h"
 
 #include <Urho3D/Core/Object.h>
+#include <Urho3D/IO/File.h>
+
+#include <map>
 
 namespace Tundra
 {
 
 /// Implements a disk cache for asset files to avoid re-downloading assets between runs.
+/** The cache keeps an index of its entries in memory, so finding an asset in the cache does not touch the disk.
+    The index is saved to the cache directory at start and when the cache is destroyed. In between, each change is
+    appended to a journal next to it, so the index survives a crash; only the order of use is not journaled. At start
+    the index is reconciled with the files on disk: entries whose data is missing are dropped, and objects that no
+    entry refers to are kept if their content matches their name, and deleted first when the cache needs room.
+
+    The data stored with StoreAsset is content-addressed: it is written once to the objects subdirectory, named by
+    its hash and size, and identical data stored under several asset refs shares the same file. Files written to
+    DiskSourceByRef() by others are added to the index when they are first looked up.
+
+    The size of the cache can be limited with SetMaxSize() or --assetCacheMaxSize <megabytes>. When the limit is
+    exceeded, the least recently used entries are deleted. */
 class TUNDRACORE_API AssetCache : public Object
 {
     URHO3D_OBJECT(AssetCache, Object);
 
 public:
     explicit AssetCache(AssetAPI *owner, String assetCacheDirectory);
+    ~AssetCache();
 
     /// Returns the absolute path on the local file system that contains a cached copy of the given asset ref.
     /// If the given asset file does not exist in the cache, an empty string is returned.
@@ -38,18 +54,44 @@ public:
     /// @return String the absolute path name to the asset cache entry. If not successful returns an empty string.
     String StoreAsset(const u8 *data, uint numBytes, const String &assetName);
 
+    /// Moves the file @c filename to the asset cache, or deletes it if the data is in the cache already.
+    /** Used when the data has been written to disk elsewhere than the main thread, so that it is neither written again nor read to memory.
+        The file must be on the same file system as the cache directory.
+        @param contentHash ContentHash() of the data in the file, computed while it was written.
+        @param numBytes Size of the file.
+        @return String the absolute path name to the asset cache entry. If not successful returns an empty string, and the file is left in place. */
+    String StoreFile(const String &filename, u64 contentHash, uint numBytes, const String &assetName);
+
+    /// Initial value of ContentHash().
+    static const u64 cContentHashSeed = 14695981039346656037ULL;
+
+    /// Returns the 64-bit FNV-1a hash of the data, which names the content-addressed files. Identical hashes are confirmed by comparing the data.
+    /** Data received in parts can be hashed by passing the hash of the previous parts as @c hash. */
+    static u64 ContentHash(const u8 *data, uint numBytes, u64 hash = cContentHashSeed);
+
+    /// Adds the file that has been written to DiskSourceByRef(assetRef) by someone else than StoreAsset to the cache index.
+    /// If the asset ref is in the index already, its size is updated.
+    void AddFile(const String &assetRef);
+
     /// Return the last modified time for assetRefs cache file as seconds since 1.1.1970.
-    /// If cache file does not exist for assetRef return invalid QDateTime. You can check return value with QDateTime::isValid().
+    /// The time set with SetLastModified is kept per asset ref in the index, as the file may be shared with other refs.
+    /// If none has been set, the modification time of the file is returned. If the asset ref is not in the cache, returns 0.
     /// @param String assetRef Asset reference of which cache file last modified date and time will be returned.
-    /// @return QDateTime Last modified date and time of the cache file.
     unsigned LastModified(const String &assetRef);
 
-    /// Sets the last modified date and time for the assetRefs cache file.
+    /// Sets the last modified date and time for the assetRefs cache entry.
     /// @param String assetRef Asset reference thats cache file last modified date and time will be set.
-    /// @param QDateTime The date and time to set.
+    /// @param dateTime The date and time to set, as seconds since 1.1.1970.
     /// @return bool Returns true if successful, false otherwise.
     bool SetLastModified(const String &assetRef, unsigned dateTime);
 
+    /// Returns the HTTP entity tag stored for the assetRefs cache entry, or an empty string if there is none.
+    String ETag(const String &assetRef) const;
+
+    /// Sets the HTTP entity tag of the assetRefs cache entry. It is cleared when the data of the entry is replaced.
+    /// @return bool Returns true if successful, false if the asset ref is not in the cache.
+    bool SetETag(const String &assetRef, const String &etag);
+
     /// Deletes the asset with the given assetRef from the cache, if it exists.
     /// @param String asset reference.
     void DeleteAsset(const String &assetRef);
@@ -61,8 +103,73 @@ public:
     /// Get the cache directory. Returned path is guaranteed to have a trailing slash /.
     /// @return String absolute path to the caches data directory
     String CacheDirectory() const;
-    
+
+    /// Sets the maximum size of the cache in bytes, 0 for unlimited. Deletes the least recently used entries if the cache is larger.
+    void SetMaxSize(u64 bytes);
+    /// Returns the maximum size of the cache in bytes, 0 if unlimited.
+    u64 MaxSize() const { return maxSize; }
+    /// Returns the size of the data in the cache in bytes. Data shared by several entries is counted once.
+    u64 Size() const { return totalSize; }
+    /// Returns the number of asset refs in the cache.
+    uint NumEntries() const { return entries.Size(); }
+
 private:
+    /// An asset ref in the cache.
+    struct Entry
+    {
+        Entry() : size(0), lastModified(0), lastUse(0) {}
+
+        String object; ///< Filename of the content-addressed object holding the data, empty if the data is in the file of the asset ref.
+        uint size; ///< Size of the data.
+        unsigned lastModified; ///< Time set with SetLastModified, 0 if not set.
+        String etag; ///< Entity tag set with SetETag.
+        unsigned long long lastUse;
+    };
+
+    /// A content-addressed file in the objects subdirectory.
+    struct ContentObject
+    {
+        ContentObject() : size(0), numRefs(0) {}
+
+        uint size;
+        uint numRefs; ///< Number of entries referring to the object.
+    };
+
+    /// Stores the data with @c contentHash under @c assetName, writing it or moving it from @c filename if it is not empty.
+    String Store(const u8 *data, uint numBytes, u64 contentHash, const String &filename, const String &assetName);
+    /// Writes the data to @c destination, or moves @c filename there if it is not empty.
+    bool WriteData(const u8 *data, uint numBytes, const String &filename, const String &destination);
+    /// Returns the absolute path of the file holding the data of @c entry, which is stored under @c key.
+    String EntryPath(const String &key, const Entry &entry) const;
+    /// Adds the file of the asset ref @c key, written by someone else than StoreAsset, to the index.
+    void AddFileEntry(const String &key, const String &absolutePath);
+    /// Marks @c entry as the most recently used.
+    void Touch(const String &key, Entry &entry);
+    /// Adds @c entry to the index as the most recently used, taking a reference to its object. There must be no entry @c key.
+    void InsertEntry(const String &key, const Entry &entry);
+    /// Removes the entry @c key from the index. Its data is deleted if @c deleteData is true and it is not shared with other entries.
+    void EraseEntry(const String &key, bool deleteData);
+    /// Removes the entry @c key from the index and the journal, and deletes its data unless the data is shared with other entries.
+    void RemoveEntry(const String &key);
+    /// Deletes the unreferenced objects and then the least recently used entries until the cache fits in the maximum size.
+    /// The entry @c keep is not deleted.
+    void Evict(const String &keep);
+
+    /// Reads the index saved to @c filename. Returns false if there is none.
+    bool LoadIndex(const String &filename);
+    /// Applies the changes appended to the journal after the index was saved.
+    void ReplayJournal();
+    /// Drops the entries whose files are missing, and adds the files and objects that are not in the index.
+    void Reconcile();
+    /// Writes the index to IndexFilename() and empties the journal.
+    void SaveIndex();
+    /// Appends the current state of the entry @c key, or its removal if it does not exist, to the journal.
+    void WriteJournal(const String &key);
+    /// Returns the filename of the saved index.
+    String IndexFilename() const { return cacheDirectory + ".cacheindex"; }
+    /// Returns the filename of the journal of the changes made after the index was saved.
+    String JournalFilename() const { return cacheDirectory + ".cachejournal"; }
+
 #ifdef WIN32
     /// Windows specific helper to open a file handle to absolutePath
     void *OpenFileHandle(const String &absolutePath);
@@ -72,6 +179,21 @@ private:
 
     /// AssetAPI ptr.
     AssetAPI *assetAPI;
+
+    /// Maps the sanitated asset refs to the entries.
+    HashMap<String, Entry> entries;
+    /// Maps the object filenames to the objects.
+    HashMap<String, ContentObject> objects;
+    /// Keys of the entries, ordered from the least to the most recently used.
+    std::map<unsigned long long, String> lruOrder;
+    /// Objects found on disk at start that no entry referred to. They are deleted first when the cache is too large.
+    StringVector unreferencedObjects;
+    /// Journal file, opened on the first change after the index was saved.
+    SharedPtr<Urho3D::File> journal;
+    uint numJournalRecords;
+    unsigned long long useCounter;
+    u64 totalSize;
+    u64 maxSize;
 };
 
 }
@@ -0,0 +1,141 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "AssetDecodeQueue.h"
+#include "AssetAPI.h"
+#include "IAsset.h"
+#include "LoggingFunctions.h"
+
+#include <Urho3D/Core/Profiler.h>
+#include <Urho3D/Core/Timer.h>
+
+namespace Tundra
+{
+
+// The decoding runs at the lowest priority, so that it does not delay the engine's own per-frame work.
+static const unsigned cDecodePriority = 0;
+
+AssetDecodeQueue::AssetDecodeQueue(AssetAPI *owner) :
+    owner_(owner),
+    timeBudget_(0.005f)
+{
+}
+
+AssetDecodeQueue::~AssetDecodeQueue()
+{
+    Clear();
+}
+
+void AssetDecodeQueue::Queue(IAsset *asset, const AssetDecodeJobPtr &job)
+{
+    if (!asset || !job)
+        return;
+
+    Cancel(asset);
+
+    Job entry;
+    entry.asset = asset;
+    entry.assetWeak = asset;
+    entry.job = job;
+
+    Urho3D::WorkQueue *workQueue = owner_->GetSubsystem<Urho3D::WorkQueue>();
+    if (!workQueue || !workQueue->GetNumThreads())
+    {
+        job->decoded = job->Decode();
+        jobs_.Push(entry);
+        return;
+    }
+
+    workQueue_ = workQueue;
+    entry.item = new Urho3D::WorkItem();
+    entry.item->workFunction_ = &AssetDecodeQueue::DecodeWork;
+    entry.item->aux_ = job.Get();
+    entry.item->priority_ = cDecodePriority;
+    jobs_.Push(entry);
+    workQueue->AddWorkItem(entry.item);
+}
+
+void AssetDecodeQueue::Cancel(IAsset *asset)
+{
+    // The cancelled jobs that are still decoding are kept alive until they finish, and removed by Update.
+    for(uint i = 0; i < jobs_.Size(); ++i)
+        if (jobs_[i].asset == asset)
+            jobs_[i].asset = 0;
+}
+
+void AssetDecodeQueue::Update()
+{
+    if (jobs_.Empty())
+        return;
+
+    URHO3D_PROFILE(AssetDecodeQueue_Update);
+
+    // At least one asset is committed per frame, so that the queue always progresses
+    Urho3D::HiresTimer timer;
+    const long long budgetUSec = (long long)(timeBudget_ * 1000000.f);
+    for(uint i = 0; i < jobs_.Size();)
+    {
+        if (!IsDecoded(jobs_[i]))
+        {
+            ++i;
+            continue;
+        }
+
+        // Committing emits the asset's signals, which may queue or cancel jobs, so take the job out first.
+        Job job = jobs_[i];
+        jobs_.Erase(i);
+        if (!job.asset)
+            continue;
+
+        Commit(job);
+        if (budgetUSec > 0 && timer.GetUSec(false) >= budgetUSec)
+            break;
+    }
+}
+
+void AssetDecodeQueue::Clear()
+{
+    if (workQueue_)
+    {
+        for(uint i = 0; i < jobs_.Size(); ++i)
+        {
+            if (!IsDecoded(jobs_[i]))
+            {
+                workQueue_->Complete(cDecodePriority);
+                break;
+            }
+        }
+    }
+    jobs_.Clear();
+}
+
+void AssetDecodeQueue::SetTimeBudget(float seconds)
+{
+    timeBudget_ = (seconds > 0.f ? seconds : 0.f);
+}
+
+void AssetDecodeQueue::DecodeWork(const Urho3D::WorkItem *item, unsigned /*threadIndex*/)
+{
+    IAssetDecodeJob *job = static_cast<IAssetDecodeJob*>(item->aux_);
+    job->decoded = job->Decode();
+}
+
+void AssetDecodeQueue::Commit(Job &job)
+{
+    AssetPtr asset = job.assetWeak.Lock();
+    if (!asset)
+        return;
+
+    URHO3D_PROFILE(AssetDecodeQueue_Commit);
+
+    const String name = asset->Name();
+    if (job.job->decoded && job.job->Commit())
+        owner_->AssetLoadCompleted(name);
+    else
+    {
+        LogError("AssetDecodeQueue: Failed to load asset " + name + (job.job->error.Empty() ? String() : ": " + job.job->error));
+        owner_->AssetLoadFailed(name);
+    }
+}
+
+}
@@ -0,0 +1,94 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "AssetFwd.h"
+
+#include <Urho3D/Container/RefCounted.h>
+#include <Urho3D/Core/WorkQueue.h>
+
+namespace Tundra
+{
+
+/// Decodes the data of an asset in a work queue thread, and commits the result to the asset in the main thread.
+/** Asset types that support asynchronous loading create a job in their DeserializeFromData implementation, copy
+    the data and the settings the decoding needs from the main thread into it, and hand it to AssetDecodeQueue.
+    Decode() parses the data to an intermediate, CPU-side result. As it runs in a worker thread, it must not touch
+    the asset, the Framework, the logging functions or the engine's resources; a failure is reported by setting
+    @c error and returning false. Commit() then creates the engine objects from the result in the main thread. */
+class TUNDRACORE_API IAssetDecodeJob : public RefCounted
+{
+public:
+    IAssetDecodeJob() : decoded(false) {}
+    virtual ~IAssetDecodeJob() {}
+
+    /// Decodes the data. Called in a work queue thread. Returns false on failure.
+    virtual bool Decode() = 0;
+    /// Applies the decoded result to the asset. Called in the main thread, only if Decode() succeeded. Returns false on failure.
+    virtual bool Commit() = 0;
+
+    /// Description of the decoding failure.
+    String error;
+    /// Result of Decode(). Set by AssetDecodeQueue.
+    bool decoded;
+};
+typedef SharedPtr<IAssetDecodeJob> AssetDecodeJobPtr;
+
+/// Queue of asset decode jobs that run in the work queue threads, with a per-frame time budget for committing the results.
+/** When a job has been committed, the queue calls AssetAPI::AssetLoadCompleted for its asset; when decoding or
+    committing fails, it calls AssetAPI::AssetLoadFailed. The results are committed in the order the jobs were
+    queued in, skipping the jobs that are still decoding, until the time budget of the frame is used.
+    If the work queue has no worker threads, the jobs are decoded immediately when they are queued.
+    @remark Asset decode pipeline */
+class TUNDRACORE_API AssetDecodeQueue
+{
+public:
+    explicit AssetDecodeQueue(AssetAPI *owner);
+    ~AssetDecodeQueue();
+
+    /// Starts decoding @c job for @c asset. A job queued earlier for the same asset is cancelled.
+    void Queue(IAsset *asset, const AssetDecodeJobPtr &job);
+    /// Cancels the job of @c asset. If the job is already decoding, its result is discarded.
+    void Cancel(IAsset *asset);
+    /// Commits the decoded jobs until the time budget is used. Called by AssetAPI::Update.
+    void Update();
+    /// Cancels all jobs. Waits for the jobs that are being decoded.
+    void Clear();
+
+    /// Sets the time in seconds that may be spent committing decoded assets per frame, 0 for unlimited.
+    /** At least one decoded asset is committed per frame regardless of the budget. */
+    void SetTimeBudget(float seconds);
+    /// Returns the time in seconds that may be spent committing decoded assets per frame.
+    float TimeBudget() const { return timeBudget_; }
+
+    /// Returns the number of jobs that are decoding or waiting to be committed.
+    uint NumPendingJobs() const { return jobs_.Size(); }
+
+private:
+    struct Job
+    {
+        Job() : asset(0) {}
+
+        IAsset *asset; ///< Null if the job has been cancelled.
+        AssetWeakPtr assetWeak;
+        AssetDecodeJobPtr job;
+        SharedPtr<Urho3D::WorkItem> item; ///< Null if the job was decoded immediately.
+    };
+
+    /// Work queue function for decoding the job in @c item->aux_.
+    static void DecodeWork(const Urho3D::WorkItem *item, unsigned threadIndex);
+    /// Returns whether the job has finished decoding.
+    static bool IsDecoded(const Job &job) { return !job.item || job.item->completed_; }
+    /// Commits the decoded @c job and notifies AssetAPI of the result.
+    void Commit(Job &job);
+
+    AssetAPI *owner_;
+    Vector<Job> jobs_;
+    /// The work queue the jobs were added to.
+    WeakPtr<Urho3D::WorkQueue> workQueue_;
+    float timeBudget_;
+};
+
+}
@@ -0,0 +1,202 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "AssetDependencyGraph.h"
+
+#include <Urho3D/Container/HashSet.h>
+
+namespace Tundra
+{
+
+AssetDependencyGraph::AssetDependencyGraph() :
+    numDependencies_(0)
+{
+}
+
+void AssetDependencyGraph::SetDependencies(const String &assetRef, const StringVector &dependencies)
+{
+    const uint node = Intern(assetRef);
+
+    PODVector<uint> newDependencies;
+    newDependencies.Reserve(dependencies.Size());
+    for(uint i = 0; i < dependencies.Size(); ++i)
+    {
+        if (dependencies[i].Empty())
+            continue;
+        const uint dependency = Intern(dependencies[i]);
+        if (dependency != node && !newDependencies.Contains(dependency))
+            newDependencies.Push(dependency);
+    }
+
+    const bool wasComplete = IsComplete(node);
+    const PODVector<uint> &oldDependencies = nodes_[node].dependencies;
+    for(uint i = 0; i < oldDependencies.Size(); ++i)
+    {
+        const uint dependency = oldDependencies[i];
+        if (newDependencies.Contains(dependency))
+            continue;
+        nodes_[dependency].dependents.RemoveSwap(node);
+        if (!IsComplete(dependency))
+            --nodes_[node].numPending;
+        --numDependencies_;
+    }
+    for(uint i = 0; i < newDependencies.Size(); ++i)
+    {
+        const uint dependency = newDependencies[i];
+        if (oldDependencies.Contains(dependency))
+            continue;
+        nodes_[dependency].dependents.Push(node);
+        if (!IsComplete(dependency))
+            ++nodes_[node].numPending;
+        ++numDependencies_;
+    }
+    nodes_[node].dependencies = newDependencies;
+
+    if (IsComplete(node) != wasComplete)
+        PropagateCompleteness(node, !wasComplete);
+}
+
+void AssetDependencyGraph::RemoveDependencies(const String &assetRef)
+{
+    if (Find(assetRef) != NoNode)
+        SetDependencies(assetRef, StringVector());
+}
+
+void AssetDependencyGraph::SetLoaded(const String &assetRef, bool loaded)
+{
+    uint node = Find(assetRef);
+    if (node == NoNode)
+    {
+        if (!loaded)
+            return;
+        node = Intern(assetRef);
+    }
+    if (nodes_[node].loaded == loaded)
+        return;
+
+    const bool wasComplete = IsComplete(node);
+    nodes_[node].loaded = loaded;
+    if (IsComplete(node) != wasComplete)
+        PropagateCompleteness(node, !wasComplete);
+}
+
+void AssetDependencyGraph::Clear()
+{
+    nodes_.Clear();
+    index_.Clear();
+    numDependencies_ = 0;
+}
+
+bool AssetDependencyGraph::IsLoaded(const String &assetRef) const
+{
+    const uint node = Find(assetRef);
+    return node != NoNode && nodes_[node].loaded;
+}
+
+bool AssetDependencyGraph::HasPendingDependencies(const String &assetRef) const
+{
+    const uint node = Find(assetRef);
+    return node != NoNode && nodes_[node].numPending > 0;
+}
+
+uint AssetDependencyGraph::NumPendingDependencies(const String &assetRef) const
+{
+    const uint node = Find(assetRef);
+    if (node == NoNode || nodes_[node].numPending == 0)
+        return 0;
+
+    uint numPending = 0;
+    HashSet<uint> visited;
+    PODVector<uint> stack;
+    stack.Push(node);
+    while(!stack.Empty())
+    {
+        const PODVector<uint> &dependencies = nodes_[stack.Back()].dependencies;
+        stack.Pop();
+        for(uint i = 0; i < dependencies.Size(); ++i)
+        {
+            const uint dependency = dependencies[i];
+            if (IsComplete(dependency) || !visited.Insert(dependency).second_)
+                continue;
+            if (!nodes_[dependency].loaded)
+                ++numPending;
+            if (nodes_[dependency].numPending > 0)
+                stack.Push(dependency);
+        }
+    }
+    return numPending;
+}
+
+StringVector AssetDependencyGraph::Dependencies(const String &assetRef) const
+{
+    StringVector refs;
+    const uint node = Find(assetRef);
+    if (node != NoNode)
+    {
+        const PODVector<uint> &dependencies = nodes_[node].dependencies;
+        refs.Reserve(dependencies.Size());
+        for(uint i = 0; i < dependencies.Size(); ++i)
+            refs.Push(nodes_[dependencies[i]].name);
+    }
+    return refs;
+}
+
+StringVector AssetDependencyGraph::Dependents(const String &assetRef) const
+{
+    StringVector refs;
+    const uint node = Find(assetRef);
+    if (node != NoNode)
+    {
+        const PODVector<uint> &dependents = nodes_[node].dependents;
+        refs.Reserve(dependents.Size());
+        for(uint i = 0; i < dependents.Size(); ++i)
+            refs.Push(nodes_[dependents[i]].name);
+    }
+    return refs;
+}
+
+uint AssetDependencyGraph::Intern(const String &assetRef)
+{
+    const String key = assetRef.ToLower();
+    HashMap<String, uint>::ConstIterator iter = index_.Find(key);
+    if (iter != index_.End())
+        return iter->second_;
+
+    const uint node = nodes_.Size();
+    nodes_.Resize(node + 1);
+    nodes_[node].name = assetRef;
+    index_[key] = node;
+    return node;
+}
+
+uint AssetDependencyGraph::Find(const String &assetRef) const
+{
+    HashMap<String, uint>::ConstIterator iter = index_.Find(assetRef.ToLower());
+    return iter != index_.End() ? iter->second_ : NoNode;
+}
+
+void AssetDependencyGraph::PropagateCompleteness(uint node, bool complete)
+{
+    // Only the dependents whose own completeness flips are visited further, so the walk stops at the first
+    // dependent that still has other incomplete dependencies. The counters also keep cycles from looping forever.
+    PODVector<uint> stack;
+    stack.Push(node);
+    while(!stack.Empty())
+    {
+        const PODVector<uint> &dependents = nodes_[stack.Back()].dependents;
+        stack.Pop();
+        for(uint i = 0; i < dependents.Size(); ++i)
+        {
+            const uint dependent = dependents[i];
+            const bool wasComplete = IsComplete(dependent);
+            if (complete)
+                --nodes_[dependent].numPending;
+            else
+                ++nodes_[dependent].numPending;
+            if (IsComplete(dependent) != wasComplete)
+                stack.Push(dependent);
+        }
+    }
+}
+
+}
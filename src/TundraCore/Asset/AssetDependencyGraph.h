@@ -0,0 +1,85 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+
+#include <Urho3D/Container/HashMap.h>
+
+namespace Tundra
+{
+
+/// Keeps track of the dependencies between assets, and of which assets are still waiting for their dependencies to load.
+/** Each asset ref is interned to a node once, case-insensitively, and the dependencies are stored both as forward
+    (asset -> the assets it refers to) and reverse (asset -> the assets referring to it) adjacency lists, so finding
+    the dependents of an asset does not scan the whole graph.
+
+    A node is complete when it is loaded and all of its dependencies are complete. Each node keeps a counter of its
+    incomplete dependencies, which is updated incrementally when a dependency is loaded, unloaded or replaced, so
+    HasPendingDependencies() is O(1). A change of completeness is propagated to the dependents, and onwards only as far
+    as their completeness changes. Dependency cycles do not cause endless recursion, but the assets in a cycle may stay pending.
+
+    The refs given to the graph are expected to be resolved already; the graph does no ref resolving of its own. */
+class TUNDRACORE_API AssetDependencyGraph
+{
+public:
+    AssetDependencyGraph();
+
+    /// Replaces the dependencies of @c assetRef with @c dependencies. Duplicates and self-references are ignored.
+    void SetDependencies(const String &assetRef, const StringVector &dependencies);
+    /// Removes all dependencies of @c assetRef. The asset itself stays known as a dependency of other assets.
+    void RemoveDependencies(const String &assetRef);
+    /// Sets whether @c assetRef is loaded. Unknown assets are considered not loaded.
+    void SetLoaded(const String &assetRef, bool loaded);
+    /// Forgets all assets and dependencies.
+    void Clear();
+
+    /// Returns whether @c assetRef is marked loaded.
+    bool IsLoaded(const String &assetRef) const;
+    /// Returns whether any direct or indirect dependency of @c assetRef is not loaded.
+    bool HasPendingDependencies(const String &assetRef) const;
+    /// Returns the number of distinct direct and indirect dependencies of @c assetRef that are not loaded.
+    /** Walks the pending part of the dependency tree, skipping the complete subtrees. Prefer HasPendingDependencies()
+        if the count is not needed. */
+    uint NumPendingDependencies(const String &assetRef) const;
+    /// Returns the refs of the assets @c assetRef depends on directly.
+    StringVector Dependencies(const String &assetRef) const;
+    /// Returns the refs of the assets that depend directly on @c assetRef.
+    StringVector Dependents(const String &assetRef) const;
+
+    /// Returns the number of assets known by the graph, including the ones only known as a dependency.
+    uint NumAssets() const { return nodes_.Size(); }
+    /// Returns the number of dependencies between the assets.
+    uint NumDependencies() const { return numDependencies_; }
+
+private:
+    struct Node
+    {
+        Node() : numPending(0), loaded(false) {}
+
+        String name; ///< The ref in the case it was first seen.
+        PODVector<uint> dependencies;
+        PODVector<uint> dependents;
+        uint numPending; ///< Number of dependencies that are not complete.
+        bool loaded;
+    };
+
+    /// Returns the index of the node of @c assetRef, creating it if necessary.
+    uint Intern(const String &assetRef);
+    /// Returns the index of the node of @c assetRef, or NoNode if it is not known.
+    uint Find(const String &assetRef) const;
+    /// Returns whether the node is loaded and has no incomplete dependencies.
+    bool IsComplete(uint node) const { return nodes_[node].loaded && nodes_[node].numPending == 0; }
+    /// Updates the dependents of @c node, which has just become complete or incomplete, and so on recursively.
+    void PropagateCompleteness(uint node, bool complete);
+
+    static const uint NoNode = 0xFFFFFFFF;
+
+    Vector<Node> nodes_;
+    /// Maps lowercase asset refs to node indices.
+    HashMap<String, uint> index_;
+    uint numDependencies_;
+};
+
+}
@@ -6,6 +6,7 @@
 #include "IAttribute.h"
 #include "AssetReference.h"
 #include "IComponent.h"
+#include "Entity.h"
 #include "Framework.h"
 #include "AssetAPI.h"
 #include "FrameAPI.h"
@@ -38,10 +39,11 @@ void AssetRefListener::HandleAssetRefChange(IAttribute *assetRef, const String&
             (assetRef == 0 ? "null" : assetRef->TypeName()) + " instead).");
         return;
     }
-    HandleAssetRefChange(attr->Owner()->GetFramework()->Asset(), attr->Get().ref, assetType);
+    IComponent *owner = attr->Owner();
+    HandleAssetRefChange(owner->GetFramework()->Asset(), attr->Get().ref, assetType, owner->ParentEntity());
 }
 
-void AssetRefListener::HandleAssetRefChange(AssetAPI *assetApi, String assetRef, const String& assetType)
+void AssetRefListener::HandleAssetRefChange(AssetAPI *assetApi, String assetRef, const String& assetType, Entity *entity)
 {
     // Disconnect from any previous transfer we might be listening to
     if (!currentTransfer.Expired())
@@ -101,6 +103,7 @@ void AssetRefListener::HandleAssetRefChange(AssetAPI *assetApi, String assetRef,
             return;
         }
         currentWaitingRef = assetRef;
+        transfer->AddReferringEntity(entity);
 
         transfer->Succeeded.Connect(this, &AssetRefListener::OnTransferSucceeded);
         transfer->Failed.Connect(this, &AssetRefListener::OnTransferFailed);
@@ -174,7 +177,7 @@ AssetRefListListener::AssetRefListListener(AssetAPI *assetAPI) :
         LogError("AssetRefListListener: Null AssetAPI* given to ctor!");
 }
 
-void AssetRefListListener::HandleChange(const AssetReferenceList &refs)
+void AssetRefListListener::HandleChange(const AssetReferenceList &refs, Entity *entity)
 {
     if (!assetAPI_)
         return;
@@ -231,7 +234,7 @@ void AssetRefListListener::HandleChange(const AssetReferenceList &refs)
     {
         const AssetReference &ref = current_[i];
         if (!ref.ref.Empty())
-            listeners_[i]->HandleAssetRefChange(assetAPI_, ref.ref, ref.type);
+            listeners_[i]->HandleAssetRefChange(assetAPI_, ref.ref, ref.type, entity);
     }
 }
 
@@ -4,6 +4,7 @@
 
 #include "TundraCoreApi.h"
 #include "AssetFwd.h"
+#include "SceneFwd.h"
 #include "AssetReference.h"
 #include "Signals.h"
 
@@ -28,7 +29,8 @@ public:
     /// Issues a new asset request to the given assetRef URL.
     /// @param assetApi Pass a pointer to the system Asset API into this function (This utility object doesn't keep reference to framework).
     /// @param assetType Optional asset type name
-    void HandleAssetRefChange(AssetAPI *assetApi, String assetRef, const String& assetType = "");
+    /// @param entity Optional entity that refers to the asset, used for prioritizing the transfer.
+    void HandleAssetRefChange(AssetAPI *assetApi, String assetRef, const String& assetType = "", Entity *entity = 0);
     
     /// Returns the asset currently stored in this asset reference.
     AssetPtr Asset() const;
@@ -65,8 +67,9 @@ public:
 
     /// Handles change to refs.
     /** Checks if there are actual changes against last change.
-        Requests Assets and emits signals. */
-    void HandleChange(const AssetReferenceList &refs);
+        Requests Assets and emits signals.
+        @param entity Optional entity that refers to the assets, used for prioritizing the transfers. */
+    void HandleChange(const AssetReferenceList &refs, Entity *entity = 0);
 
     /// Returns current known states assets.
     /** Returned vector will match in size with known state.
@@ -0,0 +1,324 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "AssetTransferScheduler.h"
+#include "AssetAPI.h"
+#include "IAssetTransfer.h"
+#include "IAssetProvider.h"
+#include "IAssetStorage.h"
+#include "IAssetTransferPrioritizer.h"
+#include "CoreStringUtils.h"
+#include "LoggingFunctions.h"
+
+#include <Urho3D/Core/Profiler.h>
+#include <Urho3D/Core/StringUtils.h>
+
+#include <algorithm>
+
+namespace Tundra
+{
+
+namespace
+{
+    /// Position of a queued transfer after the prioritization and aging.
+    struct RankedTransfer
+    {
+        float rank;
+        uint index;
+
+        bool operator <(const RankedTransfer &rhs) const
+        {
+            return rank < rhs.rank || (rank == rhs.rank && index < rhs.index);
+        }
+    };
+
+    /// Queued transfers of one storage, in priority order.
+    struct StorageQueue
+    {
+        StorageQueue() : next(0) {}
+
+        PODVector<uint> indices;
+        uint next;
+    };
+}
+
+AssetTransferScheduler::AssetTransferScheduler(AssetAPI *owner) :
+    owner_(owner),
+    maxInFlight_(128),
+    maxInFlightPerProvider_(32),
+    agingRate_(0.1f),
+    time_(0.f),
+    windowTime_(0.f)
+{
+}
+
+AssetTransferScheduler::~AssetTransferScheduler()
+{
+    Clear();
+}
+
+void AssetTransferScheduler::Queue(const AssetTransferPtr &transfer)
+{
+    if (!transfer)
+        return;
+
+    QueuedTransfer queued;
+    queued.transfer = transfer;
+    queued.queuedTime = time_;
+    queue_.Push(queued);
+}
+
+void AssetTransferScheduler::Finished(IAssetTransfer *transfer, bool success)
+{
+    HashMap<IAssetTransfer*, InFlightTransfer>::Iterator iter = inFlight_.Find(transfer);
+    if (iter == inFlight_.End())
+        return;
+
+    ProviderStats &stats = stats_[iter->second_.provider];
+    if (stats.inFlight > 0)
+        --stats.inFlight;
+    if (success)
+    {
+        ++stats.completed;
+        const uint bytesReceived = transfer->BytesReceived();
+        stats.bytes += bytesReceived;
+        stats.windowBytes += bytesReceived;
+    }
+    else
+        ++stats.failed;
+    ++stats.windowTransfers;
+    inFlight_.Erase(iter);
+}
+
+void AssetTransferScheduler::Update(float frametime, IAssetTransferPrioritizer *prioritizer)
+{
+    URHO3D_PROFILE(AssetTransferScheduler_Update);
+
+    time_ += frametime;
+    windowTime_ += frametime;
+    if (windowTime_ >= 1.f)
+    {
+        for(ProviderStatsMap::Iterator iter = stats_.Begin(); iter != stats_.End(); ++iter)
+        {
+            ProviderStats &stats = iter->second_;
+            stats.bytesPerSecond = (float)stats.windowBytes / windowTime_;
+            stats.transfersPerSecond = (float)stats.windowTransfers / windowTime_;
+            stats.windowBytes = 0;
+            stats.windowTransfers = 0;
+        }
+        windowTime_ = 0.f;
+    }
+
+    if (queue_.Empty())
+        return;
+    // Release the slots of forgotten transfers first, they would otherwise keep the limit full forever.
+    RemoveForgotten();
+    // Nothing can be started, leave the prioritization for a frame when there is room.
+    if (queue_.Empty() || (maxInFlight_ > 0 && inFlight_.Size() >= maxInFlight_))
+        return;
+
+    Prioritize(prioritizer);
+
+    // Split the queue by storage, keeping the priority order within each storage.
+    HashMap<String, uint> storageIndices;
+    Vector<StorageQueue> storages;
+    for(uint i = 0; i < queue_.Size(); ++i)
+    {
+        const String key = StorageKey(*queue_[i].transfer);
+        HashMap<String, uint>::Iterator iter = storageIndices.Find(key);
+        if (iter == storageIndices.End())
+        {
+            iter = storageIndices.Insert(MakePair(key, storages.Size()));
+            storages.Resize(storages.Size() + 1);
+        }
+        storages[iter->second_].indices.Push(i);
+    }
+
+    // Start the transfers in turns from each storage. The storage of the highest priority transfer goes first.
+    // A provider that finishes a transfer right away can queue new transfers, which are left for the next frame.
+    const uint numPrioritized = queue_.Size();
+    PODVector<bool> started(numPrioritized);
+    for(uint i = 0; i < started.Size(); ++i)
+        started[i] = false;
+    bool startedAny = true;
+    while(startedAny && (maxInFlight_ == 0 || inFlight_.Size() < maxInFlight_))
+    {
+        startedAny = false;
+        for(uint s = 0; s < storages.Size() && (maxInFlight_ == 0 || inFlight_.Size() < maxInFlight_); ++s)
+        {
+            StorageQueue &storage = storages[s];
+            if (storage.next >= storage.indices.Size())
+                continue;
+            const uint index = storage.indices[storage.next];
+            AssetTransferPtr transfer = queue_[index].transfer;
+            AssetProviderPtr provider = transfer->provider.Lock();
+            if (provider)
+            {
+                const String providerName = provider->Name();
+                const uint limit = ProviderLimit(providerName);
+                if (limit > 0 && stats_[providerName].inFlight >= limit)
+                    continue;
+            }
+            ++storage.next;
+            started[index] = true;
+            startedAny = true;
+            Execute(transfer);
+        }
+    }
+
+    // Keep the rest queued in priority order and update the queue depths.
+    for(ProviderStatsMap::Iterator iter = stats_.Begin(); iter != stats_.End(); ++iter)
+        iter->second_.queued = 0;
+    Vector<QueuedTransfer> remaining;
+    remaining.Reserve(queue_.Size());
+    for(uint i = 0; i < queue_.Size(); ++i)
+    {
+        if (i < numPrioritized && started[i])
+            continue;
+        remaining.Push(queue_[i]);
+        AssetProviderPtr provider = queue_[i].transfer->provider.Lock();
+        if (provider)
+            ++stats_[provider->Name()].queued;
+    }
+    queue_.Swap(remaining);
+}
+
+void AssetTransferScheduler::Clear()
+{
+    queue_.Clear();
+    inFlight_.Clear();
+    for(ProviderStatsMap::Iterator iter = stats_.Begin(); iter != stats_.End(); ++iter)
+    {
+        iter->second_.queued = 0;
+        iter->second_.inFlight = 0;
+    }
+}
+
+void AssetTransferScheduler::DumpStats() const
+{
+    LogInfo("[AssetTransferStats] " + PadString("Provider", 20) + PadString("Queued", 10) + PadString("In flight", 10) +
+        PadString("Completed", 10) + PadString("Failed", 10) + PadString("KB", 12) + PadString("KB/s", 10) + "Transfers/s");
+    for(ProviderStatsMap::ConstIterator iter = stats_.Begin(); iter != stats_.End(); ++iter)
+    {
+        const ProviderStats &stats = iter->second_;
+        LogInfo("[AssetTransferStats] " + PadString(iter->first_, 20) + PadString(stats.queued, 10) + PadString(stats.inFlight, 10) +
+            PadString(stats.completed, 10) + PadString(stats.failed, 10) + PadString((uint)(stats.bytes / 1024), 12) +
+            PadString(Urho3D::ToString("%.1f", stats.bytesPerSecond / 1024.f), 10) + Urho3D::ToString("%.1f", stats.transfersPerSecond));
+    }
+    LogInfo("[AssetTransferStats] Total queued " + String(queue_.Size()) + ", in flight " + String(inFlight_.Size()) +
+        (maxInFlight_ > 0 ? "/" + String(maxInFlight_) : String()));
+}
+
+String AssetTransferScheduler::StorageKey(const IAssetTransfer &transfer)
+{
+    AssetStoragePtr storage = transfer.storage.Lock();
+    if (storage)
+        return storage->ToString();
+
+    // Without a storage, the transfers from the same host share a queue.
+    const String &ref = transfer.source.ref;
+    uint hostStart = ref.Find("://");
+    if (hostStart == String::NPOS)
+        return String();
+    hostStart += 3;
+    return ref.Substring(0, ref.Find('/', hostStart)).ToLower();
+}
+
+uint AssetTransferScheduler::ProviderLimit(const String &providerName) const
+{
+    HashMap<String, uint>::ConstIterator iter = providerMaxInFlight_.Find(providerName);
+    return (iter != providerMaxInFlight_.End() ? iter->second_ : maxInFlightPerProvider_);
+}
+
+void AssetTransferScheduler::RemoveForgotten()
+{
+    for(HashMap<IAssetTransfer*, InFlightTransfer>::Iterator iter = inFlight_.Begin(); iter != inFlight_.End();)
+    {
+        if (owner_->PendingTransfer(iter->second_.transfer->source.ref) != iter->second_.transfer)
+        {
+            ProviderStats &stats = stats_[iter->second_.provider];
+            if (stats.inFlight > 0)
+                --stats.inFlight;
+            ++stats.failed;
+            iter = inFlight_.Erase(iter);
+        }
+        else
+            ++iter;
+    }
+
+    uint numKept = 0;
+    for(uint i = 0; i < queue_.Size(); ++i)
+    {
+        if (owner_->PendingTransfer(queue_[i].transfer->source.ref) != queue_[i].transfer)
+            continue;
+        if (numKept != i)
+            queue_[numKept] = queue_[i];
+        ++numKept;
+    }
+    queue_.Resize(numKept);
+}
+
+void AssetTransferScheduler::Prioritize(IAssetTransferPrioritizer *prioritizer)
+{
+    URHO3D_PROFILE(AssetTransferScheduler_Prioritize);
+
+    AssetTransferPtrVector transfers;
+    transfers.Reserve(queue_.Size());
+    for(uint i = 0; i < queue_.Size(); ++i)
+        transfers.Push(queue_[i].transfer);
+
+    if (prioritizer)
+    {
+        AssetTransferPtrVector sorted = prioritizer->Prioritize(transfers);
+        if (sorted.Size() == transfers.Size())
+            transfers = sorted;
+        else
+            LogErrorF("AssetAPI: IAssetTransferPrioritizer implementation returned incorrect amount of transfers. Returned %d when expecting %d", sorted.Size(), transfers.Size());
+    }
+
+    HashMap<IAssetTransfer*, float> queuedTimes;
+    for(uint i = 0; i < queue_.Size(); ++i)
+        queuedTimes[queue_[i].transfer.Get()] = queue_[i].queuedTime;
+
+    PODVector<RankedTransfer> ranks(transfers.Size());
+    for(uint i = 0; i < transfers.Size(); ++i)
+    {
+        HashMap<IAssetTransfer*, float>::ConstIterator iter = queuedTimes.Find(transfers[i].Get());
+        const float waited = (iter != queuedTimes.End() ? time_ - iter->second_ : 0.f);
+        ranks[i].rank = (float)i / (1.f + agingRate_ * waited);
+        ranks[i].index = i;
+    }
+    if (!ranks.Empty())
+        std::sort(&ranks[0], &ranks[0] + ranks.Size());
+
+    Vector<QueuedTransfer> ordered;
+    ordered.Reserve(transfers.Size());
+    for(uint i = 0; i < ranks.Size(); ++i)
+    {
+        QueuedTransfer queued;
+        queued.transfer = transfers[ranks[i].index];
+        HashMap<IAssetTransfer*, float>::ConstIterator iter = queuedTimes.Find(queued.transfer.Get());
+        queued.queuedTime = (iter != queuedTimes.End() ? iter->second_ : time_);
+        ordered.Push(queued);
+    }
+    queue_.Swap(ordered);
+}
+
+void AssetTransferScheduler::Execute(const AssetTransferPtr &transfer)
+{
+    AssetProviderPtr provider = transfer->provider.Lock();
+    if (!provider)
+    {
+        LogErrorF("AssetAPI: Cannot execute asset transfer '%s' as it has no provider", transfer->SourceUrl().CString());
+        return;
+    }
+
+    // Mark the transfer in flight first, as the provider may finish it right away.
+    InFlightTransfer &inFlight = inFlight_[transfer.Get()];
+    inFlight.transfer = transfer;
+    inFlight.provider = provider->Name();
+    ++stats_[inFlight.provider].inFlight;
+    provider->ExecuteTransfer(transfer);
+}
+
+}
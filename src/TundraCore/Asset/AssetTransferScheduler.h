@@ -0,0 +1,121 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "AssetFwd.h"
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/Str.h>
+
+namespace Tundra
+{
+
+/// Executes the requested asset transfers with bounded concurrency.
+/** AssetAPI queues every new transfer here instead of handing it to its provider right away. On each Update the
+    queued transfers are ordered by the IAssetTransferPrioritizer, and started until the global limit or the limit
+    of their provider is reached. A transfer stays in flight until AssetAPI reports that its provider finished it.
+    @li Fair queuing: the transfers are started in turns from each storage (or host, for transfers without a storage),
+        so that one storage with a long queue does not starve the others.
+    @li Priority aging: the rank of a transfer in the prioritized order is divided by 1 + agingRate * seconds waited,
+        so that transfers the prioritizer keeps pushing back are eventually started.
+    The limits can be set with the --assetTransferLimit and --assetTransferProviderLimit command line parameters,
+    and the statistics are printed with the assetTransferStats console command. */
+class TUNDRACORE_API AssetTransferScheduler
+{
+public:
+    /// Statistics of the transfers of one provider.
+    struct ProviderStats
+    {
+        ProviderStats() : queued(0), inFlight(0), completed(0), failed(0), bytes(0), bytesPerSecond(0.f), transfersPerSecond(0.f),
+            windowBytes(0), windowTransfers(0) {}
+
+        uint queued; ///< Transfers waiting to be started.
+        uint inFlight; ///< Transfers being executed by the provider.
+        uint completed; ///< Transfers completed successfully.
+        uint failed; ///< Transfers failed or aborted.
+        unsigned long long bytes; ///< Bytes received by the completed transfers, see IAssetTransfer::BytesReceived().
+        float bytesPerSecond; ///< Bytes per second during the last measurement window.
+        float transfersPerSecond; ///< Finished transfers per second during the last measurement window.
+
+        /// @cond PRIVATE
+        unsigned long long windowBytes;
+        uint windowTransfers;
+        /// @endcond
+    };
+    typedef HashMap<String, ProviderStats> ProviderStatsMap;
+
+    explicit AssetTransferScheduler(AssetAPI *owner);
+    ~AssetTransferScheduler();
+
+    /// Queues @c transfer to be started by its provider.
+    void Queue(const AssetTransferPtr &transfer);
+    /// Frees the in-flight slot of @c transfer when its provider has finished it. Ignores transfers that are not in flight.
+    void Finished(IAssetTransfer *transfer, bool success);
+    /// Starts the queued transfers the limits allow, in priority order. Called by AssetAPI::Update.
+    /** @param prioritizer Prioritizer for the queued transfers, or null to keep them in the order they were requested. */
+    void Update(float frametime, IAssetTransferPrioritizer *prioritizer);
+    /// Forgets all queued and in-flight transfers.
+    void Clear();
+
+    /// Sets the maximum number of transfers in flight in total, 0 for unlimited.
+    void SetMaxInFlight(uint maxInFlight) { maxInFlight_ = maxInFlight; }
+    uint MaxInFlight() const { return maxInFlight_; }
+    /// Sets the maximum number of transfers in flight per provider, 0 for unlimited.
+    void SetMaxInFlightPerProvider(uint maxInFlight) { maxInFlightPerProvider_ = maxInFlight; }
+    uint MaxInFlightPerProvider() const { return maxInFlightPerProvider_; }
+    /// Sets the maximum number of transfers in flight for the provider @c providerName, overriding MaxInFlightPerProvider.
+    void SetProviderMaxInFlight(const String &providerName, uint maxInFlight) { providerMaxInFlight_[providerName] = maxInFlight; }
+    /// Sets how fast the rank of a waiting transfer improves, per second. 0 disables aging.
+    void SetAgingRate(float rate) { agingRate_ = rate; }
+    float AgingRate() const { return agingRate_; }
+
+    uint NumQueued() const { return queue_.Size(); }
+    uint NumInFlight() const { return inFlight_.Size(); }
+    /// Returns the statistics by provider name.
+    const ProviderStatsMap &Stats() const { return stats_; }
+    /// Prints the statistics to the log.
+    void DumpStats() const;
+
+private:
+    struct QueuedTransfer
+    {
+        QueuedTransfer() : queuedTime(0.f) {}
+
+        AssetTransferPtr transfer;
+        float queuedTime;
+    };
+
+    struct InFlightTransfer
+    {
+        AssetTransferPtr transfer;
+        String provider;
+    };
+
+    /// Returns the key of the storage queue of @c transfer.
+    static String StorageKey(const IAssetTransfer &transfer);
+    /// Returns the in-flight limit of @c providerName, 0 if unlimited.
+    uint ProviderLimit(const String &providerName) const;
+    /// Removes the queued and in-flight transfers AssetAPI no longer tracks, eg. when a transfer was aborted.
+    void RemoveForgotten();
+    /// Orders the queue by the prioritizer and the waiting times.
+    void Prioritize(IAssetTransferPrioritizer *prioritizer);
+    /// Starts @c transfer in its provider.
+    void Execute(const AssetTransferPtr &transfer);
+
+    AssetAPI *owner_;
+    Vector<QueuedTransfer> queue_;
+    HashMap<IAssetTransfer*, InFlightTransfer> inFlight_;
+    ProviderStatsMap stats_;
+    HashMap<String, uint> providerMaxInFlight_;
+    uint maxInFlight_;
+    uint maxInFlightPerProvider_;
+    float agingRate_;
+    /// Time since creation, for the waiting times.
+    float time_;
+    /// Time of the current throughput measurement window.
+    float windowTime_;
+};
+
+}
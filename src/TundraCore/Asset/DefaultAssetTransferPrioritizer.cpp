@@ -4,21 +4,10 @@
 #include "DefaultAssetTransferPrioritizer.h"
 #include "IAssetTransfer.h"
 
-namespace Tundra
-{
+#include <algorithm>
 
-struct TypeIndex
+namespace Tundra
 {
-    uint index;
-    uint num;
-
-    TypeIndex() : index(0), num(0) {}
-
-    uint Current()
-    {
-        return index + num;
-    }
-};
 
 DefaultAssetTransferPrioritizer::DefaultAssetTransferPrioritizer()
 {
@@ -26,30 +15,45 @@ DefaultAssetTransferPrioritizer::DefaultAssetTransferPrioritizer()
 
 AssetTransferPtrVector DefaultAssetTransferPrioritizer::Prioritize(const AssetTransferPtrVector &transfers)
 {
-    /** @todo Add prioritizing with distance to active camera when EntityWeakPtr info is available in transfers.
-        @todo Add more types? Should scripts go last or first?
+    /** @todo Add more types? Should scripts go last or first?
         @todo Possibly add option for this function to communicate pending tranfers for a longer time if they are eg. 1km away from camera. */
-    TypeIndex iMesh;
-    TypeIndex iMaterial;
+    heap_.Resize(transfers.Size());
+    for(uint i = 0; i < transfers.Size(); ++i)
+    {
+        heap_[i].priority = Priority(*transfers[i]);
+        heap_[i].index = i;
+    }
 
+    // Build the heap in linear time and pop the transfers in priority order.
     AssetTransferPtrVector sorted;
-    for(auto iter = transfers.Begin(); iter != transfers.End(); ++iter)
+    sorted.Reserve(transfers.Size());
+    if (!heap_.Empty())
     {
-        const AssetTransferPtr &transfer = (*iter);
-        if (transfer->assetType.Contains("mesh", false))
+        ScoredTransfer *begin = &heap_[0];
+        ScoredTransfer *end = begin + heap_.Size();
+        std::make_heap(begin, end);
+        while(end != begin)
         {
-            sorted.Insert(iMesh.Current(), transfer);
-            iMesh.num++;
+            std::pop_heap(begin, end);
+            --end;
+            sorted.Push(transfers[end->index]);
         }
-        else if (transfer->assetType.Contains("material", false))
-        {
-            sorted.Insert(iMesh.Current() + iMaterial.Current(), transfer);
-            iMaterial.num++;
-        }
-        else
-            sorted.Push(transfer);
     }
     return sorted;
 }
 
+float DefaultAssetTransferPrioritizer::Priority(const IAssetTransfer &transfer)
+{
+    return TypePriority(transfer.assetType) / (float)(1 + transfer.dependencyDepth);
+}
+
+float DefaultAssetTransferPrioritizer::TypePriority(const String &assetType)
+{
+    if (assetType.Contains("mesh", false))
+        return 3.f;
+    else if (assetType.Contains("material", false))
+        return 2.f;
+    return 1.f;
+}
+
 }
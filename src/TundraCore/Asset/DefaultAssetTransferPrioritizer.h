@@ -4,9 +4,15 @@
 
 #include "IAssetTransferPrioritizer.h"
 
+#include <Urho3D/Container/Vector.h>
+
 namespace Tundra
 {
 
+/// Orders the pending transfers by a score computed once per transfer.
+/** The default score prefers meshes, then materials, then the rest, and assets that are requested directly over their
+    dependencies. Subclasses can override Priority() eg. to take the entities referring to the transfers into account.
+    Transfers of equal priority keep their original order. */
 class TUNDRACORE_API DefaultAssetTransferPrioritizer : public IAssetTransferPrioritizer
 {
 public:
@@ -14,6 +20,28 @@ public:
     
     /// IAssetTransferPrioritizer override
     AssetTransferPtrVector Prioritize(const AssetTransferPtrVector &transfers) override;
+
+protected:
+    /// Returns the priority of @c transfer, higher is transferred first.
+    virtual float Priority(const IAssetTransfer &transfer);
+
+    /// Returns the priority of @c assetType: 3 for meshes, 2 for materials and 1 for other types.
+    static float TypePriority(const String &assetType);
+
+private:
+    /// Scored transfers, reused between calls.
+    struct ScoredTransfer
+    {
+        float priority;
+        uint index;
+
+        /// Heap order, the highest priority and the lowest original index first.
+        bool operator <(const ScoredTransfer &rhs) const
+        {
+            return priority < rhs.priority || (priority == rhs.priority && index > rhs.index);
+        }
+    };
+    PODVector<ScoredTransfer> heap_;
 };
 
 }
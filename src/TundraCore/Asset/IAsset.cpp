@@ -137,7 +137,7 @@ AssetPtr IAsset::Clone(String newAssetName) const
     return newAsset;
 }
 
-bool IAsset::LoadFromFile(String filename)
+bool IAsset::LoadFromFile(String filename, bool allowAsynchronous)
 {
     URHO3D_PROFILE(IAsset_LoadFromFile);
 
@@ -164,9 +164,9 @@ bool IAsset::LoadFromFile(String filename)
     }
 
     // Invoke the actual virtual function to load the asset.
-    // Do not allow asynchronous loading due the caller of this 
-    // expects the asset to be usable when this function returns.
-    return LoadFromFileInMemory(&fileData[0], fileData.Size(), false);
+    // Asynchronous loading is only allowed when asked for, as callers by
+    // default expect the asset to be usable when this function returns.
+    return LoadFromFileInMemory(&fileData[0], fileData.Size(), allowAsynchronous);
 }
 
 bool IAsset::LoadFromFileInMemory(const u8 *data, uint numBytes, bool allowAsynchronous)
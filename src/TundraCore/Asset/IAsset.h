@@ -82,7 +82,8 @@ public:
     SourceType DiskSourceType() const { return diskSourceType; }
     
     /// Loads this asset from the given file on the local filesystem. Returns true if loading succeeds, false otherwise.
-    virtual bool LoadFromFile(String filename);
+    /** @param allowAsynchronous If true, the asset type may finish loading the data asynchronously, see LoadFromFileInMemory. */
+    virtual bool LoadFromFile(String filename, bool allowAsynchronous = false);
 
     /// Forces a reload of this asset from its disk source. Returns true if loading succeeded, false otherwise.
     bool LoadFromCache();
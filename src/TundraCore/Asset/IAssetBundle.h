@@ -55,6 +55,16 @@ public:
         @return Absolute disk source path if available, empty string otherwise.*/
     virtual String GetSubAssetDiskSource(const String &subAssetName) = 0;
 
+    /// Provides the data of a sub asset without copying it, if the bundle holds it uncompressed in memory.
+    /** Queried by AssetAPI before GetSubAssetData. The data stays valid while the bundle is loaded.
+        @return True if @c data and @c numBytes were set. The default implementation returns false. */
+    virtual bool GetSubAssetDataInPlace(const String & /*subAssetName*/, const u8 *& /*data*/, uint & /*numBytes*/) { return false; }
+
+    /// Hints that the data of the sub assets are about to be queried.
+    /** A bundle that has to unpack its sub assets can start unpacking them in parallel here.
+        @note The default implementation does nothing. */
+    virtual void PrepareSubAssets(const StringVector & /*subAssetNames*/) {}
+
     /// Returns the sub asset count in this bundle.
     /** @return Count of the assets or -1 if count is unknown. */
     virtual int SubAssetCount() const { return -1; }
@@ -12,10 +12,32 @@ namespace Tundra
 
 IAssetTransfer::IAssetTransfer() : 
     cachingAllowed(true),
-    diskSourceType(IAsset::Original)
+    diskSourceType(IAsset::Original),
+    dependencyDepth(0)
 {
 }
 
+void IAssetTransfer::AddReferringEntity(Entity *entity)
+{
+    if (!entity)
+        return;
+    for(uint i = 0; i < referringEntities.Size(); ++i)
+        if (referringEntities[i].Get() == entity)
+            return;
+    referringEntities.Push(EntityWeakPtr(entity));
+}
+
+void IAssetTransfer::InheritReferrers(const IAssetTransfer &parent)
+{
+    // A transfer that has referring entities of its own was requested directly, keep its depth.
+    if (referringEntities.Empty() && dependencyDepth == 0)
+        dependencyDepth = parent.dependencyDepth + 1;
+    else
+        dependencyDepth = Min(dependencyDepth, parent.dependencyDepth + 1);
+    for(uint i = 0; i < parent.referringEntities.Size(); ++i)
+        AddReferringEntity(parent.referringEntities[i].Get());
+}
+
 IAssetTransfer::~IAssetTransfer()
 {
 }
@@ -61,6 +83,11 @@ bool IAssetTransfer::Abort()
     }
 }
 
+uint IAssetTransfer::BytesReceived() const
+{
+    return rawAssetData.Size();
+}
+
 void IAssetTransfer::SetCachingBehavior(bool cachingAllowed, String diskSource)
 {
     this->cachingAllowed = cachingAllowed; 
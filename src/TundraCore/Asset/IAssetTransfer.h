@@ -5,6 +5,7 @@
 #include "TundraCoreApi.h"
 #include "CoreTypes.h"
 #include "AssetFwd.h"
+#include "SceneFwd.h"
 #include "AssetReference.h"
 #include "IAsset.h"
 #include "Signals.h"
@@ -43,6 +44,19 @@ public:
     /// Specifies the storage this asset is being downloaded from.
     AssetStorageWeakPtr storage;
 
+    /// Entities whose components refer to this asset, or to an asset that depends on it.
+    /** Filled by AssetRefListener, and inherited by the transfers of the asset's dependencies. Used by IAssetTransferPrioritizer. */
+    Vector<EntityWeakPtr> referringEntities;
+
+    /// Number of dependency links between this asset and an asset that was requested directly, 0 if requested directly.
+    uint dependencyDepth;
+
+    /// Adds @c entity to referringEntities, if not already added.
+    void AddReferringEntity(Entity *entity);
+
+    /// Adds the referring entities of @c parent and sets the dependency depth as a dependency of it.
+    void InheritReferrers(const IAssetTransfer &parent);
+
     /// Emits Downloaded signal.
     void EmitAssetDownloaded();
 
@@ -55,6 +69,10 @@ public:
     /// Stores the raw asset bytes for this asset.
     Vector<u8> rawAssetData;
 
+    /// Returns the number of bytes received for the asset. Override in a subclass that receives the data elsewhere than rawAssetData, eg. to a file.
+    /** @note Default IAssetTransfer implementation returns the size of rawAssetData. */
+    virtual uint BytesReceived() const;
+
     /// Aborts the transfer immediately. Override this function in a subclass implementation.
     /** @note Default IAssetTransfer implementation logs a not implemented warning and return false.
         @return True if abort was successful, false otherwise. */
@@ -21,19 +21,75 @@
 #include <Urho3D/Core/StringUtils.h>
 #include <Urho3D/IO/FileWatcher.h>
 
+#include <cstdio>
+#if defined(__linux__) && !defined(ANDROID)
+#include <fcntl.h>
+#endif
+
 namespace Tundra
 {
 
+// The reads run at the lowest priority, so that they do not delay the engine's own per-frame work.
+static const unsigned cReadPriority = 0;
+// Limits the number of files that are being read or waiting to be handed to AssetAPI, and so the memory they take.
+static const uint cMaxReadsInProgress = 32;
+
+/// Reads the whole file to @c dst. Uses the C file API and does not log, so that it can be called in a work queue thread.
+static bool ReadFileToVector(const String &filename, Vector<u8> &dst)
+{
+#ifdef _WIN32
+    FILE *file = _wfopen(Urho3D::GetWideNativePath(filename).CString(), L"rb");
+#else
+    FILE *file = fopen(Urho3D::GetNativePath(filename).CString(), "rb");
+#endif
+    if (!file)
+        return false;
+
+#if defined(__linux__) && !defined(ANDROID)
+    // The file is read from start to end, let the kernel read ahead aggressively.
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    bool success = false;
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        long size = ftell(file);
+        if (size >= 0 && fseek(file, 0, SEEK_SET) == 0)
+        {
+            dst.Resize((uint)size);
+            success = (size == 0 || fread(&dst[0], 1, (size_t)size, file) == (size_t)size);
+        }
+    }
+    fclose(file);
+    return success;
+}
+
 LocalAssetProvider::LocalAssetProvider(Framework* framework_) :
     IAssetProvider(framework_->GetContext()),
-    framework(framework_)
+    framework(framework_),
+    loadTimeBudget(0.016f)
 {
     enableRequestsOutsideStorages = (framework_->HasCommandLineParameter("--acceptUnknownLocalSources") ||
         framework_->HasCommandLineParameter("--accept_unknown_local_sources"));  /**< @todo Remove support for the deprecated underscore version at some point. */
+    StringVector loadBudgetParam = framework_->CommandLineParameters("--localAssetLoadBudget"); // Milliseconds
+    if (!loadBudgetParam.Empty())
+        SetLoadTimeBudget(Urho3D::ToFloat(loadBudgetParam.Back()) / 1000.f);
 }
 
 LocalAssetProvider::~LocalAssetProvider()
 {
+    // The reads in progress refer to their FileRead, so wait for them to finish.
+    if (workQueue)
+    {
+        for(uint i = 0; i < readsInProgress.Size(); ++i)
+        {
+            if (!readsInProgress[i]->item->completed_)
+            {
+                workQueue->Complete(cReadPriority);
+                break;
+            }
+        }
+    }
 }
 
 String LocalAssetProvider::Name() const
@@ -112,6 +168,16 @@ bool LocalAssetProvider::AbortTransfer(IAssetTransfer *transfer)
             return true;
         }
     }
+    // A read in progress is left to finish, and its result is discarded.
+    for(uint i = 0; i < readsInProgress.Size(); ++i)
+    {
+        if (readsInProgress[i]->transfer.Get() == transfer)
+        {
+            framework->Asset()->AssetTransferAborted(transfer);
+            readsInProgress[i]->transfer.Reset();
+            return true;
+        }
+    }
     return false;
 }
 
@@ -198,6 +264,7 @@ void LocalAssetProvider::DeleteAssetFromStorage(String assetRef)
         bool success = fileSystem->Delete(fullFilename);
         if (success)
         {
+            storage->RemoveCachedFile(GuaranteeTrailingSlash(path) + AssetAPI::ExtractFilenameFromAssetRef(assetRef));
             LogInfo("LocalAssetProvider::DeleteAssetFromStorage: Deleted asset \"" + assetRef + "\", file " + fullFilename + " from disk.");
             framework->Asset()->EmitAssetDeletedFromStorage(assetRef);
         }
@@ -221,7 +288,7 @@ bool LocalAssetProvider::RemoveAssetStorage(String storageName)
 }
 
 LocalAssetStoragePtr LocalAssetProvider::AddStorageDirectory(String directory, String storageName, bool recursive, bool writable, 
-    bool liveUpdate, bool autoDiscoverable, bool replicated, const String &trustedStateStr)
+    bool liveUpdate, bool autoDiscoverable, bool replicated, const String &trustedStateStr, bool persistentIndex)
 {
     directory = directory.Trimmed();
     if (directory.Empty())
@@ -266,6 +333,7 @@ LocalAssetStoragePtr LocalAssetProvider::AddStorageDirectory(String directory, S
     storage->directory = directory;
     storage->name = storageName;
     storage->recursive = recursive;
+    storage->persistentIndex = persistentIndex;
     storage->SetReplicated(replicated);
     if (!trustedStateStr.Empty())
         storage->trustState = IAssetStorage::TrustStateFromString(trustedStateStr);
@@ -330,10 +398,45 @@ void LocalAssetProvider::CompletePendingFileDownloads()
     if (pendingUploads.Size() > 0)
         return;
 
-    const int maxLoadMSecs = 16;
+    if (pendingDownloads.Empty() && readsInProgress.Empty())
+        return;
+
+    // At least one transfer is completed per frame, so that loading always progresses.
     Urho3D::HiresTimer downloadTimer;
+    const long long budgetUSec = (long long)(loadTimeBudget * 1000000.f);
 
-    while(pendingDownloads.Size() > 0)
+    for(uint i = 0; i < readsInProgress.Size();)
+    {
+        if (!readsInProgress[i]->item->completed_)
+        {
+            ++i;
+            continue;
+        }
+
+        // Completing the transfer emits signals that may abort other transfers, so take the read out first.
+        SharedPtr<FileRead> read = readsInProgress[i];
+        readsInProgress.Erase(i);
+        if (!read->transfer)
+            continue;
+
+        URHO3D_PROFILE(LocalAssetProvider_CompleteFileRead);
+        read->transfer->rawAssetData.Swap(read->data);
+        CompleteFileDownload(read->transfer.Get(), read->filename, read->storage, read->success);
+
+        if (budgetUSec > 0 && downloadTimer.GetUSec(false) >= budgetUSec)
+            return;
+    }
+
+    // On Android the files may be inside the apk, which only Urho3D::File can read, so they are read in the main thread.
+#ifndef ANDROID
+    Urho3D::WorkQueue *queue = GetSubsystem<Urho3D::WorkQueue>();
+    const bool threaded = queue && queue->GetNumThreads() > 0;
+#else
+    Urho3D::WorkQueue *queue = 0;
+    const bool threaded = false;
+#endif
+
+    while(pendingDownloads.Size() > 0 && (!threaded || readsInProgress.Size() < cMaxReadsInProgress))
     {
         URHO3D_PROFILE(LocalAssetProvider_ProcessPendingDownload);
 
@@ -374,31 +477,59 @@ void LocalAssetProvider::CompletePendingFileDownloads()
             }
         }
 
-        bool success = LoadFileToVector(file, transfer->rawAssetData);
-        if (!success)
+        if (threaded)
         {
-            String reason = "Failed to read asset data for asset \"" + ref + "\" from file \"" + file + "\"";
-            framework->Asset()->AssetTransferFailed(transfer.Get(), reason);
-            // Also throttle asset loading here. This is needed in the case we have a lot of failed refs.
-            if (downloadTimer.GetUSec(false) / 1000 > maxLoadMSecs)
-                break;
+            SharedPtr<FileRead> read(new FileRead());
+            read->transfer = transfer;
+            read->storage = storage;
+            read->filename = file;
+            read->item = new Urho3D::WorkItem();
+            read->item->workFunction_ = &LocalAssetProvider::ReadFileWork;
+            read->item->aux_ = read.Get();
+            read->item->priority_ = cReadPriority;
+            readsInProgress.Push(read);
+            workQueue = queue;
+            queue->AddWorkItem(read->item);
             continue;
         }
-        
-        // Tell the Asset API that this asset should not be cached into the asset cache, and instead the original filename should be used
-        // as a disk source, rather than generating a cache file for it.
-        transfer->SetCachingBehavior(false, file);
-        transfer->storage = storage;
 
-        // Signal the Asset API that this asset is now successfully downloaded.
-        framework->Asset()->AssetTransferCompleted(transfer.Get());
+        bool success = LoadFileToVector(file, transfer->rawAssetData);
+        CompleteFileDownload(transfer.Get(), file, storage, success);
 
-        // Throttle asset loading to at most 16 msecs/frame.
-        if (downloadTimer.GetUSec(false) / 1000 > maxLoadMSecs)
+        if (budgetUSec > 0 && downloadTimer.GetUSec(false) >= budgetUSec)
             break;
     }
 }
 
+void LocalAssetProvider::CompleteFileDownload(IAssetTransfer *transfer, const String &file, const LocalAssetStoragePtr &storage, bool success)
+{
+    if (!success)
+    {
+        String reason = "Failed to read asset data for asset \"" + transfer->source.ref + "\" from file \"" + file + "\"";
+        framework->Asset()->AssetTransferFailed(transfer, reason);
+        return;
+    }
+
+    // Tell the Asset API that this asset should not be cached into the asset cache, and instead the original filename should be used
+    // as a disk source, rather than generating a cache file for it.
+    transfer->SetCachingBehavior(false, file);
+    transfer->storage = storage;
+
+    // Signal the Asset API that this asset is now successfully downloaded.
+    framework->Asset()->AssetTransferCompleted(transfer);
+}
+
+void LocalAssetProvider::ReadFileWork(const Urho3D::WorkItem *item, unsigned /*threadIndex*/)
+{
+    FileRead *read = static_cast<FileRead*>(item->aux_);
+    read->success = ReadFileToVector(read->filename, read->data);
+}
+
+void LocalAssetProvider::SetLoadTimeBudget(float seconds)
+{
+    loadTimeBudget = (seconds > 0.f ? seconds : 0.f);
+}
+
 AssetStoragePtr LocalAssetProvider::TryCreateStorage(HashMap<String, String> &storageParams, bool /*fromNetwork*/)
 {
     if (!storageParams.Contains("src"))
@@ -426,9 +557,10 @@ AssetStoragePtr LocalAssetProvider::TryCreateStorage(HashMap<String, String> &st
     bool autoDiscoverable   = (storageParams.Contains("autodiscoverable") ? Urho3D::ToBool(storageParams["autodiscoverable"]) : true);
     bool replicated         = (storageParams.Contains("replicated") ? Urho3D::ToBool(storageParams["replicated"]) : true);
     String trusted          = (storageParams.Contains("trusted") ? storageParams["trusted"] : "");
+    bool persistentIndex    = (storageParams.Contains("persistentindex") ? Urho3D::ToBool(storageParams["persistentindex"]) : false);
 
     LocalAssetStoragePtr storagePtr = AddStorageDirectory(path, name, recursive, writable, 
-        liveUpdate, autoDiscoverable, replicated, trusted);
+        liveUpdate, autoDiscoverable, replicated, trusted, persistentIndex);
 
     return AssetStoragePtr(storagePtr);
 }
@@ -514,6 +646,7 @@ void LocalAssetProvider::CompletePendingFileUploads()
         }
         else
         {
+            storage->AddCachedFile(toFile);
             framework->Asset()->AssetUploadTransferCompleted(transfer.Get());
         }
     }
@@ -533,7 +666,17 @@ void LocalAssetProvider::CheckForPendingFileSystemChanges()
         while (storage->changeWatcher->GetNextChange(file))
         {
             file = storage->directory + file;
+            if (file == storage->IndexFilename())
+                continue;
             LogInfo(file);
+
+            // The filename index of the storage relies on the change notifications, so it is kept up to date regardless of auto-discovery.
+            bool exists = fileSystem->FileExists(file);
+            if (exists)
+                storage->AddCachedFile(file);
+            else
+                storage->RemoveCachedFile(file);
+
             if (!storage->AutoDiscoverable())
             {
                 LogWarning("Received file change notification for storage of which auto-discovery is false.");
@@ -546,7 +689,6 @@ void LocalAssetProvider::CheckForPendingFileSystemChanges()
                 assetRef = assetRef.Substring(lastSlash + 1);
             assetRef = "local://" + assetRef;
 
-            bool exists = fileSystem->FileExists(file);
             if (!exists)
             {
                 /// \todo Currently it seems that we do not get delete notifications at all
@@ -6,10 +6,14 @@
 #include "IAssetProvider.h"
 #include "AssetFwd.h"
 
+#include <Urho3D/Core/WorkQueue.h>
+
 namespace Tundra
 {
 
 /// Provides access to files on the local file system using the 'local://' URL specifier.
+/** The files are read in the work queue threads, several at a time, and handed to AssetAPI in the main thread within
+    a per-frame time budget, which can be set with --localAssetLoadBudget <milliseconds>. */
 class TUNDRACORE_API LocalAssetProvider : public IAssetProvider
 {
     URHO3D_OBJECT(LocalAssetProvider, IAssetProvider);
@@ -25,8 +29,9 @@ public:
         @param writable If true, assets can be uploaded to the storage.
         @param liveUpdate If true, assets will be reloaded when the underlying file changes.
         @param autoDiscoverable If true, a recursive directory search will be initially performed to know which assets reside inside the storage.
+        @param persistentIndex If true, the index of the files in the storage is saved to the storage directory, see LocalAssetStorage::persistentIndex.
         Returns the newly created storage, or 0 if a storage with the given name already existed, or if some other error occurred. */
-    LocalAssetStoragePtr AddStorageDirectory(String directory, String storageName, bool recursive, bool writable = true, bool liveUpdate = true, bool autoDiscoverable = true, bool replicated = false, const String &trustStateStr = "");
+    LocalAssetStoragePtr AddStorageDirectory(String directory, String storageName, bool recursive, bool writable = true, bool liveUpdate = true, bool autoDiscoverable = true, bool replicated = false, const String &trustStateStr = "", bool persistentIndex = false);
 
     /// IAssetProvider override.
     String Name() const override;
@@ -53,7 +58,29 @@ public:
     /// IAssetProvider override.
     AssetUploadTransferPtr UploadAssetFromFileInMemory(const u8 *data, uint numBytes, AssetStoragePtr destination, const String &assetName) override;
 
+    /// Sets the time in seconds that may be spent completing local asset transfers per frame, 0 for unlimited.
+    /** At least one transfer is completed per frame regardless of the budget. */
+    void SetLoadTimeBudget(float seconds);
+    /// Returns the time in seconds that may be spent completing local asset transfers per frame.
+    float LoadTimeBudget() const { return loadTimeBudget; }
+
 private:
+    /// A file that is being read in a work queue thread. The work queue thread only touches filename, data and success.
+    struct FileRead : public RefCounted
+    {
+        FileRead() : success(false) {}
+
+        AssetTransferPtr transfer; ///< Null if the transfer has been aborted.
+        LocalAssetStoragePtr storage;
+        String filename;
+        Vector<u8> data;
+        bool success;
+        SharedPtr<Urho3D::WorkItem> item;
+    };
+
+    /// Work queue function for reading the file of the FileRead in @c item->aux_.
+    static void ReadFileWork(const Urho3D::WorkItem *item, unsigned threadIndex);
+
     /// IAssetProvider override.
     AssetStoragePtr TryCreateStorage(HashMap<String, String> &storageParams, bool fromNetwork) override;
 
@@ -67,9 +94,12 @@ private:
     /// @param storage [out] Receives the local storage that contains the asset.
     String GetPathForAsset(const String &localFilename, LocalAssetStoragePtr *storage) const;
 
-    /// Takes all the pending file download transfers and finishes them.
+    /// Starts reading the files of the pending download transfers, and finishes the transfers whose files have been read.
     void CompletePendingFileDownloads();
 
+    /// Finishes the download transfer of @c file, which has been read to @c transfer->rawAssetData if @c success is true.
+    void CompleteFileDownload(IAssetTransfer *transfer, const String &file, const LocalAssetStoragePtr &storage, bool success);
+
     /// Takes all the pending file upload transfers and finishes them.
     void CompletePendingFileUploads();
 
@@ -83,6 +113,11 @@ private:
     Vector<LocalAssetStoragePtr> storages;          ///< Asset directories to search, may be recursive or not
     Vector<AssetUploadTransferPtr> pendingUploads;  ///< The following asset uploads are pending to be completed by this provider.
     Vector<AssetTransferPtr> pendingDownloads;      ///< The following asset downloads are pending to be completed by this provider.
+    Vector<SharedPtr<FileRead> > readsInProgress;   ///< Files being read in the work queue threads, in the order the reads were started.
+    /// The work queue the reads were added to.
+    WeakPtr<Urho3D::WorkQueue> workQueue;
+    /// Time in seconds that may be spent completing transfers per frame.
+    float loadTimeBudget;
 
     /// If true, assets outside any known local storages are allowed. Otherwise, requests to them will fail.
     bool enableRequestsOutsideStorages;
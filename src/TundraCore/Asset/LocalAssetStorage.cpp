@@ -12,14 +12,30 @@
 #include <Urho3D/IO/FileSystem.h>
 #include <Urho3D/IO/FileWatcher.h>
 #include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/Core/Timer.h>
 
 namespace Tundra
 {
 
+/// Identifier and version of the saved filename index file.
+static const char *cIndexFileID = "TLFI";
+static const unsigned cIndexVersion = 1;
+/// Looking up a missing asset walks the storage again at most this often.
+static const unsigned cRescanIntervalMsecs = 5000;
+
+static bool IsVersionControlPath(const String &path)
+{
+    return path.Contains(".git") || path.Contains(".svn") || path.Contains(".hg");
+}
+
 LocalAssetStorage::LocalAssetStorage(Urho3D::Context* context, bool writable_, bool liveUpdate_, bool autoDiscoverable_) :
     IAssetStorage(context),
     recursive(true),
-    changeWatcher(0)
+    persistentIndex(false),
+    changeWatcher(0),
+    contentsCached(false),
+    loadedFromIndex(false),
+    lastScanTime(0)
 {
     // Override the parameters for the base class.
     writable = writable_;
@@ -34,97 +50,269 @@ LocalAssetStorage::~LocalAssetStorage()
 
 void LocalAssetStorage::LoadAllAssetsOfType(AssetAPI *assetAPI, const String &suffix, const String &assetType)
 {
-    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
-    StringVector filenames;
-    fileSystem->ScanDir(filenames, directory, "*.*", Urho3D::SCAN_FILES, recursive);
-    foreach(String str, filenames)
-    {
-        if ((suffix == "" || str.EndsWith(suffix)) && !(str.Contains(".git") || str.Contains(".svn") || str.Contains(".hg")))
-        {
-            uint lastSlash = str.FindLast('/');
-            if (lastSlash != String::NPOS)
-                str = str.Substring(lastSlash + 1);
-            assetAPI->RequestAsset("local://" + str, assetType);
-        }
-    }
+    EnsureStorageContentsCached();
+
+    for(std::map<String, String, StringCompareCaseInsensitive>::const_iterator iter = cachedFiles.begin(); iter != cachedFiles.end(); ++iter)
+        if (suffix == "" || iter->first.EndsWith(suffix))
+            assetAPI->RequestAsset("local://" + iter->first, assetType);
 }
 
 void LocalAssetStorage::RefreshAssetRefs()
 {
-    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
-    StringVector filenames;
-    fileSystem->ScanDir(filenames, directory, "*.*", Urho3D::SCAN_FILES, recursive);
+    // The first refresh may use the saved index, a later one is a request to walk the storage again.
+    if (contentsCached)
+        CacheStorageContents();
+    else
+        EnsureStorageContentsCached();
 
-    foreach(String str, filenames)
+    for(std::map<String, String, StringCompareCaseInsensitive>::const_iterator iter = cachedFiles.begin(); iter != cachedFiles.end(); ++iter)
     {
-        if (!(str.Contains(".git") || str.Contains(".svn") || str.Contains(".hg")))
+        String assetRef = "local://" + iter->first;
+        if (!assetRefs.Contains(assetRef))
         {
-            String diskSource = directory + str;
-            uint lastSlash = str.FindLast('/');
-            if (lastSlash != String::NPOS)
-                str = str.Substring(lastSlash + 1);
-            String localName = str;
-            str = "local://" + str;
-            if (!assetRefs.Contains(str))
-            {
-                assetRefs.Push(str);
-                AssetChanged.Emit(this, localName, diskSource, IAssetStorage::AssetCreate);
-            }
+            assetRefs.Push(assetRef);
+            AssetChanged.Emit(this, iter->first, iter->second, IAssetStorage::AssetCreate);
         }
     }
 }
 
 void LocalAssetStorage::CacheStorageContents()
 {
-    cachedFiles.clear();
+    URHO3D_PROFILE(LocalAssetStorage_CacheStorageContents);
+
     Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
+
+    // For a persistent index, the time and the modification times of the directories are read before the walk, so that
+    // a change made during the walk is seen as a modification when the index is loaded. The index file is created first,
+    // as creating it modifies the storage directory.
+    Vector<Pair<String, unsigned> > directoryTimes;
+    unsigned scanTime = 0;
+    if (persistentIndex)
+    {
+        if (!fileSystem->FileExists(IndexFilename()))
+            Urho3D::File(GetContext(), IndexFilename(), Urho3D::FILE_WRITE);
+
+        scanTime = Urho3D::Time::GetTimeSinceEpoch();
+        StringVector directories;
+        if (recursive)
+            fileSystem->ScanDir(directories, directory, "*", Urho3D::SCAN_DIRS, true);
+        directories.Push("");
+        foreach(const String &dir, directories)
+            if (!dir.EndsWith(".") && !IsVersionControlPath(dir))
+                directoryTimes.Push(MakePair(dir, fileSystem->GetLastModifiedTime(directory + dir)));
+    }
+
+    cachedFiles.clear();
     StringVector filenames;
     fileSystem->ScanDir(filenames, directory, "*.*", Urho3D::SCAN_FILES, recursive);
+    foreach(const String &str, filenames)
+        AddCachedFile(directory + str);
+
+    contentsCached = true;
+    loadedFromIndex = false;
+    lastScanTime = Urho3D::Time::GetSystemTime();
+
+    if (persistentIndex)
+        SaveIndex(directoryTimes, scanTime);
+}
+
+void LocalAssetStorage::EnsureStorageContentsCached()
+{
+    if (!contentsCached && !LoadIndex())
+        CacheStorageContents();
+}
+
+void LocalAssetStorage::AddCachedFile(const String &absoluteFilename)
+{
+    if (IsVersionControlPath(absoluteFilename.Substring(directory.Length())))
+        return;
+    // The saved index is not hidden on all platforms.
+    if (absoluteFilename.Compare(IndexFilename(), false) == 0)
+        return;
 
-    foreach(String str, filenames)
+    const String localName = Urho3D::GetFileNameAndExtension(absoluteFilename);
+    std::map<String, String, StringCompareCaseInsensitive>::iterator iter = cachedFiles.find(localName);
+    if (iter != cachedFiles.end())
     {
-        if (!(str.Contains(".git") || str.Contains(".svn") || str.Contains(".hg")))
-        {
-            String diskSource = directory + str;
-            uint lastSlash = str.FindLast('/');
-            if (lastSlash != String::NPOS)
-                str = str.Substring(lastSlash + 1);
-            String localName = str;
+        if (iter->second.Compare(absoluteFilename, false) == 0)
+            return;
 
 ///\todo This is an often-received error condition if the user is not aware, but also occurs naturally in built-in Ogre Media storages.
 /// Fix this check to occur somehow nicer (without additional constraints to asset load time) without a hardcoded check
 /// against the storage name.
-            if (cachedFiles.find(localName) != cachedFiles.end())
-                LogWarning("Warning: Asset Storage \"" + Name() + "\" contains ambiguous assets \"" + cachedFiles[localName] + "\" and \"" + diskSource + "\" in two different subdirectories!");
+        LogWarning("Warning: Asset Storage \"" + Name() + "\" contains ambiguous assets \"" + iter->second + "\" and \"" + absoluteFilename + "\" in two different subdirectories!");
+
+        // The file in the storage directory itself is preferred, as it is the one a non-recursive lookup finds.
+        if (Urho3D::GetPath(iter->second) == directory)
+            return;
+    }
+    cachedFiles[localName] = absoluteFilename;
+}
 
-            cachedFiles[localName] = diskSource;
+void LocalAssetStorage::RemoveCachedFile(const String &absoluteFilename)
+{
+    std::map<String, String, StringCompareCaseInsensitive>::iterator iter = cachedFiles.find(Urho3D::GetFileNameAndExtension(absoluteFilename));
+    if (iter != cachedFiles.end() && iter->second.Compare(absoluteFilename, false) == 0)
+        cachedFiles.erase(iter);
+}
+
+bool LocalAssetStorage::LoadIndex()
+{
+    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
+    if (!persistentIndex || !fileSystem->FileExists(IndexFilename()))
+        return false;
+
+    URHO3D_PROFILE(LocalAssetStorage_LoadIndex);
+
+    Urho3D::File file(GetContext(), IndexFilename(), Urho3D::FILE_READ);
+    if (!file.IsOpen() || file.GetSize() == 0 || file.ReadFileID() != cIndexFileID || file.ReadUInt() != cIndexVersion ||
+        file.ReadBool() != recursive)
+        return false;
+
+    // Adding, removing or renaming a file modifies its directory. The modification times have a resolution of one second,
+    // so a directory that was modified during the second the walk started in may have been modified again after it.
+    // The storage directory always is when the index file was created for the walk. Such directories are listed
+    // to compare them against the index, instead of walking the whole storage again.
+    const unsigned scanTime = file.ReadUInt();
+    const uint numDirectories = file.ReadUInt();
+    StringVector directories, uncertainDirectories;
+    for(uint i = 0; i < numDirectories; ++i)
+    {
+        const String dir = file.ReadString();
+        const unsigned modifiedTime = file.ReadUInt();
+        if (fileSystem->GetLastModifiedTime(directory + dir) != modifiedTime)
+        {
+            LogDebug("LocalAssetStorage: Saved index of storage " + ToString() + " is out of date.");
+            return false;
         }
+        directories.Push(dir);
+        if (modifiedTime >= scanTime)
+            uncertainDirectories.Push(dir);
     }
+
+    std::map<String, String, StringCompareCaseInsensitive> files;
+    const uint numFiles = file.ReadUInt();
+    for(uint i = 0; i < numFiles && !file.IsEof(); ++i)
+    {
+        const String filename = directory + file.ReadString();
+        files[Urho3D::GetFileNameAndExtension(filename)] = filename;
+    }
+
+    foreach(const String &dir, uncertainDirectories)
+        if (!MatchesIndex(dir, directories, files))
+        {
+            LogDebug("LocalAssetStorage: Saved index of storage " + ToString() + " is out of date.");
+            return false;
+        }
+
+    cachedFiles.swap(files);
+    contentsCached = true;
+    loadedFromIndex = true;
+    lastScanTime = Urho3D::Time::GetSystemTime();
+    LogDebug("LocalAssetStorage: Loaded index of " + String(cachedFiles.size()) + " files for storage " + ToString() + ".");
+    return true;
 }
 
-String LocalAssetStorage::GetFullPathForAsset(const String &assetname, bool recursiveLookup)
+bool LocalAssetStorage::MatchesIndex(const String &dir, const StringVector &directories, const std::map<String, String, StringCompareCaseInsensitive> &files) const
 {
     Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
-    if (fileSystem->FileExists(directory + assetname))
-        return directory;
+    const String path = Urho3D::AddTrailingSlash(directory + dir);
+    const String prefix = dir.Empty() ? dir : Urho3D::AddTrailingSlash(dir);
+
+    // Every file of the directory is indexed at its path, and no other indexed file is in the directory.
+    StringVector filenames;
+    fileSystem->ScanDir(filenames, path, "*.*", Urho3D::SCAN_FILES, false);
+    uint numFiles = 0;
+    foreach(const String &filename, filenames)
+    {
+        if (IsVersionControlPath(prefix + filename) || (path + filename).Compare(IndexFilename(), false) == 0)
+            continue;
+        std::map<String, String, StringCompareCaseInsensitive>::const_iterator iter = files.find(filename);
+        if (iter == files.end() || iter->second.Compare(path + filename, false) != 0)
+            return false;
+        ++numFiles;
+    }
+    uint numIndexedFiles = 0;
+    for(std::map<String, String, StringCompareCaseInsensitive>::const_iterator iter = files.begin(); iter != files.end(); ++iter)
+        if (Urho3D::GetPath(iter->second).Compare(path, false) == 0)
+            ++numIndexedFiles;
+    if (numFiles != numIndexedFiles)
+        return false;
+
+    // A new subdirectory is not in the index. A removed one is seen by its modification time.
+    if (recursive)
+    {
+        StringVector subdirectories;
+        fileSystem->ScanDir(subdirectories, path, "*", Urho3D::SCAN_DIRS, false);
+        foreach(const String &subdir, subdirectories)
+            if (!subdir.EndsWith(".") && !IsVersionControlPath(prefix + subdir) && !directories.Contains(prefix + subdir))
+                return false;
+    }
+    return true;
+}
+
+void LocalAssetStorage::SaveIndex(const Vector<Pair<String, unsigned> > &directoryTimes, unsigned scanTime)
+{
+    URHO3D_PROFILE(LocalAssetStorage_SaveIndex);
+
+    Urho3D::File file(GetContext(), IndexFilename(), Urho3D::FILE_WRITE);
+    if (!file.IsOpen())
+    {
+        LogWarning("LocalAssetStorage: Could not save index of storage " + ToString() + " to " + IndexFilename() + ".");
+        return;
+    }
+
+    file.WriteFileID(cIndexFileID);
+    file.WriteUInt(cIndexVersion);
+    file.WriteBool(recursive);
+    file.WriteUInt(scanTime);
+    file.WriteUInt(directoryTimes.Size());
+    for(uint i = 0; i < directoryTimes.Size(); ++i)
+    {
+        file.WriteString(directoryTimes[i].first_);
+        file.WriteUInt(directoryTimes[i].second_);
+    }
+    file.WriteUInt((uint)cachedFiles.size());
+    for(std::map<String, String, StringCompareCaseInsensitive>::const_iterator iter = cachedFiles.begin(); iter != cachedFiles.end(); ++iter)
+        file.WriteString(iter->second.Substring(directory.Length()));
+}
+
+String LocalAssetStorage::GetFullPathForAsset(const String &assetname, bool recursiveLookup)
+{
+    // The index is keyed by the filename, so a name with a path is looked up from the disk.
+    if (assetname.Contains('/'))
+        return GetSubsystem<Urho3D::FileSystem>()->FileExists(directory + assetname) ? directory : "";
+
+    EnsureStorageContentsCached();
 
     std::map<String, String, StringCompareCaseInsensitive>::iterator iter = cachedFiles.find(assetname);
     if (iter == cachedFiles.end())
     {
-        if (!recursive || !recursiveLookup)
-            return "";
-        else
+        // The index may be out of date even with a watcher: a file can be written before its change notification arrives,
+        // and a subdirectory created after the watch was set up may not be watched. A file in the storage directory itself
+        // is checked directly. Otherwise the storage is walked again, but not more often than cRescanIntervalMsecs, so that
+        // a scene referring to many missing assets does not walk it for each.
+        Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
+        if (assetname.Compare(Urho3D::GetFileNameAndExtension(IndexFilename()), false) != 0 && fileSystem->FileExists(directory + assetname))
+            AddCachedFile(directory + assetname);
+        else if (recursiveLookup && Urho3D::Time::GetSystemTime() - lastScanTime >= cRescanIntervalMsecs)
             CacheStorageContents();
+        iter = cachedFiles.find(assetname);
+        if (iter == cachedFiles.end())
+            return "";
     }
-
-    iter = cachedFiles.find(assetname);
-    if (iter != cachedFiles.end())
+    else if (!changeWatcher && !GetSubsystem<Urho3D::FileSystem>()->FileExists(iter->second))
     {
-        if (fileSystem->FileExists(iter->second))
-            return Urho3D::GetPath(iter->second);
+        // Without change notifications a removed file is only noticed here.
+        cachedFiles.erase(iter);
+        return "";
     }
 
-    return "";
+    // A non-recursive lookup only finds the files in the storage directory itself.
+    String path = Urho3D::GetPath(iter->second);
+    if (!recursiveLookup && path != directory)
+        return "";
+    return path;
 }
 
 /// @todo Make this function handle arbitrary asset refs.
@@ -148,7 +336,7 @@ String LocalAssetStorage::SerializeToString(bool networkTransfer) const
     else
         return "type=" + Type() + ";name=" + name + ";src=" + directory + ";recursive=" + String(recursive) + ";readonly=" + String(!writable) +
             ";liveupdate=" + String(liveUpdate) + ";autodiscoverable=" + String(autoDiscoverable) + ";replicated=" + String(isReplicated)
-            + ";trusted=" + TrustStateToString(GetTrustState());
+            + ";trusted=" + TrustStateToString(GetTrustState()) + (persistentIndex ? ";persistentindex=true" : "");
 }
 
 void LocalAssetStorage::EmitAssetChanged(String absoluteFilename, IAssetStorage::ChangeType change)
@@ -170,8 +358,10 @@ void LocalAssetStorage::SetupWatcher()
         RemoveWatcher();
 
     changeWatcher = new Urho3D::FileWatcher(GetContext());
-    changeWatcher->StartWatching(directory, recursive);
-    LogInfo("LocalAssetStorage: started watching " + directory);
+    if (changeWatcher->StartWatching(directory, recursive))
+        LogInfo("LocalAssetStorage: started watching " + directory);
+    else
+        RemoveWatcher(); // The filename index relies on the change notifications only if the directory is watched.
 }
 
 void LocalAssetStorage::RemoveWatcher()
@@ -31,6 +31,10 @@ public:
 
     /// If true, all subdirectories of the storage directory are automatically looked in when loading an asset.
     bool recursive;
+
+    /// If true, the filename index is saved to the storage directory after walking the storage, so that the next start does not need to walk it.
+    /** The saved index is used only if none of the directories of the storage have been modified since the walk. */
+    bool persistentIndex;
     
     /// Starts listening on the local directory this asset storage points to.
     void SetupWatcher();
@@ -54,6 +58,9 @@ public:
     /// Returns the full local filesystem path name of the given asset in this storage, if it exists.
     /// Example: GetFullPathForAsset("my.mesh", true) might return "C:\Projects\Tundra\bin\data\assets".
     /// If the file does not exist, returns "".
+    /// The lookup is answered from the filename index, which is built on first use. While the storage is watched for changes,
+    /// the index is kept up to date by the change notifications and a lookup of a known file does not touch the file system.
+    /// A missing file is checked from the storage directory, and a recursive lookup walks the storage again at most every few seconds.
     String GetFullPathForAsset(const String &assetname, bool recursive);
 
     /// Returns the URL that should be used in a scene asset reference attribute to refer to the asset with the given localName.
@@ -87,12 +94,37 @@ public:
     /// Walks through this storage on disk and creates a cached index of all the filenames inside this storage.
     void CacheStorageContents();
 
+    /// Returns whether the cached index of the filenames was read from the saved index, instead of walking the storage.
+    bool LoadedFromIndex() const { return loadedFromIndex; }
+
+    /// Returns the filename of the saved filename index. The file is never indexed as an asset.
+    String IndexFilename() const { return directory + ".tundraindex"; }
+
 private:
     friend class LocalAssetProvider;
 
+    /// Creates the filename index if it does not exist yet, from the saved index if it is up to date, otherwise by walking the storage.
+    void EnsureStorageContentsCached();
+    /// Adds the file to the filename index.
+    void AddCachedFile(const String &absoluteFilename);
+    /// Removes the file from the filename index.
+    void RemoveCachedFile(const String &absoluteFilename);
+    /// Reads the saved filename index. Returns false if there is none, or if the storage has been modified after it was saved.
+    bool LoadIndex();
+    /// Returns whether the files and subdirectories directly in the storage subdirectory @c dir match the saved index being loaded.
+    bool MatchesIndex(const String &dir, const StringVector &directories, const std::map<String, String, StringCompareCaseInsensitive> &files) const;
+    /// Writes the filename index to IndexFilename(), along with the modification times of the directories that were walked.
+    void SaveIndex(const Vector<Pair<String, unsigned> > &directoryTimes, unsigned scanTime);
+
     /// Maps a file basename 'asset.mesh' to its full path 'c:\project\assets\asset.mesh'.
     /// Used to quickly lookup known assets by basename instead of having to do an expensive recursive directory search.
     std::map<String, String, StringCompareCaseInsensitive> cachedFiles;
+    /// Whether cachedFiles has been created.
+    bool contentsCached;
+    /// Whether cachedFiles was read from the saved index.
+    bool loadedFromIndex;
+    /// System time in milliseconds of the last walk of the storage.
+    unsigned lastScanTime;
 };
 
 }
@@ -165,6 +165,7 @@ void Framework::Initialize()
 
     console->RegisterCommand("plugins", "Prints all currently loaded plugins.", plugin.Get(), &PluginAPI::ListPlugins);
     console->RegisterCommand("exit", "Shuts down gracefully.", this, &Framework::Exit);
+    console->RegisterCommand("assetTransferStats", "Prints the asset transfer queue statistics per provider.", asset->TransferScheduler(), &AssetTransferScheduler::DumpStats);
 
     // Initialize plugins now
     LogInfo("");
@@ -0,0 +1,345 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "AttributeInterpolator.h"
+#include "IComponent.h"
+
+#include <Math/MathFunc.h>
+#include <Urho3D/Core/Profiler.h>
+
+namespace Tundra
+{
+
+AttributeInterpolator::AttributeInterpolator() :
+    updating_(false)
+{
+}
+
+AttributeInterpolator::~AttributeInterpolator()
+{
+    Clear();
+}
+
+Transform AttributeInterpolator::Evaluate(const TransformKey &start, const TransformKey &end, float t)
+{
+    Transform ret;
+    ret.pos = Lerp(start.pos, end.pos, t);
+    ret.SetOrientation(Slerp(start.rot, end.rot, t));
+    ret.scale = Lerp(start.scale, end.scale, t);
+    return ret;
+}
+
+float3 AttributeInterpolator::Evaluate(const float3 &start, const float3 &end, float t)
+{
+    return Lerp(start, end, t);
+}
+
+Quat AttributeInterpolator::Evaluate(const Quat &start, const Quat &end, float t)
+{
+    return Slerp(start, end, t);
+}
+
+float AttributeInterpolator::Evaluate(float start, float end, float t)
+{
+    return Lerp(start, end, t);
+}
+
+Color AttributeInterpolator::Evaluate(const Color &start, const Color &end, float t)
+{
+    return Color(Lerp(start.r, end.r, t), Lerp(start.g, end.g, t), Lerp(start.b, end.b, t), Lerp(start.a, end.a, t));
+}
+
+AttributeInterpolator::GenericValue AttributeInterpolator::Evaluate(IAttribute *start, IAttribute *end, float t)
+{
+    GenericValue ret = { start, end, t };
+    return ret;
+}
+
+template <typename Value>
+void AttributeInterpolator::SetValue(IAttribute *attr, const Value &value)
+{
+    static_cast<Attribute<Value>*>(attr)->Set(value, AttributeChange::LocalOnly);
+}
+
+void AttributeInterpolator::SetValue(IAttribute *attr, const GenericValue &value)
+{
+    attr->Interpolate(value.start, value.end, value.t, AttributeChange::LocalOnly);
+}
+
+template <typename Key, typename Value>
+void AttributeInterpolator::Add(Channel<Key, Value> &channel, u32 type, IAttribute *attr, const Key &start, const Key &end, float length)
+{
+    Slot slot = { type, channel.attributes.Size() };
+    slots_[attr] = slot;
+    channel.attributes.Push(AttributeWeakPtr(attr->Owner(), attr));
+    channel.start.Push(start);
+    channel.end.Push(end);
+    channel.time.Push(0.f);
+    channel.length.Push(length);
+}
+
+template <typename Key, typename Value>
+void AttributeInterpolator::Remove(Channel<Key, Value> &channel, uint index)
+{
+    slots_.Erase(channel.attributes[index].attribute);
+
+    const uint last = channel.attributes.Size() - 1;
+    if (index != last)
+    {
+        channel.attributes[index] = channel.attributes[last];
+        channel.start[index] = channel.start[last];
+        channel.end[index] = channel.end[last];
+        channel.time[index] = channel.time[last];
+        channel.length[index] = channel.length[last];
+        slots_[channel.attributes[index].attribute].index = index;
+    }
+    channel.attributes.Pop();
+    channel.start.Pop();
+    channel.end.Pop();
+    channel.time.Pop();
+    channel.length.Pop();
+}
+
+template <typename Key, typename Value>
+void AttributeInterpolator::Advance(Channel<Key, Value> &channel, u32 type, float frametime)
+{
+    const uint num = channel.attributes.Size();
+    channel.pendingAttributes.Clear();
+    channel.pendingValues.Clear();
+    if (num == 0)
+        return;
+
+    // The value is set until the length is reached, and the interpolation is kept for another length
+    // so that a continuous stream of updates is detected in StartAttributeInterpolation.
+    channel.factors.Resize(num);
+    float *time = &channel.time[0];
+    const float *length = &channel.length[0];
+    float *factors = &channel.factors[0];
+    for(uint i = 0; i < num; ++i)
+    {
+        const float previous = time[i];
+        time[i] = previous + frametime;
+        factors[i] = (previous <= length[i] ? Min(time[i] / length[i], 1.f) : -1.f);
+    }
+
+    channel.values.Resize(num);
+    const Key *start = &channel.start[0];
+    const Key *end = &channel.end[0];
+    Value *values = &channel.values[0];
+    for(uint i = 0; i < num; ++i)
+        if (factors[i] >= 0.f)
+            values[i] = Evaluate(start[i], end[i], factors[i]);
+
+    // Backwards, so that the interpolation moved in place of a removed one has been handled already.
+    for(uint i = num; i-- > 0;)
+    {
+        if (channel.attributes[i].Expired())
+        {
+            Slot slot = { type, i };
+            Remove(slot);
+        }
+        else if (factors[i] >= 0.f)
+        {
+            channel.pendingAttributes.Push(channel.attributes[i]);
+            channel.pendingValues.Push(values[i]);
+        }
+        else if (time[i] >= length[i] * 2.f)
+        {
+            Slot slot = { type, i };
+            Remove(slot);
+        }
+    }
+}
+
+template <typename Key, typename Value>
+void AttributeInterpolator::SetPending(Channel<Key, Value> &channel)
+{
+    for(uint i = 0; i < channel.pendingAttributes.Size(); ++i)
+    {
+        // An earlier signal handler may have removed the component.
+        IAttribute *attr = channel.pendingAttributes[i].Get();
+        if (attr)
+            SetValue(attr, channel.pendingValues[i]);
+    }
+    channel.pendingAttributes.Clear();
+    channel.pendingValues.Clear();
+}
+
+void AttributeInterpolator::Start(IAttribute *attr, IAttribute *endValue, float length)
+{
+    HashMap<IAttribute*, Slot>::ConstIterator it = slots_.Find(attr);
+    if (it != slots_.End())
+    {
+        const Slot slot = it->second_;
+        Remove(slot);
+    }
+
+    const u32 type = attr->TypeId();
+    if (endValue->TypeId() != type)
+    {
+        // Attribute::Interpolate ignores mismatching end values
+        Add(generic_, IAttribute::NoneId, attr, attr->Clone(), endValue, length);
+        return;
+    }
+
+    switch(type)
+    {
+    case IAttribute::TransformId:
+    {
+        const Transform &start = static_cast<Attribute<Transform>*>(attr)->Get();
+        const Transform &end = static_cast<Attribute<Transform>*>(endValue)->Get();
+        TransformKey startKey = { start.pos, start.Orientation(), start.scale };
+        TransformKey endKey = { end.pos, end.Orientation(), end.scale };
+        Add(transforms_, type, attr, startKey, endKey, length);
+        delete endValue;
+        break;
+    }
+    case IAttribute::Float3Id:
+        Add(float3s_, type, attr, static_cast<Attribute<float3>*>(attr)->Get(), static_cast<Attribute<float3>*>(endValue)->Get(), length);
+        delete endValue;
+        break;
+    case IAttribute::QuatId:
+        Add(quats_, type, attr, static_cast<Attribute<Quat>*>(attr)->Get(), static_cast<Attribute<Quat>*>(endValue)->Get(), length);
+        delete endValue;
+        break;
+    case IAttribute::RealId:
+        Add(reals_, type, attr, static_cast<Attribute<float>*>(attr)->Get(), static_cast<Attribute<float>*>(endValue)->Get(), length);
+        delete endValue;
+        break;
+    case IAttribute::ColorId:
+        Add(colors_, type, attr, static_cast<Attribute<Color>*>(attr)->Get(), static_cast<Attribute<Color>*>(endValue)->Get(), length);
+        delete endValue;
+        break;
+    default:
+        Add(generic_, IAttribute::NoneId, attr, attr->Clone(), endValue, length);
+        break;
+    }
+}
+
+bool AttributeInterpolator::End(IAttribute *attr)
+{
+    HashMap<IAttribute*, Slot>::Iterator it = slots_.Find(attr);
+    if (it == slots_.End())
+        return false;
+    // An expired slot belongs to an attribute of a removed component that had the same address.
+    const Slot slot = it->second_;
+    const bool running = !SlotAttribute(slot).Expired();
+    Remove(slot);
+    return running;
+}
+
+void AttributeInterpolator::Clear()
+{
+    for(uint i = 0; i < generic_.attributes.Size(); ++i)
+    {
+        garbage_.Push(generic_.start[i]);
+        garbage_.Push(generic_.end[i]);
+    }
+    transforms_ = TransformChannel();
+    float3s_ = Float3Channel();
+    quats_ = QuatChannel();
+    reals_ = RealChannel();
+    colors_ = ColorChannel();
+    generic_ = GenericChannel();
+    slots_.Clear();
+
+    if (!updating_)
+    {
+        for(uint i = 0; i < garbage_.Size(); ++i)
+            delete garbage_[i];
+        garbage_.Clear();
+    }
+}
+
+void AttributeInterpolator::Update(float frametime)
+{
+    // Setting the values may signal code that ends or starts interpolations, but not a nested update.
+    if (updating_)
+        return;
+
+    URHO3D_PROFILE(AttributeInterpolator_Update);
+
+    updating_ = true;
+
+    Advance(transforms_, IAttribute::TransformId, frametime);
+    Advance(float3s_, IAttribute::Float3Id, frametime);
+    Advance(quats_, IAttribute::QuatId, frametime);
+    Advance(reals_, IAttribute::RealId, frametime);
+    Advance(colors_, IAttribute::ColorId, frametime);
+    Advance(generic_, IAttribute::NoneId, frametime);
+
+    // The arrays are not touched while setting, so the signal handlers are free to start and end interpolations.
+    SetPending(transforms_);
+    SetPending(float3s_);
+    SetPending(quats_);
+    SetPending(reals_);
+    SetPending(colors_);
+    SetPending(generic_);
+
+    for(uint i = 0; i < garbage_.Size(); ++i)
+        delete garbage_[i];
+    garbage_.Clear();
+
+    updating_ = false;
+}
+
+bool AttributeInterpolator::Contains(IAttribute *attr) const
+{
+    HashMap<IAttribute*, Slot>::ConstIterator it = slots_.Find(attr);
+    return it != slots_.End() && !SlotAttribute(it->second_).Expired();
+}
+
+void AttributeInterpolator::Remove(const Slot &slot)
+{
+    switch(slot.type)
+    {
+    case IAttribute::TransformId:
+        Remove(transforms_, slot.index);
+        break;
+    case IAttribute::Float3Id:
+        Remove(float3s_, slot.index);
+        break;
+    case IAttribute::QuatId:
+        Remove(quats_, slot.index);
+        break;
+    case IAttribute::RealId:
+        Remove(reals_, slot.index);
+        break;
+    case IAttribute::ColorId:
+        Remove(colors_, slot.index);
+        break;
+    default:
+        // The values may still be waiting to be set by the update in progress.
+        garbage_.Push(generic_.start[slot.index]);
+        garbage_.Push(generic_.end[slot.index]);
+        Remove(generic_, slot.index);
+        if (!updating_)
+        {
+            for(uint i = 0; i < garbage_.Size(); ++i)
+                delete garbage_[i];
+            garbage_.Clear();
+        }
+        break;
+    }
+}
+
+const AttributeWeakPtr &AttributeInterpolator::SlotAttribute(const Slot &slot) const
+{
+    switch(slot.type)
+    {
+    case IAttribute::TransformId:
+        return transforms_.attributes[slot.index];
+    case IAttribute::Float3Id:
+        return float3s_.attributes[slot.index];
+    case IAttribute::QuatId:
+        return quats_.attributes[slot.index];
+    case IAttribute::RealId:
+        return reals_.attributes[slot.index];
+    case IAttribute::ColorId:
+        return colors_.attributes[slot.index];
+    default:
+        return generic_.attributes[slot.index];
+    }
+}
+
+}
@@ -0,0 +1,142 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "SceneFwd.h"
+#include "IAttribute.h"
+#include "Math/Transform.h"
+#include "Math/Color.h"
+
+#include <Math/float3.h>
+#include <Math/Quat.h>
+
+#include <Urho3D/Container/HashMap.h>
+
+namespace Tundra
+{
+
+/// Runs the attribute interpolations of a scene.
+/** The start and end values of the Transform, float3, Quat, float and Color attributes are stored by value in arrays per
+    type. On each update the interpolated values of a type are evaluated in one loop, and then written to the attributes.
+    The attributes of the other interpolated types use IAttribute::Interpolate with a cloned start value.
+    The running interpolations are found by attribute with a hash lookup.
+    @sa Scene::StartAttributeInterpolation */
+class TUNDRACORE_API AttributeInterpolator
+{
+public:
+    AttributeInterpolator();
+    ~AttributeInterpolator();
+
+    /// Starts interpolating @c attr from its current value to @c endValue over @c length seconds.
+    /** A running interpolation of @c attr is restarted from the current value. Takes the ownership of @c endValue. */
+    void Start(IAttribute *attr, IAttribute *endValue, float length);
+    /// Ends the interpolation of @c attr. The last set value remains.
+    /** @return true if an interpolation of @c attr was running. */
+    bool End(IAttribute *attr);
+    /// Ends all interpolations.
+    void Clear();
+    /// Advances the interpolations by @c frametime and sets the interpolated values with LocalOnly change.
+    /** An interpolation is kept for twice its length, though the value is no longer set after the length,
+        so that Contains detects continuous updates. */
+    void Update(float frametime);
+
+    /// Returns whether an interpolation of @c attr is running.
+    bool Contains(IAttribute *attr) const;
+    /// Returns the number of running interpolations.
+    uint Size() const { return slots_.Size(); }
+
+private:
+    /// Start and end values of a Transform interpolation. The orientation is converted to a quaternion once, when starting.
+    struct TransformKey
+    {
+        float3 pos;
+        Quat rot;
+        float3 scale;
+    };
+
+    /// Interpolation of an attribute of another type, evaluated by IAttribute::Interpolate when it is set.
+    struct GenericValue
+    {
+        IAttribute *start;
+        IAttribute *end;
+        float t;
+    };
+
+    /// Running interpolations of one attribute type, stored as parallel arrays.
+    /** @c Key is the form the start and end values are stored in, @c Value the type of the attribute. */
+    template <typename Key, typename Value>
+    struct Channel
+    {
+        Vector<AttributeWeakPtr> attributes;
+        PODVector<Key> start;
+        PODVector<Key> end;
+        PODVector<float> time;
+        PODVector<float> length;
+
+        /// Interpolation factors of the current update, negative when the value is not set.
+        PODVector<float> factors;
+        /// Interpolated values of the current update.
+        PODVector<Value> values;
+        /// Values to set at the end of the current update.
+        Vector<AttributeWeakPtr> pendingAttributes;
+        PODVector<Value> pendingValues;
+    };
+
+    /// Position of an interpolation in the channel of its type.
+    struct Slot
+    {
+        u32 type; ///< IAttribute::TypeId of the channel, IAttribute::NoneId for the generic channel.
+        uint index;
+    };
+
+    typedef Channel<TransformKey, Transform> TransformChannel;
+    typedef Channel<float3, float3> Float3Channel;
+    typedef Channel<Quat, Quat> QuatChannel;
+    typedef Channel<float, float> RealChannel;
+    typedef Channel<Color, Color> ColorChannel;
+    /// The start values are clones of the attributes and the end values the received end attributes, owned by the channel.
+    typedef Channel<IAttribute*, GenericValue> GenericChannel;
+
+    /// Adds an interpolation of @c attr to @c channel.
+    template <typename Key, typename Value>
+    void Add(Channel<Key, Value> &channel, u32 type, IAttribute *attr, const Key &start, const Key &end, float length);
+    /// Removes the interpolation at @c index of @c channel, moving the last one in its place.
+    template <typename Key, typename Value>
+    void Remove(Channel<Key, Value> &channel, uint index);
+    /// Advances the interpolations of @c channel, evaluates their values and removes the finished ones.
+    template <typename Key, typename Value>
+    void Advance(Channel<Key, Value> &channel, u32 type, float frametime);
+    /// Sets the values evaluated by Advance to the attributes.
+    template <typename Key, typename Value>
+    void SetPending(Channel<Key, Value> &channel);
+    /// Removes the interpolation at @c slot. The owned values of a generic interpolation are deleted after the update in progress.
+    void Remove(const Slot &slot);
+    /// Returns the attribute of the interpolation at @c slot.
+    const AttributeWeakPtr &SlotAttribute(const Slot &slot) const;
+
+    /// @cond PRIVATE
+    static Transform Evaluate(const TransformKey &start, const TransformKey &end, float t);
+    static float3 Evaluate(const float3 &start, const float3 &end, float t);
+    static Quat Evaluate(const Quat &start, const Quat &end, float t);
+    static float Evaluate(float start, float end, float t);
+    static Color Evaluate(const Color &start, const Color &end, float t);
+    static GenericValue Evaluate(IAttribute *start, IAttribute *end, float t);
+    template <typename Value>
+    static void SetValue(IAttribute *attr, const Value &value);
+    static void SetValue(IAttribute *attr, const GenericValue &value);
+    /// @endcond
+
+    TransformChannel transforms_;
+    Float3Channel float3s_;
+    QuatChannel quats_;
+    RealChannel reals_;
+    ColorChannel colors_;
+    GenericChannel generic_;
+    HashMap<IAttribute*, Slot> slots_;
+    /// Owned values of the generic interpolations removed during an update, deleted when it ends.
+    PODVector<IAttribute*> garbage_;
+    bool updating_;
+};
+
+}
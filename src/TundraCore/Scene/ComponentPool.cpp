@@ -0,0 +1,84 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "ComponentPool.h"
+
+namespace Tundra
+{
+
+// Alignment of the slots, enough for the SIMD members of the math types.
+static const uint cSlotAlignment = 16;
+
+/// Returns the first aligned slot of a block allocated with cSlotAlignment bytes of slack.
+static inline u8 *FirstSlot(u8 *block)
+{
+    return reinterpret_cast<u8*>(((size_t)block + cSlotAlignment - 1) & ~(size_t)(cSlotAlignment - 1));
+}
+
+ComponentPool::ComponentPool(uint objectSize, uint objectsPerBlock) :
+    objectSize_((Max(objectSize, (uint)sizeof(FreeSlot)) + cSlotAlignment - 1) & ~(cSlotAlignment - 1)),
+    objectsPerBlock_(Max(objectsPerBlock, 1U)),
+    free_(0),
+    numAllocated_(0)
+{
+}
+
+ComponentPool::~ComponentPool()
+{
+    // Objects that outlive the pool, eg. in static destruction order, keep their memory.
+    // The pools are destroyed at exit, when the logging is no longer available, so this is not reported.
+    if (numAllocated_ > 0)
+        return;
+    for(uint i = 0; i < blocks_.Size(); ++i)
+        ::operator delete(blocks_[i]);
+}
+
+void *ComponentPool::Allocate()
+{
+    if (!free_)
+        AllocateBlock();
+    FreeSlot *slot = free_;
+    free_ = slot->next;
+    ++numAllocated_;
+    return slot;
+}
+
+void ComponentPool::Free(void *ptr)
+{
+    if (!ptr)
+        return;
+    assert(Contains(ptr));
+    FreeSlot *slot = static_cast<FreeSlot*>(ptr);
+    slot->next = free_;
+    free_ = slot;
+    --numAllocated_;
+}
+
+bool ComponentPool::Contains(const void *ptr) const
+{
+    const u8 *p = static_cast<const u8*>(ptr);
+    const uint blockSize = objectSize_ * objectsPerBlock_;
+    for(uint i = 0; i < blocks_.Size(); ++i)
+    {
+        const u8 *first = FirstSlot(blocks_[i]);
+        if (p >= first && p < first + blockSize)
+            return (uint)(p - first) % objectSize_ == 0;
+    }
+    return false;
+}
+
+void ComponentPool::AllocateBlock()
+{
+    u8 *block = static_cast<u8*>(::operator new(objectSize_ * objectsPerBlock_ + cSlotAlignment));
+    blocks_.Push(block);
+    // Link the slots in address order, so that consecutive allocations are consecutive in memory.
+    u8 *first = FirstSlot(block);
+    for(uint i = objectsPerBlock_; i-- > 0;)
+    {
+        FreeSlot *slot = reinterpret_cast<FreeSlot*>(first + i * objectSize_);
+        slot->next = free_;
+        free_ = slot;
+    }
+}
+
+}
@@ -0,0 +1,57 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+
+#include <Urho3D/Container/Vector.h>
+
+namespace Tundra
+{
+
+/// Allocates objects of one size from contiguous blocks.
+/** Used by the component types that declare COMPONENT_POOL_ALLOCATED, so that their instances are packed next to each
+    other in memory and iterating all of them, eg. with Scene::ForEachComponent, does not jump around the heap.
+    The freed slots are reused before a new block is allocated. The blocks are kept until the pool is destroyed.
+    @note Not thread-safe, the components are created and destroyed in the main thread. */
+class TUNDRACORE_API ComponentPool
+{
+public:
+    /// @param objectSize Size of the allocated objects in bytes.
+    /// @param objectsPerBlock Number of objects in each contiguous block.
+    explicit ComponentPool(uint objectSize, uint objectsPerBlock = 256);
+    /// Frees the blocks, unless there are objects still allocated from them.
+    ~ComponentPool();
+
+    /// Returns memory for one object.
+    void *Allocate();
+    /// Returns the memory of an object allocated with Allocate to the pool.
+    void Free(void *ptr);
+
+    /// Returns whether @c ptr points into the blocks of this pool.
+    bool Contains(const void *ptr) const;
+
+    uint ObjectSize() const { return objectSize_; }
+    uint NumAllocated() const { return numAllocated_; }
+    uint NumBlocks() const { return blocks_.Size(); }
+    /// Returns the number of objects that fit in the allocated blocks.
+    uint Capacity() const { return blocks_.Size() * objectsPerBlock_; }
+
+private:
+    struct FreeSlot
+    {
+        FreeSlot *next;
+    };
+
+    /// Allocates a new block and adds its slots to the free list.
+    void AllocateBlock();
+
+    uint objectSize_;
+    uint objectsPerBlock_;
+    PODVector<u8*> blocks_;
+    FreeSlot *free_;
+    uint numAllocated_;
+};
+
+}
@@ -108,7 +108,10 @@ void Entity::AddComponent(component_id_t id, const ComponentPtr &component, Attr
         if (change != AttributeChange::Disconnected)
             ComponentAdded.Emit(component.Get(), change == AttributeChange::Default ? component->UpdateMode() : change);
         if (scene_)
+        {
+            scene_->AddToComponentIndex(component.Get());
             scene_->EmitComponentAdded(this, component.Get(), change);
+        }
     }
 }
 
@@ -144,7 +147,10 @@ void Entity::RemoveComponent(ComponentMap::Iterator iter, AttributeChange::Type
     if (change != AttributeChange::Disconnected)
         ComponentRemoved(iter->second_.Get(), change == AttributeChange::Default ? component->UpdateMode() : change);
     if (scene_)
+    {
         scene_->EmitComponentRemoved(this, iter->second_.Get(), change);
+        scene_->RemoveFromComponentIndex(iter->second_.Get());
+    }
 
     iter->second_->SetParentEntity(0);
     components_.Erase(iter);
@@ -380,6 +380,10 @@ public:
     /// Returns if parent entity is set.
     bool HasParent() const { return parent_.Get() != nullptr; }
 
+    /// Returns parent entity of this entity without taking a reference, or null if entity is on the root level.
+    /** Unlike Parent() this does not modify reference counts, so it can be used by worker threads that only read the scene. */
+    Entity *ParentEntity() const { return parent_.Get(); }
+
     /// Returns number of child entities.
     uint NumChildren() const { return children_.Size(); }
 
@@ -9,6 +9,7 @@
 #include "IComponent.h"
 #include "Entity.h"
 #include "Scene.h"
+#include "Name.h"
 #include "SceneAPI.h"
 #include "Framework.h"
 #include "LoggingFunctions.h"
@@ -29,7 +30,10 @@ IComponent::IComponent(Urho3D::Context* context, Scene* scene) :
     updateMode(AttributeChange::Replicate),
     replicated(true),
     temporary(false),
-    id(0)
+    id(0),
+    sceneIndexSlot(0),
+    changeBatchDepth(0),
+    collectedByScene(false)
 {
 }
 
@@ -399,11 +403,21 @@ void IComponent::EmitAttributeChanged(IAttribute* attribute, AttributeChange::Ty
         change = updateMode;
     assert(change != AttributeChange::Default);
 
+    // The name and group indices of the scene are kept current also for the changes that are not signalled.
+    Scene* scene = ParentScene();
+    if (scene && TypeId() == Name::ComponentTypeId)
+        scene->UpdateNameIndex(static_cast<Name*>(this));
+
     if (change == AttributeChange::Disconnected)
         return; // No signals
+
+    if (changeBatchDepth > 0 || (scene && scene->IsCollectingAttributeChanges()))
+    {
+        CollectAttributeChange(attribute, change);
+        return;
+    }
     
     // Trigger scenemanager signal
-    Scene* scene = ParentScene();
     if (scene)
         scene->EmitAttributeChanged(this, attribute, change);
     
@@ -501,9 +515,109 @@ void IComponent::ComponentChanged(AttributeChange::Type change)
     // We are signalling attribute changes, but the desired change type is saying "don't signal about changes".
     assert(change != AttributeChange::Default && change != AttributeChange::Disconnected);
 
+    // Signal every attribute, but let the derived class react to them at once.
+    BeginAttributeChanges();
     for(uint i = 0; i < attributes.Size(); ++i)
         if (attributes[i])
             EmitAttributeChanged(attributes[i], change);
+    EndAttributeChanges();
+}
+
+void IComponent::BeginAttributeChanges()
+{
+    ++changeBatchDepth;
+}
+
+void IComponent::EndAttributeChanges()
+{
+    if (changeBatchDepth == 0)
+    {
+        LogError("IComponent::EndAttributeChanges: called without BeginAttributeChanges for " + TypeName());
+        return;
+    }
+    if (--changeBatchDepth > 0 || !HasCollectedAttributeChanges())
+        return;
+
+    // Leave the changes to the scene if it is still collecting
+    Scene* scene = ParentScene();
+    if (scene && scene->IsCollectingAttributeChanges())
+    {
+        if (!collectedByScene)
+        {
+            collectedByScene = true;
+            scene->collectingComponents_.Push(ComponentWeakPtr(this));
+        }
+        return;
+    }
+    SignalCollectedAttributeChanges();
+}
+
+bool IComponent::IsCollectingAttributeChanges() const
+{
+    if (changeBatchDepth > 0)
+        return true;
+    Scene* scene = ParentScene();
+    return scene && scene->IsCollectingAttributeChanges();
+}
+
+void IComponent::CollectAttributeChange(IAttribute* attribute, AttributeChange::Type change)
+{
+    PODVector<u32> &collected = (change == AttributeChange::Replicate ? collectedReplicate : collectedLocalOnly);
+    const uint word = attribute->Index() >> 5;
+    if (word >= collected.Size())
+    {
+        const uint oldSize = collected.Size();
+        collected.Resize(word + 1);
+        for(uint i = oldSize; i < collected.Size(); ++i)
+            collected[i] = 0;
+    }
+    collected[word] |= 1u << (attribute->Index() & 31);
+
+    // Outside its own batch, the component is collecting for the scene.
+    if (changeBatchDepth == 0 && !collectedByScene)
+    {
+        Scene* scene = ParentScene();
+        if (scene)
+        {
+            collectedByScene = true;
+            scene->collectingComponents_.Push(ComponentWeakPtr(this));
+        }
+    }
+}
+
+void IComponent::SignalCollectedAttributeChanges()
+{
+    PODVector<u32> localOnly, replicate;
+    localOnly.Swap(collectedLocalOnly);
+    replicate.Swap(collectedReplicate);
+    if (localOnly.Empty() && replicate.Empty())
+        return;
+
+    // The handlers may remove this component from its entity.
+    ComponentPtr keepAlive(this);
+    Scene* scene = ParentScene();
+    for(uint i = 0; i < attributes.Size(); ++i)
+    {
+        const uint word = i >> 5;
+        const u32 bit = 1u << (i & 31);
+        AttributeChange::Type change;
+        if (word < replicate.Size() && (replicate[word] & bit))
+            change = AttributeChange::Replicate;
+        else if (word < localOnly.Size() && (localOnly[word] & bit))
+            change = AttributeChange::LocalOnly;
+        else
+            continue;
+        if (!attributes[i])
+            continue;
+        if (scene)
+            scene->EmitAttributeChanged(this, attributes[i], change);
+        AttributeChanged.Emit(attributes[i], change);
+    }
+
+    AttributesChanged();
+    for(uint i = 0; i < attributes.Size(); ++i)
+        if (attributes[i])
+            attributes[i]->ClearChangedFlag();
 }
 
 void IComponent::SetTemporary(bool enable)
@@ -11,6 +11,7 @@
 #include "AttributeChangeType.h"
 #include "IAttribute.h"
 #include "Signals.h"
+#include "ComponentPool.h"
 
 #include <Urho3D/Core/Object.h>
 
@@ -44,6 +45,31 @@ public:
     }                                                                                   \
 private: // Return the class visibility specifier to the strictest form so that the user most likely catches that this macro had to change the visibility.
 
+/// Allocates the instances of a component type from a ComponentPool, so that they are contiguous in memory.
+/** Place after COMPONENT_NAME in the declaration of a component that is created in large numbers and iterated every frame.
+    The component is still created by its factory and owned by ComponentPtr as usual. Instances of derived classes,
+    which have a different size, are allocated from the heap. */
+#define COMPONENT_POOL_ALLOCATED(componentTypeName)                                     \
+public:                                                                                 \
+    static void *operator new(size_t size)                                              \
+    {                                                                                   \
+        return size == sizeof(componentTypeName) ? Pool().Allocate() : ::operator new(size); \
+    }                                                                                   \
+    static void operator delete(void *ptr, size_t size)                                 \
+    {                                                                                   \
+        if (size == sizeof(componentTypeName))                                          \
+            Pool().Free(ptr);                                                           \
+        else                                                                            \
+            ::operator delete(ptr);                                                     \
+    }                                                                                   \
+    /** Returns the pool the instances of this component type are allocated from. */    \
+    static Tundra::ComponentPool &Pool()                                                \
+    {                                                                                   \
+        static Tundra::ComponentPool pool(sizeof(componentTypeName));                   \
+        return pool;                                                                    \
+    }                                                                                   \
+private:
+
 /** @def INIT_ATTRIBUTE(id, name)
     Macro for constructing an attribute in the component's constructor initializer list.
     "id" is the property/variable name, "name" is the human-readable name used in editing. */
@@ -287,6 +313,18 @@ public:
         every attribute will be synced to the network. */
     void ComponentChanged(AttributeChange::Type change);
 
+    /// Starts collecting the attribute changes of this component instead of signalling each of them. Can be nested. [noscript]
+    /** The changed attributes are recorded in a bitmask, and at the outermost EndAttributeChanges each of them is
+        signalled once with Scene::AttributeChanged and AttributeChanged, and AttributesChanged is called once.
+        Each attribute is signalled with the change type it was changed with, as Replicate if it was changed both locally and replicated.
+        Scripts use the scoped BatchAttributeChanges(function) instead.
+        @sa Scene::BeginAttributeChanges, AttributeChangeBatch */
+    void BeginAttributeChanges();
+    /// Ends collecting the attribute changes and signals them, unless the parent scene is still collecting changes. [noscript]
+    void EndAttributeChanges();
+    /// Returns whether the attribute changes of this component are being collected, by this component or its parent scene.
+    bool IsCollectingAttributeChanges() const;
+
     /// Returns the Entity this Component is part of.
     /** @note Calling this function will return null if it is called in the ctor or dtor of this Component.
         This is because the parent entity has not yet been set with a call to SetParentEntity at that point,
@@ -387,6 +425,7 @@ protected:
 private:
     friend class IAttribute;
     friend class Entity;
+    friend class Scene;
 
     /// This function is called by the base class (IComponent) to signal to the derived class that one or more
     /// of its attributes have changed, and it should update its internal state accordingly.
@@ -396,6 +435,19 @@ private:
 
     /// Set component id. Called by Entity
     void SetNewId(component_id_t newId);
+
+    /// Records a change of @c attribute while collecting the attribute changes.
+    void CollectAttributeChange(IAttribute* attribute, AttributeChange::Type change);
+    /// Returns whether any attribute changes have been collected.
+    bool HasCollectedAttributeChanges() const { return !collectedLocalOnly.Empty() || !collectedReplicate.Empty(); }
+    /// Signals the collected attribute changes.
+    void SignalCollectedAttributeChanges();
+
+    uint sceneIndexSlot; ///< Position in the per-type component index of the parent scene. Managed by Scene.
+    uint changeBatchDepth; ///< Nesting depth of BeginAttributeChanges.
+    PODVector<u32> collectedLocalOnly; ///< Bitmask of the attributes changed with LocalOnly while collecting, by attribute index.
+    PODVector<u32> collectedReplicate; ///< Bitmask of the attributes changed with Replicate while collecting, by attribute index.
+    bool collectedByScene; ///< Whether the parent scene will signal the collected changes.
 };
 
 }
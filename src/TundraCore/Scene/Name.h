@@ -66,6 +66,12 @@ public:
         implementations how the group information is used.
         @sa Entity::SetGroup, Entity::Group, Scene::EntitiesOfGroup */
     Attribute<String> group;
+
+private:
+    friend class Scene;
+
+    String indexedName; ///< Name under which the parent scene has indexed this component. Managed by Scene.
+    String indexedGroup; ///< Group under which the parent scene has indexed this component. Managed by Scene.
 };
 
 COMPONENT_TYPEDEFS(Name)
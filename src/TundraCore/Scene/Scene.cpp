@@ -37,7 +37,8 @@ Scene::Scene(const String &name, Framework *framework, bool viewEnabled, bool au
     name_(name),
     framework_(framework),
     interpolating_(false),
-    authority_(authority)
+    authority_(authority),
+    attributeChangeBatchDepth_(0)
 {
     // In headless mode only view disabled-scenes can be created
     viewEnabled_ = framework->IsHeadless() ? false : viewEnabled;
@@ -137,10 +138,16 @@ EntityPtr Scene::EntityByName(const String &name) const
     if (name.Empty())
         return EntityPtr();
 
-    for(ConstIterator it = Begin(); it != End(); ++it)
-        if (it->second_->Name() == name)
-            return it->second_;
-
+    NameIndex::ConstIterator it = componentsByName_.Find(name);
+    if (it == componentsByName_.End())
+        return EntityPtr();
+    const PODVector<Name*> &components = it->second_;
+    for(uint i = 0; i < components.Size(); ++i)
+    {
+        Entity *entity = NamedEntity(components[i]);
+        if (entity)
+            return EntityPtr(entity);
+    }
     return EntityPtr();
 }
 
@@ -246,6 +253,9 @@ void Scene::RemoveAllEntities(bool signal, AttributeChange::Type change)
     {
         LogWarning("Scene::RemoveAllEntities: entity map was not clear after removing all entities, clearing manually");
         entities_.Clear();
+        componentsByType_.Clear();
+        componentsByName_.Clear();
+        componentsByGroup_.Clear();
     }
     
     if (signal)
@@ -274,10 +284,19 @@ EntityVector Scene::EntitiesWithComponent(const String &typeName, const String &
 
 EntityVector Scene::EntitiesWithComponent(u32 typeId, const String &name) const
 {
+    const ComponentList &components = ComponentsOfType(typeId);
     EntityVector entities;
-    for(ConstIterator it = Begin(); it != End(); ++it)
-        if ((name.Empty() && it->second_->Component(typeId)) || it->second_->Component(typeId, name))
-            entities.Push(it->second_);
+    entities.Reserve(components.Size());
+    for(uint i = 0; i < components.Size(); ++i)
+    {
+        IComponent *comp = components[i];
+        Entity *entity = comp->ParentEntity();
+        if (!name.Empty() && comp->Name() != name)
+            continue;
+        // List an entity with several matching components only once, by its first matching component.
+        if ((name.Empty() ? entity->Component(typeId) : entity->Component(typeId, name)).Get() == comp)
+            entities.Push(EntityPtr(entity));
+    }
     return entities;
 }
 
@@ -287,10 +306,17 @@ EntityVector Scene::EntitiesOfGroup(const String &groupName) const
     if (groupName.Empty())
         return entities;
 
-    for (ConstIterator it = Begin(); it != End(); ++it)
-        if (it->second_->Group() == groupName)
-            entities.Push(it->second_);
-
+    NameIndex::ConstIterator it = componentsByGroup_.Find(groupName);
+    if (it == componentsByGroup_.End())
+        return entities;
+    const PODVector<Name*> &components = it->second_;
+    entities.Reserve(components.Size());
+    for(uint i = 0; i < components.Size(); ++i)
+    {
+        Entity *entity = NamedEntity(components[i]);
+        if (entity)
+            entities.Push(EntityPtr(entity));
+    }
     return entities;
 }
 
@@ -301,26 +327,127 @@ Entity::ComponentVector Scene::Components(const String &typeName, const String &
 
 Entity::ComponentVector Scene::Components(u32 typeId, const String &name) const
 {
+    const ComponentList &components = ComponentsOfType(typeId);
     Entity::ComponentVector ret;
-    if (name.Empty())
+    ret.Reserve(components.Size());
+    for(uint i = 0; i < components.Size(); ++i)
+        if (name.Empty() || components[i]->Name() == name)
+            ret.Push(ComponentPtr(components[i]));
+    return ret;
+}
+
+const Scene::ComponentList &Scene::ComponentsOfType(u32 typeId) const
+{
+    static const ComponentList empty;
+    HashMap<u32, ComponentList>::ConstIterator it = componentsByType_.Find(typeId);
+    return (it != componentsByType_.End() ? it->second_ : empty);
+}
+
+void Scene::AddToComponentIndex(IComponent *comp)
+{
+    ComponentList &components = componentsByType_[comp->TypeId()];
+    comp->sceneIndexSlot = components.Size();
+    components.Push(comp);
+    if (comp->TypeId() == Name::ComponentTypeId)
+        UpdateNameIndex(static_cast<Name*>(comp));
+}
+
+void Scene::RemoveFromComponentIndex(IComponent *comp)
+{
+    if (comp->TypeId() == Name::ComponentTypeId)
+        RemoveFromNameIndex(static_cast<Name*>(comp));
+
+    HashMap<u32, ComponentList>::Iterator it = componentsByType_.Find(comp->TypeId());
+    if (it == componentsByType_.End())
+        return;
+    ComponentList &components = it->second_;
+    const uint slot = comp->sceneIndexSlot;
+    if (slot >= components.Size() || components[slot] != comp)
     {
-        for(ConstIterator it = Begin(); it != End(); ++it)
-        {
-            Entity::ComponentVector components =  it->second_->ComponentsOfType(typeId);
-            if (!components.Empty())
-                ret.Insert(ret.End(), components.Begin(), components.End());
-        }
+        LogError("Scene::RemoveFromComponentIndex: " + comp->TypeName() + " is not in the component index of scene " + name_);
+        return;
     }
-    else
+    // Move the last component to the freed slot
+    components[slot] = components.Back();
+    components[slot]->sceneIndexSlot = slot;
+    components.Pop();
+}
+
+void Scene::Reindex(NameIndex &index, const String &oldKey, const String &newKey, Name *comp)
+{
+    if (!oldKey.Empty())
     {
-        for(ConstIterator it = Begin(); it != End(); ++it)
+        NameIndex::Iterator it = index.Find(oldKey);
+        if (it != index.End())
         {
-            ComponentPtr component = it->second_->Component(typeId, name);
-            if (component)
-                ret.Push(component);
+            // Keep the order of the rest, so that the entity that was named first is found first.
+            it->second_.Remove(comp);
+            if (it->second_.Empty())
+                index.Erase(it);
         }
     }
-    return ret;
+    if (!newKey.Empty())
+        index[newKey].Push(comp);
+}
+
+void Scene::UpdateNameIndex(Name *comp)
+{
+    const String &name = comp->name.Get();
+    if (name != comp->indexedName)
+    {
+        Reindex(componentsByName_, comp->indexedName, name, comp);
+        comp->indexedName = name;
+    }
+    const String &group = comp->group.Get();
+    if (group != comp->indexedGroup)
+    {
+        Reindex(componentsByGroup_, comp->indexedGroup, group, comp);
+        comp->indexedGroup = group;
+    }
+}
+
+void Scene::RemoveFromNameIndex(Name *comp)
+{
+    Reindex(componentsByName_, comp->indexedName, String::EMPTY, comp);
+    Reindex(componentsByGroup_, comp->indexedGroup, String::EMPTY, comp);
+    comp->indexedName.Clear();
+    comp->indexedGroup.Clear();
+}
+
+Entity *Scene::NamedEntity(Name *comp)
+{
+    Entity *entity = comp->ParentEntity();
+    return (entity && entity->Component(Name::ComponentTypeId).Get() == comp ? entity : 0);
+}
+
+void Scene::BeginAttributeChanges()
+{
+    ++attributeChangeBatchDepth_;
+}
+
+void Scene::EndAttributeChanges()
+{
+    if (attributeChangeBatchDepth_ == 0)
+    {
+        LogError("Scene::EndAttributeChanges: called without BeginAttributeChanges for scene " + name_);
+        return;
+    }
+    if (--attributeChangeBatchDepth_ > 0)
+        return;
+
+    // The handlers of the signals may change more attributes, which are then signalled right away.
+    Vector<ComponentWeakPtr> components;
+    components.Swap(collectingComponents_);
+    for(uint i = 0; i < components.Size(); ++i)
+    {
+        ComponentPtr comp = components[i].Lock();
+        if (!comp)
+            continue;
+        comp->collectedByScene = false;
+        // A component still collecting its own changes signals them at its EndAttributeChanges.
+        if (comp->changeBatchDepth == 0)
+            comp->SignalCollectedAttributeChanges();
+    }
 }
 
 void Scene::EmitComponentAdded(Entity* entity, IComponent* comp, AttributeChange::Type change)
@@ -1389,51 +1516,25 @@ bool Scene::StartAttributeInterpolation(IAttribute* attr, IAttribute* endvalue,
         return false;
     }
     
-    // End previous interpolation if existed
-    bool previous = EndAttributeInterpolation(attr);
-    
     // If previous interpolation does not exist, perform a direct snapping to the end value
     // but still start an interpolation period, so that on the next update we detect that an interpolation is going on,
     // and will interpolate normally
-    if (!previous)
+    if (!interpolator_.Contains(attr))
         attr->CopyValue(endvalue, AttributeChange::LocalOnly);
     
-    AttributeInterpolation newInterp;
-    newInterp.dest = AttributeWeakPtr(comp, attr);
-    newInterp.start = AttributeWeakPtr(comp, attr->Clone());
-    newInterp.end = AttributeWeakPtr(comp, endvalue);
-    newInterp.length = length;
-    
-    interpolations_.Push(newInterp);
+    // Replaces the previous interpolation if existed
+    interpolator_.Start(attr, endvalue, length);
     return true;
 }
 
 bool Scene::EndAttributeInterpolation(IAttribute* attr)
 {
-    for(uint i = 0; i < interpolations_.Size(); ++i)
-    {
-        AttributeInterpolation& interp = interpolations_[i];
-        if (interp.dest.Get() == attr)
-        {
-            delete interp.start.Get();
-            delete interp.end.Get();
-            interpolations_.Erase(interpolations_.Begin() + i);
-            return true;
-        }
-    }
-    return false;
+    return interpolator_.End(attr);
 }
 
 void Scene::EndAllAttributeInterpolations()
 {
-    for(uint i = 0; i < interpolations_.Size(); ++i)
-    {
-        AttributeInterpolation& interp = interpolations_[i];
-        delete interp.start.Get();
-        delete interp.end.Get();
-    }
-    
-    interpolations_.Clear();
+    interpolator_.Clear();
 }
 
 void Scene::UpdateAttributeInterpolations(float frametime)
@@ -1441,44 +1542,7 @@ void Scene::UpdateAttributeInterpolations(float frametime)
     URHO3D_PROFILE(Scene_UpdateInterpolation);
     
     interpolating_ = true;
-    
-    for(uint i = interpolations_.Size() - 1; i < interpolations_.Size(); --i)
-    {
-        AttributeInterpolation& interp = interpolations_[i];
-        bool finished = false;
-        
-        // Check that the component still exists i.e. it's safe to access the attribute
-        if (!interp.start.owner.Expired())
-        {
-            // Allow the interpolation to persist for 2x time, though we are no longer setting the value
-            // This is for the continuous/discontinuous update detection in StartAttributeInterpolation()
-            if (interp.time <= interp.length)
-            {
-                interp.time += frametime;
-                float t = interp.time / interp.length;
-                if (t > 1.0f)
-                    t = 1.0f;
-                interp.dest.Get()->Interpolate(interp.start.Get(), interp.end.Get(), t, AttributeChange::LocalOnly);
-            }
-            else
-            {
-                interp.time += frametime;
-                if (interp.time >= interp.length * 2.0f)
-                    finished = true;
-            }
-        }
-        else // Component pointer has expired, abort this interpolation
-            finished = true;
-        
-        // Remove interpolation (& delete start/endpoints) when done
-        if (finished)
-        {
-            delete interp.start.Get();
-            delete interp.end.Get();
-            interpolations_.Erase(interpolations_.Begin() + i);
-        }
-    }
-
+    interpolator_.Update(frametime);
     interpolating_ = false;
 }
 
@@ -1859,4 +1923,26 @@ uint Scene::FixPlaceableParentIds(const Vector<Entity *> &entities, const Entity
     return fixed;
 }
 
+AttributeChangeBatch::AttributeChangeBatch(Scene *scene) :
+    scene_(scene)
+{
+    if (scene)
+        scene->BeginAttributeChanges();
+}
+
+AttributeChangeBatch::AttributeChangeBatch(IComponent *component) :
+    component_(component)
+{
+    if (component)
+        component->BeginAttributeChanges();
+}
+
+AttributeChangeBatch::~AttributeChangeBatch()
+{
+    if (scene_)
+        scene_->EndAttributeChanges();
+    if (component_)
+        component_->EndAttributeChanges();
+}
+
 }
@@ -11,6 +11,7 @@
 #include "Math/float3.h"
 #include "SceneDesc.h"
 #include "Entity.h"
+#include "AttributeInterpolator.h"
 
 #include <Urho3D/Container/Vector.h>
 
@@ -18,6 +19,7 @@ namespace Tundra
 {
 
 class UserConnection;
+class Name;
 
 /// A collection of entities which form an observable world.
 /** Acts as a factory for all entities.
@@ -38,6 +40,7 @@ public:
     typedef EntityMap::ConstIterator ConstIterator; ///< const entity iterator. see begin() and end()
     typedef HashMap<entity_id_t, entity_id_t> EntityIdMap; ///< Used to map entity ID changes (oldId, newId).
     typedef HashMap<StringHash, SharedPtr<Object> > SubsystemMap; ///< Maps scene subsystems by type
+    typedef PODVector<IComponent*> ComponentList; ///< Components of one type, see ComponentsOfType.
 
     /// Returns name of the scene.
     const String &Name() const { return name_; }
@@ -106,6 +109,17 @@ public:
     /// See if scene is currently performing interpolations, to differentiate between interpolative & non-interpolative attribute changes.
     bool IsInterpolating() const { return interpolating_; }
 
+    /// Starts collecting the attribute changes of all components in the scene instead of signalling each of them. Can be nested. [noscript]
+    /** At the outermost EndAttributeChanges each changed attribute is signalled once, and IComponent::AttributesChanged
+        is called once per changed component. Use when changing several attributes at once, eg. when applying a network message.
+        Scripts use the scoped BatchAttributeChanges(function) instead.
+        @sa IComponent::BeginAttributeChanges, AttributeChangeBatch */
+    void BeginAttributeChanges();
+    /// Ends collecting the attribute changes and signals them. [noscript]
+    void EndAttributeChanges();
+    /// Returns whether the attribute changes are being collected.
+    bool IsCollectingAttributeChanges() const { return attributeChangeBatchDepth_ > 0; }
+
     /// Returns Framework
     Framework *GetFramework() const { return framework_; }
 
@@ -185,15 +199,21 @@ public:
     void EmitComponentAcked(IComponent* component, component_id_t oldId);
 
     /// Returns all components of type T (and additionally with specific name) in the scene.
+    /** @note O(number of components of type T) */
     template <typename T>
     Vector<SharedPtr<T> > Components(const String &name = "") const;
 
     /// Returns list of entities with a specific component present.
     /** @param name Name of the component, optional.
-        @note O(n) */
+        @note O(number of components of type T) */
     template <typename T>
     EntityVector EntitiesWithComponent(const String &name = "") const;
 
+    /// Calls @c func with a pointer to each component of type T in the scene, without allocating.
+    /** @c func must not add or remove components of type T. */
+    template <typename T, typename Func>
+    void ForEachComponent(Func func) const;
+
     /// @cond PRIVATE
     /// Do not directly allocate new scenes using operator new, but use the factory-based SceneAPI::CreateScene functions instead.
     /** @param name Name of the scene.
@@ -280,12 +300,12 @@ public:
     /** @note The name of the entity is stored in a Name component. If this component is not present in the entity, it has no name.
         @note Returns a shared pointer, but it is preferable to use a weak pointer, EntityWeakPtr,
               to avoid dangling references that prevent entities from being properly destroyed.
-        @note @note O(n)
+        @note O(1), the entity names are indexed.
         @sa EntityById, FindEntitiesContaining */
     EntityPtr EntityByName(const String &name) const;
 
     /// Returns whether name is unique within the scene, i.e. is only encountered once, or not at all.
-    /** @note O(n) */
+    /** @note O(1) */
     bool IsUniqueName(const String& name) const;
 
     /// Returns true if entity with the specified id exists in this scene, false otherwise
@@ -315,7 +335,7 @@ public:
     /// Returns list of entities with a specific component present.
     /** @param typeId Type ID of the component
         @param name Name of the component, optional.
-        @note O(n) */
+        @note O(number of components of the type) */
     EntityVector EntitiesWithComponent(u32 typeId, const String &name = "") const;
     /// @overload
     /** @param typeName typeName Type name of the component.
@@ -323,7 +343,8 @@ public:
     EntityVector EntitiesWithComponent(const String &typeName, const String &name = "") const;
 
     /// Returns list of entities that belong to the group 'groupName'
-    /** @param groupName The name of the group to be queried */
+    /** @param groupName The name of the group to be queried
+        @note O(matches), the entity groups are indexed. */
     EntityVector EntitiesOfGroup(const String &groupName) const;
 
     /// Returns all components of specific type (and additionally with specific name) in the scene.
@@ -335,6 +356,12 @@ public:
         @note The overload taking type ID is more efficient than this overload. */
     Entity::ComponentVector Components(const String &typeName, const String &name = "") const;
 
+    /// Returns all components of type @c typeId in the scene, in no particular order, without allocating.
+    /** The list is owned by the scene, and is modified when components of the type are added or removed.
+        Copy it, or iterate it backwards, if the iteration can add or remove components of the type.
+        @note O(1) */
+    const ComponentList &ComponentsOfType(u32 typeId) const;
+
     /// Performs a search through the entities, and returns a list of all the entities that contain @c substring in their Entity name.
     /** @param substring String to be searched.
         @param caseSensitive Case sensitivity for the string matching. */
@@ -505,6 +532,8 @@ private:
     void OnUpdated(float frameTime);
 
     friend class SceneAPI;
+    friend class Entity;
+    friend class IComponent;
 
     /// Create entity from an XML element and recurse into child entities. Called internally.
     void CreateEntityFromXml(EntityPtr parent, const Urho3D::XMLElement& ent_elem, bool useEntityIDsFromFile,
@@ -518,33 +547,66 @@ private:
     /// Create entity desc from an XML element and recurse into child entities. Called internally.
     void CreateEntityDescFromXml(SceneDesc& sceneDesc, Vector<EntityDesc>& dest, const Urho3D::XMLElement& ent_elem) const;
 
-    /// Container for an ongoing attribute interpolation
-    struct AttributeInterpolation
-    {
-        AttributeInterpolation() : time(0.0f), length(0.0f) {}
-        AttributeWeakPtr dest, start, end;
-        float time;
-        float length;
-    };
-
     /// Resolved parent Entity id that is set to Placeable::parentRef.
     /** @return Returns 0 if parent is not set or the parent ref is not a Entity id (but a entity name). */
     entity_id_t PlaceableParentId(const Entity *ent) const;
     entity_id_t PlaceableParentId(const EntityDesc &ent) const; ///< @overload
 
+    /// Adds @c comp to the per-type component index. Called by Entity when a component is added to an entity in the scene.
+    void AddToComponentIndex(IComponent *comp);
+    /// Removes @c comp from the per-type component index.
+    void RemoveFromComponentIndex(IComponent *comp);
+
+    /// Name components by name or group.
+    typedef HashMap<String, PODVector<Name*> > NameIndex;
+    /// Updates the name and group indices after the attributes of @c comp have changed. Called by IComponent.
+    void UpdateNameIndex(Name *comp);
+    /// Removes @c comp from the name and group indices.
+    void RemoveFromNameIndex(Name *comp);
+    /// Moves @c comp from the @c oldKey to the @c newKey bucket of @c index. Empty keys are not indexed.
+    static void Reindex(NameIndex &index, const String &oldKey, const String &newKey, Name *comp);
+    /// Returns the entity of @c comp if @c comp is its first Name component, ie. the one Entity::Name and Entity::Group report, otherwise null.
+    static Entity *NamedEntity(Name *comp);
+
     UniqueIdGenerator idGenerator_; ///< Entity ID generator
     EntityMap entities_; ///< All entities in the scene.
+    HashMap<u32, ComponentList> componentsByType_; ///< Components of all entities in the scene by type ID.
+    NameIndex componentsByName_; ///< Name components of the scene by entity name.
+    NameIndex componentsByGroup_; ///< Name components of the scene by entity group.
     Framework *framework_; ///< Parent framework.
     String name_; ///< Name of the scene.
     bool viewEnabled_; ///< View enabled -flag.
     bool interpolating_; ///< Currently doing interpolation-flag.
     bool authority_; ///< Authority -flag
-    Vector<AttributeInterpolation> interpolations_; ///< Running attribute interpolations.
+    uint attributeChangeBatchDepth_; ///< Nesting depth of BeginAttributeChanges.
+    Vector<ComponentWeakPtr> collectingComponents_; ///< Components with collected attribute changes to signal at EndAttributeChanges.
+    AttributeInterpolator interpolator_; ///< Running attribute interpolations.
     Vector<Pair<EntityWeakPtr, AttributeChange::Type> > entitiesCreatedThisFrame_; ///< Entities to signal for creation at frame end.
     ParentingTracker parentTracker_; ///< Tracker for client side mass Entity imports (eg. SceneDesc based).
     SubsystemMap subsystems; ///< Scene subsystems
 };
 
+/// Collects the attribute changes of a scene or a component for the lifetime of this object.
+/** @code
+    {
+        AttributeChangeBatch batch(scene);
+        placeable->transform.Set(transform, AttributeChange::Default);
+        rigidBody->mass.Set(mass, AttributeChange::Default);
+    } // Each changed attribute is signalled once here.
+    @endcode
+    @sa Scene::BeginAttributeChanges, IComponent::BeginAttributeChanges */
+class TUNDRACORE_API AttributeChangeBatch
+{
+public:
+    explicit AttributeChangeBatch(Scene *scene);
+    explicit AttributeChangeBatch(IComponent *component);
+    ~AttributeChangeBatch();
+
+private:
+    SceneWeakPtr scene_;
+    ComponentWeakPtr component_;
+};
+
 }
 
 #include "Scene.inl"
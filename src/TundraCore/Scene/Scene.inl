@@ -13,25 +13,12 @@ SharedPtr<T> Scene::Subsystem() const
 template <typename T>
 Vector<SharedPtr<T> > Scene::Components(const String &name) const
 {
+    const ComponentList &components = ComponentsOfType(T::TypeIdStatic());
     Vector<SharedPtr<T> > ret;
-    if (name.Empty())
-    {
-        for(ConstIterator it = Begin(); it != End(); ++it)
-        {
-            Vector<SharedPtr<T> > components =  it->second_->ComponentsOfType<T>();
-            if (!components.Empty())
-                ret.Insert(ret.End(), components.Begin(), components.End());
-        }
-    }
-    else
-    {
-        for(ConstIterator it = Begin(); it != End(); ++it)
-        {
-            SharedPtr<T> component = it->second_->Component<T>(name);
-            if (component)
-                ret.Push(component);
-        }
-    }
+    ret.Reserve(components.Size());
+    for(uint i = 0; i < components.Size(); ++i)
+        if (name.Empty() || components[i]->Name() == name)
+            ret.Push(SharedPtr<T>(static_cast<T*>(components[i])));
     return ret;
 }
 
@@ -41,4 +28,12 @@ EntityVector Scene::EntitiesWithComponent(const String &name) const
     return EntitiesWithComponent(T::ComponentTypeId, name);
 }
 
+template <typename T, typename Func>
+void Scene::ForEachComponent(Func func) const
+{
+    const ComponentList &components = ComponentsOfType(T::TypeIdStatic());
+    for(uint i = 0; i < components.Size(); ++i)
+        func(static_cast<T*>(components[i]));
+}
+
 }
@@ -0,0 +1,699 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "TestRunner.h"
+#include "TestBenchmark.h"
+
+#include "AssetDependencyGraph.h"
+#include "AssetDecodeQueue.h"
+#include "AssetAPI.h"
+#include "BinaryAsset.h"
+#include "LocalAssetStorage.h"
+#include "AssetCache.h"
+#include "DefaultAssetTransferPrioritizer.h"
+#include "IAssetTransfer.h"
+#include "IAssetProvider.h"
+#include "AssetTransferScheduler.h"
+#include "Scene.h"
+#include "Entity.h"
+
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+
+using namespace Tundra;
+using namespace Tundra::Test;
+
+namespace
+{
+    const uint NumMeshes = 20000;
+    const uint NumMaterials = 20000;
+    const uint NumTextures = 10000;
+    const uint NumTexturesPerMaterial = 2;
+
+    String MeshRef(uint i) { return "http://server/mesh" + String(i) + ".mesh"; }
+    String MaterialRef(uint i) { return "http://server/material" + String(i) + ".material"; }
+    String TextureRef(uint i) { return "http://server/texture" + String(i) + ".png"; }
+
+    /// Creates a mesh -> material -> texture graph of 50000 assets. Each mesh uses its own material,
+    /// and the textures are shared between the materials.
+    void CreateMeshGraph(AssetDependencyGraph &graph)
+    {
+        StringVector dependencies;
+        for (uint i = 0; i < NumMaterials; ++i)
+        {
+            dependencies.Clear();
+            for (uint j = 0; j < NumTexturesPerMaterial; ++j)
+                dependencies.Push(TextureRef((i * 7 + j * 3) % NumTextures));
+            graph.SetDependencies(MaterialRef(i), dependencies);
+        }
+        for (uint i = 0; i < NumMeshes; ++i)
+        {
+            dependencies.Clear();
+            dependencies.Push(MaterialRef(i % NumMaterials));
+            graph.SetDependencies(MeshRef(i), dependencies);
+        }
+    }
+
+    /// Decode job that fills a BinaryAsset with 16 bytes.
+    class BinaryDecodeJob : public IAssetDecodeJob
+    {
+    public:
+        BinaryDecodeJob(BinaryAsset *asset_, bool fail_) : asset(asset_), fail(fail_), committed(false) {}
+
+        bool Decode() override
+        {
+            if (fail)
+            {
+                error = "Failed on purpose";
+                return false;
+            }
+            for (uint i = 0; i < 16; ++i)
+                data.Push((u8)i);
+            return true;
+        }
+
+        bool Commit() override
+        {
+            asset->data = data;
+            committed = true;
+            return true;
+        }
+
+        BinaryAsset *asset;
+        bool fail;
+        bool committed;
+        Vector<u8> data;
+    };
+
+    AssetTransferPtr CreateTransfer(const String &ref, const String &type, uint dependencyDepth = 0)
+    {
+        AssetTransferPtr transfer(new IAssetTransfer());
+        transfer->source.ref = ref;
+        transfer->assetType = type;
+        transfer->dependencyDepth = dependencyDepth;
+        return transfer;
+    }
+
+    /// Provider for test:// refs that records the transfers it is asked to execute and never finishes them by itself.
+    class RecordingAssetProvider : public IAssetProvider
+    {
+        URHO3D_OBJECT(RecordingAssetProvider, IAssetProvider);
+
+    public:
+        explicit RecordingAssetProvider(Urho3D::Context *context) : IAssetProvider(context) {}
+
+        String Name() const override { return "Recording"; }
+        bool IsValidRef(String assetRef, String) const override { return assetRef.StartsWith("test://"); }
+        AssetTransferPtr CreateTransfer(String assetRef, String assetType) override
+        {
+            AssetTransferPtr transfer(new IAssetTransfer());
+            transfer->source.ref = assetRef;
+            transfer->assetType = assetType;
+            return transfer;
+        }
+        void ExecuteTransfer(AssetTransferPtr transfer) override { executed.Push(transfer); }
+        void DeleteAssetFromStorage(String) override {}
+        Vector<AssetStoragePtr> Storages() const override { return Vector<AssetStoragePtr>(); }
+        AssetStoragePtr StorageByName(const String &) const override { return AssetStoragePtr(); }
+        AssetStoragePtr StorageForAssetRef(const String &) const override { return AssetStoragePtr(); }
+
+        AssetTransferPtrVector executed;
+
+    private:
+        AssetStoragePtr TryCreateStorage(HashMap<String, String> &, bool) override { return AssetStoragePtr(); }
+    };
+
+    /// Updates the queue until it is empty, or gives up after a second.
+    void CompleteDecodeQueue(AssetDecodeQueue *queue)
+    {
+        for (uint i = 0; i < 1000 && queue->NumPendingJobs() > 0; ++i)
+        {
+            queue->Update();
+            if (queue->NumPendingJobs() > 0)
+                Urho3D::Time::Sleep(1);
+        }
+    }
+}
+
+TEST_F(Runner, AssetDependencyGraph)
+{
+    AssetDependencyGraph graph;
+    StringVector dependencies;
+
+    // mesh -> material -> texture1, texture2
+    dependencies.Push("local://texture1.png");
+    dependencies.Push("local://texture2.png");
+    dependencies.Push("local://Texture1.png"); // Duplicates are ignored case-insensitively
+    graph.SetDependencies("local://a.material", dependencies);
+    dependencies.Clear();
+    dependencies.Push("local://a.material");
+    graph.SetDependencies("local://a.mesh", dependencies);
+
+    ASSERT_EQ(graph.NumAssets(), 4U);
+    ASSERT_EQ(graph.NumDependencies(), 3U);
+    ASSERT_TRUE(graph.HasPendingDependencies("local://a.mesh"));
+    ASSERT_EQ(graph.NumPendingDependencies("local://a.mesh"), 3U);
+    ASSERT_EQ(graph.NumPendingDependencies("local://a.material"), 2U);
+    ASSERT_EQ(graph.Dependents("LOCAL://TEXTURE1.PNG").Size(), 1U);
+    ASSERT_EQ(graph.Dependents("local://texture1.png")[0], "local://a.material");
+
+    // Loading the dependencies completes the chain only when every link is loaded
+    graph.SetLoaded("local://texture1.png", true);
+    graph.SetLoaded("local://a.material", true);
+    ASSERT_TRUE(graph.HasPendingDependencies("local://a.mesh"));
+    ASSERT_EQ(graph.NumPendingDependencies("local://a.mesh"), 1U);
+    graph.SetLoaded("local://texture2.png", true);
+    ASSERT_FALSE(graph.HasPendingDependencies("local://a.material"));
+    ASSERT_FALSE(graph.HasPendingDependencies("local://a.mesh"));
+    ASSERT_EQ(graph.NumPendingDependencies("local://a.mesh"), 0U);
+
+    // Unloading a texture makes the whole chain pending again
+    graph.SetLoaded("local://texture2.png", false);
+    ASSERT_TRUE(graph.HasPendingDependencies("local://a.mesh"));
+    graph.SetLoaded("local://texture2.png", true);
+    ASSERT_FALSE(graph.HasPendingDependencies("local://a.mesh"));
+
+    // Replacing the dependencies updates the counters and both directions of the edges
+    dependencies.Clear();
+    dependencies.Push("local://texture1.png");
+    dependencies.Push("local://texture3.png");
+    graph.SetDependencies("local://a.material", dependencies);
+    ASSERT_EQ(graph.NumDependencies(), 3U);
+    ASSERT_TRUE(graph.Dependents("local://texture2.png").Empty());
+    ASSERT_TRUE(graph.HasPendingDependencies("local://a.mesh"));
+    graph.RemoveDependencies("local://a.material");
+    ASSERT_EQ(graph.NumDependencies(), 1U);
+    ASSERT_FALSE(graph.HasPendingDependencies("local://a.mesh"));
+    ASSERT_TRUE(graph.Dependencies("local://a.material").Empty());
+
+    // A dependency shared through two paths is counted once
+    dependencies.Clear();
+    dependencies.Push("local://b.png");
+    graph.SetDependencies("local://left.material", dependencies);
+    graph.SetDependencies("local://right.material", dependencies);
+    dependencies.Clear();
+    dependencies.Push("local://left.material");
+    dependencies.Push("local://right.material");
+    graph.SetDependencies("local://b.mesh", dependencies);
+    ASSERT_EQ(graph.NumPendingDependencies("local://b.mesh"), 3U);
+
+    // A dependency cycle does not recurse endlessly
+    dependencies.Clear();
+    dependencies.Push("local://cycle2.material");
+    graph.SetDependencies("local://cycle1.material", dependencies);
+    dependencies.Clear();
+    dependencies.Push("local://cycle1.material");
+    graph.SetDependencies("local://cycle2.material", dependencies);
+    ASSERT_TRUE(graph.HasPendingDependencies("local://cycle1.material"));
+    ASSERT_EQ(graph.NumPendingDependencies("local://cycle1.material"), 2U);
+    graph.SetLoaded("local://cycle1.material", true);
+    graph.SetLoaded("local://cycle2.material", true);
+
+    // Unknown assets have no dependencies
+    ASSERT_FALSE(graph.HasPendingDependencies("local://unknown.mesh"));
+    ASSERT_FALSE(graph.IsLoaded("local://unknown.mesh"));
+
+    graph.Clear();
+    ASSERT_EQ(graph.NumAssets(), 0U);
+    ASSERT_EQ(graph.NumDependencies(), 0U);
+}
+
+TEST_F(Runner, AssetDependencyGraphLoad)
+{
+    const uint numAssets = NumMeshes + NumMaterials + NumTextures;
+    uint numPending = 0;
+
+    Tundra::Benchmark::Iterations = 10;
+
+    // Building the graph and loading it bottom up, which checks the pending dependencies of every dependent on every load.
+    BENCHMARK(String(numAssets) + " assets", 30)
+    {
+        AssetDependencyGraph graph;
+        CreateMeshGraph(graph);
+        for (uint i = 0; i < NumTextures; ++i)
+            graph.SetLoaded(TextureRef(i), true);
+        for (uint i = 0; i < NumMaterials; ++i)
+            graph.SetLoaded(MaterialRef(i), true);
+
+        numPending = 0;
+        for (uint i = 0; i < NumMeshes; ++i)
+        {
+            graph.SetLoaded(MeshRef(i), true);
+            if (graph.HasPendingDependencies(MeshRef(i)))
+                ++numPending;
+        }
+
+        BENCHMARK_STEP_END;
+
+        ASSERT_EQ(graph.NumAssets(), numAssets);
+    }
+    BENCHMARK_END;
+
+    ASSERT_EQ(numPending, 0U);
+}
+
+TEST_F(Runner, AssetDependencyGraphReload)
+{
+    AssetDependencyGraph graph;
+    CreateMeshGraph(graph);
+    for (uint i = 0; i < NumTextures; ++i)
+        graph.SetLoaded(TextureRef(i), true);
+    for (uint i = 0; i < NumMaterials; ++i)
+        graph.SetLoaded(MaterialRef(i), true);
+
+    uint numDependents = 0;
+
+    Tundra::Benchmark::Iterations = 1000;
+
+    // Reloading a texture makes its materials and their meshes pending and complete again.
+    BENCHMARK("Reload texture", 30)
+    {
+        const String texture = TextureRef(42);
+        graph.SetLoaded(texture, false);
+        numDependents = graph.Dependents(texture).Size();
+        graph.SetLoaded(texture, true);
+
+        BENCHMARK_STEP_END;
+    }
+    BENCHMARK_END;
+
+    ASSERT_TRUE(numDependents > 0);
+    ASSERT_FALSE(graph.HasPendingDependencies(MeshRef(0)));
+}
+
+TEST_F(Runner, AssetDecodeQueue)
+{
+    AssetAPI *assetAPI = framework->Asset();
+    AssetDecodeQueue *queue = assetAPI->DecodeQueue();
+    ASSERT_TRUE(queue != nullptr);
+
+    BinaryAsset *asset = dynamic_cast<BinaryAsset*>(assetAPI->CreateNewAsset("Binary", "local://decoded.bin").Get());
+    BinaryAsset *cancelledAsset = dynamic_cast<BinaryAsset*>(assetAPI->CreateNewAsset("Binary", "local://cancelled.bin").Get());
+    BinaryAsset *failedAsset = dynamic_cast<BinaryAsset*>(assetAPI->CreateNewAsset("Binary", "local://failed.bin").Get());
+    ASSERT_TRUE(asset && cancelledAsset && failedAsset);
+
+    // The result is committed to the asset in Update
+    SharedPtr<BinaryDecodeJob> job(new BinaryDecodeJob(asset, false));
+    queue->Queue(asset, AssetDecodeJobPtr(job.Get()));
+    ASSERT_EQ(queue->NumPendingJobs(), 1U);
+    ASSERT_FALSE(asset->IsLoaded());
+    CompleteDecodeQueue(queue);
+    ASSERT_TRUE(job->committed);
+    ASSERT_TRUE(asset->IsLoaded());
+    ASSERT_EQ(asset->data.Size(), 16U);
+
+    // A cancelled job, or a job replaced by a newer one, is not committed
+    SharedPtr<BinaryDecodeJob> cancelled(new BinaryDecodeJob(cancelledAsset, false));
+    SharedPtr<BinaryDecodeJob> replaced(new BinaryDecodeJob(asset, false));
+    SharedPtr<BinaryDecodeJob> replacing(new BinaryDecodeJob(asset, false));
+    queue->Queue(cancelledAsset, AssetDecodeJobPtr(cancelled.Get()));
+    queue->Queue(asset, AssetDecodeJobPtr(replaced.Get()));
+    queue->Queue(asset, AssetDecodeJobPtr(replacing.Get()));
+    queue->Cancel(cancelledAsset);
+    CompleteDecodeQueue(queue);
+    ASSERT_FALSE(cancelled->committed);
+    ASSERT_FALSE(cancelledAsset->IsLoaded());
+    ASSERT_FALSE(replaced->committed);
+    ASSERT_TRUE(replacing->committed);
+
+    // A failed decode is not committed
+    SharedPtr<BinaryDecodeJob> failed(new BinaryDecodeJob(failedAsset, true));
+    queue->Queue(failedAsset, AssetDecodeJobPtr(failed.Get()));
+    CompleteDecodeQueue(queue);
+    ASSERT_FALSE(failed->committed);
+    ASSERT_FALSE(failedAsset->IsLoaded());
+    ASSERT_EQ(queue->NumPendingJobs(), 0U);
+}
+
+TEST_F(Runner, AssetTransferPrioritizer)
+{
+    DefaultAssetTransferPrioritizer prioritizer;
+    AssetTransferPtrVector transfers;
+    transfers.Push(CreateTransfer("local://a.png", "Texture"));
+    transfers.Push(CreateTransfer("local://b.material", "OgreMaterial"));
+    transfers.Push(CreateTransfer("local://c.mesh", "OgreMesh"));
+    transfers.Push(CreateTransfer("local://d.png", "Texture", 1));
+    transfers.Push(CreateTransfer("local://e.mesh", "OgreMesh"));
+    transfers.Push(CreateTransfer("local://f.png", "Texture"));
+
+    // Meshes, materials and the rest, the dependencies after the directly requested assets of the same type.
+    // Transfers of equal priority keep their order.
+    AssetTransferPtrVector sorted = prioritizer.Prioritize(transfers);
+    ASSERT_EQ(sorted.Size(), transfers.Size());
+    ASSERT_EQ(sorted[0]->source.ref, "local://c.mesh");
+    ASSERT_EQ(sorted[1]->source.ref, "local://e.mesh");
+    ASSERT_EQ(sorted[2]->source.ref, "local://b.material");
+    ASSERT_EQ(sorted[3]->source.ref, "local://a.png");
+    ASSERT_EQ(sorted[4]->source.ref, "local://f.png");
+    ASSERT_EQ(sorted[5]->source.ref, "local://d.png");
+
+    // A dependency is one level deeper than its parent, unless it was also requested directly.
+    AssetTransferPtr material = CreateTransfer("local://g.material", "OgreMaterial", 1);
+    AssetTransferPtr texture = CreateTransfer("local://g.png", "Texture");
+    texture->InheritReferrers(*material);
+    ASSERT_EQ(texture->dependencyDepth, 2U);
+    AssetTransferPtr direct = CreateTransfer("local://h.png", "Texture");
+    EntityPtr entity = scene->CreateLocalEntity();
+    direct->AddReferringEntity(entity.Get());
+    direct->AddReferringEntity(entity.Get());
+    direct->InheritReferrers(*material);
+    ASSERT_EQ(direct->dependencyDepth, 0U);
+    ASSERT_EQ(direct->referringEntities.Size(), 1U);
+}
+
+TEST_F(Runner, AssetTransferPrioritizerBenchmark)
+{
+    AssetTransferPtrVector transfers;
+    for (uint i = 0; i < 10000; ++i)
+    {
+        if (i % 3 == 0)
+            transfers.Push(CreateTransfer(MeshRef(i), "OgreMesh"));
+        else if (i % 3 == 1)
+            transfers.Push(CreateTransfer(MaterialRef(i), "OgreMaterial", 1));
+        else
+            transfers.Push(CreateTransfer(TextureRef(i), "Texture", 2));
+    }
+
+    DefaultAssetTransferPrioritizer prioritizer;
+    AssetTransferPtrVector sorted;
+
+    Tundra::Benchmark::Iterations = 100;
+
+    // Re-prioritizing every pending transfer, as AssetAPI does every frame.
+    BENCHMARK("10000 transfers", 30)
+    {
+        sorted = prioritizer.Prioritize(transfers);
+
+        BENCHMARK_STEP_END;
+    }
+    BENCHMARK_END;
+
+    ASSERT_EQ(sorted.Size(), transfers.Size());
+    ASSERT_EQ(sorted[0]->assetType, "OgreMesh");
+    ASSERT_EQ(sorted.Back()->assetType, "Texture");
+}
+
+TEST_F(Runner, AssetTransferScheduler)
+{
+    AssetAPI *assetAPI = framework->Asset();
+    SharedPtr<RecordingAssetProvider> provider(new RecordingAssetProvider(framework->GetContext()));
+    assetAPI->RegisterAssetProvider(AssetProviderPtr(provider.Get()));
+    AssetTransferScheduler *scheduler = assetAPI->TransferScheduler();
+    ASSERT_TRUE(scheduler != nullptr);
+    scheduler->SetMaxInFlight(2);
+    scheduler->SetMaxInFlightPerProvider(0);
+
+    // Three transfers from one host and one from another
+    for (uint i = 0; i < 3; ++i)
+        ASSERT_TRUE(assetAPI->RequestAsset("test://a/" + String(i) + ".bin", "Binary").Get() != nullptr);
+    ASSERT_TRUE(assetAPI->RequestAsset("test://b/0.bin", "Binary").Get() != nullptr);
+    ASSERT_TRUE(provider->executed.Empty());
+    ASSERT_EQ(scheduler->NumQueued(), 4U);
+
+    // The hosts take turns within the global limit
+    assetAPI->Update(0.f);
+    ASSERT_EQ(provider->executed.Size(), 2U);
+    ASSERT_EQ(provider->executed[0]->source.ref, "test://a/0.bin");
+    ASSERT_EQ(provider->executed[1]->source.ref, "test://b/0.bin");
+    ASSERT_EQ(scheduler->NumInFlight(), 2U);
+    ASSERT_EQ(scheduler->Stats().Find("Recording")->second_.queued, 2U);
+
+    // Finishing a transfer frees its slot
+    assetAPI->AssetTransferFailed(provider->executed[0].Get(), "Failed on purpose");
+    ASSERT_EQ(scheduler->NumInFlight(), 1U);
+    assetAPI->Update(0.f);
+    ASSERT_EQ(provider->executed.Size(), 3U);
+    ASSERT_EQ(provider->executed[2]->source.ref, "test://a/1.bin");
+    ASSERT_EQ(scheduler->Stats().Find("Recording")->second_.failed, 1U);
+
+    // The provider limit applies on top of the global limit
+    scheduler->SetMaxInFlight(0);
+    scheduler->SetProviderMaxInFlight("Recording", 2);
+    assetAPI->Update(0.f);
+    ASSERT_EQ(provider->executed.Size(), 3U);
+    scheduler->SetProviderMaxInFlight("Recording", 3);
+    assetAPI->Update(0.f);
+    ASSERT_EQ(provider->executed.Size(), 4U);
+    ASSERT_EQ(scheduler->NumQueued(), 0U);
+
+    // Forgetting an asset while the limit is full of transfers frees the slot of its transfer
+    scheduler->SetProviderMaxInFlight("Recording", 0);
+    scheduler->SetMaxInFlight(4);
+    ASSERT_TRUE(assetAPI->CreateNewAsset("Binary", "test://c/0.bin").Get() != nullptr);
+    ASSERT_TRUE(assetAPI->RequestAsset("test://c/0.bin", "Binary", true).Get() != nullptr);
+    ASSERT_TRUE(assetAPI->RequestAsset("test://c/1.bin", "Binary").Get() != nullptr);
+    assetAPI->Update(0.f);
+    ASSERT_EQ(provider->executed.Size(), 5U);
+    ASSERT_EQ(scheduler->NumInFlight(), 4U);
+    ASSERT_TRUE(assetAPI->ForgetAsset("test://c/0.bin", false));
+    ASSERT_EQ(scheduler->NumInFlight(), 3U);
+    assetAPI->Update(0.f);
+    ASSERT_EQ(provider->executed.Size(), 6U);
+    ASSERT_EQ(provider->executed[5]->source.ref, "test://c/1.bin");
+
+    assetAPI->ForgetAllAssets();
+    ASSERT_EQ(scheduler->NumInFlight(), 0U);
+}
+
+TEST_F(Runner, LocalAssetStorageIndex)
+{
+    Urho3D::FileSystem *fileSystem = framework->GetSubsystem<Urho3D::FileSystem>();
+    const String directory = fileSystem->GetProgramDir() + "TundraTestLocalAssetStorage/";
+    ASSERT_TRUE(fileSystem->CreateDir(directory + "sub/"));
+    Urho3D::File(framework->GetContext(), directory + "root.txt", Urho3D::FILE_WRITE).WriteString("root");
+    Urho3D::File(framework->GetContext(), directory + "sub/nested.txt", Urho3D::FILE_WRITE).WriteString("nested");
+
+    String rootPath, nestedPath, nonRecursivePath, missingPath, indexPath, latePath;
+    bool savedIndex = false;
+    {
+        SharedPtr<LocalAssetStorage> storage(new LocalAssetStorage(framework->GetContext(), true, false, false));
+        storage->directory = directory;
+        storage->persistentIndex = true;
+        rootPath = storage->GetFullPathForAsset("root.txt", false);
+        nestedPath = storage->GetFullPathForAsset("NESTED.TXT", true);
+        nonRecursivePath = storage->GetFullPathForAsset("nested.txt", false);
+        missingPath = storage->GetFullPathForAsset("missing.txt", true);
+        savedIndex = fileSystem->FileExists(storage->IndexFilename());
+        indexPath = storage->GetFullPathForAsset(".tundraindex", true);
+
+        // A file written after the walk is found without waiting for a change notification
+        Urho3D::File(framework->GetContext(), directory + "late.txt", Urho3D::FILE_WRITE).WriteString("late");
+        latePath = storage->GetFullPathForAsset("late.txt", true);
+    }
+
+    // A second storage for the same directory walks the directory, as it was modified after the index was saved,
+    // and finds the same files.
+    String reloadedNestedPath;
+    {
+        SharedPtr<LocalAssetStorage> storage(new LocalAssetStorage(framework->GetContext(), true, false, false));
+        storage->directory = directory;
+        storage->persistentIndex = true;
+        reloadedNestedPath = storage->GetFullPathForAsset("nested.txt", true);
+    }
+
+    // Cleanup files before any asserts can exit prematurely
+    fileSystem->Delete(directory + ".tundraindex");
+    fileSystem->Delete(directory + "late.txt");
+    fileSystem->Delete(directory + "sub/nested.txt");
+    fileSystem->Delete(directory + "root.txt");
+
+    ASSERT_EQ(rootPath, directory);
+    ASSERT_EQ(nestedPath, directory + "sub/");
+    ASSERT_TRUE(nonRecursivePath.Empty());
+    ASSERT_TRUE(missingPath.Empty());
+    ASSERT_TRUE(savedIndex);
+    ASSERT_TRUE(indexPath.Empty());
+    ASSERT_EQ(latePath, directory);
+    ASSERT_EQ(reloadedNestedPath, directory + "sub/");
+}
+
+TEST_F(Runner, LocalAssetStorageIndexReload)
+{
+    Urho3D::FileSystem *fileSystem = framework->GetSubsystem<Urho3D::FileSystem>();
+    const String directory = fileSystem->GetProgramDir() + "TundraTestLocalAssetStorageReload/";
+    ASSERT_TRUE(fileSystem->CreateDir(directory + "sub/"));
+    Urho3D::File(framework->GetContext(), directory + "root.txt", Urho3D::FILE_WRITE).WriteString("root");
+    Urho3D::File(framework->GetContext(), directory + "sub/nested.txt", Urho3D::FILE_WRITE).WriteString("nested");
+
+    bool walked = false, savedIndex = false;
+    {
+        SharedPtr<LocalAssetStorage> storage(new LocalAssetStorage(framework->GetContext(), true, false, false));
+        storage->directory = directory;
+        storage->persistentIndex = true;
+        storage->GetFullPathForAsset("nested.txt", true);
+        walked = !storage->LoadedFromIndex();
+        savedIndex = fileSystem->FileExists(storage->IndexFilename());
+    }
+
+    // The unmodified storage is not walked again, even though it was modified during the same second as the walk
+    bool reloaded = false;
+    String reloadedRootPath, reloadedNestedPath;
+    {
+        SharedPtr<LocalAssetStorage> storage(new LocalAssetStorage(framework->GetContext(), true, false, false));
+        storage->directory = directory;
+        storage->persistentIndex = true;
+        reloadedNestedPath = storage->GetFullPathForAsset("nested.txt", true);
+        reloadedRootPath = storage->GetFullPathForAsset("root.txt", false);
+        reloaded = storage->LoadedFromIndex();
+    }
+
+    // A file added after the index was saved means the storage is walked again
+    Urho3D::File(framework->GetContext(), directory + "added.txt", Urho3D::FILE_WRITE).WriteString("added");
+    bool reloadedAfterAdd = true;
+    String addedPath;
+    {
+        SharedPtr<LocalAssetStorage> storage(new LocalAssetStorage(framework->GetContext(), true, false, false));
+        storage->directory = directory;
+        storage->persistentIndex = true;
+        addedPath = storage->GetFullPathForAsset("added.txt", true);
+        reloadedAfterAdd = storage->LoadedFromIndex();
+    }
+
+    // Cleanup files before any asserts can exit prematurely
+    fileSystem->Delete(directory + ".tundraindex");
+    fileSystem->Delete(directory + "added.txt");
+    fileSystem->Delete(directory + "sub/nested.txt");
+    fileSystem->Delete(directory + "root.txt");
+
+    ASSERT_TRUE(walked);
+    ASSERT_TRUE(savedIndex);
+    ASSERT_TRUE(reloaded);
+    ASSERT_EQ(reloadedRootPath, directory);
+    ASSERT_EQ(reloadedNestedPath, directory + "sub/");
+    ASSERT_FALSE(reloadedAfterAdd);
+    ASSERT_EQ(addedPath, directory);
+}
+
+TEST_F(Runner, AssetCacheLimits)
+{
+    const String directory = framework->GetSubsystem<Urho3D::FileSystem>()->GetProgramDir() + "TundraTestAssetCache/";
+    u8 data[1000];
+    for (uint i = 0; i < 1000; ++i)
+        data[i] = (u8)i;
+
+    String pathA, pathB, pathC, foundA, foundB, reloadedC;
+    u64 sharedSize = 0, evictedSize = 0;
+    {
+        SharedPtr<AssetCache> cache(new AssetCache(framework->Asset(), directory));
+        cache->ClearAssetCache();
+
+        // Identical data under two refs is stored once
+        pathA = cache->StoreAsset(data, 1000, "http://server/a.bin");
+        pathB = cache->StoreAsset(data, 1000, "http://mirror/a.bin");
+        sharedSize = cache->Size();
+
+        // Exceeding the maximum size deletes the least recently used refs. The shared data is freed with the last ref to it.
+        cache->SetMaxSize(1500);
+        data[0] = 255;
+        pathC = cache->StoreAsset(data, 1000, "http://server/c.bin");
+        evictedSize = cache->Size();
+        foundA = cache->FindInCache("http://server/a.bin");
+        foundB = cache->FindInCache("http://mirror/a.bin");
+    }
+    // The index is saved and read back
+    {
+        SharedPtr<AssetCache> cache(new AssetCache(framework->Asset(), directory));
+        reloadedC = cache->FindInCache("http://server/c.bin");
+        cache->ClearAssetCache();
+    }
+
+    ASSERT_FALSE(pathA.Empty());
+    ASSERT_EQ(pathA, pathB);
+    ASSERT_EQ(sharedSize, 1000U);
+    ASSERT_NE(pathA, pathC);
+    ASSERT_EQ(evictedSize, 1000U);
+    ASSERT_TRUE(foundA.Empty());
+    ASSERT_TRUE(foundB.Empty());
+    ASSERT_EQ(reloadedC, pathC);
+}
+
+TEST_F(Runner, AssetCacheRecovery)
+{
+    Urho3D::FileSystem *fileSystem = framework->GetSubsystem<Urho3D::FileSystem>();
+    const String directory = fileSystem->GetProgramDir() + "TundraTestAssetCacheRecovery/";
+    u8 data[1000];
+    for (uint i = 0; i < 1000; ++i)
+        data[i] = (u8)i;
+
+    String path, journaledPath, rebuiltPath, storedAgainPath;
+    unsigned modifiedA = 0, modifiedB = 0;
+    u64 rebuiltSize = 0;
+    {
+        SharedPtr<AssetCache> cache(new AssetCache(framework->Asset(), directory));
+        cache->ClearAssetCache();
+        path = cache->StoreAsset(data, 1000, "http://server/a.bin");
+        cache->StoreAsset(data, 1000, "http://mirror/a.bin");
+
+        // Refs sharing the data keep their own modification times
+        cache->SetLastModified("http://server/a.bin", 1000);
+        cache->SetLastModified("http://mirror/a.bin", 2000);
+
+        // The index is not saved before exit, so a cache opened meanwhile sees the state of a crashed one through the journal
+        SharedPtr<AssetCache> crashed(new AssetCache(framework->Asset(), directory));
+        journaledPath = crashed->FindInCache("http://server/a.bin");
+        modifiedA = crashed->LastModified("http://server/a.bin");
+        modifiedB = crashed->LastModified("http://mirror/a.bin");
+    }
+    // Without an index the stored data is kept, and storing it again reuses it
+    fileSystem->Delete(directory + ".cacheindex");
+    {
+        SharedPtr<AssetCache> cache(new AssetCache(framework->Asset(), directory));
+        rebuiltSize = cache->Size();
+        rebuiltPath = cache->FindInCache("http://server/a.bin");
+        storedAgainPath = cache->StoreAsset(data, 1000, "http://server/a.bin");
+        cache->ClearAssetCache();
+    }
+
+    ASSERT_FALSE(path.Empty());
+    ASSERT_EQ(journaledPath, path);
+    ASSERT_EQ(modifiedA, 1000U);
+    ASSERT_EQ(modifiedB, 2000U);
+    ASSERT_EQ(rebuiltSize, 1000U);
+    ASSERT_TRUE(rebuiltPath.Empty());
+    ASSERT_EQ(storedAgainPath, path);
+}
+
+TEST_F(Runner, AssetCacheStoreFile)
+{
+    Urho3D::FileSystem *fileSystem = framework->GetSubsystem<Urho3D::FileSystem>();
+    const String directory = fileSystem->GetProgramDir() + "TundraTestAssetCacheStoreFile/";
+    u8 data[1000];
+    for (uint i = 0; i < 1000; ++i)
+        data[i] = (u8)i;
+
+    String movedPath, sharedPath, reloadedETag, replacedETag;
+    bool movedFileExists = true, sharedFileExists = true;
+    {
+        SharedPtr<AssetCache> cache(new AssetCache(framework->Asset(), directory));
+        cache->ClearAssetCache();
+
+        // A file written elsewhere is moved to the cache, or deleted if the data is there already
+        const String download = directory + "download.part";
+        SaveAssetFromMemoryToFile(data, 1000, download);
+        movedPath = cache->StoreFile(download, AssetCache::ContentHash(data, 1000), 1000, "http://server/a.bin");
+        movedFileExists = fileSystem->FileExists(download);
+        SaveAssetFromMemoryToFile(data, 1000, download);
+        sharedPath = cache->StoreFile(download, AssetCache::ContentHash(data, 1000), 1000, "http://mirror/a.bin");
+        sharedFileExists = fileSystem->FileExists(download);
+
+        cache->SetETag("http://server/a.bin", "\"a\"");
+    }
+    {
+        // The entity tag is kept in the index, and cleared when the data is replaced
+        SharedPtr<AssetCache> cache(new AssetCache(framework->Asset(), directory));
+        reloadedETag = cache->ETag("http://server/a.bin");
+        data[0] = 255;
+        cache->StoreAsset(data, 1000, "http://server/a.bin");
+        replacedETag = cache->ETag("http://server/a.bin");
+        cache->ClearAssetCache();
+    }
+
+    ASSERT_FALSE(movedPath.Empty());
+    ASSERT_FALSE(movedFileExists);
+    ASSERT_EQ(sharedPath, movedPath);
+    ASSERT_FALSE(sharedFileExists);
+    ASSERT_EQ(reloadedETag, "\"a\"");
+    ASSERT_TRUE(replacedETag.Empty());
+}
+
+TUNDRA_TEST_MAIN();
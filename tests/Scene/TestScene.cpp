@@ -5,6 +5,11 @@
 
 #include "Scene.h"
 #include "Entity.h"
+#include "Name.h"
+#include "DynamicComponent.h"
+#include "ComponentPool.h"
+#include "AttributeMetadata.h"
+#include "Math/Transform.h"
 #include "LoggingFunctions.h"
 
 #include <Urho3D/IO/FileSystem.h>
@@ -14,6 +19,51 @@
 using namespace Tundra;
 using namespace Tundra::Test;
 
+namespace Tundra
+{
+    /// Component type allocated from a pool, not registered to SceneAPI.
+    class PooledTestComponent : public IComponent
+    {
+        COMPONENT_NAME(PooledTestComponent, 100000)
+        COMPONENT_POOL_ALLOCATED(PooledTestComponent)
+
+    public:
+        PooledTestComponent(Urho3D::Context* context, Scene* scene) :
+            IComponent(context, scene),
+            INIT_ATTRIBUTE_VALUE(value, "Value", 0.f)
+        {}
+
+        Attribute<float> value;
+    };
+}
+
+/// Counts the attribute change signals of a scene.
+struct AttributeChangeCounter
+{
+    AttributeChangeCounter() : numChanges(0), numReplicated(0), lastChange(AttributeChange::Default) {}
+
+    void OnAttributeChanged(IComponent* /*comp*/, IAttribute* /*attribute*/, AttributeChange::Type change)
+    {
+        ++numChanges;
+        if (change == AttributeChange::Replicate)
+            ++numReplicated;
+        lastChange = change;
+    }
+
+    uint numChanges;
+    uint numReplicated;
+    AttributeChange::Type lastChange;
+};
+
+/// Returns a detached copy of @c attr holding @c value, for an interpolation end value.
+template <typename T>
+IAttribute *EndValue(Attribute<T> *attr, const T &value)
+{
+    Attribute<T> *end = static_cast<Attribute<T>*>(attr->Clone());
+    end->Set(value, AttributeChange::Disconnected);
+    return end;
+}
+
 TEST_F(Runner, CreateEntity)
 {
     foreach_std(bool replicated, TrueAndFalse)
@@ -194,6 +244,382 @@ TEST_F(Runner, CreateComponentsParented)
     }
 }
 
+TEST_F(Runner, ComponentIndex)
+{
+    scene->RemoveAllEntities();
+
+    // Every other entity has a Name, one entity has two DynamicComponents
+    Vector<EntityPtr> ents;
+    for (uint i = 0; i < 100; ++i)
+    {
+        EntityPtr ent = scene->CreateEntity();
+        if (i % 2 == 0)
+            ent->CreateComponent<Name>("", (i % 4 == 0 ? AttributeChange::Default : AttributeChange::Disconnected));
+        ents.Push(ent);
+    }
+    ents[1]->CreateComponent<DynamicComponent>("A");
+    ents[1]->CreateComponent<DynamicComponent>("B");
+
+    ASSERT_EQ(scene->ComponentsOfType(Name::ComponentTypeId).Size(), 50U);
+    ASSERT_EQ(scene->EntitiesWithComponent<Name>().Size(), 50U);
+    ASSERT_EQ(scene->Components<Name>().Size(), 50U);
+    ASSERT_EQ(scene->EntitiesWithComponent<DynamicComponent>().Size(), 1U);
+    ASSERT_EQ(scene->Components<DynamicComponent>().Size(), 2U);
+    ASSERT_EQ(scene->Components<DynamicComponent>("B").Size(), 1U);
+    ASSERT_EQ(scene->EntitiesWithComponent<DynamicComponent>("B").Size(), 1U);
+    ASSERT_EQ(scene->Components(DynamicComponent::ComponentTypeId, "C").Size(), 0U);
+
+    // Removing components and entities keeps the index current
+    ents[0]->RemoveComponent(ents[0]->Component<Name>());
+    scene->RemoveEntity(ents[2]->Id());
+    scene->RemoveEntity(ents[3]->Id());
+    ents[1]->RemoveComponent(ents[1]->Component<DynamicComponent>("A"));
+    ASSERT_EQ(scene->ComponentsOfType(Name::ComponentTypeId).Size(), 48U);
+    ASSERT_EQ(scene->EntitiesWithComponent<DynamicComponent>().Size(), 1U);
+    ASSERT_EQ(scene->Components<DynamicComponent>("A").Size(), 0U);
+
+    uint numVisited = 0;
+    scene->ForEachComponent<Name>([&numVisited](Name *name)
+    {
+        if (name->ParentEntity())
+            ++numVisited;
+    });
+    ASSERT_EQ(numVisited, 48U);
+
+    scene->RemoveAllEntities();
+    ASSERT_TRUE(scene->ComponentsOfType(Name::ComponentTypeId).Empty());
+    ASSERT_TRUE(scene->ComponentsOfType(DynamicComponent::ComponentTypeId).Empty());
+}
+
+TEST_F(Runner, ComponentIndexQuery)
+{
+    scene->RemoveAllEntities();
+
+    // 100k entities of which 100 have the queried component
+    const uint numEntities = 100000;
+    for (uint i = 0; i < numEntities; ++i)
+    {
+        EntityPtr ent = scene->CreateLocalEntity();
+        if (i % 1000 == 0)
+            ent->CreateComponent<DynamicComponent>();
+    }
+
+    uint numFound = 0;
+
+    Tundra::Benchmark::Iterations = 10000;
+
+    BENCHMARK("EntitiesWithComponent", 25)
+    {
+        numFound = scene->EntitiesWithComponent<DynamicComponent>().Size();
+
+        BENCHMARK_STEP_END;
+    }
+    BENCHMARK_END;
+
+    ASSERT_EQ(numFound, numEntities / 1000);
+
+    scene->RemoveAllEntities();
+}
+
+TEST_F(Runner, EntityNameIndex)
+{
+    scene->RemoveAllEntities();
+
+    EntityPtr first = scene->CreateEntity();
+    first->SetName("First");
+    first->SetGroup("Group");
+    EntityPtr second = scene->CreateEntity();
+    second->SetName("Second");
+    second->SetGroup("Group");
+    EntityPtr unnamed = scene->CreateEntity();
+
+    ASSERT_TRUE(scene->EntityByName("First") == first);
+    ASSERT_TRUE(scene->EntityByName("Second") == second);
+    ASSERT_TRUE(scene->EntityByName("") == nullptr);
+    ASSERT_FALSE(scene->IsUniqueName("First"));
+    ASSERT_TRUE(scene->IsUniqueName("Third"));
+    ASSERT_EQ(scene->EntitiesOfGroup("Group").Size(), 2U);
+
+    // Renames, also disconnected ones, are indexed
+    first->Component<Name>()->name.Set("Renamed", AttributeChange::Disconnected);
+    second->Component<Name>()->group.Set("Other", AttributeChange::Default);
+    ASSERT_TRUE(scene->EntityByName("First") == nullptr);
+    ASSERT_TRUE(scene->EntityByName("Renamed") == first);
+    ASSERT_EQ(scene->EntitiesOfGroup("Group").Size(), 1U);
+    ASSERT_TRUE(scene->EntitiesOfGroup("Other")[0] == second);
+
+    // Duplicate names resolve to one of the entities until they are removed
+    unnamed->SetName("Renamed");
+    ASSERT_TRUE(scene->EntityByName("Renamed") == first);
+    scene->RemoveEntity(first->Id());
+    ASSERT_TRUE(scene->EntityByName("Renamed") == unnamed);
+    unnamed->RemoveComponent(unnamed->Component<Name>());
+    ASSERT_TRUE(scene->EntityByName("Renamed") == nullptr);
+
+    // Only the first Name component of an entity names it
+    second->CreateComponent<Name>("Extra")->name.Set("Extra");
+    ASSERT_TRUE(scene->EntityByName("Extra") == nullptr);
+    ASSERT_TRUE(scene->EntityByName("Second") == second);
+
+    scene->RemoveAllEntities();
+    ASSERT_TRUE(scene->EntityByName("Second") == nullptr);
+    ASSERT_TRUE(scene->EntitiesOfGroup("Other").Empty());
+}
+
+TEST_F(Runner, EntityNameIndexImport)
+{
+    scene->RemoveAllEntities();
+
+    // Import 100k named entities and resolve each of them by name, as the name parented placeables do
+    const uint numEntities = 100000;
+    StringVector names;
+    names.Reserve(numEntities);
+    for (uint i = 0; i < numEntities; ++i)
+    {
+        names.Push("Entity_" + String(i));
+        EntityPtr ent = scene->CreateEntity();
+        ent->SetName(names.Back());
+        ent->SetGroup("Group_" + String(i % 100));
+    }
+    const String xml = scene->SerializeToXmlString(false, false);
+    scene->RemoveAllEntities();
+
+    uint numResolved = 0;
+
+    Tundra::Benchmark::Iterations = 1;
+
+    BENCHMARK("Import and resolve 100k names", 35)
+    {
+        Vector<Entity*> ents = scene->CreateContentFromXml(xml, true, AttributeChange::Disconnected);
+        numResolved = 0;
+        for (uint i = 0; i < names.Size(); ++i)
+            if (scene->EntityByName(names[i]))
+                ++numResolved;
+
+        BENCHMARK_STEP_END;
+    }
+    BENCHMARK_END;
+
+    ASSERT_EQ(numResolved, numEntities);
+    ASSERT_EQ(scene->EntitiesOfGroup("Group_0").Size(), numEntities / 100);
+
+    Tundra::Benchmark::Iterations = 10000;
+    uint index = 0;
+    EntityPtr found;
+
+    BENCHMARK("EntityByName", 35)
+    {
+        found = scene->EntityByName(names[index]);
+        index = (index + 7919) % numEntities;
+
+        BENCHMARK_STEP_END;
+    }
+    BENCHMARK_END;
+
+    ASSERT_TRUE(found != nullptr);
+
+    scene->RemoveAllEntities();
+}
+
+TEST_F(Runner, ComponentPool)
+{
+    // Consecutive allocations are consecutive in memory and freed slots are reused
+    {
+        Tundra::ComponentPool pool(40, 4);
+        ASSERT_EQ(pool.ObjectSize(), 48U);
+        PODVector<void*> ptrs;
+        for (uint i = 0; i < 6; ++i)
+            ptrs.Push(pool.Allocate());
+        ASSERT_EQ(pool.NumBlocks(), 2U);
+        ASSERT_EQ(pool.NumAllocated(), 6U);
+        ASSERT_EQ(pool.Capacity(), 8U);
+        for (uint i = 1; i < 4; ++i)
+            ASSERT_EQ((u8*)ptrs[i] - (u8*)ptrs[i-1], 48);
+        ASSERT_TRUE(pool.Contains(ptrs[5]));
+        ASSERT_FALSE(pool.Contains((u8*)ptrs[0] + 1));
+
+        pool.Free(ptrs[2]);
+        ASSERT_EQ(pool.Allocate(), ptrs[2]);
+        for (uint i = 0; i < ptrs.Size(); ++i)
+            pool.Free(ptrs[i]);
+        ASSERT_EQ(pool.NumAllocated(), 0U);
+    }
+
+    // Pooled components are owned by ComponentPtr as usual
+    scene->RemoveAllEntities();
+    Tundra::ComponentPool &pool = PooledTestComponent::Pool();
+    const uint numAllocated = pool.NumAllocated();
+    Vector<ComponentWeakPtr> weakComponents;
+    for (uint i = 0; i < 100; ++i)
+    {
+        EntityPtr ent = scene->CreateEntity();
+        SharedPtr<PooledTestComponent> comp(new PooledTestComponent(framework->GetContext(), scene.Get()));
+        ASSERT_TRUE(pool.Contains(comp.Get()));
+        ent->AddComponent(comp);
+        weakComponents.Push(ComponentWeakPtr(comp));
+    }
+    ASSERT_EQ(pool.NumAllocated(), numAllocated + 100);
+
+    float sum = 0.f;
+    const Scene::ComponentList &components = scene->ComponentsOfType(PooledTestComponent::ComponentTypeId);
+    ASSERT_EQ(components.Size(), 100U);
+    for (uint i = 0; i < components.Size(); ++i)
+        sum += static_cast<PooledTestComponent*>(components[i])->value.Get();
+    ASSERT_EQ(sum, 0.f);
+
+    scene->RemoveAllEntities();
+    for (uint i = 0; i < weakComponents.Size(); ++i)
+        ASSERT_TRUE(weakComponents[i].Expired());
+    ASSERT_EQ(pool.NumAllocated(), numAllocated);
+}
+
+TEST_F(Runner, AttributeChangeBatch)
+{
+    scene->RemoveAllEntities();
+
+    EntityPtr ent = scene->CreateEntity();
+    NamePtr name = ent->CreateComponent<Name>();
+    AttributeChangeCounter counter;
+    scene->AttributeChanged.Connect(&counter, &AttributeChangeCounter::OnAttributeChanged);
+
+    // Scene batch: one signal per changed attribute at the end
+    {
+        AttributeChangeBatch batch(scene.Get());
+        name->name.Set("First", AttributeChange::LocalOnly);
+        name->name.Set("Second", AttributeChange::Default);
+        name->group.Set("Group", AttributeChange::LocalOnly);
+        name->description.Set("Hidden", AttributeChange::Disconnected);
+        ASSERT_EQ(counter.numChanges, 0U);
+        ASSERT_TRUE(name->IsCollectingAttributeChanges());
+        // The name index is current already during the batch
+        ASSERT_TRUE(scene->EntityByName("Second") == ent);
+    }
+    // Each attribute keeps its own change type: name was replicated, group only changed locally
+    ASSERT_EQ(counter.numChanges, 2U);
+    ASSERT_EQ(counter.numReplicated, 1U);
+    ASSERT_EQ(counter.lastChange, AttributeChange::LocalOnly);
+    ASSERT_FALSE(name->IsCollectingAttributeChanges());
+
+    // Component batch nested in a scene batch is signalled when the scene batch ends
+    counter.numChanges = 0;
+    scene->BeginAttributeChanges();
+    {
+        AttributeChangeBatch batch(name.Get());
+        name->description.Set("Description", AttributeChange::LocalOnly);
+    }
+    ASSERT_EQ(counter.numChanges, 0U);
+    scene->EndAttributeChanges();
+    ASSERT_EQ(counter.numChanges, 1U);
+    ASSERT_EQ(counter.lastChange, AttributeChange::LocalOnly);
+
+    // Component batch on its own
+    counter.numChanges = 0;
+    name->BeginAttributeChanges();
+    name->name.Set("Third", AttributeChange::LocalOnly);
+    name->name.Set("Fourth", AttributeChange::LocalOnly);
+    ASSERT_EQ(counter.numChanges, 0U);
+    name->EndAttributeChanges();
+    ASSERT_EQ(counter.numChanges, 1U);
+
+    // Outside of batches every change is signalled right away
+    counter.numChanges = 0;
+    name->ComponentChanged(AttributeChange::LocalOnly);
+    ASSERT_EQ(counter.numChanges, 3U);
+    name->name.Set("Fifth", AttributeChange::LocalOnly);
+    ASSERT_EQ(counter.numChanges, 4U);
+
+    scene->AttributeChanged.Disconnect(&counter, &AttributeChangeCounter::OnAttributeChanged);
+    scene->RemoveAllEntities();
+}
+
+TEST_F(Runner, AttributeInterpolation)
+{
+    scene->RemoveAllEntities();
+
+    AttributeMetadata interpolated;
+    interpolated.interpolation = AttributeMetadata::Interpolate;
+
+    EntityPtr ent = scene->CreateEntity();
+    SharedPtr<DynamicComponent> comp = ent->CreateComponent<DynamicComponent>();
+    Attribute<float> *real = static_cast<Attribute<float>*>(comp->CreateAttribute(IAttribute::RealTypeName, "real"));
+    Attribute<Transform> *transform = static_cast<Attribute<Transform>*>(comp->CreateAttribute(IAttribute::TransformTypeName, "transform"));
+    Attribute<int> *integer = static_cast<Attribute<int>*>(comp->CreateAttribute(IAttribute::IntTypeName, "int"));
+    ASSERT_TRUE(real && transform && integer);
+    real->SetMetadata(&interpolated);
+    transform->SetMetadata(&interpolated);
+    integer->SetMetadata(&interpolated);
+
+    // The first update snaps to the end value, the continuous ones interpolate
+    ASSERT_TRUE(scene->StartAttributeInterpolation(real, EndValue(real, 10.f), 1.f));
+    ASSERT_TRUE(scene->StartAttributeInterpolation(transform, EndValue(transform, Transform(float3(2.f, 0.f, 0.f), float3::zero, float3::one)), 1.f));
+    ASSERT_TRUE(scene->StartAttributeInterpolation(integer, EndValue(integer, 4), 1.f));
+    ASSERT_EQ(real->Get(), 10.f);
+    ASSERT_EQ(integer->Get(), 4);
+    ASSERT_TRUE(scene->StartAttributeInterpolation(real, EndValue(real, 20.f), 1.f));
+    ASSERT_TRUE(scene->StartAttributeInterpolation(transform, EndValue(transform, Transform(float3(4.f, 0.f, 0.f), float3::zero, float3::one)), 1.f));
+    ASSERT_TRUE(scene->StartAttributeInterpolation(integer, EndValue(integer, 8), 1.f));
+    ASSERT_EQ(real->Get(), 10.f);
+
+    scene->UpdateAttributeInterpolations(0.5f);
+    ASSERT_FLOAT_EQ(real->Get(), 15.f);
+    ASSERT_FLOAT_EQ(transform->Get().pos.x, 3.f);
+    ASSERT_EQ(integer->Get(), 6);
+    scene->UpdateAttributeInterpolations(0.5f);
+    ASSERT_FLOAT_EQ(real->Get(), 20.f);
+    ASSERT_FLOAT_EQ(transform->Get().pos.x, 4.f);
+
+    // Ending keeps the last value, the others finish after twice their length
+    ASSERT_TRUE(scene->EndAttributeInterpolation(integer));
+    ASSERT_FALSE(scene->EndAttributeInterpolation(integer));
+    scene->UpdateAttributeInterpolations(0.5f);
+    scene->UpdateAttributeInterpolations(0.5f);
+    ASSERT_FALSE(scene->EndAttributeInterpolation(real));
+    ASSERT_FALSE(scene->EndAttributeInterpolation(transform));
+
+    // Removing the component aborts its interpolations
+    ASSERT_TRUE(scene->StartAttributeInterpolation(real, EndValue(real, 30.f), 1.f));
+    ASSERT_TRUE(scene->StartAttributeInterpolation(integer, EndValue(integer, 12), 1.f));
+    ent->RemoveComponent(comp);
+    comp.Reset();
+    scene->UpdateAttributeInterpolations(0.5f);
+
+    scene->EndAllAttributeInterpolations();
+    scene->RemoveAllEntities();
+}
+
+TEST_F(Runner, AttributeInterpolationUpdate)
+{
+    scene->RemoveAllEntities();
+
+    AttributeMetadata interpolated;
+    interpolated.interpolation = AttributeMetadata::Interpolate;
+
+    // Thousands of interpolated transforms, as on a client receiving a busy scene
+    const uint numEntities = 5000;
+    for (uint i = 0; i < numEntities; ++i)
+    {
+        EntityPtr ent = scene->CreateEntity();
+        SharedPtr<DynamicComponent> comp = ent->CreateComponent<DynamicComponent>();
+        Attribute<Transform> *transform = static_cast<Attribute<Transform>*>(comp->CreateAttribute(IAttribute::TransformTypeName, "transform"));
+        transform->SetMetadata(&interpolated);
+        scene->StartAttributeInterpolation(transform, EndValue(transform, Transform()), 1000.f);
+        scene->StartAttributeInterpolation(transform, EndValue(transform, Transform(float3((float)i, 0.f, 0.f), float3(0.f, 90.f, 0.f), float3::one)), 1000.f);
+    }
+
+    Tundra::Benchmark::Iterations = 100;
+
+    BENCHMARK("UpdateAttributeInterpolations", 35)
+    {
+        scene->UpdateAttributeInterpolations(0.001f);
+
+        BENCHMARK_STEP_END;
+    }
+    BENCHMARK_END;
+
+    scene->EndAllAttributeInterpolations();
+    scene->RemoveAllEntities();
+}
+
 TEST_F(Runner, SceneSerialization)
 {
     // Remove tundra.json hardcoded scene ents
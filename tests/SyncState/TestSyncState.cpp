@@ -0,0 +1,478 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "TestRunner.h"
+#include "TestBenchmark.h"
+
+#include "Scene.h"
+#include "Entity.h"
+#include "IComponent.h"
+#include "SyncState.h"
+#include "EntityGrid.h"
+#include "SyncReceiveQueue.h"
+#include "TundraMessages.h"
+#include "UserConnection.h"
+
+#include <kNet/DataSerializer.h>
+
+#include <cstring>
+
+using namespace Tundra;
+using namespace Tundra::Test;
+
+namespace
+{
+    const uint NumEntities = 2000;
+    const uint NumComponentsPerEntity = 4;
+
+    /// Fills the scene with replicated entities and returns their IDs.
+    void CreateEntities(Scene *scene, PODVector<entity_id_t> &ids)
+    {
+        StringVector components;
+        components.Push("Name");
+        components.Push("DynamicComponent");
+        for (uint i = 0; i < NumEntities; ++i)
+        {
+            EntityPtr ent = scene->CreateEntity(0, components, AttributeChange::LocalOnly);
+            ids.Push(ent->Id());
+        }
+    }
+
+    /// Walks the dirty queue like SyncManager::ProcessSyncState does and returns the number of processed states.
+    uint ProcessDirtyQueue(SceneSyncState &state)
+    {
+        uint processed = 0;
+        while (!state.dirtyQueue.Empty())
+        {
+            EntitySyncState *entityState = state.dirtyQueue.Front();
+            for (auto i = entityState->components.Begin(); i != entityState->components.End(); ++i)
+            {
+                if (i->isInQueue)
+                    ++processed;
+            }
+            entityState->DirtyProcessed();
+            state.RemoveFromQueue(entityState->id);
+        }
+        return processed;
+    }
+}
+
+TEST_F(Runner, ComponentSyncStateVector)
+{
+    ComponentSyncStateVector components;
+    const component_id_t ids[] = { 7, 3, 12, 1, 5 };
+    for (uint i = 0; i < NUMELEMS(ids); ++i)
+        components[ids[i]].MarkAttributeDirty((u8)i);
+
+    ASSERT_EQ(components.Size(), (uint)NUMELEMS(ids));
+    component_id_t previous = 0;
+    for (auto i = components.Begin(); i != components.End(); ++i)
+    {
+        ASSERT_TRUE(i->id > previous);
+        previous = i->id;
+    }
+    for (uint i = 0; i < NUMELEMS(ids); ++i)
+    {
+        ComponentSyncState *state = components.Find(ids[i]);
+        ASSERT_TRUE(state != nullptr);
+        ASSERT_EQ(state->id, ids[i]);
+        ASSERT_TRUE((state->dirtyAttributes[i >> 3] & (1 << (i & 7))) != 0);
+    }
+    ASSERT_TRUE(components.Find(4) == nullptr);
+
+    components.ChangeId(12, 2);
+    ASSERT_TRUE(components.Find(12) == nullptr);
+    ASSERT_TRUE(components.Find(2) != nullptr);
+    ASSERT_EQ(components.Find(2)->id, 2U);
+    ASSERT_TRUE(components.Begin()->id == 1U && (components.Begin() + 1)->id == 2U);
+
+    ASSERT_TRUE(components.Erase(3));
+    ASSERT_FALSE(components.Erase(3));
+    ASSERT_EQ(components.Size(), (uint)NUMELEMS(ids) - 1);
+
+    ComponentSyncState &compState = *components.Find(1);
+    compState.MarkAttributeCreated(200);
+    ASSERT_TRUE(compState.IsAttributeCreated(200));
+    compState.MarkAttributeRemoved(200);
+    ASSERT_FALSE(compState.IsAttributeCreated(200));
+    ASSERT_TRUE(compState.IsAttributeRemoved(200));
+    compState.ClearAttributeCreatedOrRemoved(200);
+    ASSERT_FALSE(compState.IsAttributeRemoved(200));
+}
+
+TEST_F(Runner, EntitySyncStateQueue)
+{
+    PODVector<entity_id_t> ids;
+    CreateEntities(scene.Get(), ids);
+
+    SceneSyncState state;
+    state.SetParentScene(SceneWeakPtr(scene));
+    for (uint i = 0; i < ids.Size(); ++i)
+        state.MarkEntityDirty(ids[i]);
+    ASSERT_EQ(state.dirtyQueue.Size(), ids.Size());
+
+    // Marking again must not queue twice
+    state.MarkEntityDirty(ids[0]);
+    ASSERT_EQ(state.dirtyQueue.Size(), ids.Size());
+    ASSERT_EQ(state.dirtyQueue.Front()->id, ids[0]);
+    ASSERT_EQ(state.dirtyQueue.Back()->id, ids.Back());
+
+    // Remove from the middle, front and back
+    state.RemoveFromQueue(ids[ids.Size() / 2]);
+    state.RemoveFromQueue(ids[0]);
+    state.RemoveFromQueue(ids.Back());
+    ASSERT_EQ(state.dirtyQueue.Size(), ids.Size() - 3);
+    ASSERT_EQ(state.dirtyQueue.Front()->id, ids[1]);
+    ASSERT_EQ(state.dirtyQueue.Back()->id, ids[ids.Size() - 2]);
+
+    uint walked = 0;
+    for (EntitySyncState *entityState = state.dirtyQueue.Front(); entityState; entityState = entityState->nextDirty)
+    {
+        ASSERT_TRUE(entityState->isInQueue);
+        ++walked;
+    }
+    ASSERT_EQ(walked, state.dirtyQueue.Size());
+
+    // Highest final priority first
+    for (EntitySyncState *entityState = state.dirtyQueue.Front(); entityState; entityState = entityState->nextDirty)
+    {
+        entityState->priority = (float)(entityState->id % 17) + 1.f;
+        entityState->relevancy = 1.f;
+    }
+    state.dirtyQueue.SortByPriority();
+    ASSERT_EQ(state.dirtyQueue.Size(), ids.Size() - 3);
+    for (EntitySyncState *entityState = state.dirtyQueue.Front(); entityState && entityState->nextDirty; entityState = entityState->nextDirty)
+        ASSERT_TRUE(entityState->FinalPriority() >= entityState->nextDirty->FinalPriority());
+
+    state.Clear();
+    ASSERT_TRUE(state.dirtyQueue.Empty());
+    ASSERT_TRUE(state.dirtyQueue.Front() == nullptr);
+}
+
+TEST_F(Runner, EntitySyncStateHeap)
+{
+    const uint numStates = 1000;
+    Vector<EntitySyncState> states;
+    states.Resize(numStates);
+    EntitySyncStateHeap heap;
+    for (uint i = 0; i < numStates; ++i)
+    {
+        states[i].id = i + 1;
+        states[i].nextSendTime = (kNet::tick_t)((i * 7919) % 503);
+        heap.Push(&states[i]);
+    }
+    ASSERT_EQ(heap.Size(), numStates);
+
+    // Remove and reschedule some states
+    for (uint i = 0; i < numStates; i += 10)
+        heap.Remove(&states[i]);
+    for (uint i = 5; i < numStates; i += 10)
+    {
+        states[i].nextSendTime = (kNet::tick_t)((i * 31) % 1009);
+        heap.Update(&states[i]);
+    }
+    ASSERT_EQ(heap.Size(), numStates - numStates / 10);
+    ASSERT_EQ(states[0].heapIndex, EntitySyncStateHeap::NotInHeap);
+
+    kNet::tick_t previous = 0;
+    uint popped = 0;
+    while (EntitySyncState *state = heap.Pop())
+    {
+        ASSERT_TRUE(state->nextSendTime >= previous);
+        ASSERT_EQ(state->heapIndex, EntitySyncStateHeap::NotInHeap);
+        previous = state->nextSendTime;
+        ++popped;
+    }
+    ASSERT_EQ(popped, numStates - numStates / 10);
+}
+
+TEST_F(Runner, ReleaseDueEntities)
+{
+    PODVector<entity_id_t> ids;
+    CreateEntities(scene.Get(), ids);
+
+    SceneSyncState state;
+    state.SetParentScene(SceneWeakPtr(scene));
+    state.ReleaseDueEntities(1000);
+
+    // Entities due later than the current tick wait outside the dirty queue
+    for (uint i = 0; i < ids.Size(); ++i)
+    {
+        state.GetOrCreateEntitySyncState(ids[i]).nextSendTime = (i % 2) ? 1000 + i : 0;
+        state.MarkEntityDirty(ids[i]);
+    }
+    ASSERT_EQ(state.dirtyQueue.Size(), ids.Size() / 2);
+    ASSERT_EQ(state.waitingQueue.Size(), ids.Size() / 2);
+
+    state.ReleaseDueEntities(1000 + ids.Size() / 2);
+    ASSERT_EQ(state.waitingQueue.Size(), ids.Size() / 4);
+    ASSERT_EQ(state.dirtyQueue.Size(), ids.Size() / 2 + ids.Size() / 4);
+
+    // Removal does not wait for the update interval
+    EntitySyncState *waiting = state.waitingQueue.Top();
+    waiting->isNew = false;
+    state.MarkEntityRemoved(waiting->id);
+    ASSERT_EQ(waiting->heapIndex, EntitySyncStateHeap::NotInHeap);
+    ASSERT_TRUE(state.dirtyQueue.Back() == waiting);
+
+    state.RemoveFromQueue(state.waitingQueue.Top()->id);
+    ASSERT_EQ(state.waitingQueue.Size(), ids.Size() / 4 - 2);
+
+    state.Clear();
+    ASSERT_TRUE(state.waitingQueue.Empty());
+}
+
+TEST_F(Runner, RigidBodyBaselines)
+{
+    PODVector<entity_id_t> ids;
+    CreateEntities(scene.Get(), ids);
+
+    SceneSyncState server;
+    server.SetParentScene(SceneWeakPtr(scene));
+    EntitySyncState &entityState = server.GetOrCreateEntitySyncState(ids[0]);
+    entityState.isNew = false;
+    ASSERT_TRUE(server.RigidBodyBaseline(entityState, server.rigidBodySequence) == 0);
+
+    // Send the body in two packets, and acknowledge them out of order
+    u16 sequences[2];
+    for (uint i = 0; i < 2; ++i)
+    {
+        RigidBodyPacketRecord &record = server.BeginRigidBodyPacket();
+        RigidBodyPacketRecord::Entry entry;
+        entry.id = entityState.id;
+        entry.sendIndex = entityState.rigidBodySendIndex++;
+        entry.state.pos = float3((float)i, 0.f, 0.f);
+        record.entries.Push(entry);
+        sequences[i] = record.sequence;
+    }
+    server.AckRigidBodyPacket(sequences[1]);
+    server.AckRigidBodyPacket(sequences[0]);
+    const RigidBodySnapshot *baseline = server.RigidBodyBaseline(entityState, server.rigidBodySequence);
+    ASSERT_TRUE(baseline != 0);
+    ASSERT_EQ(baseline->pos.x, 1.f);
+    ASSERT_EQ(entityState.rigidBodyBaselineSequence, sequences[1]);
+
+    // The client keeps only the latest states of each body
+    entityState.rigidBodySendIndex += cRigidBodyBaselineHistory;
+    ASSERT_TRUE(server.RigidBodyBaseline(entityState, server.rigidBodySequence) == 0);
+    entityState.rigidBodySendIndex -= cRigidBodyBaselineHistory;
+    ASSERT_TRUE(server.RigidBodyBaseline(entityState, (u16)(sequences[1] + cRigidBodyBaselineWindow + 1)) == 0);
+
+    // The acknowledgement of the client covers the packets before the newest one, including across the wrap-around
+    SceneSyncState client;
+    client.MarkRigidBodyPacketReceived(65534);
+    client.MarkRigidBodyPacketReceived(1);
+    client.MarkRigidBodyPacketReceived(0);
+    ASSERT_EQ(client.rigidBodyAckSequence, 1);
+    ASSERT_EQ(client.rigidBodyAckBits, (1u << 0) | (1u << 2));
+    client.MarkRigidBodyPacketReceived(40);
+    ASSERT_EQ(client.rigidBodyAckBits, 0u);
+
+    // A late state never evicts a newer one from the client's history
+    RigidBodyInterpolationState interp;
+    RigidBodySnapshot snapshot;
+    for (uint i = 0; i < cRigidBodyBaselineHistory; ++i)
+        interp.StoreBaseline((u16)(65530 + i), snapshot);
+    interp.StoreBaseline(65529, snapshot);
+    ASSERT_TRUE(interp.FindBaseline(65529) == 0);
+    interp.StoreBaseline((u16)(65530 + cRigidBodyBaselineHistory), snapshot);
+    ASSERT_TRUE(interp.FindBaseline(65530) == 0);
+    ASSERT_TRUE(interp.FindBaseline(65531) != 0);
+    ASSERT_TRUE(interp.FindBaseline((u16)(65530 + cRigidBodyBaselineHistory)) != 0);
+}
+
+TEST_F(Runner, SyncReceiveQueue)
+{
+    // CreateEntity message with two components
+    char buffer[256];
+    kNet::DataSerializer ds(buffer, sizeof(buffer));
+    ds.AddVLE<kNet::VLE8_16_32>(0);
+    ds.AddVLE<kNet::VLE8_16_32>(42);
+    ds.Add<u8>(1);
+    ds.Add<u32>(7);
+    ds.AddVLE<kNet::VLE8_16_32>(2);
+    for (uint i = 0; i < 2; ++i)
+    {
+        ds.AddVLE<kNet::VLE8_16_32>(i + 1);
+        ds.AddVLE<kNet::VLE8_16_32>(20 + i);
+        ds.AddString(i ? "second" : "");
+        ds.AddVLE<kNet::VLE8_16_32>(3);
+        ds.AddArray<u8>((const u8*)"abc", 3);
+    }
+
+    SyncReceiveQueue queue;
+    queue.Push(cCreateEntityMessage, 1, ProtocolHierarchicScene, buffer, ds.BytesFilled());
+    // Truncated into the attribute data of the second component
+    queue.Push(cCreateEntityMessage, 2, ProtocolHierarchicScene, buffer, ds.BytesFilled() - 2);
+    queue.Push(cRemoveEntityMessage, 3, ProtocolHierarchicScene, buffer, 2);
+    ASSERT_EQ(queue.Size(), 3u);
+    ASSERT_TRUE(queue.Front() == 0);
+
+    queue.StartDecode(0);
+    ReceivedSyncMessage *msg = queue.Front();
+    ASSERT_TRUE(msg != 0);
+    ASSERT_EQ(msg->packetId, 1u);
+    ASSERT_TRUE(msg->valid);
+    ASSERT_EQ(msg->entity.id, 42u);
+    ASSERT_TRUE(msg->entity.temporary);
+    ASSERT_EQ(msg->entity.parentId, 7u);
+    ASSERT_EQ(msg->entity.components.size(), 2u);
+    const ReceivedComponent &comp = msg->entity.components[1];
+    ASSERT_EQ(comp.id, 2u);
+    ASSERT_EQ(comp.typeId, 21u);
+    ASSERT_TRUE(comp.name == "second");
+    ASSERT_EQ(comp.attrDataSize, 3u);
+    ASSERT_EQ(memcmp(&msg->data[comp.attrDataOffset], "abc", 3), 0);
+    queue.Pop();
+
+    msg = queue.Front();
+    ASSERT_TRUE(msg != 0);
+    ASSERT_EQ(msg->packetId, 2u);
+    ASSERT_FALSE(msg->valid);
+    queue.Pop();
+
+    // Messages without entity framing pass through as is
+    msg = queue.Front();
+    ASSERT_TRUE(msg != 0);
+    ASSERT_TRUE(msg->valid);
+    ASSERT_EQ(msg->data.size(), 2u);
+    queue.Pop();
+    ASSERT_TRUE(queue.Empty());
+
+    // Clearing drops the messages that have not been decoded
+    queue.Push(cEditAttributesMessage, 4, ProtocolHierarchicScene, buffer, 2);
+    queue.Clear();
+    ASSERT_TRUE(queue.Empty());
+    ASSERT_TRUE(queue.Front() == 0);
+}
+
+TEST_F(Runner, MarkAttributeDirty)
+{
+    PODVector<entity_id_t> ids;
+    CreateEntities(scene.Get(), ids);
+
+    SceneSyncState state;
+    state.SetParentScene(SceneWeakPtr(scene));
+
+    Tundra::Benchmark::Iterations = 100;
+
+    BENCHMARK(String(NumEntities) + " entities x " + String(NumComponentsPerEntity) + " components", 30)
+    {
+        for (uint i = 0; i < ids.Size(); ++i)
+            for (component_id_t c = 1; c <= NumComponentsPerEntity; ++c)
+                state.MarkAttributeDirty(ids[i], c, (u8)(i & 255));
+
+        BENCHMARK_STEP_END;
+
+        ASSERT_EQ(state.dirtyQueue.Size(), ids.Size());
+        ASSERT_EQ(ProcessDirtyQueue(state), NumEntities * NumComponentsPerEntity);
+    }
+    BENCHMARK_END;
+
+    // Approximate per-user memory footprint of the sync state, as process RSS is not portably measurable here
+    uint bytes = state.entities.Size() * (sizeof(EntitySyncState) + NumComponentsPerEntity * sizeof(ComponentSyncState));
+    Log(PadString("Sync state per user", 30) + String(bytes / 1024) + " KB for " + String(state.entities.Size()) + " entities", 2);
+}
+
+TEST_F(Runner, ProcessDirtyQueue)
+{
+    PODVector<entity_id_t> ids;
+    CreateEntities(scene.Get(), ids);
+
+    SceneSyncState state;
+    state.SetParentScene(SceneWeakPtr(scene));
+
+    for (uint i = 0; i < ids.Size(); ++i)
+        for (component_id_t c = 1; c <= NumComponentsPerEntity; ++c)
+            state.MarkAttributeDirty(ids[i], c, (u8)(i & 255));
+
+    Tundra::Benchmark::Iterations = 100;
+
+    BENCHMARK(String(NumEntities) + " entities x " + String(NumComponentsPerEntity) + " components", 30)
+    {
+        uint processed = ProcessDirtyQueue(state);
+
+        BENCHMARK_STEP_END;
+
+        ASSERT_EQ(processed, NumEntities * NumComponentsPerEntity);
+        ASSERT_TRUE(state.dirtyQueue.Empty());
+
+        // Dirty the state for the next iteration outside of the measured step
+        for (uint i = 0; i < ids.Size(); ++i)
+            for (component_id_t c = 1; c <= NumComponentsPerEntity; ++c)
+                state.MarkAttributeDirty(ids[i], c, (u8)(i & 255));
+    }
+    BENCHMARK_END;
+}
+
+TEST_F(Runner, EntityGrid)
+{
+    EntityGrid grid(10.f);
+    grid.Update(1, float3(0.f, 0.f, 0.f));
+    grid.Update(2, float3(15.f, 0.f, 0.f));
+    grid.Update(3, float3(-25.f, 5.f, 0.f));
+    grid.Update(4, float3(1000.f, 0.f, -1000.f));
+    ASSERT_EQ(grid.Size(), 4U);
+
+    PODVector<entity_id_t> result;
+    grid.Query(float3::zero, 20.f, result);
+    ASSERT_EQ(result.Size(), 2U);
+    ASSERT_TRUE(result.Contains(1) && result.Contains(2));
+
+    // Moving to another cell
+    grid.Update(2, float3(-20.f, 0.f, 0.f));
+    ASSERT_TRUE(grid.Position(2).Equals(float3(-20.f, 0.f, 0.f)));
+    result.Clear();
+    grid.Query(float3(-20.f, 0.f, 0.f), 8.f, result);
+    ASSERT_EQ(result.Size(), 2U);
+    ASSERT_TRUE(result.Contains(2) && result.Contains(3));
+
+    // Removing keeps the other entities of the cell
+    grid.Remove(3);
+    ASSERT_FALSE(grid.Contains(3));
+    result.Clear();
+    grid.Query(float3(-20.f, 0.f, 0.f), 8.f, result);
+    ASSERT_EQ(result.Size(), 1U);
+    ASSERT_EQ(result[0], 2U);
+
+    // Changing the cell size redistributes the entities
+    grid.SetCellSize(3.f);
+    result.Clear();
+    grid.Query(float3(1000.f, 0.f, -1000.f), 1.f, result);
+    ASSERT_EQ(result.Size(), 1U);
+    ASSERT_EQ(result[0], 4U);
+
+    // A query with an unknown observer position finds nothing
+    result.Clear();
+    grid.Query(float3::nan, 100.f, result);
+    ASSERT_TRUE(result.Empty());
+}
+
+TEST_F(Runner, EntityGridQuery)
+{
+    // Entities spread on a 2 km x 2 km plane, observer area of 100 m
+    const uint numEntities = 50000;
+    EntityGrid grid(100.f);
+    for (uint i = 0; i < numEntities; ++i)
+        grid.Update(i + 1, float3((float)((i * 7919) % 2000) - 1000.f, 0.f, (float)((i * 104729) % 2000) - 1000.f));
+
+    PODVector<entity_id_t> result;
+    uint found = 0;
+
+    Tundra::Benchmark::Iterations = 100;
+
+    BENCHMARK(String(numEntities) + " entities, 100 m radius", 30)
+    {
+        result.Clear();
+        grid.Query(float3(100.f, 0.f, -200.f), 100.f, result);
+
+        BENCHMARK_STEP_END;
+
+        found = result.Size();
+    }
+    BENCHMARK_END;
+
+    ASSERT_TRUE(found > 0 && found < numEntities / 10);
+    Log(PadString("Entities in area", 30) + String(found), 2);
+}
+
+TUNDRA_TEST_MAIN();